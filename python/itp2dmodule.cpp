@@ -0,0 +1,675 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python bindings for itp2d, built with "make python". The module exposes
+ * Parameters, ITPSystem and its StateSet, so that the results of a simulation
+ * can be analyzed in the same process without going through a datafile:
+ *
+ *   import itp2d, numpy
+ *   params = itp2d.Parameters(["-s", "64", "-p", "ring(3,1,2)", "--save-nothing", "-q"])
+ *   system = itp2d.System(params)
+ *   system.run()
+ *   psi = numpy.asarray(system.states[system.sorted_indices[0]])
+ *
+ * Parameters are given as itp2d command line arguments. States support the
+ * buffer protocol, so numpy.asarray gives a complex128 array of shape
+ * (sizey, sizex) that views the memory of the state without copying it. The
+ * StateSet gives an array of shape (num_states, sizey, sizex) in the same way.
+ * The views are only valid until the next step, since a step can move the
+ * states to other memory (--highmem-orthonormalization) or lock them
+ * (--compress-converged). Locked states cannot be viewed until the system has
+ * finished.
+ *
+ * The bindings work with both Python 2 and Python 3.
+ */
+
+#include <Python.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "parameters.hpp"
+#include "commandlineparser.hpp"
+#include "itpsystem.hpp"
+
+// The type objects are filled in when the module is initialized
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+/*
+ * Helpers for converting between C++ and Python values
+ */
+
+static PyObject* list_from_vector(std::vector<double> const& vec) {
+	PyObject* list = PyList_New(static_cast<Py_ssize_t>(vec.size()));
+	if (list == NULL)
+		return NULL;
+	for (size_t i=0; i<vec.size(); i++)
+		PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), PyFloat_FromDouble(vec[i]));
+	return list;
+}
+
+static PyObject* string_from_std(std::string const& str) {
+#if PY_MAJOR_VERSION >= 3
+	return PyUnicode_FromString(str.c_str());
+#else
+	return PyString_FromString(str.c_str());
+#endif
+}
+
+// Read a sequence of strings into args. Returns false with a Python
+// exception set on failure.
+static bool strings_from_sequence(PyObject* seq, std::vector<std::string>& args) {
+	PyObject* fast = PySequence_Fast(seq, "arguments must be a sequence of strings");
+	if (fast == NULL)
+		return false;
+	const Py_ssize_t len = PySequence_Fast_GET_SIZE(fast);
+	for (Py_ssize_t i=0; i<len; i++) {
+		PyObject* item = PySequence_Fast_GET_ITEM(fast, i);
+#if PY_MAJOR_VERSION >= 3
+		const char* str = PyUnicode_Check(item)? PyUnicode_AsUTF8(item) : NULL;
+#else
+		const char* str = PyString_Check(item)? PyString_AsString(item) : NULL;
+#endif
+		if (str == NULL) {
+			Py_DECREF(fast);
+			if (not PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "arguments must be a sequence of strings");
+			return false;
+		}
+		args.push_back(str);
+	}
+	Py_DECREF(fast);
+	return true;
+}
+
+/*
+ * itp2d.Parameters
+ */
+
+typedef struct {
+	PyObject_HEAD
+	Parameters* params;
+} ParametersObject;
+
+static PyTypeObject ParametersType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+// Objects created with __new__ but not __init__ have no Parameters
+static bool parameters_ready(ParametersObject* self) {
+	if (self->params == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "Parameters not initialized");
+		return false;
+	}
+	return true;
+}
+
+static void Parameters_dealloc(ParametersObject* self) {
+	delete self->params;
+	Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+// Parameters are parsed from a sequence of command line arguments, without
+// the program name
+static int Parameters_init(ParametersObject* self, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"args", NULL};
+	PyObject* seq = NULL;
+	if (not PyArg_ParseTupleAndKeywords(args, kwds, "|O", const_cast<char**>(kwlist), &seq))
+		return -1;
+	std::vector<std::string> arguments(1, "itp2d");
+	if (seq != NULL and not strings_from_sequence(seq, arguments))
+		return -1;
+	CommandLineParser parser;
+	try {
+		parser.parse(arguments);
+	}
+	catch (TCLAP::ArgException& e) {
+		PyErr_Format(PyExc_ValueError, "%s (%s)", e.error().c_str(), e.argId().c_str());
+		return -1;
+	}
+	catch (TCLAP::ExitException&) {
+		PyErr_SetString(PyExc_ValueError, "arguments such as --help and --version are not supported");
+		return -1;
+	}
+	delete self->params;
+	self->params = new Parameters(parser.get_params());
+	return 0;
+}
+
+static PyObject* Parameters_str(ParametersObject* self) {
+	if (not parameters_ready(self))
+		return NULL;
+	std::ostringstream stream;
+	stream << *self->params;
+	return string_from_std(stream.str());
+}
+
+static PyObject* Parameters_get_sizex(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyLong_FromSize_t(self->params->get_sizex());
+}
+static PyObject* Parameters_get_sizey(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyLong_FromSize_t(self->params->get_sizey());
+}
+static PyObject* Parameters_get_lenx(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyFloat_FromDouble(self->params->get_lenx());
+}
+static PyObject* Parameters_get_num_states(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyLong_FromSize_t(self->params->get_N());
+}
+static PyObject* Parameters_get_num_threads(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyLong_FromSize_t(self->params->get_num_threads());
+}
+static PyObject* Parameters_get_random_seed(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyLong_FromUnsignedLong(self->params->get_random_seed());
+}
+static PyObject* Parameters_get_potential(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return string_from_std(self->params->get_potential_type(0));
+}
+static PyObject* Parameters_get_B(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return PyFloat_FromDouble(self->params->get_B(0));
+}
+static PyObject* Parameters_get_datafile(ParametersObject* self, void*) {
+	if (not parameters_ready(self))
+		return NULL;
+	return string_from_std(self->params->get_datafile_name());
+}
+
+static PyGetSetDef Parameters_getset[] = {
+	{const_cast<char*>("sizex"), reinterpret_cast<getter>(Parameters_get_sizex), NULL, const_cast<char*>("Number of grid points in the x direction"), NULL},
+	{const_cast<char*>("sizey"), reinterpret_cast<getter>(Parameters_get_sizey), NULL, const_cast<char*>("Number of grid points in the y direction"), NULL},
+	{const_cast<char*>("lenx"), reinterpret_cast<getter>(Parameters_get_lenx), NULL, const_cast<char*>("Length of the grid in the x direction"), NULL},
+	{const_cast<char*>("num_states"), reinterpret_cast<getter>(Parameters_get_num_states), NULL, const_cast<char*>("Number of states propagated"), NULL},
+	{const_cast<char*>("num_threads"), reinterpret_cast<getter>(Parameters_get_num_threads), NULL, const_cast<char*>("Number of threads"), NULL},
+	{const_cast<char*>("random_seed"), reinterpret_cast<getter>(Parameters_get_random_seed), NULL, const_cast<char*>("Seed of the random number generator"), NULL},
+	{const_cast<char*>("potential"), reinterpret_cast<getter>(Parameters_get_potential), NULL, const_cast<char*>("Description of the potential"), NULL},
+	{const_cast<char*>("B"), reinterpret_cast<getter>(Parameters_get_B), NULL, const_cast<char*>("Strength of the magnetic field"), NULL},
+	{const_cast<char*>("datafile"), reinterpret_cast<getter>(Parameters_get_datafile), NULL, const_cast<char*>("Name of the datafile"), NULL},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+/*
+ * itp2d.System
+ */
+
+typedef struct {
+	PyObject_HEAD
+	ITPSystem* sys;
+	bool busy;	// Set while a step is running with the GIL released
+} SystemObject;
+
+static PyTypeObject SystemType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+// The system must be initialized, and it must not be accessed while another
+// Python thread is stepping it
+static bool system_ready(SystemObject* self) {
+	if (self->sys == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "System not initialized");
+		return false;
+	}
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "System is being stepped in another thread");
+		return false;
+	}
+	return true;
+}
+
+static void System_dealloc(SystemObject* self) {
+	delete self->sys;
+	Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+// A System is created from a Parameters object or directly from a sequence
+// of command line arguments. It cannot be initialized again, since views of
+// its states may still exist.
+static int System_init(SystemObject* self, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"params", NULL};
+	PyObject* arg = NULL;
+	if (not PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist), &arg))
+		return -1;
+	if (self->sys != NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "System already initialized");
+		return -1;
+	}
+	PyObject* params_object = arg;
+	if (PyObject_TypeCheck(arg, &ParametersType))
+		Py_INCREF(params_object);
+	else {
+		params_object = PyObject_CallFunctionObjArgs(reinterpret_cast<PyObject*>(&ParametersType), arg, NULL);
+		if (params_object == NULL)
+			return -1;
+	}
+	if (not parameters_ready(reinterpret_cast<ParametersObject*>(params_object))) {
+		Py_DECREF(params_object);
+		return -1;
+	}
+	Parameters const& params = *reinterpret_cast<ParametersObject*>(params_object)->params;
+	ITPSystem* sys = NULL;
+	try {
+		sys = new ITPSystem(params);
+	}
+	catch (std::exception& e) {
+		Py_DECREF(params_object);
+		PyErr_SetString(PyExc_RuntimeError, e.what());
+		return -1;
+	}
+	Py_DECREF(params_object);
+	self->sys = sys;
+	return 0;
+}
+
+// Run steps of ITP with the GIL released. If whole is true, continue until
+// the system and all points of a parameter sweep have finished. The busy flag
+// is only touched while holding the GIL, so it keeps other Python threads
+// from using the system until the steps are done.
+static PyObject* System_iterate(SystemObject* self, bool whole) {
+	if (not system_ready(self))
+		return NULL;
+	self->busy = true;
+	std::string error;
+	Py_BEGIN_ALLOW_THREADS
+	try {
+		if (whole) {
+			do {
+				while (not self->sys->is_finished())
+					self->sys->step();
+			} while (self->sys->next_sweep_point());
+		}
+		else if (not self->sys->is_finished())
+			self->sys->step();
+	}
+	catch (std::exception& e) {
+		error = e.what();
+	}
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+	if (not error.empty()) {
+		PyErr_SetString(PyExc_RuntimeError, error.c_str());
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* System_step(SystemObject* self, PyObject*) {
+	return System_iterate(self, false);
+}
+
+static PyObject* System_run(SystemObject* self, PyObject*) {
+	return System_iterate(self, true);
+}
+
+static PyObject* System_finish(SystemObject* self, PyObject*) {
+	if (not system_ready(self))
+		return NULL;
+	try {
+		self->sys->finish();
+	}
+	catch (std::exception& e) {
+		PyErr_SetString(PyExc_RuntimeError, e.what());
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* System_next_sweep_point(SystemObject* self, PyObject*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyBool_FromLong(self->sys->next_sweep_point());
+}
+
+static PyMethodDef System_methods[] = {
+	{"step", reinterpret_cast<PyCFunction>(System_step), METH_NOARGS, "Take a single step of ITP."},
+	{"run", reinterpret_cast<PyCFunction>(System_run), METH_NOARGS, "Take steps until the system, and all points of a parameter sweep, have finished."},
+	{"finish", reinterpret_cast<PyCFunction>(System_finish), METH_NOARGS, "Finish the system now, saving data as if it had converged."},
+	{"next_sweep_point", reinterpret_cast<PyCFunction>(System_next_sweep_point), METH_NOARGS, "Continue with the next point of a parameter sweep. Returns False if there are no more points."},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyObject* System_get_finished(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyBool_FromLong(self->sys->is_finished());
+}
+static PyObject* System_get_error_flag(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyBool_FromLong(self->sys->get_error_flag());
+}
+static PyObject* System_get_total_steps(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyLong_FromLong(self->sys->get_total_step_counter());
+}
+static PyObject* System_get_num_converged(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyLong_FromSize_t(self->sys->how_many_finally_converged());
+}
+static PyObject* System_get_time_step(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyFloat_FromDouble(self->sys->get_eps());
+}
+static PyObject* System_get_B(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	return PyFloat_FromDouble(self->sys->get_B());
+}
+
+static PyObject* System_get_energies(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	std::vector<std::vector<double> > const& energies = self->sys->get_energies();
+	return list_from_vector(energies.empty()? std::vector<double>() : energies.back());
+}
+
+static PyObject* System_get_standard_deviations(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	std::vector<std::vector<double> > const& deviations = self->sys->get_standard_deviations();
+	return list_from_vector(deviations.empty()? std::vector<double>() : deviations.back());
+}
+
+static PyObject* System_get_energy_history(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	std::vector<std::vector<double> > const& energies = self->sys->get_energies();
+	PyObject* list = PyList_New(static_cast<Py_ssize_t>(energies.size()));
+	if (list == NULL)
+		return NULL;
+	for (size_t i=0; i<energies.size(); i++)
+		PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), list_from_vector(energies[i]));
+	return list;
+}
+
+static PyObject* System_get_sorted_indices(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	const size_t N = self->sys->params.get_N();
+	if (self->sys->get_energies().empty())
+		return PyList_New(0);
+	PyObject* list = PyList_New(static_cast<Py_ssize_t>(N));
+	if (list == NULL)
+		return NULL;
+	for (size_t n=0; n<N; n++)
+		PyList_SET_ITEM(list, static_cast<Py_ssize_t>(n), PyLong_FromSize_t(self->sys->get_sorted_index(n)));
+	return list;
+}
+
+static PyObject* System_get_states(SystemObject* self, void*);
+
+static PyGetSetDef System_getset[] = {
+	{const_cast<char*>("finished"), reinterpret_cast<getter>(System_get_finished), NULL, const_cast<char*>("True if the system has finished"), NULL},
+	{const_cast<char*>("error_flag"), reinterpret_cast<getter>(System_get_error_flag), NULL, const_cast<char*>("True if the system finished without converging"), NULL},
+	{const_cast<char*>("total_steps"), reinterpret_cast<getter>(System_get_total_steps), NULL, const_cast<char*>("Number of steps taken"), NULL},
+	{const_cast<char*>("num_converged"), reinterpret_cast<getter>(System_get_num_converged), NULL, const_cast<char*>("Number of converged states"), NULL},
+	{const_cast<char*>("time_step"), reinterpret_cast<getter>(System_get_time_step), NULL, const_cast<char*>("Current imaginary time step"), NULL},
+	{const_cast<char*>("B"), reinterpret_cast<getter>(System_get_B), NULL, const_cast<char*>("Current strength of the magnetic field"), NULL},
+	{const_cast<char*>("energies"), reinterpret_cast<getter>(System_get_energies), NULL, const_cast<char*>("Latest energies, in increasing order"), NULL},
+	{const_cast<char*>("standard_deviations"), reinterpret_cast<getter>(System_get_standard_deviations), NULL, const_cast<char*>("Standard deviations of the latest energies"), NULL},
+	{const_cast<char*>("energy_history"), reinterpret_cast<getter>(System_get_energy_history), NULL, const_cast<char*>("Energies of each step, in increasing order"), NULL},
+	{const_cast<char*>("sorted_indices"), reinterpret_cast<getter>(System_get_sorted_indices), NULL, const_cast<char*>("Indices of the states in order of increasing energy"), NULL},
+	{const_cast<char*>("states"), reinterpret_cast<getter>(System_get_states), NULL, const_cast<char*>("The states of the system"), NULL},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+/*
+ * itp2d.StateSet and itp2d.State. Both keep the System they belong to alive
+ * while they or any views of their memory exist.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	SystemObject* system;
+	Py_ssize_t shape[3];
+	Py_ssize_t strides[3];
+} StateSetObject;
+
+typedef struct {
+	PyObject_HEAD
+	SystemObject* system;
+	size_t index;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+} StateObject;
+
+static PyTypeObject StateSetType = { PyVarObject_HEAD_INIT(NULL, 0) };
+static PyTypeObject StateType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static PyObject* System_get_states(SystemObject* self, void*) {
+	if (not system_ready(self))
+		return NULL;
+	StateSetObject* states = PyObject_New(StateSetObject, &StateSetType);
+	if (states == NULL)
+		return NULL;
+	Py_INCREF(self);
+	states->system = self;
+	return reinterpret_cast<PyObject*>(states);
+}
+
+static void StateSet_dealloc(StateSetObject* self) {
+	Py_DECREF(self->system);
+	PyObject_Del(self);
+}
+
+static void State_dealloc(StateObject* self) {
+	Py_DECREF(self->system);
+	PyObject_Del(self);
+}
+
+static Py_ssize_t StateSet_length(StateSetObject* self) {
+	if (not system_ready(self->system))
+		return -1;
+	return static_cast<Py_ssize_t>(self->system->sys->get_states().get_num_states());
+}
+
+static PyObject* StateSet_item(StateSetObject* self, Py_ssize_t i) {
+	const Py_ssize_t len = StateSet_length(self);
+	if (len < 0)
+		return NULL;
+	if (i < 0 or i >= len) {
+		PyErr_SetString(PyExc_IndexError, "state index out of range");
+		return NULL;
+	}
+	StateObject* state = PyObject_New(StateObject, &StateType);
+	if (state == NULL)
+		return NULL;
+	Py_INCREF(self->system);
+	state->system = self->system;
+	state->index = static_cast<size_t>(i);
+	return reinterpret_cast<PyObject*>(state);
+}
+
+static PySequenceMethods StateSet_as_sequence = {
+	reinterpret_cast<lenfunc>(StateSet_length),
+	NULL, NULL,
+	reinterpret_cast<ssizeargfunc>(StateSet_item),
+};
+
+// Fill in a buffer of ndim dimensions of complex doubles
+static int fill_buffer(PyObject* exporter, Py_buffer* view, int flags, comp* ptr, int ndim,
+		Py_ssize_t* shape, Py_ssize_t* strides) {
+	Py_ssize_t len = static_cast<Py_ssize_t>(sizeof(comp));
+	for (int i=0; i<ndim; i++)
+		len *= shape[i];
+	view->buf = ptr;
+	view->obj = exporter;
+	Py_INCREF(exporter);
+	view->len = len;
+	view->readonly = 0;
+	view->itemsize = static_cast<Py_ssize_t>(sizeof(comp));
+	view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT)? const_cast<char*>("Zd") : NULL;
+	view->ndim = ndim;
+	view->shape = ((flags & PyBUF_ND) == PyBUF_ND)? shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)? strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static int State_getbuffer(StateObject* self, Py_buffer* view, int flags) {
+	if (not system_ready(self->system)) {
+		view->obj = NULL;
+		return -1;
+	}
+	StateSet const& states = self->system->sys->get_states();
+	if (states.is_locked(self->index)) {
+		PyErr_SetString(PyExc_BufferError, "the state is locked and stored in compressed form until the system has finished");
+		view->obj = NULL;
+		return -1;
+	}
+	DataLayout const& dl = states.datalayout;
+	self->shape[0] = static_cast<Py_ssize_t>(dl.sizey);
+	self->shape[1] = static_cast<Py_ssize_t>(dl.sizex);
+	self->strides[0] = static_cast<Py_ssize_t>(dl.sizex*sizeof(comp));
+	self->strides[1] = static_cast<Py_ssize_t>(sizeof(comp));
+	return fill_buffer(reinterpret_cast<PyObject*>(self), view, flags, states[self->index].data_ptr(), 2,
+			self->shape, self->strides);
+}
+
+// The whole StateSet can be viewed if the states lie one after another in
+// memory, which is the case unless some of them are locked.
+static int StateSet_getbuffer(StateSetObject* self, Py_buffer* view, int flags) {
+	if (not system_ready(self->system)) {
+		view->obj = NULL;
+		return -1;
+	}
+	StateSet const& states = self->system->sys->get_states();
+	DataLayout const& dl = states.datalayout;
+	const size_t N = states.get_num_states();
+	comp* const first = states[0].data_ptr();
+	for (size_t n=0; n<N; n++) {
+		if (states.is_locked(n) or states[n].data_ptr() != first + n*dl.N) {
+			PyErr_SetString(PyExc_BufferError, "the states are not stored contiguously, view them one at a time");
+			view->obj = NULL;
+			return -1;
+		}
+	}
+	self->shape[0] = static_cast<Py_ssize_t>(N);
+	self->shape[1] = static_cast<Py_ssize_t>(dl.sizey);
+	self->shape[2] = static_cast<Py_ssize_t>(dl.sizex);
+	self->strides[0] = static_cast<Py_ssize_t>(dl.N*sizeof(comp));
+	self->strides[1] = static_cast<Py_ssize_t>(dl.sizex*sizeof(comp));
+	self->strides[2] = static_cast<Py_ssize_t>(sizeof(comp));
+	return fill_buffer(reinterpret_cast<PyObject*>(self), view, flags, first, 3, self->shape, self->strides);
+}
+
+static PyBufferProcs State_as_buffer;
+static PyBufferProcs StateSet_as_buffer;
+
+/*
+ * Module initialization
+ */
+
+static PyMethodDef module_methods[] = {
+	{NULL, NULL, 0, NULL}
+};
+
+static const char module_doc[] = "Python bindings for itp2d, the imaginary time propagation solver for the 2D Schrödinger equation.";
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef module_def = {
+	PyModuleDef_HEAD_INIT, "itp2d", module_doc, -1, module_methods
+};
+#endif
+
+static PyObject* init_module() {
+	ParametersType.tp_name = "itp2d.Parameters";
+	ParametersType.tp_basicsize = sizeof(ParametersObject);
+	ParametersType.tp_dealloc = reinterpret_cast<destructor>(Parameters_dealloc);
+	ParametersType.tp_str = reinterpret_cast<reprfunc>(Parameters_str);
+	ParametersType.tp_flags = Py_TPFLAGS_DEFAULT;
+	ParametersType.tp_doc = "Parameters(args=[]): simulation parameters parsed from itp2d command line arguments";
+	ParametersType.tp_getset = Parameters_getset;
+	ParametersType.tp_init = reinterpret_cast<initproc>(Parameters_init);
+	ParametersType.tp_new = PyType_GenericNew;
+	SystemType.tp_name = "itp2d.System";
+	SystemType.tp_basicsize = sizeof(SystemObject);
+	SystemType.tp_dealloc = reinterpret_cast<destructor>(System_dealloc);
+	SystemType.tp_flags = Py_TPFLAGS_DEFAULT;
+	SystemType.tp_doc = "System(params): an ITP simulation, created from Parameters or a list of command line arguments";
+	SystemType.tp_methods = System_methods;
+	SystemType.tp_getset = System_getset;
+	SystemType.tp_init = reinterpret_cast<initproc>(System_init);
+	SystemType.tp_new = PyType_GenericNew;
+	StateSet_as_buffer.bf_getbuffer = reinterpret_cast<getbufferproc>(StateSet_getbuffer);
+	StateSetType.tp_name = "itp2d.StateSet";
+	StateSetType.tp_basicsize = sizeof(StateSetObject);
+	StateSetType.tp_dealloc = reinterpret_cast<destructor>(StateSet_dealloc);
+	StateSetType.tp_as_sequence = &StateSet_as_sequence;
+	StateSetType.tp_as_buffer = &StateSet_as_buffer;
+	StateSetType.tp_doc = "The states of a System. Supports the buffer protocol for viewing all states at once.";
+	State_as_buffer.bf_getbuffer = reinterpret_cast<getbufferproc>(State_getbuffer);
+	StateType.tp_name = "itp2d.State";
+	StateType.tp_basicsize = sizeof(StateObject);
+	StateType.tp_dealloc = reinterpret_cast<destructor>(State_dealloc);
+	StateType.tp_as_buffer = &State_as_buffer;
+	StateType.tp_doc = "A single state of a System. Supports the buffer protocol.";
+#if PY_MAJOR_VERSION >= 3
+	StateSetType.tp_flags = Py_TPFLAGS_DEFAULT;
+	StateType.tp_flags = Py_TPFLAGS_DEFAULT;
+#else
+	StateSetType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+	StateType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+	if (PyType_Ready(&ParametersType) < 0 or PyType_Ready(&SystemType) < 0
+			or PyType_Ready(&StateSetType) < 0 or PyType_Ready(&StateType) < 0)
+		return NULL;
+#if PY_MAJOR_VERSION >= 3
+	PyObject* module = PyModule_Create(&module_def);
+#else
+	PyObject* module = Py_InitModule3("itp2d", module_methods, module_doc);
+#endif
+	if (module == NULL)
+		return NULL;
+	Py_INCREF(&ParametersType);
+	PyModule_AddObject(module, "Parameters", reinterpret_cast<PyObject*>(&ParametersType));
+	Py_INCREF(&SystemType);
+	PyModule_AddObject(module, "System", reinterpret_cast<PyObject*>(&SystemType));
+	Py_INCREF(&StateSetType);
+	PyModule_AddObject(module, "StateSet", reinterpret_cast<PyObject*>(&StateSetType));
+	Py_INCREF(&StateType);
+	PyModule_AddObject(module, "State", reinterpret_cast<PyObject*>(&StateType));
+	PyModule_AddStringConstant(module, "__version__", version_string);
+	return module;
+}
+
+#if PY_MAJOR_VERSION >= 3
+PyMODINIT_FUNC PyInit_itp2d(void) {
+	return init_module();
+}
+#else
+PyMODINIT_FUNC inititp2d(void) {
+	init_module();
+}
+#endif
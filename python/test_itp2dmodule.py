@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# Smoke tests for the itp2d Python module. Run with "make check-python", or
+# directly with the directory containing the built module in PYTHONPATH.
+# memoryview.cast needs Python 3.3 or newer.
+from __future__ import print_function
+import ctypes, struct, unittest
+import itp2d
+
+args = ["-s", "32", "-N", "6", "-p", "harmonic", "-q", "--save-nothing", "--threads", "1"]
+
+def address_of(view):
+    return ctypes.addressof(ctypes.c_char.from_buffer(view.cast("B")))
+
+class TestSystem(unittest.TestCase):
+    def test_uninitialized(self):
+        system = itp2d.System.__new__(itp2d.System)
+        self.assertRaises(RuntimeError, system.step)
+        self.assertRaises(RuntimeError, lambda: system.finished)
+        params = itp2d.Parameters.__new__(itp2d.Parameters)
+        self.assertRaises(RuntimeError, lambda: params.sizex)
+        self.assertRaises(RuntimeError, itp2d.System, params)
+
+    def test_step_and_view_states(self):
+        system = itp2d.System(args)
+        system.step()
+        self.assertEqual(system.total_steps, 1)
+        self.assertFalse(system.finished)
+        self.assertEqual(len(system.states), 6)
+        # The views have the shape of the grid and alias the memory of the
+        # solver: each state is a slice of the view of the whole set
+        whole = memoryview(system.states)
+        self.assertEqual(whole.shape, (6, 32, 32))
+        self.assertEqual(whole.format, "Zd")
+        state = memoryview(system.states[2])
+        self.assertEqual(state.shape, (32, 32))
+        self.assertEqual(address_of(state), address_of(whole) + 2*32*32*16)
+        # Writing through one view is seen through the other
+        struct.pack_into("dd", state.cast("B"), 16*(32*5+7), 1.5, -2.5)
+        self.assertEqual(struct.unpack_from("dd", whole.cast("B"), 16*(32*(2*32+5)+7)), (1.5, -2.5))
+        state.release()
+        whole.release()
+        self.assertRaises(RuntimeError, system.__init__, args)
+        system.run()
+        self.assertTrue(system.finished)
+        self.assertFalse(system.error_flag)
+        for (E, reference) in zip(system.energies, [1, 2, 2, 3, 3, 3]):
+            self.assertAlmostEqual(E, reference, places=4)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,47 @@
+#!/usr/bin/env python2
+from __future__ import division
+import sys, os, h5py
+from optparse import OptionParser
+import matplotlib
+from matplotlib import pyplot
+from numpy import *
+
+# Plots how the time of each step of ITP is divided between the phases of the
+# algorithm, using the per-step telemetry saved in the datafile.
+
+phases = ["propagation_time", "orthonormalization_time", "convtest_time", "io_time"]
+
+def main():
+    # Parse command line arguments
+    parser = OptionParser(usage="%prog [options] datafile.h5")
+    parser.add_option("-s", "--share", action="store_true", dest="share", default=False,
+            help="plot the share of each phase of the step time instead of the absolute times")
+    (options, args) = parser.parse_args()
+    if len(args) != 1:
+        parser.error("required argument datafile missing")
+    filename = args[0]
+    file = h5py.File(filename)
+    telemetry = array(file["/telemetry"])
+    file.close()
+    steps = telemetry["step"]
+    wall = telemetry["wall_time"]
+    other = wall - sum([ telemetry[phase] for phase in phases ], axis=0)
+    for (name, t) in [ (phase, telemetry[phase]) for phase in phases ] + [ ("other", other) ]:
+        label = name.replace("_time", "")
+        if options.share:
+            pyplot.plot(steps, t/wall, label=label)
+        else:
+            pyplot.semilogy(steps, t, label=label)
+    if options.share:
+        pyplot.ylabel("share of step time")
+        pyplot.ylim(0, 1)
+    else:
+        pyplot.semilogy(steps, wall, 'k', label="total")
+        pyplot.ylabel("time (s)")
+    pyplot.xlim(min(steps), max(steps))
+    pyplot.xlabel("Step")
+    pyplot.legend(loc="upper left", ncol=3, prop={"size": "small"})
+    pyplot.show()
+
+if __name__=="__main__":
+    main()
@@ -0,0 +1,166 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "asyncwriter.hpp"
+
+AsyncWriter::AsyncWriter(Datafile& arg_datafile, size_t arg_queue_length) :
+		datafile(arg_datafile), queue_length(arg_queue_length),
+		busy(false), stopping(false) {
+	assert(queue_length > 0);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&job_available, NULL);
+	pthread_cond_init(&job_done, NULL);
+	// Signals such as SIGINT should be handled by the main thread, so block
+	// them for the background thread. The new thread inherits the mask.
+	sigset_t all_signals, old_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	const int ret = pthread_create(&thread, NULL, &AsyncWriter::thread_main, this);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (ret != 0)
+		throw GeneralError("Cannot start the background thread for writing the datafile.");
+}
+
+AsyncWriter::~AsyncWriter() {
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_signal(&job_available);
+	pthread_mutex_unlock(&mutex);
+	pthread_join(thread, NULL);
+	// Only left over if the background thread failed
+	for (std::deque<WriteJob*>::iterator it = queue.begin(); it != queue.end(); ++it)
+		delete *it;
+	for (size_t i=0; i<spare_buffers.size(); i++)
+		delete spare_buffers[i];
+	pthread_cond_destroy(&job_done);
+	pthread_cond_destroy(&job_available);
+	pthread_mutex_destroy(&mutex);
+}
+
+StateArray* AsyncWriter::snapshot(StateSet const& states, std::list<size_t> const* sort_order) {
+	const size_t N = states.get_num_states();
+	StateArray* buffer = NULL;
+	pthread_mutex_lock(&mutex);
+	while (not spare_buffers.empty() and buffer == NULL) {
+		buffer = spare_buffers.back();
+		spare_buffers.pop_back();
+		if (buffer->size() != N) {
+			delete buffer;
+			buffer = NULL;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	if (buffer == NULL)
+		buffer = new StateArray(N, states.datalayout);
+	std::list<size_t>::const_iterator it;
+	if (sort_order != NULL)
+		it = sort_order->begin();
+	for (size_t m=0; m<N; m++) {
+		const size_t index = (sort_order == NULL)? m : *(it++);
+		if (states.is_locked(index))
+			states.get_locked_state(index, (*buffer)[m]);
+		else
+			(*buffer)[m] = states[index];
+	}
+	return buffer;
+}
+
+void AsyncWriter::submit(WriteJob* job) {
+	wait_timer.start();
+	pthread_mutex_lock(&mutex);
+	// The job being written counts against the queue length
+	while (error_message.empty() and queue.size() + (busy? 1 : 0) >= queue_length)
+		pthread_cond_wait(&job_done, &mutex);
+	if (error_message.empty()) {
+		queue.push_back(job);
+		pthread_cond_signal(&job_available);
+	}
+	else
+		delete job;
+	pthread_mutex_unlock(&mutex);
+	wait_timer.stop();
+	throw_if_failed();
+}
+
+void AsyncWriter::flush() {
+	wait_timer.start();
+	pthread_mutex_lock(&mutex);
+	while (error_message.empty() and (busy or not queue.empty()))
+		pthread_cond_wait(&job_done, &mutex);
+	pthread_mutex_unlock(&mutex);
+	wait_timer.stop();
+	throw_if_failed();
+}
+
+void AsyncWriter::throw_if_failed() {
+	pthread_mutex_lock(&mutex);
+	const std::string message = error_message;
+	pthread_mutex_unlock(&mutex);
+	if (not message.empty())
+		throw GeneralError("Writing to the datafile in the background failed: " + message);
+}
+
+void* AsyncWriter::thread_main(void* arg) {
+	static_cast<AsyncWriter*>(arg)->work();
+	return NULL;
+}
+
+void AsyncWriter::work() {
+	// Error printing is set per thread in thread-safe builds of HDF5. See
+	// the Datafile constructor.
+	H5::Exception::dontPrint();
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (queue.empty() and not stopping)
+			pthread_cond_wait(&job_available, &mutex);
+		// Everything in the queue is written before stopping
+		if (queue.empty() or not error_message.empty())
+			break;
+		WriteJob* const job = queue.front();
+		queue.pop_front();
+		busy = true;
+		pthread_mutex_unlock(&mutex);
+		std::string failure;
+		write_timer.start();
+		try {
+			TraceScope trace("write job");
+			job->run(datafile);
+		}
+		catch (H5::Exception& e) {
+			failure = e.getDetailMsg();
+		}
+		catch (std::exception& e) {
+			failure = e.what();
+		}
+		write_timer.stop();
+		StateArray* const buffer = job->take_buffer();
+		delete job;
+		pthread_mutex_lock(&mutex);
+		busy = false;
+		if (buffer != NULL) {
+			if (spare_buffers.size() < queue_length)
+				spare_buffers.push_back(buffer);
+			else
+				delete buffer;
+		}
+		if (not failure.empty())
+			error_message = failure;
+		pthread_cond_broadcast(&job_done);
+	}
+	pthread_mutex_unlock(&mutex);
+}
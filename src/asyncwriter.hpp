@@ -0,0 +1,155 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A background thread for writing to a Datafile, so that compressing and
+ * writing a large set of states does not stall the computation. The data to
+ * write is copied into a write job, which is put in a bounded queue and
+ * written by the background thread while the caller continues. When the
+ * queue is full, submitting a new job blocks until the oldest one is written.
+ * With a queue length of two this is double buffering: one copy of the states
+ * is being written while the next one is being filled.
+ *
+ * HDF5 is not thread-safe, so while an AsyncWriter exists the Datafile must
+ * not be used directly without calling flush() first.
+ */
+
+#ifndef _ASYNCWRITER_HPP_
+#define _ASYNCWRITER_HPP_
+
+#include <deque>
+#include <vector>
+#include <list>
+#include <string>
+#include <exception>
+#include <pthread.h>
+#include <csignal>
+#include "H5Cpp.h"
+#include "itp2d_common.hpp"
+#include "exceptions.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
+#include "datafile.hpp"
+#include "stateset.hpp"
+#include "statearray.hpp"
+
+// A single piece of data waiting to be written
+class WriteJob {
+	public:
+		virtual ~WriteJob() {}
+		virtual void run(Datafile& datafile) = 0;
+		// Jobs holding a copy of the states give it back for reuse
+		virtual StateArray* take_buffer() { return NULL; }
+};
+
+class StateSetWriteJob : public WriteJob {
+	public:
+		StateSetWriteJob(StateArray* arg_snapshot, int arg_step) : snapshot(arg_snapshot), step(arg_step) {}
+		~StateSetWriteJob() { delete snapshot; }
+		void run(Datafile& datafile) { datafile.write_stateset(*snapshot, step); }
+		StateArray* take_buffer() { StateArray* const p = snapshot; snapshot = NULL; return p; }
+	private:
+		StateArray* snapshot;
+		const int step;
+};
+
+class EnergyHistoryWriteJob : public WriteJob {
+	public:
+		EnergyHistoryWriteJob(std::vector<double> const& E, std::vector<double> const& sd, size_t arg_index) :
+			energies(E), deviations(sd), index(arg_index) {}
+		void run(Datafile& datafile) {
+			datafile.write_energy_history(energies, index);
+			datafile.write_deviation_history(deviations, index);
+		}
+	private:
+		const std::vector<double> energies;
+		const std::vector<double> deviations;
+		const size_t index;
+};
+
+class FinalEnergiesWriteJob : public WriteJob {
+	public:
+		FinalEnergiesWriteJob(std::vector<double> const& E, std::vector<double> const& sd) :
+			energies(E), deviations(sd) {}
+		void run(Datafile& datafile) {
+			if (not energies.empty())
+				datafile.write_energies(energies);
+			if (not deviations.empty())
+				datafile.write_energy_standard_deviations(deviations);
+		}
+	private:
+		const std::vector<double> energies;
+		const std::vector<double> deviations;
+};
+
+class TimeStepHistoryWriteJob : public WriteJob {
+	public:
+		TimeStepHistoryWriteJob(size_t arg_index, double arg_eps) : index(arg_index), eps(arg_eps) {}
+		void run(Datafile& datafile) { datafile.write_time_step_history(index, eps); }
+	private:
+		const size_t index;
+		const double eps;
+};
+
+class TelemetryWriteJob : public WriteJob {
+	public:
+		TelemetryWriteJob(Datafile::telemetry_row const& arg_row) : row(arg_row) {}
+		void run(Datafile& datafile) { datafile.write_telemetry(row); }
+	private:
+		const Datafile::telemetry_row row;
+};
+
+class HistoryFlushJob : public WriteJob {
+	public:
+		void run(Datafile& datafile) { datafile.flush_history(); }
+};
+
+class AsyncWriter {
+	public:
+		AsyncWriter(Datafile& datafile, size_t queue_length);
+		~AsyncWriter();	// Writes everything still in the queue
+		// Copy the states in the given order (all states in their StateSet
+		// order if sort_order is NULL). The copy is done in the calling
+		// thread and can be submitted with a StateSetWriteJob.
+		StateArray* snapshot(StateSet const& states, std::list<size_t> const* sort_order);
+		void submit(WriteJob* job);		// Takes ownership of job. Blocks if the queue is full.
+		void flush();					// Block until everything submitted so far is written
+		// Time the calling thread spent blocked in submit() and flush(), and
+		// time the background thread spent writing
+		inline double get_wait_time() { return wait_timer.get_time(); }
+		inline double get_write_time() { return write_timer.get_time(); }
+	private:
+		static void* thread_main(void* arg);
+		void work();
+		void throw_if_failed();
+		Datafile& datafile;
+		const size_t queue_length;
+		std::deque<WriteJob*> queue;
+		std::vector<StateArray*> spare_buffers;
+		bool busy;			// The background thread is writing a job that is no longer in the queue
+		bool stopping;
+		std::string error_message;	// Set if a write failed in the background thread
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t job_available;
+		pthread_cond_t job_done;
+		Timer wait_timer;
+		Timer write_timer;
+};
+
+#endif // _ASYNCWRITER_HPP_
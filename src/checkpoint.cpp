@@ -0,0 +1,161 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <unistd.h>
+#include "checkpoint.hpp"
+#include "datafile.hpp"
+
+Checkpoint::Checkpoint(std::string const& arg_filename) :
+		filename(arg_filename) {
+	H5::Exception::dontPrint();
+	try {
+		hfile.openFile(filename, H5F_ACC_RDONLY);
+	}
+	catch (H5::Exception&) {
+		throw GeneralError("Cannot open checkpoint file '" + filename + "'.");
+	}
+}
+
+Checkpoint::~Checkpoint() {
+	hfile.close();
+}
+
+bool Checkpoint::exists(std::string const& filename) {
+	return access(filename.c_str(), F_OK) == 0;
+}
+
+GeneralError Checkpoint::read_error(const char* name) const {
+	return GeneralError("Cannot read " + std::string(name) + " from checkpoint file '" + filename + "'.");
+}
+
+int Checkpoint::read_int(const char* name) const {
+	int value;
+	try {
+		hfile.openGroup("/").openAttribute(name).read(H5::PredType::NATIVE_INT, &value);
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return value;
+}
+
+unsigned long int Checkpoint::read_ulong(const char* name) const {
+	unsigned long int value;
+	try {
+		hfile.openGroup("/").openAttribute(name).read(H5::PredType::NATIVE_ULONG, &value);
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return value;
+}
+
+double Checkpoint::read_double(const char* name) const {
+	double value;
+	try {
+		hfile.openGroup("/").openAttribute(name).read(H5::PredType::NATIVE_DOUBLE, &value);
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return value;
+}
+
+std::string Checkpoint::read_string(const char* name) const {
+	std::string value;
+	try {
+		H5::Attribute attr = hfile.openGroup("/").openAttribute(name);
+		const H5::StrType string_type = attr.getStrType();
+		std::vector<char> buffer(string_type.getSize()+1, '\0');
+		attr.read(string_type, &buffer[0]);
+		value = &buffer[0];
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return value;
+}
+
+std::vector<int> Checkpoint::read_int_values(const char* name) const {
+	std::vector<int> values;
+	try {
+		H5::DataSet dataset = hfile.openDataSet(name);
+		values.resize(static_cast<size_t>(dataset.getSpace().getSimpleExtentNpoints()));
+		if (not values.empty())
+			dataset.read(&values[0], H5::PredType::NATIVE_INT);
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return values;
+}
+
+std::vector<double> Checkpoint::read_double_values(const char* name) const {
+	std::vector<double> values;
+	try {
+		H5::DataSet dataset = hfile.openDataSet(name);
+		values.resize(static_cast<size_t>(dataset.getSpace().getSimpleExtentNpoints()));
+		if (not values.empty())
+			dataset.read(&values[0], H5::PredType::NATIVE_DOUBLE);
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return values;
+}
+
+std::vector<std::vector<double> > Checkpoint::read_history(const char* name) const {
+	std::vector<std::vector<double> > history;
+	try {
+		if (not H5Lexists(hfile.getId(), name, H5P_DEFAULT))
+			return history;
+		H5::DataSet dataset = hfile.openDataSet(name);
+		hsize_t dims[2];
+		dataset.getSpace().getSimpleExtentDims(dims);
+		std::vector<double> values(static_cast<size_t>(dims[0]*dims[1]));
+		if (not values.empty())
+			dataset.read(&values[0], H5::PredType::NATIVE_DOUBLE);
+		const size_t width = static_cast<size_t>(dims[1]);
+		for (size_t i=0; i<dims[0]; i++)
+			history.push_back(std::vector<double>(values.begin()+i*width, values.begin()+(i+1)*width));
+	}
+	catch (H5::Exception&) {
+		throw read_error(name);
+	}
+	return history;
+}
+
+std::vector<std::pair<int,double> > Checkpoint::read_time_step_history() const {
+	std::vector<std::pair<int,double> > history;
+	try {
+		H5::DataSet dataset = hfile.openDataSet("/time_step_history");
+		H5::CompType pair_type(sizeof(Datafile::time_step_history_pair));
+		pair_type.insertMember("step", offsetof(Datafile::time_step_history_pair, step), H5::PredType::NATIVE_INT);
+		pair_type.insertMember("time_step", offsetof(Datafile::time_step_history_pair, time_step), H5::PredType::NATIVE_DOUBLE);
+		std::vector<Datafile::time_step_history_pair> pairs(static_cast<size_t>(dataset.getSpace().getSimpleExtentNpoints()));
+		if (not pairs.empty())
+			dataset.read(&pairs[0], pair_type);
+		for (size_t i=0; i<pairs.size(); i++)
+			history.push_back(std::make_pair(pairs[i].step, pairs[i].time_step));
+	}
+	catch (H5::Exception&) {
+		throw read_error("/time_step_history");
+	}
+	return history;
+}
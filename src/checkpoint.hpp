@@ -0,0 +1,58 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reading back the checkpoints written by ITPSystem. A checkpoint is an
+ * ordinary itp2d datafile holding the states in the order they are stored in
+ * the StateSet, the complete energy and time step histories, and a few extra
+ * attributes and arrays describing where the simulation was. See
+ * ITPSystem::write_checkpoint().
+ */
+
+#ifndef _CHECKPOINT_HPP_
+#define _CHECKPOINT_HPP_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "H5Cpp.h"
+#include "exceptions.hpp"
+
+class Checkpoint {
+	public:
+		Checkpoint(std::string const& filename);
+		~Checkpoint();
+		static bool exists(std::string const& filename);
+		// Attributes of the root group
+		int read_int(const char* name) const;
+		unsigned long int read_ulong(const char* name) const;
+		double read_double(const char* name) const;
+		std::string read_string(const char* name) const;
+		// Arrays written with Datafile::write_values()
+		std::vector<int> read_int_values(const char* name) const;
+		std::vector<double> read_double_values(const char* name) const;
+		// The history datasets. Missing datasets read as empty histories.
+		std::vector<std::vector<double> > read_history(const char* name) const;
+		std::vector<std::pair<int,double> > read_time_step_history() const;
+		const std::string filename;
+	private:
+		GeneralError read_error(const char* name) const;
+		H5::H5File hfile;
+};
+
+#endif // _CHECKPOINT_HPP_
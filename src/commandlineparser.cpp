@@ -24,6 +24,136 @@ const char CommandLineParser::help_highmem[] = "\
 Use a different orthonormalization algorithm, which doubles the memory usage but *possibly* offers \
 better performance.";
 
+const char CommandLineParser::help_numa_interleave[] = "\
+Interleave the memory of the states over all NUMA nodes instead of placing each state on the node \
+of the thread that propagates it. Requires itp2d to be compiled with libnuma support.";
+
+const char CommandLineParser::help_pin_threads[] = "\
+Pin each thread to a single CPU so that the threads do not migrate away from their memory.";
+
+const char CommandLineParser::help_huge_pages[] = "\
+Back the states and the working memory with huge pages to reduce TLB misses. Possible values are \
+'none', 'transparent' for transparent huge pages, and '2M' or '1G' for explicit huge pages of that \
+size (these need to be reserved by the system administrator). 1G pages are only used for \
+allocations of at least 1 GB, and 2M pages for smaller ones. If the requested huge pages are not \
+available, smaller ones are used instead.";
+
+const char CommandLineParser::help_out_of_core[] = "\
+Store the states in a scratch file in DIRECTORY instead of in memory, so that state sets larger \
+than the available memory can be computed. The states are worked on in blocks that fit in the \
+memory budget set with --memory-budget. The scratch file is removed when itp2d exits. Use a \
+directory on a fast local disk.";
+
+const char CommandLineParser::help_memory_budget[] = "\
+Amount of memory in megabytes to use for orthonormalization when the states are stored \
+out-of-core. This includes the overlap matrix of all states, so the budget has to be larger than \
+16*N*N bytes for N states, and the copies of the states made when saving them with --async-io.";
+
+const char CommandLineParser::help_compress_converged[] = "\
+Lock converged states and store them in single precision, which halves their memory usage. Locked \
+states are no longer propagated, and the other states are only kept orthogonal to them. Only states \
+whose lower states are also converged are locked. The energies of locked states are not updated \
+after locking, and the saved states are accurate to single precision only. The number of such \
+states is saved in the datafile attribute num_single_precision_states.";
+
+const char CommandLineParser::help_async_io[] = "\
+Write the datafile in a background thread, so that the computation can continue while states and \
+energies are being compressed and written. This needs memory for a copy of the states for each \
+write waiting in the queue and for one more copy being made, see --io-queue-length. With \
+--out-of-core these copies are counted in --memory-budget.";
+
+const char CommandLineParser::help_io_queue_length[] = "\
+Number of writes that can be pending with --async-io before the computation waits for the \
+background thread. The default of two means that one copy of the states can be written while the \
+next one is waiting and a third one is being made. At most this many copies of the states plus \
+one are in memory at the same time.";
+
+const char CommandLineParser::help_states_chunk_size[] = "\
+Number of states stored together in one compressed chunk of the datafile. Larger chunks make \
+saving many states faster and compress better, but reading a single state back needs the whole \
+chunk to be decompressed.";
+
+const char CommandLineParser::help_compression[] = "\
+Filter used for compressing the data written to the datafile. Valid choices are 'none', 'deflate', \
+'shuffle+deflate', and, if itp2d is compiled with support for them, 'lz4' and 'zstd'. The states \
+are compressed in parallel. States of noisy systems compress poorly, in which case 'none' or 'lz4' \
+saves a lot of time. Reading files written with 'lz4' or 'zstd' needs the corresponding HDF5 \
+filter plugin.";
+
+const char CommandLineParser::help_compression_level[] = "\
+Compression level used with the filter set with --compression, from 1 to 9 for 'deflate' and \
+'shuffle+deflate', and from 1 to 22 for 'zstd'. Lower levels are faster.";
+
+const char CommandLineParser::help_single_precision[] = "\
+Store the states in the datafile in single precision. This halves the size of the states in the \
+file and the time needed to write them. The states are converted in parallel while writing. The \
+computation itself is always done in double precision, and --copy-from can read the states back.";
+
+const char CommandLineParser::help_checkpoint[] = "\
+Periodically save everything needed to continue the simulation to this file: the states, the \
+time step and the list of time steps still to be used, the step counters, the convergence flags \
+and the energy history. A checkpoint is also written when itp2d is interrupted with SIGINT or \
+SIGTERM. The file is removed when the simulation finishes successfully. See --resume.";
+
+const char CommandLineParser::help_checkpoint_interval[] = "\
+Seconds between checkpoints. Checkpoints are written at the end of a step, so with zero a \
+checkpoint is written after every step.";
+
+const char CommandLineParser::help_resume[] = "\
+Continue the simulation from the file given with --checkpoint, exactly where it was when the \
+checkpoint was written. If the file does not exist, the simulation starts from the beginning, so \
+the same command can be used to start a job and to restart it. The random seed is taken from the \
+checkpoint, the other parameters should be the same as in the interrupted run. The datafile is \
+overwritten, and it will contain the complete energy and time step histories, but states saved \
+with --save-everything before the checkpoint are lost.";
+
+const char CommandLineParser::help_cascade[] = "\
+Converge the states on a cascade of this many grids, from coarse to fine. Each coarser grid has \
+half as many points in both directions as the next one, so the grid size must be divisible by \
+2^(LEVELS-1). The states converged on one grid are interpolated onto the next one as its initial \
+states. Only the finest grid is saved to the datafile.";
+
+const char CommandLineParser::help_cascade_tolerance_factor[] = "\
+The limits of the convergence tests are multiplied by this factor for each level of the cascade \
+coarser than the finest one.";
+
+const char CommandLineParser::help_sweep[] = "\
+Solve the system for a range of values of one parameter in a single run. The sweep is given as \
+name(start,end,points), where name is B for the magnetic field or p1, p2, ... for the first, \
+second, ... parameter of the potential, which must then be given explicitly, for example \
+-p \"ring(3,1,2)\" --sweep \"p1(2,4,201)\". The points are evenly spaced from start to end. Each \
+point starts from the converged states and the final time step of the previous one, and the grid, \
+FFTW plans and memory are kept between the points. All points are saved to one datafile: the \
+histories and states of the points follow each other, and datasets named sweep_* tell which steps \
+belong to which point and give the final energies of each point. Cannot be used with --checkpoint.";
+
+const char CommandLineParser::help_ensemble[] = "\
+Solve this many independent realizations of the system, for example for averaging over impurity \
+noise. The realizations use consecutive random seeds starting from the one given with --rngseed. \
+Several realizations are run at the same time, each with the number of threads given with \
+--ensemble-threads, which is much faster than running them one by one when the grid is small. The \
+final energies and the noise realization of realization K are saved in group /realizations/K of \
+the datafile, states are not saved. Cannot be used with --sweep, --cascade, --checkpoint or \
+--pin-threads.";
+
+const char CommandLineParser::help_ensemble_threads[] = "\
+Number of threads used by each realization of an ensemble. The number of realizations run at the \
+same time is the total number of threads divided by this.";
+
+const char CommandLineParser::help_service[] = "\
+Run as a service taking jobs from this spool directory. A job is a file NAME.job containing itp2d \
+command line arguments. Jobs are run one at a time in order of their names, and renamed to \
+NAME.running and finally to NAME.done or NAME.failed. The output of a job goes to NAME.log and, \
+unless the job gives a datafile name, its results to NAME.h5. The FFTW plans, kinetic energy \
+operators and workspaces of the most recently used grids are kept between jobs, so that jobs on \
+the same grid start quickly. Several services can share a directory. The service stops when a \
+file named 'stop' appears in the directory. All other arguments are ignored.";
+
+const char CommandLineParser::help_trace[] = "\
+Record a trace of where the time goes in each thread, and write it to this file in the Chrome \
+trace event format when the program exits. The trace can be viewed with chrome://tracing or \
+Perfetto (https://ui.perfetto.dev).";
+
 const char CommandLineParser::help_wisdom_file_name[] = "\
 File name to use for FFTW wisdom.";
 
@@ -37,8 +167,16 @@ Description of the type of impurity bumps added to the potential. Valid descript
 Gaussian bumps with normally distributed amplitude and width:\n\
 \tgaussian(amp_mean, width_mean)\n\
 \tgaussian(amp_mean, amp_stdev, width_mean, width_stdev)\n\
+A further last parameter cutoff evaluates each Gaussian only up to cutoff widths from its center, \
+which makes setting up the potential much faster with many impurities:\n\
+\tgaussian(amp_mean, width_mean, cutoff)\n\
+\tgaussian(amp_mean, amp_stdev, width_mean, width_stdev, cutoff)\n\
 Coulomb-like impurities with alpha/r^e potential:\n\
 \tcoulomb(e,alpha)\n\
+The same, but computed as a convolution with FFTs, which is much faster with many impurities. \
+The potential is approximate within a few grid spacings from each impurity, and with periodic \
+boundary conditions only the nearest periodic image of each impurity is included:\n\
+\tcoulombfft(e,alpha)\n\
 Hemisphere bumps with given amplitude and radius:\n\
 \themisphere(amplitude,radius)\n\
 Delta function bumps with normally distributed volume:\n\
@@ -138,13 +276,17 @@ const char CommandLineParser::help_save_onlyenergies[] = "\
 Save only final state energies, not the states themselves.";
 
 const char CommandLineParser::help_save_everything[] = "\
-Save state data after each step. Causes MASSIVE datafiles.";
+Save state data after each step. Causes MASSIVE datafiles. States locked with \
+--compress-converged are saved with single precision accuracy.";
 
 const char CommandLineParser::help_clobber[] = "\
 Overwrite datafile if it exists.";
 
 const char CommandLineParser::help_copy_from[] = "\
-Copy state data from specified datafile.";
+Copy state data from specified datafile. The datafile may contain fewer or more states, in which \
+case the missing states are initialized to random noise orthogonal to the copied ones. It may also \
+use a different grid covering the same area, in which case the states are resampled by spectral \
+interpolation.";
 
 const char CommandLineParser::help_datafile_name[] = "\
 File name to save data to.";
@@ -206,6 +348,16 @@ Soft stadium potential of Tomsovic & Heller\n\
 \tsoftstadium(R,L,V,a,b)\n\
 Another soft stadium potential with power-function walls\n\
 \tpowerstadium(R,L,a)\n\
+Any potential given as an expression of the coordinates x and y and the radius r, using +, -, *, /, \
+^ (power), parentheses, the constant pi and the functions sin, cos, tan, asin, acos, atan, sinh, \
+cosh, tanh, exp, log, sqrt, abs, atan2, pow, hypot, min and max, for example\n\
+\texpression(0.5*(x^2+y^2) + 0.1*sin(3*atan2(y,x)))\n\
+A potential tabulated on a grid centered on the origin, interpolated bicubically. The table can be \
+the potential of an itp2d datafile, an HDF5 dataset with grid spacing dx, or a raw binary file of \
+sizex*sizey doubles with grid spacing dx:\n\
+\ttabulated(file.h5)\n\
+\ttabulated(file.h5:/dataset,dx)\n\
+\ttabulated(file.bin,sizex,sizey,dx)\n\
 See header potential.hpp for details.";
 
 const char CommandLineParser::help_epilogue[] = "\
@@ -223,6 +375,29 @@ CommandLineParser::CommandLineParser() :
 	params(),
 	cmd(help_epilogue, ' ', version_string),
 	arg_highmem("", "highmem-orthonormalization", help_highmem, cmd),
+	arg_numa_interleave("", "numa-interleave", help_numa_interleave, cmd),
+	arg_pin_threads("", "pin-threads", help_pin_threads, cmd),
+	arg_huge_pages("", "huge-pages", help_huge_pages, false, "none", "STRING", cmd),
+	arg_out_of_core("", "out-of-core", help_out_of_core, false, Parameters::default_scratch_directory, "DIRECTORY", cmd),
+	arg_memory_budget("", "memory-budget", help_memory_budget, false, Parameters::default_memory_budget, "MB", cmd),
+	arg_compress_converged("", "compress-converged", help_compress_converged, cmd),
+	arg_async_io("", "async-io", help_async_io, cmd),
+	arg_io_queue_length("", "io-queue-length", help_io_queue_length, false, Parameters::default_io_queue_length, "NUM", cmd),
+	arg_states_chunk_size("", "states-per-chunk", help_states_chunk_size, false, Parameters::default_states_chunk_size, "NUM", cmd),
+	arg_compression("", "compression", help_compression, false, "deflate", "STRING", cmd),
+	arg_compression_level("", "compression-level", help_compression_level, false, Parameters::default_compression_level, "NUM", cmd),
+	arg_single_precision("", "single-precision", help_single_precision, cmd),
+	arg_checkpoint("", "checkpoint", help_checkpoint, false, Parameters::default_checkpoint_file, "FILENAME", cmd),
+	arg_checkpoint_interval("", "checkpoint-interval", help_checkpoint_interval, false, Parameters::default_checkpoint_interval, "SECONDS", cmd),
+	arg_resume("", "resume", help_resume, cmd),
+	arg_cascade("", "cascade", help_cascade, false, Parameters::default_cascade_levels, "LEVELS", cmd),
+	arg_cascade_tolerance_factor("", "cascade-tolerance-factor", help_cascade_tolerance_factor, false,
+			Parameters::default_cascade_tolerance_factor, "FACTOR", cmd),
+	arg_sweep("", "sweep", help_sweep, false, Parameters::default_sweep, "DESCRIPTION", cmd),
+	arg_ensemble("", "ensemble", help_ensemble, false, Parameters::default_ensemble_size, "NUM", cmd),
+	arg_ensemble_threads("", "ensemble-threads", help_ensemble_threads, false, Parameters::default_ensemble_threads, "NUM", cmd),
+	arg_service("", "service", help_service, false, Parameters::default_service_directory, "DIRECTORY", cmd),
+	arg_trace("", "trace", help_trace, false, Parameters::default_trace_file, "FILENAME", cmd),
 	arg_wisdom_file_name("", "wisdomfile", help_wisdom_file_name, false, Parameters::default_wisdom_file_name, "FILENAME", cmd),
 	arg_noise("", "noise", help_noise, false, Parameters::default_noise_type, "STRING", cmd),
 	arg_impurity_type("", "impurity-type", help_impurity_type, false, Parameters::default_impurity_type, "STRING", cmd),
@@ -298,6 +473,76 @@ void CommandLineParser::parse(std::vector<std::string>& args) {
 	throw_if_nonpositive(arg_order);
 	if (arg_order.getValue() % 2 != 0)
 		throw TCLAP::CmdLineParseException("Has to be even.", arg_order.getName());
+	std::string const& huge_pages = arg_huge_pages.getValue();
+	if (huge_pages != "none" and huge_pages != "transparent" and huge_pages != "2M" and huge_pages != "1G")
+		throw TCLAP::CmdLineParseException("Unknown huge page setting.", arg_huge_pages.getName());
+	if (arg_out_of_core.isSet() and arg_out_of_core.getValue().empty())
+		throw TCLAP::CmdLineParseException("Empty directory name not allowed.", arg_out_of_core.getName());
+	if (arg_out_of_core.isSet() and arg_highmem.isSet())
+		throw TCLAP::CmdLineParseException("Arguments cannot be set together.",
+				arg_out_of_core.getName()+" and "+arg_highmem.getName());
+	if (arg_out_of_core.isSet() and (arg_numa_interleave.isSet() or arg_huge_pages.isSet()))
+		throw TCLAP::CmdLineParseException("Arguments cannot be set together.",
+				arg_out_of_core.getName()+" and ("+arg_numa_interleave.getName()+" or "+arg_huge_pages.getName()+")");
+	throw_if_nonpositive(arg_memory_budget);
+	throw_if_nonpositive(arg_io_queue_length);
+	if (arg_io_queue_length.isSet() and not arg_async_io.isSet())
+		throw TCLAP::CmdLineParseException("Argument has no effect without " + arg_async_io.getName() + ".", arg_io_queue_length.getName());
+	throw_if_nonpositive(arg_states_chunk_size);
+	std::string const& compression = arg_compression.getValue();
+	CompressionFilter compression_filter;
+	if (compression == "none")
+		compression_filter = NoCompression;
+	else if (compression == "deflate")
+		compression_filter = DeflateCompression;
+	else if (compression == "shuffle+deflate")
+		compression_filter = ShuffleDeflateCompression;
+	else if (compression == "lz4")
+		compression_filter = LZ4Compression;
+	else if (compression == "zstd")
+		compression_filter = ZstdCompression;
+	else
+		throw TCLAP::CmdLineParseException("Unknown compression filter.", arg_compression.getName());
+	if (not compression_filter_available(compression_filter))
+		throw TCLAP::CmdLineParseException("itp2d was compiled without support for this compression filter.", arg_compression.getName());
+	if (arg_compression_level.isSet() and (compression_filter == NoCompression or compression_filter == LZ4Compression))
+		throw TCLAP::CmdLineParseException("Argument has no effect with compression filter '" + compression + "'.", arg_compression_level.getName());
+	const int max_compression_level = (compression_filter == ZstdCompression)? 22 : 9;
+	if (arg_compression_level.getValue() < 1 or arg_compression_level.getValue() > max_compression_level)
+		throw TCLAP::CmdLineParseException("Compression level out of range.", arg_compression_level.getName());
+	if (arg_checkpoint.isSet() and arg_checkpoint.getValue().empty())
+		throw TCLAP::CmdLineParseException("Empty file name not allowed.", arg_checkpoint.getName());
+	throw_if_negative(arg_checkpoint_interval);
+	if (arg_checkpoint_interval.isSet() and not arg_checkpoint.isSet())
+		throw TCLAP::CmdLineParseException("Argument has no effect without " + arg_checkpoint.getName() + ".", arg_checkpoint_interval.getName());
+	if (arg_resume.isSet() and not arg_checkpoint.isSet())
+		throw TCLAP::CmdLineParseException("Argument needs " + arg_checkpoint.getName() + ".", arg_resume.getName());
+	throw_if_nonpositive(arg_cascade);
+	if (arg_cascade.getValue() > 16)
+		throw TCLAP::CmdLineParseException("Too many levels.", arg_cascade.getName());
+	const size_t cascade_divisor = static_cast<size_t>(1) << (arg_cascade.getValue()-1);
+	const size_t given_sizex = (arg_size.isSet())? arg_size.getValue() : arg_sizex.getValue();
+	const size_t given_sizey = (arg_size.isSet())? arg_size.getValue() : arg_sizey.getValue();
+	if (given_sizex % cascade_divisor != 0 or given_sizey % cascade_divisor != 0)
+		throw TCLAP::CmdLineParseException("Grid size must be divisible by 2^(LEVELS-1).", arg_cascade.getName());
+	if (arg_cascade_tolerance_factor.getValue() < 1)
+		throw TCLAP::CmdLineParseException("Factor must be at least one.", arg_cascade_tolerance_factor.getName());
+	if (arg_cascade_tolerance_factor.isSet() and not arg_cascade.isSet())
+		throw TCLAP::CmdLineParseException("Argument has no effect without " + arg_cascade.getName() + ".", arg_cascade_tolerance_factor.getName());
+	throw_if_nonpositive(arg_ensemble_threads);
+	if (arg_ensemble.isSet()) {
+		throw_if_nonpositive(arg_ensemble);
+		if (arg_sweep.isSet() or arg_cascade.isSet() or arg_checkpoint.isSet() or arg_pin_threads.isSet())
+			throw TCLAP::CmdLineParseException("Arguments cannot be set together.",
+					arg_ensemble.getName()+" and ("+arg_sweep.getName()+" or "+arg_cascade.getName()+" or "
+					+arg_checkpoint.getName()+" or "+arg_pin_threads.getName()+")");
+	}
+	if (arg_service.isSet() and arg_service.getValue().empty())
+		throw TCLAP::CmdLineParseException("Empty directory name not allowed.", arg_service.getName());
+	if (arg_trace.isSet() and arg_trace.getValue().empty())
+		throw TCLAP::CmdLineParseException("Empty file name not allowed.", arg_trace.getName());
+	if (arg_ensemble_threads.isSet() and not arg_ensemble.isSet())
+		throw TCLAP::CmdLineParseException("Argument has no effect without " + arg_ensemble.getName() + ".", arg_ensemble_threads.getName());
 	throw_if_negative(arg_min_time_step);
 	throw_if_nonpositive(arg_max_steps);
 	// Build the Parameters class instance based on the command line options given
@@ -334,6 +579,45 @@ void CommandLineParser::parse(std::vector<std::string>& args) {
 	params.clobber = arg_clobber.getValue();
 	params.verbosity = Parameters::default_verbosity + arg_verbosity.getValue() - arg_quietness.getValue();
 	params.num_threads = arg_num_threads.getValue();
+	params.numa_interleave = arg_numa_interleave.getValue();
+	params.pin_threads = arg_pin_threads.getValue();
+	if (huge_pages == "transparent")
+		params.page_backing = TransparentHugePages;
+	else if (huge_pages == "2M")
+		params.page_backing = HugePages2M;
+	else if (huge_pages == "1G")
+		params.page_backing = HugePages1G;
+	else
+		params.page_backing = NormalPages;
+	params.scratch_directory = arg_out_of_core.getValue();
+	params.memory_budget = arg_memory_budget.getValue();
+	params.compress_converged = arg_compress_converged.getValue();
+	params.async_io = arg_async_io.getValue();
+	params.io_queue_length = arg_io_queue_length.getValue();
+	params.states_chunk_size = arg_states_chunk_size.getValue();
+	params.compression_filter = compression_filter;
+	params.compression_level = arg_compression_level.getValue();
+	params.state_precision = arg_single_precision.getValue()? SinglePrecision : DoublePrecision;
+	params.checkpoint_file = arg_checkpoint.getValue();
+	params.checkpoint_interval = arg_checkpoint_interval.getValue();
+	params.resume = arg_resume.getValue();
+	params.cascade_levels = arg_cascade.getValue();
+	params.cascade_tolerance_factor = arg_cascade_tolerance_factor.getValue();
+	if (arg_sweep.isSet()) {
+		if (arg_checkpoint.isSet())
+			throw TCLAP::CmdLineParseException("Arguments cannot be set together.",
+					arg_sweep.getName()+" and "+arg_checkpoint.getName());
+		try {
+			params.set_sweep(arg_sweep.getValue());
+			params.get_potential_type(0);
+		}
+		catch (InvalidSweep& e) {
+			throw TCLAP::CmdLineParseException(e.what(), arg_sweep.getName());
+		}
+	}
+	params.set_ensemble(arg_ensemble.getValue(), arg_ensemble_threads.getValue());
+	params.set_service_directory(arg_service.getValue());
+	params.set_trace_file(arg_trace.getValue());
 	params.sizex = arg_sizex.getValue();
 	params.sizey = arg_sizey.getValue();
 	if (arg_size.isSet()) {
@@ -30,6 +30,7 @@
 #include "itp2d_common.hpp"
 #include "exceptions.hpp"
 #include "parameters.hpp"
+#include "compression.hpp"
 #include "rng.hpp"
 
 class CommandLineParser {
@@ -39,6 +40,28 @@ class CommandLineParser {
 		Parameters const& get_params() const { return params; }		// ...and return the corresponding Parameters instance
 		// Documentation strings for each command line parameter. These are printed with --help
 		static const char help_highmem[];
+		static const char help_numa_interleave[];
+		static const char help_pin_threads[];
+		static const char help_huge_pages[];
+		static const char help_out_of_core[];
+		static const char help_memory_budget[];
+		static const char help_compress_converged[];
+		static const char help_async_io[];
+		static const char help_io_queue_length[];
+		static const char help_states_chunk_size[];
+		static const char help_compression[];
+		static const char help_compression_level[];
+		static const char help_single_precision[];
+		static const char help_checkpoint[];
+		static const char help_checkpoint_interval[];
+		static const char help_resume[];
+		static const char help_cascade[];
+		static const char help_cascade_tolerance_factor[];
+		static const char help_sweep[];
+		static const char help_ensemble[];
+		static const char help_ensemble_threads[];
+		static const char help_service[];
+		static const char help_trace[];
 		static const char help_wisdom_file_name[];
 		static const char help_noise[];
 		static const char help_impurity_type[];
@@ -83,6 +106,28 @@ class CommandLineParser {
 		Parameters params;
 		TCLAP::CmdLine cmd;
 		TCLAP::SwitchArg arg_highmem;
+		TCLAP::SwitchArg arg_numa_interleave;
+		TCLAP::SwitchArg arg_pin_threads;
+		TCLAP::ValueArg<std::string> arg_huge_pages;
+		TCLAP::ValueArg<std::string> arg_out_of_core;
+		TCLAP::ValueArg<size_t> arg_memory_budget;
+		TCLAP::SwitchArg arg_compress_converged;
+		TCLAP::SwitchArg arg_async_io;
+		TCLAP::ValueArg<size_t> arg_io_queue_length;
+		TCLAP::ValueArg<size_t> arg_states_chunk_size;
+		TCLAP::ValueArg<std::string> arg_compression;
+		TCLAP::ValueArg<int> arg_compression_level;
+		TCLAP::SwitchArg arg_single_precision;
+		TCLAP::ValueArg<std::string> arg_checkpoint;
+		TCLAP::ValueArg<double> arg_checkpoint_interval;
+		TCLAP::SwitchArg arg_resume;
+		TCLAP::ValueArg<size_t> arg_cascade;
+		TCLAP::ValueArg<double> arg_cascade_tolerance_factor;
+		TCLAP::ValueArg<std::string> arg_sweep;
+		TCLAP::ValueArg<size_t> arg_ensemble;
+		TCLAP::ValueArg<size_t> arg_ensemble_threads;
+		TCLAP::ValueArg<std::string> arg_service;
+		TCLAP::ValueArg<std::string> arg_trace;
 		TCLAP::ValueArg<std::string> arg_wisdom_file_name;
 		TCLAP::ValueArg<std::string> arg_noise;
 		TCLAP::ValueArg<std::string> arg_impurity_type;
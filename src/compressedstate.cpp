@@ -0,0 +1,57 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compressedstate.hpp"
+
+CompressedState::CompressedState(State const& state) :
+		datalayout(state.datalayout), values(state.datalayout.N) {
+	comp const* const data = state.data_ptr();
+	for (size_t i=0; i<datalayout.N; i++)
+		values[i] = std::complex<float>(static_cast<float>(real(data[i])), static_cast<float>(imag(data[i])));
+}
+
+void CompressedState::decompress(State& state) const {
+	assert(datalayout == state.datalayout);
+	comp* const data = state.data_ptr();
+	for (size_t i=0; i<datalayout.N; i++)
+		data[i] = comp(values[i].real(), values[i].imag());
+}
+
+comp CompressedState::dot(State const& other) const {
+	assert(datalayout == other.datalayout);
+	comp const* const data = other.data_ptr();
+	// Accumulate in double precision
+	double sum_re = 0;
+	double sum_im = 0;
+	for (size_t i=0; i<datalayout.N; i++) {
+		const double a = values[i].real();
+		const double b = values[i].imag();
+		const double c = real(data[i]);
+		const double d = imag(data[i]);
+		sum_re += a*c + b*d;
+		sum_im += a*d - b*c;
+	}
+	return comp(sum_re, sum_im)*datalayout.dx*datalayout.dx;
+}
+
+void CompressedState::project_out(State& other) const {
+	const comp c = dot(other);
+	comp* const data = other.data_ptr();
+	for (size_t i=0; i<datalayout.N; i++)
+		data[i] -= c*comp(values[i].real(), values[i].imag());
+}
@@ -0,0 +1,51 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A read-only copy of a State stored in single precision, which takes half
+ * the memory of the original. StateSet uses these for locked states, which
+ * are no longer modified but are still needed for projecting them out of the
+ * other states. The values are converted back to double precision on the fly
+ * while computing dot products, so a full-size copy is never needed. The
+ * relative error of each stored value is bounded by the single precision
+ * machine epsilon, about 6e-8.
+ */
+
+#ifndef _COMPRESSEDSTATE_HPP_
+#define _COMPRESSEDSTATE_HPP_
+
+#include <complex>
+#include <vector>
+#include <cassert>
+#include "itp2d_common.hpp"
+#include "datalayout.hpp"
+#include "state.hpp"
+
+class CompressedState {
+	public:
+		CompressedState(State const& state);
+		void decompress(State& state) const;		// Write the stored values to state
+		comp dot(State const& other) const;			// <this|other> with the same normalization as State::dot
+		void project_out(State& other) const;		// other -= <this|other> this
+		inline size_t size_in_bytes() const { return values.size()*sizeof(std::complex<float>); }
+		DataLayout const& datalayout;
+	private:
+		std::vector<std::complex<float> > values;
+};
+
+#endif // _COMPRESSEDSTATE_HPP_
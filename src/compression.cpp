@@ -0,0 +1,308 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <zlib.h>
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#include "compression.hpp"
+
+namespace {
+
+	// Byte shuffle in the same order as the HDF5 shuffle filter: first bytes
+	// of all elements, then second bytes, and so on. Trailing bytes that do
+	// not form a whole element are copied as they are.
+	void shuffle(const char* in, size_t len, size_t element_size, char* out) {
+		const size_t num = len/element_size;
+		for (size_t i=0; i<element_size; i++) {
+			for (size_t j=0; j<num; j++)
+				out[i*num+j] = in[j*element_size+i];
+		}
+		memcpy(out+num*element_size, in+num*element_size, len-num*element_size);
+	}
+
+	// The compression functions return the compressed size, or zero if the
+	// result would not be smaller than the input.
+	size_t deflate(const char* in, size_t len, int level, std::vector<char>& out) {
+		uLongf outlen = compressBound(static_cast<uLong>(len));
+		out.resize(outlen);
+		if (compress2(reinterpret_cast<Bytef*>(&out[0]), &outlen,
+					reinterpret_cast<const Bytef*>(in), static_cast<uLong>(len), level) != Z_OK)
+			return 0;
+		return (outlen < len)? outlen : 0;
+	}
+
+	#ifdef USE_LZ4
+	// The LZ4 filter plugin splits the data in blocks of at most 1 GB
+	const size_t lz4_max_block_size = static_cast<size_t>(1) << 30;
+
+	// Big-endian integers used in the header of the LZ4 format
+	void write_be32(char* ptr, uint32_t value) {
+		for (int i=3; i>=0; i--) {
+			ptr[i] = static_cast<char>(value & 0xff);
+			value >>= 8;
+		}
+	}
+
+	void write_be64(char* ptr, uint64_t value) {
+		for (int i=7; i>=0; i--) {
+			ptr[i] = static_cast<char>(value & 0xff);
+			value >>= 8;
+		}
+	}
+
+	uint64_t read_be(const char* ptr, int len) {
+		uint64_t value = 0;
+		for (int i=0; i<len; i++)
+			value = (value << 8) | static_cast<unsigned char>(ptr[i]);
+		return value;
+	}
+
+	size_t lz4_compress(const char* in, size_t len, std::vector<char>& out) {
+		const size_t block_size = std::min(len, lz4_max_block_size);
+		const size_t num_blocks = (len + block_size - 1)/block_size;
+		out.resize(12 + num_blocks*(4 + static_cast<size_t>(LZ4_compressBound(static_cast<int>(block_size)))));
+		write_be64(&out[0], len);
+		write_be32(&out[8], static_cast<uint32_t>(block_size));
+		size_t pos = 12;
+		for (size_t done=0; done<len; done+=block_size) {
+			const int this_block = static_cast<int>(std::min(block_size, len-done));
+			int compressed = LZ4_compress_default(in+done, &out[pos+4], this_block, LZ4_compressBound(this_block));
+			if (compressed <= 0 or compressed >= this_block) {
+				// Blocks that do not compress are stored as they are
+				memcpy(&out[pos+4], in+done, static_cast<size_t>(this_block));
+				compressed = this_block;
+			}
+			write_be32(&out[pos], static_cast<uint32_t>(compressed));
+			pos += 4 + static_cast<size_t>(compressed);
+		}
+		return (pos < len)? pos : 0;
+	}
+
+	size_t lz4_decompress(const char* in, size_t len, std::vector<char>& out) {
+		if (len < 12)
+			return 0;
+		const size_t orig_size = static_cast<size_t>(read_be(in, 8));
+		const size_t block_size = static_cast<size_t>(read_be(in+8, 4));
+		out.resize(orig_size);
+		size_t pos = 12;
+		for (size_t done=0; done<orig_size; done+=block_size) {
+			const size_t this_block = std::min(block_size, orig_size-done);
+			if (pos+4 > len)
+				return 0;
+			const size_t compressed = static_cast<size_t>(read_be(in+pos, 4));
+			pos += 4;
+			if (pos+compressed > len)
+				return 0;
+			if (compressed == this_block)
+				memcpy(&out[done], in+pos, this_block);
+			else if (LZ4_decompress_safe(in+pos, &out[done], static_cast<int>(compressed), static_cast<int>(this_block)) != static_cast<int>(this_block))
+				return 0;
+			pos += compressed;
+		}
+		return orig_size;
+	}
+	#endif // USE_LZ4
+
+	#ifdef USE_ZSTD
+	size_t zstd_compress(const char* in, size_t len, int level, std::vector<char>& out) {
+		out.resize(ZSTD_compressBound(len));
+		const size_t outlen = ZSTD_compress(&out[0], out.size(), in, len, level);
+		if (ZSTD_isError(outlen))
+			return 0;
+		return (outlen < len)? outlen : 0;
+	}
+
+	size_t zstd_decompress(const char* in, size_t len, std::vector<char>& out) {
+		const unsigned long long orig_size = ZSTD_getFrameContentSize(in, len);
+		if (orig_size == ZSTD_CONTENTSIZE_ERROR or orig_size == ZSTD_CONTENTSIZE_UNKNOWN)
+			return 0;
+		out.resize(static_cast<size_t>(orig_size));
+		const size_t outlen = ZSTD_decompress(&out[0], out.size(), in, len);
+		return ZSTD_isError(outlen)? 0 : outlen;
+	}
+	#endif // USE_ZSTD
+
+	#if defined(USE_LZ4) || defined(USE_ZSTD)
+	// Filter callback for HDF5. Replaces the buffer with its compressed or
+	// decompressed contents, and returns the new size, or zero on failure.
+	size_t filter_callback(H5Z_filter_t id, unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+			size_t nbytes, size_t* buf_size, void** buf) {
+		const char* in = reinterpret_cast<const char*>(*buf);
+		std::vector<char> out;
+		size_t outlen = 0;
+		const bool reverse = (flags & H5Z_FLAG_REVERSE) != 0;
+		#ifdef USE_LZ4
+		if (id == H5Z_FILTER_ITP2D_LZ4)
+			outlen = reverse? lz4_decompress(in, nbytes, out) : lz4_compress(in, nbytes, out);
+		#endif
+		#ifdef USE_ZSTD
+		if (id == H5Z_FILTER_ITP2D_ZSTD) {
+			const int level = (cd_nelmts > 0)? static_cast<int>(cd_values[0]) : 3;
+			outlen = reverse? zstd_decompress(in, nbytes, out) : zstd_compress(in, nbytes, level, out);
+		}
+		#endif
+		if (outlen == 0)
+			return 0;
+		void* newbuf = malloc(outlen);
+		if (newbuf == NULL)
+			return 0;
+		memcpy(newbuf, &out[0], outlen);
+		free(*buf);
+		*buf = newbuf;
+		*buf_size = outlen;
+		return outlen;
+	}
+	#endif
+
+	#ifdef USE_LZ4
+	size_t lz4_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+			size_t nbytes, size_t* buf_size, void** buf) {
+		return filter_callback(H5Z_FILTER_ITP2D_LZ4, flags, cd_nelmts, cd_values, nbytes, buf_size, buf);
+	}
+	#endif
+
+	#ifdef USE_ZSTD
+	size_t zstd_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+			size_t nbytes, size_t* buf_size, void** buf) {
+		return filter_callback(H5Z_FILTER_ITP2D_ZSTD, flags, cd_nelmts, cd_values, nbytes, buf_size, buf);
+	}
+	#endif
+}
+
+bool compression_filter_available(CompressionFilter filter) {
+	switch (filter) {
+		case LZ4Compression:
+			#ifdef USE_LZ4
+			return true;
+			#else
+			return false;
+			#endif
+		case ZstdCompression:
+			#ifdef USE_ZSTD
+			return true;
+			#else
+			return false;
+			#endif
+		default:
+			return true;
+	}
+}
+
+std::string compression_filter_description(CompressionFilter filter) {
+	switch (filter) {
+		case NoCompression:
+			return "none";
+		case DeflateCompression:
+			return "deflate";
+		case ShuffleDeflateCompression:
+			return "shuffle+deflate";
+		case LZ4Compression:
+			return "lz4";
+		case ZstdCompression:
+			return "zstd";
+		default:
+			return "unknown";
+	}
+}
+
+void register_compression_filters() {
+	#ifdef USE_LZ4
+	if (H5Zfilter_avail(H5Z_FILTER_ITP2D_LZ4) <= 0) {
+		H5Z_class2_t lz4_class = { H5Z_CLASS_T_VERS, H5Z_FILTER_ITP2D_LZ4, 1, 1, "lz4", NULL, NULL, lz4_filter };
+		H5Zregister(&lz4_class);
+	}
+	#endif
+	#ifdef USE_ZSTD
+	if (H5Zfilter_avail(H5Z_FILTER_ITP2D_ZSTD) <= 0) {
+		H5Z_class2_t zstd_class = { H5Z_CLASS_T_VERS, H5Z_FILTER_ITP2D_ZSTD, 1, 1, "zstd", NULL, NULL, zstd_filter };
+		H5Zregister(&zstd_class);
+	}
+	#endif
+}
+
+void add_compression_filter(H5::DSetCreatPropList& props, CompressionFilter filter, int level) {
+	const unsigned int cd_level = static_cast<unsigned int>(level);
+	switch (filter) {
+		case NoCompression:
+			break;
+		case ShuffleDeflateCompression:
+			props.setShuffle();
+			props.setDeflate(cd_level);
+			break;
+		case DeflateCompression:
+			props.setDeflate(cd_level);
+			break;
+		case LZ4Compression:
+			props.setFilter(H5Z_FILTER_ITP2D_LZ4, H5Z_FLAG_OPTIONAL);
+			break;
+		case ZstdCompression:
+			props.setFilter(H5Z_FILTER_ITP2D_ZSTD, H5Z_FLAG_OPTIONAL, 1, &cd_level);
+			break;
+	}
+}
+
+ChunkCompressor::ChunkCompressor(CompressionFilter arg_filter, int arg_level, size_t arg_element_size) :
+		filter(arg_filter),
+		level(arg_level),
+		element_size(arg_element_size) {
+	// Each filter in the pipeline has its own bit in the mask
+	const unsigned int num_filters = (filter == NoCompression)? 0 : (filter == ShuffleDeflateCompression)? 2 : 1;
+	skip_mask = (1u << num_filters) - 1;
+}
+
+bool ChunkCompressor::compress(const char* in, size_t len, std::vector<char>& out) const {
+	size_t outlen = 0;
+	switch (filter) {
+		case NoCompression:
+			break;
+		case DeflateCompression:
+			outlen = deflate(in, len, level, out);
+			break;
+		case ShuffleDeflateCompression:
+			{
+				std::vector<char> shuffled(len);
+				shuffle(in, len, element_size, &shuffled[0]);
+				outlen = deflate(&shuffled[0], len, level, out);
+			}
+			break;
+		case LZ4Compression:
+			#ifdef USE_LZ4
+			outlen = lz4_compress(in, len, out);
+			#endif
+			break;
+		case ZstdCompression:
+			#ifdef USE_ZSTD
+			outlen = zstd_compress(in, len, level, out);
+			#endif
+			break;
+	}
+	if (outlen == 0) {
+		out.assign(in, in+len);
+		return false;
+	}
+	out.resize(outlen);
+	return true;
+}
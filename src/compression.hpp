@@ -0,0 +1,67 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compression of the chunks written to the datafile. The chunks are
+ * compressed here in the same format as the corresponding HDF5 filters
+ * produce, so that they can be compressed in parallel and written to the file
+ * directly, bypassing the serial filter pipeline of HDF5. The files can be read
+ * with any HDF5 installation that has the filters available.
+ *
+ * The LZ4 and Zstandard formats follow the registered HDF5 filter plugins
+ * (filter IDs 32004 and 32015). Support for them is compiled in with the
+ * macros USE_LZ4 and USE_ZSTD, in which case register_compression_filters()
+ * also registers them with HDF5, so that itp2d can read such files back.
+ */
+
+#ifndef _COMPRESSION_HPP_
+#define _COMPRESSION_HPP_
+
+#include <string>
+#include <vector>
+#include "H5Cpp.h"
+#include "itp2d_common.hpp"
+
+// Identifiers of the LZ4 and Zstandard filters in the HDF5 filter registry
+const H5Z_filter_t H5Z_FILTER_ITP2D_LZ4 = 32004;
+const H5Z_filter_t H5Z_FILTER_ITP2D_ZSTD = 32015;
+
+bool compression_filter_available(CompressionFilter filter);
+std::string compression_filter_description(CompressionFilter filter);
+void register_compression_filters();
+
+// Add a filter to the filter pipeline of a chunked dataset
+void add_compression_filter(H5::DSetCreatPropList& props, CompressionFilter filter, int level);
+
+class ChunkCompressor {
+	public:
+		ChunkCompressor(CompressionFilter filter, int level, size_t element_size);
+		// Compress len bytes from in to out, passing the data through all
+		// filters in the pipeline. If the data does not get smaller, it is
+		// copied to out as it is and false is returned, in which case the
+		// chunk should be written with filter mask get_skip_mask().
+		bool compress(const char* in, size_t len, std::vector<char>& out) const;
+		inline unsigned int get_skip_mask() const { return skip_mask; }
+	private:
+		const CompressionFilter filter;
+		const int level;
+		const size_t element_size;
+		unsigned int skip_mask;
+};
+
+#endif // _COMPRESSION_HPP_
@@ -36,6 +36,8 @@ class ConvergenceTest {
 		// This could be done with better data isolation, but let this be an exercise for the reader.
 		virtual ~ConvergenceTest() {}
 		virtual bool test(ITPSystem const& sys, size_t n) const = 0;	// returns true if state 'n' is converged in system sys.
+		// Return a new test with all its limits multiplied by factor
+		virtual ConvergenceTest* loosened(double factor) const = 0;
 		inline std::string const& get_description() const { return description; }
 	protected:
 		std::string description;
@@ -53,6 +55,7 @@ class NoConvergenceTest : public ConvergenceTest {
 		NoConvergenceTest() { init(); }
 		NoConvergenceTest(std::vector<double> const& params);
 		bool test(__attribute__((unused)) ITPSystem const& sys, __attribute__((unused)) size_t n) const { return false; }
+		ConvergenceTest* loosened(__attribute__((unused)) double factor) const { return new NoConvergenceTest(); }
 	private:
 		void init() { description = "none"; }
 };
@@ -64,6 +67,7 @@ class OneStepConvergenceTest : public ConvergenceTest {
 		OneStepConvergenceTest() { init(); }
 		OneStepConvergenceTest(std::vector<double> const& params);
 		bool test(ITPSystem const& sys, size_t n) const;
+		ConvergenceTest* loosened(__attribute__((unused)) double factor) const { return new OneStepConvergenceTest(); }
 	private:
 		void init() { description = "one-step convergence"; }
 };
@@ -75,6 +79,7 @@ class RelativeEnergyChangeTest : public ConvergenceTest {
 		RelativeEnergyChangeTest(double _limit) : limit(_limit) { init(); }
 		RelativeEnergyChangeTest(std::vector<double> const& params);
 		bool test(ITPSystem const& sys, size_t n) const;
+		ConvergenceTest* loosened(double factor) const { return new RelativeEnergyChangeTest(factor*limit); }
 	private:
 		double limit;
 		void init();
@@ -85,6 +90,7 @@ class AbsoluteEnergyChangeTest : public ConvergenceTest {
 		AbsoluteEnergyChangeTest(double _limit) : limit(_limit) { init(); }
 		AbsoluteEnergyChangeTest(std::vector<double> const& params);
 		bool test(ITPSystem const& sys, size_t n) const;
+		ConvergenceTest* loosened(double factor) const { return new AbsoluteEnergyChangeTest(factor*limit); }
 	private:
 		double limit;
 		void init();
@@ -107,6 +113,9 @@ class AbsoluteEnergyDeviationTest : public ConvergenceTest {
 		}
 		AbsoluteEnergyDeviationTest(std::vector<double> const& params);
 		bool test(ITPSystem const& sys, size_t n) const;
+		ConvergenceTest* loosened(double factor) const {
+			return new AbsoluteEnergyDeviationTest(factor*absolute_deviation_limit, factor*difference_limit);
+		}
 	private:
 		double absolute_deviation_limit;
 		double difference_limit;
@@ -123,6 +132,9 @@ class RelativeEnergyDeviationTest : public ConvergenceTest {
 		}
 		RelativeEnergyDeviationTest(std::vector<double> const& params);
 		bool test(ITPSystem const& sys, size_t n) const;
+		ConvergenceTest* loosened(double factor) const {
+			return new RelativeEnergyDeviationTest(factor*relative_deviation_limit, factor*difference_limit);
+		}
 	private:
 		double relative_deviation_limit;
 		double difference_limit;
@@ -20,6 +20,11 @@
  * A class for storing data on HDF5 files easily.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <stdint.h>
+#include <omp.h>
 #include "datafile.hpp"
 
 // Defining trivial constants seems very stupid indeed but we need to do this
@@ -28,15 +33,23 @@
 const hsize_t Datafile::unlimited_dims[] = {H5S_UNLIMITED, H5S_UNLIMITED};
 const hsize_t Datafile::ones[] = {1, 1};
 const hsize_t Datafile::zeroes[] = {0, 0};
+const size_t Datafile::gather_buffer_size = 64*1024*1024;
+const size_t Datafile::history_batch_size = 64;
 
-Datafile::Datafile(std::string filename, DataLayout const& dl, bool clobber) :
+Datafile::Datafile(std::string filename, DataLayout const& dl, bool clobber,
+		size_t arg_states_chunk_size, CompressionFilter filter, int compression_level, StatePrecision precision) :
 		datalayout(dl),
+		states_chunk_size(arg_states_chunk_size),
+		compression_filter(filter),
+		state_precision(precision),
+		state_size(datalayout.N*((precision == SinglePrecision)? sizeof(std::complex<float>) : sizeof(comp))),
 		double_type(H5::PredType::NATIVE_DOUBLE),
 		int_type(H5::PredType::NATIVE_INT),
 		scalar_space(H5S_SCALAR),
 		null_space_1d(1, zeroes, unlimited_dims),
 		null_space_2d(2, zeroes, unlimited_dims) {
 	H5::Exception::dontPrint(); // Turn off error printing from HDF5. Use exceptions.
+	register_compression_filters();
 	const hsize_t state_dims[2] = {datalayout.sizey, datalayout.sizex};
 	// Try to open the file, overwriting it if clobber is set
 	try {
@@ -57,6 +70,9 @@ Datafile::Datafile(std::string filename, DataLayout const& dl, bool clobber) :
 	complex_type = H5::CompType(sizeof(comp));
 	complex_type.insertMember("r", 0, double_type);
 	complex_type.insertMember("i", sizeof(double), double_type);
+	complex_float_type = H5::CompType(sizeof(std::complex<float>));
+	complex_float_type.insertMember("r", 0, H5::PredType::NATIVE_FLOAT);
+	complex_float_type.insertMember("i", sizeof(float), H5::PredType::NATIVE_FLOAT);
 	// if states are written to the file several times, state_history will
 	// record the iteration (or step) the states were written on, and the index
 	// the states were saved to
@@ -67,33 +83,68 @@ Datafile::Datafile(std::string filename, DataLayout const& dl, bool clobber) :
 	time_step_history_type = H5::CompType(8 + sizeof(double));
 	time_step_history_type.insertMember("step", offsetof(time_step_history_pair, step), int_type);
 	time_step_history_type.insertMember("time_step", offsetof(time_step_history_pair, time_step), double_type);
-	state_type = new H5::ArrayType(complex_type, 2, state_dims);
+	// telemetry records how the time of each step is divided between the
+	// phases of the algorithm
+	telemetry_type = H5::CompType(sizeof(telemetry_row));
+	telemetry_type.insertMember("step", offsetof(telemetry_row, step), int_type);
+	telemetry_type.insertMember("num_converged", offsetof(telemetry_row, num_converged), int_type);
+	telemetry_type.insertMember("num_timestep_converged", offsetof(telemetry_row, num_timestep_converged), int_type);
+	telemetry_type.insertMember("wall_time", offsetof(telemetry_row, wall_time), double_type);
+	telemetry_type.insertMember("propagation_time", offsetof(telemetry_row, propagation_time), double_type);
+	telemetry_type.insertMember("orthonormalization_time", offsetof(telemetry_row, orthonormalization_time), double_type);
+	telemetry_type.insertMember("convtest_time", offsetof(telemetry_row, convtest_time), double_type);
+	telemetry_type.insertMember("io_time", offsetof(telemetry_row, io_time), double_type);
+	telemetry_type.insertMember("states_per_second", offsetof(telemetry_row, states_per_second), double_type);
+	telemetry_type.insertMember("bytes_written", offsetof(telemetry_row, bytes_written), H5::PredType::NATIVE_ULONG);
+	state_type = (state_precision == SinglePrecision)? complex_float_type : complex_type;
 	potential_type = new H5::ArrayType(double_type, 2, state_dims);
 	// Dataspaces
 	// Everything is just initialized to zero size and expanded from there
 	space_1d = H5::DataSpace(1, zeroes, unlimited_dims);
 	space_2d = H5::DataSpace(2, zeroes, unlimited_dims);
-	// Dataset properties, these turn on inline compression of data
-	states_dset_props.setChunk(2, ones);
-	states_dset_props.setDeflate(9);
+	// Dataset properties, these turn on inline compression of data. The
+	// states are stored with complex numbers as elements, so that the shuffle
+	// filter groups together the same bytes of each real and imaginary part.
+	// HDF5
+	// limits the size of a chunk to 4 GB, so the number of states in a
+	// chunk is capped accordingly.
+	const size_t max_chunk_size = (static_cast<size_t>(1) << 32) - 1;
+	if (states_chunk_size*state_size > max_chunk_size)
+		states_chunk_size = max_chunk_size/state_size;
+	assert(states_chunk_size > 0);
+	const hsize_t states_chunk[4] = {1, states_chunk_size, datalayout.sizey, datalayout.sizex};
+	states_dset_props.setChunk(4, states_chunk);
 	state_history_props.setChunk(1, ones);
-	state_history_props.setDeflate(9);
 	energies_dset_props.setChunk(1, ones);
-	energies_dset_props.setDeflate(9);
-	time_step_history_props.setChunk(1, ones);
-	time_step_history_props.setDeflate(9);
-	energy_history_props.setChunk(2, ones);
-	energy_history_props.setDeflate(9);
+	// The chunks of the history datasets hold one batch of rows. The width of
+	// the two-dimensional ones is set when they are created.
+	const hsize_t history_chunk[1] = {history_batch_size};
+	time_step_history_props.setChunk(1, history_chunk);
+	telemetry_props.setChunk(1, history_chunk);
 	noise_dset_props.setChunk(1, ones);
-	noise_dset_props.setDeflate(9);
+	add_compression_filter(states_dset_props, filter, compression_level);
+	add_compression_filter(state_history_props, filter, compression_level);
+	add_compression_filter(energies_dset_props, filter, compression_level);
+	add_compression_filter(time_step_history_props, filter, compression_level);
+	add_compression_filter(telemetry_props, filter, compression_level);
+	add_compression_filter(energy_history_props, filter, compression_level);
+	add_compression_filter(noise_dset_props, filter, compression_level);
+	states_compressor = new ChunkCompressor(filter, compression_level, state_type.getSize());
 	// Standard attributes
 	add_attribute("grid_sizex", static_cast<int>(datalayout.sizex));
 	add_attribute("grid_sizey", static_cast<int>(datalayout.sizey));
 	add_attribute("grid_delta", datalayout.dx);
+	add_attribute("state_precision", (state_precision == SinglePrecision)? "single" : "double");
 }
 
 Datafile::~Datafile() {
-	delete state_type;
+	// Errors have already been reported by the write functions, and there is
+	// nothing else to do about them here
+	try {
+		flush_history();
+	}
+	catch (H5::Exception&) {}
+	delete states_compressor;
 	delete potential_type;
 	hfile.close();
 }
@@ -129,9 +180,11 @@ bool Datafile::dataset_exists(const std::string dataset_name) const{
 
 void Datafile::ensure_states_data() {
 	if (not dataset_exists("/states")) {
+		const hsize_t dims[4] = {0, 0, datalayout.sizey, datalayout.sizex};
+		const hsize_t max_dims[4] = {H5S_UNLIMITED, H5S_UNLIMITED, datalayout.sizey, datalayout.sizex};
 		states_data = hfile.createDataSet("/states",
-				*state_type, null_space_2d, states_dset_props);
-		add_description(states_data, "A two-dimensional array. First index represents a generic \"slot\" where states can be saved -- for example for saving the states after each iteration or at some user-specified situations. The second index is the index of a single state in the whole set of states. States can be ordered according to their energy, but this is not enforced by the Datafile class. Each state is a two-dimensional array of complex numbers, representing the values of the wave-function on a common grid.");
+				state_type, H5::DataSpace(4, dims, max_dims), states_dset_props);
+		add_description(states_data, "A four-dimensional array of complex numbers. First index represents a generic \"slot\" where states can be saved -- for example for saving the states after each iteration or at some user-specified situations. The second index is the index of a single state in the whole set of states. States can be ordered according to their energy, but this is not enforced by the Datafile class. The last two indices are the y and x indices of a point on the common grid, so that each state is a two-dimensional array representing the values of the wave-function on the grid.");
 	}
 }
 
@@ -160,8 +213,17 @@ void Datafile::ensure_time_step_history_data() {
 	}
 }
 
-void Datafile::ensure_energy_history_data() {
+void Datafile::ensure_telemetry_data() {
+	if (not dataset_exists("/telemetry")) {
+		telemetry_data = hfile.createDataSet("/telemetry", telemetry_type, null_space_1d, telemetry_props);
+		add_description(telemetry_data, "Performance telemetry with one row per step. Each row has the step number, the number of finally and timestep converged states after the step, the wall time of the step and the time spent in propagation, orthonormalization, convergence tests and I/O during it, the number of states propagated per second, and the total number of bytes written to this file so far.");
+	}
+}
+
+void Datafile::ensure_energy_history_data(size_t N) {
 	if (not dataset_exists("/energy_history")) {
+		const hsize_t chunk[2] = {history_batch_size, N};
+		energy_history_props.setChunk(2, chunk);
 		energy_history_data = hfile.createDataSet("/energy_history",
 				double_type, null_space_2d, energy_history_props);
 		add_description(energy_history_data, "A two-dimensional array recording the energy of each state at each iteration step. The first index is the iteration step, and the second index is the index of the state.");
@@ -176,8 +238,10 @@ void Datafile::ensure_energy_standard_deviations_data() {
 	}
 }
 
-void Datafile::ensure_deviation_history_data() {
+void Datafile::ensure_deviation_history_data(size_t N) {
 	if (not dataset_exists("/deviation_history")) {
+		const hsize_t chunk[2] = {history_batch_size, N};
+		energy_history_props.setChunk(2, chunk);
 		deviation_history_data = hfile.createDataSet("/deviation_history",
 				double_type, null_space_2d, energy_history_props);
 		add_description(deviation_history_data, "A two-dimensional array recording the standard deviation of energy of each state at each iteration step. The first index is the iteration step, and the second index is the index of the state.");
@@ -200,22 +264,32 @@ void Datafile::ensure_noise_data() {
 
 // Functions for writing data to the file
 
-// States are written in a 2D array. The second index m is meant to refer to
-// the index of the state in the set of states, whereas the first index is a
-// running index for saving the same set of states several times, e.g., after
-// each iteration
+// States are written in a 2D array of states, the grid points of each state
+// taking the last two dimensions of the dataset. The second index m is meant
+// to refer to the index of the state in the set of states, whereas the first
+// index is a running index for saving the same set of states several times,
+// e.g., after each iteration
 void Datafile::write_state(size_t n, size_t m, State const& state) {
 	assert(datalayout == state.datalayout);
-	const hsize_t coords[1][2] = {{n, m}};
-	const hsize_t min_size[2] = {n+1, m+1};
+	const hsize_t count[4] = {1, 1, datalayout.sizey, datalayout.sizex};
+	const hsize_t start[4] = {n, m, 0, 0};
+	const hsize_t len = datalayout.N;
+	hsize_t min_size[4];
 	try {
 		// extend dataset if needed, and write the state at the position specified by indices n and m
 		ensure_states_data();
+		// DataSet::extend can also shrink the dataset, so make sure previously
+		// written states are kept
+		states_data.getSpace().getSimpleExtentDims(min_size);
+		min_size[0] = std::max(min_size[0], static_cast<hsize_t>(n+1));
+		min_size[1] = std::max(min_size[1], static_cast<hsize_t>(m+1));
 		states_data.extend(min_size);
-		space_2d.setExtentSimple(2, min_size);
-		space_2d.selectElements(H5S_SELECT_SET, 1, reinterpret_cast<const hsize_t*>(coords));
-		validate_selection(space_2d);
-		states_data.write(state.data_ptr(), *state_type, scalar_space, space_2d);
+		H5::DataSpace filespace = states_data.getSpace();
+		filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+		validate_selection(filespace);
+		space_1d.setExtentSimple(1, &len);
+		space_1d.selectAll();
+		write_filtered(states_data, "/states", state.data_ptr(), state_type, space_1d, filespace);
 	}
 	catch(H5::Exception& e) {
 		e.printError();
@@ -228,38 +302,43 @@ void Datafile::write_state(size_t n, size_t m, State const& state) {
 // given to write states in an order different from their order in the
 // StateSet (for example, in order of increasing energy).
 void Datafile::write_stateset(StateSet const& stateset, int step, std::list<size_t> const* sort_order) {
-	hsize_t states_cur_size[2];
-	hsize_t state_history_cur_size[1];
+	const size_t N = stateset.get_num_states();
+	if (N == 0)
+		return;
 	try {
-		ensure_states_data();
-		ensure_state_history_data();
-		// calculate current size of states_data
-		states_data.getSpace().getSimpleExtentDims(states_cur_size);
-		// new slot for states will be same as states_cur_size[0]
-		const hsize_t new_slot = states_cur_size[0];
-		state_history_pair pair;
-		pair.step = step;
-		pair.index = static_cast<int>(new_slot);
-		// calculate current size of state_history_data and extend by one
-		state_history_data.getSpace().getSimpleExtentDims(state_history_cur_size);
-		hsize_t new_size = state_history_cur_size[0]+1;
-		state_history_data.extend(&new_size);
-		space_1d.setExtentSimple(1, &new_size);
-		space_1d.selectElements(H5S_SELECT_SET, 1, state_history_cur_size);
-		validate_selection(space_1d);
-		// record what was the step when states were saved
-		state_history_data.write(&pair, state_history_type, scalar_space, space_1d);
-		// write states
-		const size_t N = stateset.get_num_states();
-		if (sort_order == NULL)
-			for (size_t m=0; m<N; m++)
-				write_state(new_slot, m, stateset[m]);
-		else {
-			std::list<size_t>::const_iterator it = sort_order->begin();
-			for (size_t m=0; m<N; m++) {
-				write_state(new_slot, m, stateset[*it]);
-				++it;
+		const hsize_t new_slot = new_states_slot(step, N);
+		// If the states are in order and lie contiguously in memory, they can
+		// be written with a single call
+		bool in_place = true;
+		std::list<size_t>::const_iterator it;
+		if (sort_order != NULL)
+			it = sort_order->begin();
+		for (size_t m=0; m<N and in_place; m++) {
+			const size_t index = (sort_order == NULL)? m : *(it++);
+			in_place = (index == m) and not stateset.is_locked(m)
+				and stateset[m].data_ptr() == stateset[0].data_ptr() + m*datalayout.N;
+		}
+		if (in_place) {
+			write_states(new_slot, 0, N, stateset[0].data_ptr());
+			return;
+		}
+		// Otherwise the states are gathered to a buffer in the right order and
+		// written a buffer at a time. Locked states are only available in
+		// compressed form, so they are expanded in the buffer.
+		const size_t batch = std::min(N, states_per_gather());
+		StateArray buffer(batch, datalayout);
+		if (sort_order != NULL)
+			it = sort_order->begin();
+		for (size_t first=0; first<N; first+=batch) {
+			const size_t num = std::min(batch, N-first);
+			for (size_t m=0; m<num; m++) {
+				const size_t index = (sort_order == NULL)? first+m : *(it++);
+				if (stateset.is_locked(index))
+					stateset.get_locked_state(index, buffer[m]);
+				else
+					buffer[m] = stateset[index];
 			}
+			write_states(new_slot, first, num, buffer[0].data_ptr());
 		}
 	}
 	catch(H5::Exception& e) {
@@ -268,45 +347,240 @@ void Datafile::write_stateset(StateSet const& stateset, int step, std::list<size
 	}
 }
 
+void Datafile::write_stateset(StateArray const& states, int step) {
+	const size_t N = states.size();
+	if (N == 0)
+		return;
+	try {
+		const hsize_t new_slot = new_states_slot(step, N);
+		write_states(new_slot, 0, N, states[0].data_ptr());
+	}
+	catch(H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
+// Write num states from contiguous memory starting at ptr to the given slot,
+// starting from index first. States stored in single precision are converted
+// in parallel, a gather buffer at a time. Since the buffer holds whole chunks,
+// only the last chunk of the slot can be partially filled also here.
+void Datafile::write_states(hsize_t slot, size_t first, size_t num, comp const* ptr) {
+	if (state_precision == DoublePrecision) {
+		write_stored_states(slot, first, num, ptr);
+		return;
+	}
+	const size_t batch = std::min(num, states_per_gather());
+	std::vector<std::complex<float> > converted(batch*datalayout.N);
+	DatasetStatistics& stats = statistics["/states"];
+	for (size_t done=0; done<num; done+=batch) {
+		const size_t len = std::min(batch, num-done)*datalayout.N;
+		comp const* const in = ptr + done*datalayout.N;
+		stats.compression_timer.start();
+		#pragma omp parallel for schedule(static)
+		for (size_t i=0; i<len; i++)
+			converted[i] = std::complex<float>(in[i]);
+		stats.compression_timer.stop();
+		write_stored_states(slot, first+done, std::min(batch, num-done), &converted[0]);
+	}
+}
+
+// Write num states, already in the precision they are stored in, from
+// contiguous memory starting at ptr. If the states are compressed, the chunks
+// are compressed in parallel and written to the file directly. Otherwise they
+// are written with a single hyperslab write.
+void Datafile::write_stored_states(hsize_t slot, size_t first, size_t num, const void* ptr) {
+	#if H5_VERSION_GE(1,10,2)
+	if (compression_filter != NoCompression) {
+		const size_t chunk_size = states_chunk_size*state_size;
+		const size_t num_chunks = (num + states_chunk_size - 1)/states_chunk_size;
+		// Chunks are compressed a batch at a time to bound the memory used
+		const size_t batch = std::max(gather_buffer_size/chunk_size, static_cast<size_t>(omp_get_max_threads()));
+		// Only the last chunk of a slot can be partially filled
+		assert(first % states_chunk_size == 0);
+		#ifndef NDEBUG
+		hsize_t cur_size[4];
+		states_data.getSpace().getSimpleExtentDims(cur_size);
+		assert(num % states_chunk_size == 0 or first+num == cur_size[1]);
+		#endif
+		DatasetStatistics& stats = statistics["/states"];
+		std::vector<std::vector<char> > compressed(std::min(batch, num_chunks));
+		std::vector<char> filtered(compressed.size());
+		for (size_t batch_start=0; batch_start<num_chunks; batch_start+=batch) {
+			const size_t batch_len = std::min(batch, num_chunks-batch_start);
+			stats.compression_timer.start();
+			#pragma omp parallel
+			{
+				std::vector<char> padded;
+				#pragma omp for schedule(dynamic)
+				for (size_t c=0; c<batch_len; c++) {
+					const size_t index = (batch_start+c)*states_chunk_size;
+					const char* in = static_cast<const char*>(ptr) + index*state_size;
+					const size_t states_in_chunk = std::min(states_chunk_size, num-index);
+					if (states_in_chunk < states_chunk_size) {
+						// HDF5 stores partial chunks at the edge as whole chunks
+						padded.assign(chunk_size, 0);
+						memcpy(&padded[0], in, states_in_chunk*state_size);
+						in = &padded[0];
+					}
+					filtered[c] = states_compressor->compress(in, chunk_size, compressed[c]);
+				}
+			}
+			stats.compression_timer.stop();
+			for (size_t c=0; c<batch_len; c++) {
+				const hsize_t offset[4] = {slot, first + (batch_start+c)*states_chunk_size, 0, 0};
+				const uint32_t filter_mask = filtered[c]? 0 : states_compressor->get_skip_mask();
+				if (H5Dwrite_chunk(states_data.getId(), H5P_DEFAULT, filter_mask, offset,
+							compressed[c].size(), &compressed[c][0]) < 0)
+					throw H5::DataSetIException("Datafile::write_stored_states", "H5Dwrite_chunk failed");
+			}
+		}
+		stats.bytes_written += num*state_size;
+		return;
+	}
+	#endif
+	const hsize_t count[4] = {1, num, datalayout.sizey, datalayout.sizex};
+	const hsize_t start[4] = {slot, first, 0, 0};
+	const hsize_t len = num*datalayout.N;
+	H5::DataSpace filespace = states_data.getSpace();
+	filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+	validate_selection(filespace);
+	space_1d.setExtentSimple(1, &len);
+	space_1d.selectAll();
+	write_filtered(states_data, "/states", ptr, state_type, space_1d, filespace);
+}
+
+// Write data through the filter pipeline of HDF5, recording the statistics
+void Datafile::write_filtered(H5::DataSet& dataset, const char* name, const void* buf, H5::DataType const& type,
+		H5::DataSpace const& memspace, H5::DataSpace const& filespace) {
+	DatasetStatistics& stats = statistics[name];
+	stats.compression_timer.start();
+	try {
+		dataset.write(buf, type, memspace, filespace);
+	}
+	catch (H5::Exception&) {
+		stats.compression_timer.stop();
+		throw;
+	}
+	stats.compression_timer.stop();
+	stats.bytes_written += static_cast<unsigned long int>(memspace.getSelectNpoints())*type.getSize();
+}
+
+// How many states to gather at a time when they need to be reordered. The
+// gather buffer holds a whole number of chunks, so that no chunk is
+// compressed more than once.
+size_t Datafile::states_per_gather() const {
+	const size_t chunk_size = states_chunk_size*datalayout.N*sizeof(comp);
+	const size_t chunks = std::max(gather_buffer_size/chunk_size, static_cast<size_t>(1));
+	return chunks*states_chunk_size;
+}
+
+// Record in state_history that a new slot of N states is written at the
+// given step, extend the states dataset to hold it, and return the index of
+// the slot
+hsize_t Datafile::new_states_slot(int step, size_t N) {
+	hsize_t states_cur_size[4];
+	hsize_t state_history_cur_size[1];
+	ensure_states_data();
+	ensure_state_history_data();
+	// calculate current size of states_data
+	states_data.getSpace().getSimpleExtentDims(states_cur_size);
+	// new slot for states will be same as states_cur_size[0]
+	const hsize_t new_slot = states_cur_size[0];
+	// DataSet::extend can also shrink the dataset, so keep the old number of
+	// states per slot if it is larger
+	const hsize_t states_new_size[4] = {new_slot+1, std::max(states_cur_size[1], static_cast<hsize_t>(N)),
+		datalayout.sizey, datalayout.sizex};
+	states_data.extend(states_new_size);
+	state_history_pair pair;
+	pair.step = step;
+	pair.index = static_cast<int>(new_slot);
+	// calculate current size of state_history_data and extend by one
+	state_history_data.getSpace().getSimpleExtentDims(state_history_cur_size);
+	hsize_t new_size = state_history_cur_size[0]+1;
+	state_history_data.extend(&new_size);
+	space_1d.setExtentSimple(1, &new_size);
+	space_1d.selectElements(H5S_SELECT_SET, 1, state_history_cur_size);
+	validate_selection(space_1d);
+	// record what was the step when states were saved
+	write_filtered(state_history_data, "/state_history", &pair, state_history_type, scalar_space, space_1d);
+	return new_slot;
+}
+
 void Datafile::write_time_step_history(size_t index, double eps) {
 	// pack values of index and eps into a struct in memory
 	time_step_history_pair pair;
+	memset(&pair, 0, sizeof(pair));
 	pair.step = static_cast<int>(index);
 	pair.time_step = eps;
+	time_step_history_buffer.push_back(pair);
+	if (time_step_history_buffer.size() >= history_batch_size)
+		write_time_step_history_buffer();
+}
+
+void Datafile::write_time_step_history_buffer() {
+	if (time_step_history_buffer.empty())
+		return;
+	const hsize_t num = time_step_history_buffer.size();
 	try {
 		ensure_time_step_history_data();
-		// calculate current size, extend if needed, and write data. You know the drill.
-		H5::DataSpace tempspace = time_step_history_data.getSpace();
-		tempspace.selectAll();
-		hsize_t cur_size = tempspace.getSelectNpoints();
-		hsize_t new_size = cur_size + 1;
-		space_1d.setExtentSimple(1, &new_size);
+		// calculate current size, extend, and write the buffered values after the old ones
+		hsize_t cur_size;
+		time_step_history_data.getSpace().getSimpleExtentDims(&cur_size);
+		const hsize_t new_size = cur_size + num;
 		time_step_history_data.extend(&new_size);
-		space_1d.selectElements(H5S_SELECT_SET, 1, &cur_size);
-		validate_selection(space_1d);
-		time_step_history_data.write(&pair, time_step_history_type, scalar_space, space_1d);
+		H5::DataSpace filespace = time_step_history_data.getSpace();
+		filespace.selectHyperslab(H5S_SELECT_SET, &num, &cur_size);
+		validate_selection(filespace);
+		space_1d.setExtentSimple(1, &num);
+		space_1d.selectAll();
+		write_filtered(time_step_history_data, "/time_step_history", &time_step_history_buffer[0],
+				time_step_history_type, space_1d, filespace);
 	}
 	catch(H5::Exception& e) {
 		e.printError();
 		throw;
 	}
+	time_step_history_buffer.clear();
 }
 
-void Datafile::write_energy_history(std::vector<double> energy_history, size_t index) {
-	const hsize_t N = energy_history.size();
-	const hsize_t min_size[2] = {index+1, N};
-	const hsize_t count[2] = {1, N};
-	const hsize_t start[2] = {index, 0};
+void Datafile::write_telemetry(telemetry_row row) {
+	row.bytes_written = 0;
+	for (std::map<std::string, DatasetStatistics>::const_iterator it = statistics.begin(); it != statistics.end(); it++)
+		row.bytes_written += it->second.bytes_written;
+	telemetry_buffer.push_back(row);
+	if (telemetry_buffer.size() >= history_batch_size)
+		write_telemetry_buffer();
+}
+
+void Datafile::write_telemetry_buffer() {
+	if (telemetry_buffer.empty())
+		return;
+	const hsize_t num = telemetry_buffer.size();
 	try {
-		ensure_energy_history_data();
-		energy_history_data.extend(min_size);
-		space_2d.setExtentSimple(2, min_size);
-		space_2d.selectHyperslab(H5S_SELECT_SET, count, start);
-		validate_selection(space_2d);
-		space_1d.setExtentSimple(1, &N);
+		ensure_telemetry_data();
+		hsize_t cur_size;
+		telemetry_data.getSpace().getSimpleExtentDims(&cur_size);
+		const hsize_t new_size = cur_size + num;
+		telemetry_data.extend(&new_size);
+		H5::DataSpace filespace = telemetry_data.getSpace();
+		filespace.selectHyperslab(H5S_SELECT_SET, &num, &cur_size);
+		validate_selection(filespace);
+		space_1d.setExtentSimple(1, &num);
 		space_1d.selectAll();
-		energy_history_data.write(&(energy_history.front()), double_type,
-				space_1d, space_2d);
+		write_filtered(telemetry_data, "/telemetry", &telemetry_buffer[0], telemetry_type, space_1d, filespace);
+	}
+	catch(H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+	telemetry_buffer.clear();
+}
+
+void Datafile::write_energy_history(std::vector<double> energy_history, size_t index) {
+	try {
+		ensure_energy_history_data(energy_history.size());
+		buffer_history_row(energy_history_data, "/energy_history", energy_history_buffer, energy_history, index);
 	}
 	catch (H5::Exception& e) {
 		e.printError();
@@ -320,14 +594,10 @@ void Datafile::write_energy_history(std::vector<std::vector<double> > energy_his
 		write_energy_history(energy_history[n], n);
 }
 
-void Datafile::write_energies(std::vector<double> energies) {
-	const hsize_t N = energies.size();
+void Datafile::write_deviation_history(std::vector<double> deviation_history, size_t index) {
 	try {
-		ensure_energies_data();
-		space_1d.setExtentSimple(1, &N);
-		space_1d.selectAll();
-		energies_data.extend(&N);
-		energies_data.write(&energies.front(), double_type, space_1d, space_1d);
+		ensure_deviation_history_data(deviation_history.size());
+		buffer_history_row(deviation_history_data, "/deviation_history", deviation_history_buffer, deviation_history, index);
 	}
 	catch (H5::Exception& e) {
 		e.printError();
@@ -335,32 +605,74 @@ void Datafile::write_energies(std::vector<double> energies) {
 	}
 }
 
-void Datafile::write_deviation_history(std::vector<double> deviation_history, size_t index) {
+void Datafile::write_deviation_history(std::vector<std::vector<double> > deviation_history) {
 	const hsize_t N = deviation_history.size();
-	const hsize_t min_size[2] = {index+1, N};
-	const hsize_t count[2] = {1, N};
-	const hsize_t start[2] = {index, 0};
+	for (size_t n=0; n<N; n++)
+		write_deviation_history(deviation_history[n], n);
+}
+
+// Rows are collected in the buffer as long as they are consecutive and of the
+// same length, and written once a whole batch has been collected
+void Datafile::buffer_history_row(H5::DataSet& dataset, const char* name, HistoryBuffer& buffer,
+		std::vector<double> const& row, size_t index) {
+	if (buffer.rows > 0 and (index != buffer.first + buffer.rows or row.size() != buffer.width))
+		write_history_buffer(dataset, name, buffer);
+	if (buffer.rows == 0) {
+		buffer.first = index;
+		buffer.width = row.size();
+	}
+	buffer.values.insert(buffer.values.end(), row.begin(), row.end());
+	buffer.rows++;
+	if (buffer.rows >= history_batch_size)
+		write_history_buffer(dataset, name, buffer);
+}
+
+void Datafile::write_history_buffer(H5::DataSet& dataset, const char* name, HistoryBuffer& buffer) {
+	if (buffer.rows == 0)
+		return;
+	const hsize_t count[2] = {buffer.rows, buffer.width};
+	const hsize_t start[2] = {buffer.first, 0};
+	// DataSet::extend can also shrink the dataset, so never make it smaller
+	hsize_t new_size[2];
+	dataset.getSpace().getSimpleExtentDims(new_size);
+	new_size[0] = std::max(new_size[0], static_cast<hsize_t>(buffer.first + buffer.rows));
+	new_size[1] = std::max(new_size[1], static_cast<hsize_t>(buffer.width));
+	dataset.extend(new_size);
+	H5::DataSpace filespace = dataset.getSpace();
+	filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+	validate_selection(filespace);
+	H5::DataSpace memspace(2, count);
+	write_filtered(dataset, name, &buffer.values[0], double_type, memspace, filespace);
+	buffer.values.clear();
+	buffer.rows = 0;
+}
+
+void Datafile::flush_history() {
 	try {
-		ensure_deviation_history_data();
-		deviation_history_data.extend(min_size);
-		space_2d.setExtentSimple(2, min_size);
-		space_2d.selectHyperslab(H5S_SELECT_SET, count, start);
-		validate_selection(space_2d);
-		space_1d.setExtentSimple(1, &N);
-		space_1d.selectAll();
-		deviation_history_data.write(&(deviation_history.front()), double_type,
-				space_1d, space_2d);
+		write_history_buffer(energy_history_data, "/energy_history", energy_history_buffer);
+		write_history_buffer(deviation_history_data, "/deviation_history", deviation_history_buffer);
 	}
 	catch (H5::Exception& e) {
 		e.printError();
 		throw;
 	}
+	write_time_step_history_buffer();
+	write_telemetry_buffer();
 }
 
-void Datafile::write_deviation_history(std::vector<std::vector<double> > deviation_history) {
-	const hsize_t N = deviation_history.size();
-	for (size_t n=0; n<N; n++)
-		write_deviation_history(deviation_history[n], n);
+void Datafile::write_energies(std::vector<double> energies) {
+	const hsize_t N = energies.size();
+	try {
+		ensure_energies_data();
+		space_1d.setExtentSimple(1, &N);
+		space_1d.selectAll();
+		energies_data.extend(&N);
+		write_filtered(energies_data, "/final_energies", &energies.front(), double_type, space_1d, space_1d);
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
 }
 
 void Datafile::write_energy_standard_deviations(std::vector<double> standard_deviations) {
@@ -370,7 +682,7 @@ void Datafile::write_energy_standard_deviations(std::vector<double> standard_dev
 		space_1d.setExtentSimple(1, &N);
 		space_1d.selectAll();
 		energy_standard_deviations_data.extend(&N);
-		energy_standard_deviations_data.write(&standard_deviations.front(), double_type, space_1d, space_1d);
+		write_filtered(energy_standard_deviations_data, "/final_energy_standard_deviations", &standard_deviations.front(), double_type, space_1d, space_1d);
 	}
 	catch (H5::Exception& e) {
 		e.printError();
@@ -383,7 +695,7 @@ void Datafile::write_potential(Potential const& pot) {
 		return;	// Potential is zero so we have nothing to write.
 	try {
 		ensure_potential_data();
-		potential_data.write(pot.get_valueptr(), *potential_type, scalar_space, scalar_space);
+		write_filtered(potential_data, "/potential_values", pot.get_valueptr(), *potential_type, scalar_space, scalar_space);
 	}
 	catch(H5::Exception& e) {
 		e.printError();
@@ -401,7 +713,7 @@ void Datafile::write_noise_realization(Noise const& noise) {
 		space_1d.setExtentSimple(1, &N);
 		space_1d.selectAll();
 		noise_data.extend(&N);
-		noise_data.write(&vec.front(), double_type, space_1d, space_1d);
+		write_filtered(noise_data, "/noise_data", &vec.front(), double_type, space_1d, space_1d);
 	}
 	catch (H5::Exception& e) {
 		e.printError();
@@ -413,6 +725,85 @@ void Datafile::write_noise_realization(Noise const& noise) {
  * The attibute adding functions are just decorated overloaded wrappers over createAttribute.
  */
 
+void Datafile::write_values(const char* name, std::vector<double> const& values, std::string const& description) {
+	write_values(name, values.empty()? NULL : &values[0], values.size(), double_type, description);
+}
+
+void Datafile::write_values(const char* name, std::vector<int> const& values, std::string const& description) {
+	write_values(name, values.empty()? NULL : &values[0], values.size(), int_type, description);
+}
+
+// Rows of equal length are written as a two-dimensional dataset
+void Datafile::write_values(const char* name, std::vector<std::vector<double> > const& values, std::string const& description) {
+	const hsize_t dims[2] = {values.size(), values.empty()? 0 : values.front().size()};
+	std::vector<double> buffer;
+	buffer.reserve(dims[0]*dims[1]);
+	for (size_t i=0; i<values.size(); i++) {
+		assert(values[i].size() == dims[1]);
+		buffer.insert(buffer.end(), values[i].begin(), values[i].end());
+	}
+	try {
+		H5::DataSpace space(2, dims);
+		H5::DataSet dataset = hfile.createDataSet(name, double_type, space);
+		add_description(dataset, description);
+		if (not buffer.empty())
+			dataset.write(&buffer[0], double_type);
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
+void Datafile::write_values(const char* name, const void* values, hsize_t num, H5::DataType const& type,
+		std::string const& description) {
+	try {
+		H5::DataSpace space(1, &num);
+		H5::DataSet dataset = hfile.createDataSet(name, type, space);
+		add_description(dataset, description);
+		if (num > 0)
+			dataset.write(values, type);
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
+void Datafile::create_group(const char* name) {
+	try {
+		hfile.createGroup(name);
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
+void Datafile::add_group_attribute(const char* group, const char* name, int value) {
+	add_group_attribute(group, name, int_type, &value);
+}
+
+void Datafile::add_group_attribute(const char* group, const char* name, unsigned long int value) {
+	add_group_attribute(group, name, H5::PredType::NATIVE_ULONG, &value);
+}
+
+void Datafile::add_group_attribute(const char* group, const char* name, double value) {
+	add_group_attribute(group, name, double_type, &value);
+}
+
+void Datafile::add_group_attribute(const char* group, const char* name, H5::DataType const& type, const void* value) {
+	try {
+		H5::Group g = hfile.openGroup(group);
+		H5::Attribute attr = g.createAttribute(name, type, scalar_space);
+		attr.write(type, value);
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
 void Datafile::add_attribute(const char* name, double value) {
 	try {
 		H5::Attribute attr = root_group.createAttribute(name, double_type, scalar_space);
@@ -465,3 +856,39 @@ void Datafile::add_attribute(const char* name, std::string const& value) {
 		throw;
 	}
 }
+
+/*
+ * Statistics of the data written are stored as attributes of each dataset.
+ */
+
+void Datafile::write_statistics() {
+	try {
+		for (std::map<std::string, DatasetStatistics>::iterator it = statistics.begin(); it != statistics.end(); ++it) {
+			H5::DataSet dataset = root_group.openDataSet(it->first);
+			const unsigned long int bytes_stored = static_cast<unsigned long int>(dataset.getStorageSize());
+			const double compression_time = it->second.compression_timer.get_time();
+			H5::Attribute attr = dataset.createAttribute("bytes_written", H5::PredType::NATIVE_ULONG, scalar_space);
+			attr.write(H5::PredType::NATIVE_ULONG, &it->second.bytes_written);
+			attr = dataset.createAttribute("bytes_stored", H5::PredType::NATIVE_ULONG, scalar_space);
+			attr.write(H5::PredType::NATIVE_ULONG, &bytes_stored);
+			attr = dataset.createAttribute("compression_time", double_type, scalar_space);
+			attr.write(double_type, &compression_time);
+		}
+	}
+	catch (H5::Exception& e) {
+		e.printError();
+		throw;
+	}
+}
+
+void Datafile::print_statistics(std::ostream& stream) {
+	const double MB = 1024.0*1024.0;
+	stream << "Data written:" << std::endl;
+	for (std::map<std::string, DatasetStatistics>::iterator it = statistics.begin(); it != statistics.end(); ++it) {
+		const double bytes_stored = static_cast<double>(root_group.openDataSet(it->first).getStorageSize());
+		stream << "	" << std::left << std::setw(34) << it->first << std::right << std::fixed
+			<< std::setprecision(3) << std::setw(10) << static_cast<double>(it->second.bytes_written)/MB << " MB, "
+			<< std::setw(10) << bytes_stored/MB << " MB stored, "
+			<< it->second.compression_timer.get_time() << " s compressing" << std::endl;
+	}
+}
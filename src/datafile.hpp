@@ -28,10 +28,14 @@
 #include <string>
 #include <iostream>
 #include <list>
+#include <map>
 #include <vector>
 #include "H5Cpp.h"
 #include "itp2d_common.hpp"
+#include "compression.hpp"
+#include "timer.hpp"
 #include "stateset.hpp"
+#include "statearray.hpp"
 #include "state.hpp"
 #include "datalayout.hpp"
 #include "potential.hpp"
@@ -41,16 +45,54 @@ class Datafile {
 	static const hsize_t unlimited_dims[2];
 	static const hsize_t ones[2];
 	static const hsize_t zeroes[2];
+	// Size of the buffer used for reordering states before writing them
+	static const size_t gather_buffer_size;
+	// Number of history rows buffered before writing them to the file. This
+	// is also the number of rows in each chunk of the history datasets.
+	static const size_t history_batch_size;
 	public:
 		// std::pair would be nicer, but unfortunately we need to do this the C way for HDF5.
 		struct state_history_pair { int step; int index; };
 		struct time_step_history_pair { int step; double time_step; };
-		Datafile(std::string filename, DataLayout const& dl, bool clobber = false);
+		// One row of the per-step telemetry. The times are the wall times
+		// spent in each phase during the step. bytes_written is the total
+		// amount of data written to the file so far, and is filled in by
+		// write_telemetry().
+		struct telemetry_row {
+			int step;
+			int num_converged;
+			int num_timestep_converged;
+			double wall_time;
+			double propagation_time;
+			double orthonormalization_time;
+			double convtest_time;
+			double io_time;
+			double states_per_second;
+			unsigned long int bytes_written;
+		};
+		// How much data has been written to a dataset, and how long it took to
+		// compress it. For datasets written through the HDF5 filter pipeline
+		// the compression time is the time spent in the write calls.
+		struct DatasetStatistics {
+			DatasetStatistics() : bytes_written(0) {}
+			unsigned long int bytes_written;
+			Timer compression_timer;
+		};
+		// States are stored states_chunk_size at a time in chunks, and all
+		// datasets are compressed with the given filter and compression level.
+		// States are compressed in parallel and written to the file directly.
+		// With SinglePrecision the states are converted to single precision
+		// before compressing them.
+		Datafile(std::string filename, DataLayout const& dl, bool clobber = false,
+				size_t states_chunk_size = 1, CompressionFilter filter = DeflateCompression, int compression_level = 9,
+				StatePrecision precision = DoublePrecision);
 		~Datafile();
 		// functions for writing States, StateSets and such into the file
 		void write_state(size_t n, size_t m, State const& state);
 		void write_stateset(StateSet const& stateset, int step, std::list<size_t> const* sort_order = NULL);
+		void write_stateset(StateArray const& states, int step);	// Write states in their order in the array
 		void write_time_step_history(size_t index, double eps);
+		void write_telemetry(telemetry_row row);
 		void write_energy_history(std::vector<double> energy_history, size_t index);
 		void write_energy_history(std::vector<std::vector<double> > energy_history);
 		void write_deviation_history(std::vector<double> energy_history, size_t index);
@@ -59,17 +101,58 @@ class Datafile {
 		void write_energy_standard_deviations(std::vector<double> standard_deviations);
 		void write_potential(Potential const& pot);
 		void write_noise_realization(Noise const& noise);
+		// functions for writing small arrays of values uncompressed and in one
+		// go. These are used for the extra data stored in checkpoints.
+		void write_values(const char* name, std::vector<double> const& values, std::string const& description);
+		void write_values(const char* name, std::vector<int> const& values, std::string const& description);
+		void write_values(const char* name, std::vector<std::vector<double> > const& values, std::string const& description);
+		// Groups collect the datasets of one part of a larger run, such as
+		// one realization of an ensemble. The write_values functions accept
+		// full paths such as /group/name for writing into a group.
+		void create_group(const char* name);
+		void add_group_attribute(const char* group, const char* name, int value);
+		void add_group_attribute(const char* group, const char* name, unsigned long int value);
+		void add_group_attribute(const char* group, const char* name, double value);
+		// The history datasets are written in batches. This writes all rows
+		// that are still waiting in the buffers.
+		void flush_history();
 		// functions for adding attributes describing the simulation
 		void add_attribute(const char* name, int value);
 		void add_attribute(const char* name, unsigned long int value);
 		void add_attribute(const char* name, double value);
 		void add_attribute(const char* name, const char* value);
 		void add_attribute(const char* name, std::string const& value);
-		inline void flush() { hfile.flush(H5F_SCOPE_GLOBAL); }
+		// functions for reporting the amount of data written and the time
+		// used to compress it
+		void write_statistics();	// Store the statistics as attributes of each dataset
+		void print_statistics(std::ostream& stream);
+		inline void flush() { flush_history(); hfile.flush(H5F_SCOPE_GLOBAL); }
                 bool is_open() const;
 	private:
+		// Rows of a two-dimensional history dataset waiting to be written
+		struct HistoryBuffer {
+			HistoryBuffer() : first(0), rows(0), width(0) {}
+			std::vector<double> values;
+			size_t first;	// Index of the first buffered row in the dataset
+			size_t rows;
+			size_t width;
+		};
                 bool dataset_exists(const std::string name) const;
 		static inline void validate_selection(H5::DataSpace const& dataspace);
+		hsize_t new_states_slot(int step, size_t N);
+		void write_states(hsize_t slot, size_t first, size_t num, comp const* ptr);
+		void write_stored_states(hsize_t slot, size_t first, size_t num, const void* ptr);
+		void write_filtered(H5::DataSet& dataset, const char* name, const void* buf, H5::DataType const& type,
+				H5::DataSpace const& memspace, H5::DataSpace const& filespace);
+		size_t states_per_gather() const;
+		void buffer_history_row(H5::DataSet& dataset, const char* name, HistoryBuffer& buffer,
+				std::vector<double> const& row, size_t index);
+		void write_history_buffer(H5::DataSet& dataset, const char* name, HistoryBuffer& buffer);
+		void write_time_step_history_buffer();
+		void write_telemetry_buffer();
+		void write_values(const char* name, const void* values, hsize_t num, H5::DataType const& type,
+				std::string const& description);
+		void add_group_attribute(const char* group, const char* name, H5::DataType const& type, const void* value);
 		// template for adding a string as a HDF5 Attribute in order to provide
 		// documentation for DataSets and other HDF5 objects
 		template <typename Type> void add_description(Type& obj, std::string const& value);
@@ -77,22 +160,35 @@ class Datafile {
 		void ensure_state_history_data();
 		void ensure_energies_data();
 		void ensure_time_step_history_data();
-		void ensure_energy_history_data();
+		void ensure_telemetry_data();
+		void ensure_energy_history_data(size_t N);
 		void ensure_energy_standard_deviations_data();
-		void ensure_deviation_history_data();
+		void ensure_deviation_history_data(size_t N);
 		void ensure_potential_data();
 		void ensure_noise_data();
 		DataLayout const& datalayout;
+		size_t states_chunk_size;
+		const CompressionFilter compression_filter;
+		const StatePrecision state_precision;
+		size_t state_size;	// Size of a state in the file, in bytes
+		ChunkCompressor* states_compressor;
+		std::map<std::string, DatasetStatistics> statistics;
+		HistoryBuffer energy_history_buffer;
+		HistoryBuffer deviation_history_buffer;
+		std::vector<time_step_history_pair> time_step_history_buffer;
+		std::vector<telemetry_row> telemetry_buffer;
 		H5::H5File hfile;
 		H5::Group root_group;
 		// Datatypes
 		H5::DataType const& double_type;
 		H5::DataType const& int_type;
 		H5::CompType complex_type;
+		H5::CompType complex_float_type;
 		H5::CompType state_history_type;
 		H5::CompType time_step_history_type;
-		H5::ArrayType* state_type;		// H5::ArrayType has a protected default
-		H5::ArrayType* potential_type;	// constructor, so we need to do this stupid trick.
+		H5::CompType telemetry_type;
+		H5::CompType state_type;		// Type of a single grid point of a state
+		H5::ArrayType* potential_type;	// H5::ArrayType has a protected default constructor, so we need to do this stupid trick.
 		// Dataspaces
 		const H5::DataSpace scalar_space;
 		const H5::DataSpace null_space_1d;
@@ -104,6 +200,7 @@ class Datafile {
 		H5::DataSet state_history_data;
 		H5::DataSet energies_data;
 		H5::DataSet time_step_history_data;
+		H5::DataSet telemetry_data;
 		H5::DataSet energy_history_data;
 		H5::DataSet energy_standard_deviations_data;
 		H5::DataSet deviation_history_data;
@@ -114,6 +211,7 @@ class Datafile {
 		H5::DSetCreatPropList state_history_props;
 		H5::DSetCreatPropList energies_dset_props;
 		H5::DSetCreatPropList time_step_history_props;
+		H5::DSetCreatPropList telemetry_props;
 		H5::DSetCreatPropList energy_history_props;
 		H5::DSetCreatPropList potential_dset_props;
 		H5::DSetCreatPropList noise_dset_props;
@@ -61,6 +61,7 @@ class EigenSolver {
 		inline comp const& eigenvector(comp const* input_matrix, size_t n, size_t i) const { return input_matrix[n*size+i]; } // i:th element of n:th eigenvector
 		inline void scale_eigenvector(comp* input_matrix, size_t n, double value) const;
 		inline double const& eigenvalue(size_t n) const { return evals[n]; }
+		inline size_t get_memory() const; // Memory used by the workspace, in bytes
 		inline void solve(comp* input_matrix); // Note: Input data must be specified in column-major (FORTRAN) order! Also note that this destroys the matrix.
 	private:
 		const int size;
@@ -73,6 +74,11 @@ class EigenSolver {
 		static char UpperOrLower[2];
 };
 
+inline size_t EigenSolver::get_memory() const {
+	const size_t N = static_cast<size_t>(size);
+	return static_cast<size_t>(lwork_size)*sizeof(comp) + (4*N-2)*sizeof(double);
+}
+
 inline void EigenSolver::scale_eigenvector(comp* input_matrix, size_t n, double value) const {
 	cblas_zdscal(size, value, reinterpret_cast<double*>(input_matrix+n*size), 1);
 }
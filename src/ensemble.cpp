@@ -0,0 +1,215 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ensemble.hpp"
+
+Ensemble::Ensemble(Parameters const& given_params,
+		volatile sig_atomic_t* arg_abort_flagptr,
+		std::ostream& arg_out, std::ostream& arg_err) :
+		params(given_params),
+		abort_flagptr(arg_abort_flagptr),
+		out(arg_out), err(arg_err),
+		operators(params),
+		num_concurrent(std::max(static_cast<size_t>(1), std::min(params.get_ensemble_size(),
+						params.get_num_threads()/params.get_ensemble_threads()))),
+		error_flag(false),
+		num_converged(params.get_ensemble_size(), 0),
+		steps(params.get_ensemble_size(), 0),
+		member_error_flags(params.get_ensemble_size(), 0),
+		final_energies(params.get_ensemble_size(), std::vector<double>(params.get_N(), NaN)),
+		final_deviations(params.get_ensemble_size(), std::vector<double>(params.get_N(), NaN)) {
+	if (not params.is_ensemble())
+		throw GeneralError("Ensemble created with parameters that do not define an ensemble.");
+	if (params.is_sweep() or params.get_cascade_levels() > 1 or not params.get_checkpoint_file().empty())
+		throw GeneralError("Parameter sweeps, cascades and checkpoints cannot be used with an ensemble.");
+	if (params.get_save_what() != Parameters::Nothing) {
+		datafile = new Datafile(params.get_datafile_name(), operators.datalayout, params.get_clobber(),
+				params.get_states_chunk_size(), params.get_compression_filter(), params.get_compression_level(),
+				params.get_state_precision());
+		datafile->add_attribute("program_version", version_string);
+		datafile->add_attribute("random_seed", params.get_random_seed());
+		datafile->add_attribute("ensemble_size", static_cast<int>(params.get_ensemble_size()));
+		datafile->add_attribute("ensemble_threads", static_cast<int>(params.get_ensemble_threads()));
+		datafile->add_attribute("num_threads", params.get_num_threads());
+		datafile->add_attribute("num_states", static_cast<int>(params.get_N()));
+		datafile->add_attribute("num_wanted_to_converge", static_cast<int>(params.get_needed_to_converge()));
+		datafile->add_attribute("ignore_lowest", static_cast<int>(params.get_ignore_lowest()));
+		datafile->add_attribute("grid_length", params.get_lenx());
+		datafile->add_attribute("grid_boundary_type", (params.get_boundary_type() == Periodic)? "periodic" : "dirichlet");
+		datafile->add_attribute("operator_splitting_order", 2*params.get_halforder());
+		datafile->add_attribute("potential", params.get_potential_type(0));
+		datafile->add_attribute("noise", params.get_noise_type());
+		datafile->add_attribute("impurity_type", params.get_impurity_type());
+		datafile->add_attribute("impurity_distribution", params.get_impurity_distribution());
+		datafile->add_attribute("impurity_constraint", params.get_impurity_constraint());
+		datafile->add_attribute("timestep_convergence_test", params.get_timestep_convergence_test().get_description());
+		datafile->add_attribute("final_convergence_test", params.get_final_convergence_test().get_description());
+		datafile->add_attribute("magnetic_field_strength", params.get_B(0));
+		datafile->create_group("/realizations");
+	}
+	else
+		datafile = NULL;
+}
+
+Ensemble::~Ensemble() {
+	delete datafile;
+}
+
+// Each realization is a normal system that saves nothing and prints nothing,
+// since the ensemble collects its results and reports its progress.
+Parameters Ensemble::member_parameters(size_t index) const {
+	Parameters member_params(params);
+	member_params.set_ensemble(0);
+	member_params.set_random_seed(params.get_random_seed() + index);
+	member_params.set_num_threads(static_cast<int>(params.get_ensemble_threads()));
+	member_params.set_pin_threads(false);
+	member_params.set_async_io(false);
+	member_params.set_verbosity(0);
+	member_params.define_data_storage(params.get_datafile_name(), Parameters::Nothing);
+	return member_params;
+}
+
+// The realizations are divided among num_concurrent threads, each of which
+// runs its realizations with a nested team of ensemble_threads threads.
+void Ensemble::run() {
+	total_timer.start();
+	if (verb(1))
+		print_initial_message();
+	const int old_max_active_levels = omp_get_max_active_levels();
+	omp_set_max_active_levels(2);
+	const int size = static_cast<int>(params.get_ensemble_size());
+	#pragma omp parallel for schedule(dynamic) num_threads(static_cast<int>(num_concurrent))
+	for (int i=0; i<size; i++) {
+		if (abort_flagptr == NULL or not *abort_flagptr)
+			run_member(static_cast<size_t>(i));
+	}
+	omp_set_max_active_levels(old_max_active_levels);
+	total_timer.stop();
+	if (datafile != NULL) {
+		datafile->add_attribute("error_flag", error_flag);
+		datafile->add_attribute("total_time", total_timer.get_time());
+		datafile->flush();
+	}
+	if (verb(1))
+		print_final_message();
+}
+
+// Setting up and tearing down a system is done one at a time, since it may
+// involve creating FFTW plans or reading HDF5 files, neither of which is
+// thread-safe. For the same reason the results are written one at a time.
+// Exceptions must not leave the critical sections, so they are caught inside
+// them and reported afterwards.
+void Ensemble::run_member(size_t index) {
+	ITPSystem* sys = NULL;
+	std::string error_message;
+	#pragma omp critical(ensemble_serial)
+	{
+		try {
+			sys = new ITPSystem(member_parameters(index), abort_flagptr, NULL, out, err, &operators);
+		}
+		catch (std::exception& e) {
+			error_message = e.what();
+		}
+	}
+	if (sys != NULL) {
+		try {
+			while (not sys->is_finished())
+				sys->step();
+		}
+		catch (std::exception& e) {
+			error_message = e.what();
+		}
+	}
+	#pragma omp critical(ensemble_serial)
+	{
+		try {
+			if (error_message.empty()) {
+				record_member(index, *sys);
+				if (datafile != NULL)
+					write_member(index, *sys);
+				if (verb(1))
+					print_member_message(index);
+			}
+		}
+		catch (std::exception& e) {
+			error_message = e.what();
+		}
+		if (not error_message.empty()) {
+			err << "Error in realization " << index << " of the ensemble:" << std::endl
+				<< error_message << std::endl;
+			member_error_flags[index] = 1;
+			error_flag = true;
+		}
+		delete sys;
+	}
+}
+
+void Ensemble::record_member(size_t index, ITPSystem const& sys) {
+	num_converged[index] = static_cast<int>(sys.get_states().get_num_finally_converged());
+	steps[index] = sys.get_total_step_counter();
+	member_error_flags[index] = sys.get_error_flag();
+	if (sys.get_error_flag())
+		error_flag = true;
+	if (not sys.get_energies().empty()) {
+		final_energies[index] = sys.get_energies().back();
+		final_deviations[index] = sys.get_standard_deviations().back();
+	}
+}
+
+void Ensemble::write_member(size_t index, ITPSystem const& sys) {
+	std::ostringstream group;
+	group << "/realizations/" << index;
+	datafile->create_group(group.str().c_str());
+	const std::string prefix = group.str() + "/";
+	datafile->add_group_attribute(group.str().c_str(), "random_seed", sys.params.get_random_seed());
+	datafile->add_group_attribute(group.str().c_str(), "num_converged", num_converged[index]);
+	datafile->add_group_attribute(group.str().c_str(), "total_steps_done", steps[index]);
+	datafile->add_group_attribute(group.str().c_str(), "error_flag", member_error_flags[index]);
+	datafile->write_values((prefix + "final_energies").c_str(), final_energies[index],
+			"Final energies of the realization, in increasing order.");
+	datafile->write_values((prefix + "final_energy_standard_deviations").c_str(), final_deviations[index],
+			"Standard deviations of the final energies.");
+	std::vector<double> noise_data;
+	sys.get_noise().write_realization_data(noise_data);
+	datafile->write_values((prefix + "noise_data").c_str(), noise_data,
+			"Data describing the noise realization, as in /noise_data of a normal datafile.");
+}
+
+void Ensemble::print_initial_message() {
+	out << "Running an ensemble of " << params.get_ensemble_size() << " realizations, "
+		<< num_concurrent << " at a time with " << params.get_ensemble_threads() << " threads each." << std::endl
+		<< "\tpotential: " << params.get_potential_type(0) << std::endl
+		<< "\tnoise: " << params.get_noise_type() << std::endl
+		<< "\tgrid: " << params.get_sizex() << "x" << params.get_sizey() << " of length " << params.get_lenx() << std::endl
+		<< "\trandom seeds: " << params.get_random_seed() << " to "
+		<< params.get_random_seed() + params.get_ensemble_size() - 1 << std::endl;
+}
+
+void Ensemble::print_member_message(size_t index) {
+	out << "Realization " << index << " finished after " << steps[index] << " steps, "
+		<< num_converged[index] << " states converged, lowest energy "
+		<< std::fixed << std::setprecision(6) << final_energies[index].front() << std::endl;
+}
+
+void Ensemble::print_final_message() {
+	const double total_time = total_timer.get_time();
+	out << "Ensemble finished. Total time " << std::fixed << std::setprecision(3) << total_time << " s, "
+		<< static_cast<double>(params.get_ensemble_size())/total_time << " realizations per second." << std::endl;
+	if (error_flag)
+		out << "Some realizations failed to converge." << std::endl;
+}
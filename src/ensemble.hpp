@@ -0,0 +1,99 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A class for running an ensemble of independent realizations of the same
+ * system, which differ only by their random seed, for example for averaging
+ * over different realizations of impurity noise. A small system does not have
+ * enough work to keep many threads busy, so instead of running the
+ * realizations one after another with all threads, several of them are run at
+ * the same time with a few threads each. The realizations share the grid, the
+ * FFTW plans, the kinetic energy operator and the tables of its exponential.
+ *
+ * The final energies of each realization are saved in group /realizations/K
+ * of the datafile, K being the index of the realization, together with its
+ * noise realization. States are not saved.
+ */
+
+#ifndef _ENSEMBLE_HPP_
+#define _ENSEMBLE_HPP_
+
+#include <string>
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <csignal>
+
+#include <omp.h>
+
+#include "itp2d_common.hpp"
+#include "exceptions.hpp"
+#include "parameters.hpp"
+#include "datafile.hpp"
+#include "timer.hpp"
+#include "itpsystem.hpp"
+
+class Ensemble {
+	public:
+		Ensemble(Parameters const& params,
+				volatile sig_atomic_t* abort_flagptr = NULL,
+				std::ostream& out = std::cout,
+				std::ostream& err = std::cerr);
+		~Ensemble();
+		// Run all realizations
+		void run();
+		// Parameters of the realization with the given index. Its random seed
+		// is the seed in params plus the index.
+		Parameters member_parameters(size_t index) const;
+		// Getters
+		inline size_t get_size() const { return params.get_ensemble_size(); }
+		inline size_t get_num_concurrent() const { return num_concurrent; }
+		inline bool get_error_flag() const { return error_flag; }
+		inline std::vector<int> const& get_num_converged() const { return num_converged; }
+		inline std::vector<int> const& get_steps() const { return steps; }
+		inline std::vector<std::vector<double> > const& get_final_energies() const { return final_energies; }
+		inline std::vector<std::vector<double> > const& get_final_standard_deviations() const { return final_deviations; }
+		inline double get_total_time() { return total_timer.get_time(); }
+		const Parameters params;
+	private:
+		void run_member(size_t index);
+		void record_member(size_t index, ITPSystem const& sys);
+		void write_member(size_t index, ITPSystem const& sys);
+		void print_initial_message();
+		void print_member_message(size_t index);
+		void print_final_message();
+		inline bool verb(int level) const { return (params.get_verbosity() >= level)? true : false; }
+		volatile sig_atomic_t* abort_flagptr;
+		std::ostream& out;
+		std::ostream& err;
+		const SharedOperators operators;
+		const size_t num_concurrent;	// How many realizations run at the same time
+		bool error_flag;
+		Timer total_timer;
+		Datafile* datafile;
+		// Results of each realization
+		std::vector<int> num_converged;
+		std::vector<int> steps;
+		std::vector<int> member_error_flags;
+		std::vector<std::vector<double> > final_energies;
+		std::vector<std::vector<double> > final_deviations;
+};
+
+#endif // _ENSEMBLE_HPP_
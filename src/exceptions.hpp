@@ -124,6 +124,15 @@ class ParseError : public std::runtime_error {
 		}
 };
 
+class InvalidExpression : public std::runtime_error {
+	public:
+		InvalidExpression(std::string str, size_t pos, std::string reason) : std::runtime_error("") {
+			std::stringstream ss;
+			ss << "Expression \"" << str << "\" could not be parsed at position " << pos+1 << ": " << reason << ".";
+			static_cast<std::runtime_error&>(*this) = std::runtime_error(ss.str());
+		}
+};
+
 class UnknownPotentialType : public std::runtime_error {
 	public:
 		UnknownPotentialType(std::string str) : std::runtime_error("") {
@@ -188,6 +197,15 @@ class InvalidPotentialType : public std::runtime_error {
 		}
 };
 
+class InvalidSweep : public std::runtime_error {
+	public:
+		InvalidSweep(std::string str, std::string reason) : std::runtime_error("") {
+			std::stringstream ss;
+			ss << "Invalid parameter sweep \"" << str << "\": " << reason << ".";
+			static_cast<std::runtime_error&>(*this) = std::runtime_error(ss.str());
+		}
+};
+
 class InvalidImpurityType : public std::runtime_error {
 	public:
 		InvalidImpurityType(std::string str) : std::runtime_error("") {
@@ -253,4 +271,22 @@ class InvalidNumberOfStates : public std::runtime_error {
 		}
 };
 
+class ScratchFileError : public std::runtime_error {
+	public:
+		ScratchFileError(std::string filename, std::string reason) : std::runtime_error("") {
+			std::stringstream ss;
+			ss << "Cannot use scratch file " << filename << ": " << reason << ".";
+			static_cast<std::runtime_error&>(*this) = std::runtime_error(ss.str());
+		}
+};
+
+class TabulatedPotentialError : public std::runtime_error {
+	public:
+		TabulatedPotentialError(std::string filename, std::string reason) : std::runtime_error("") {
+			std::stringstream ss;
+			ss << "Cannot read tabulated potential from " << filename << ": " << reason << ".";
+			static_cast<std::runtime_error&>(*this) = std::runtime_error(ss.str());
+		}
+};
+
 #endif // _EXCEPTIONS_HPP_
@@ -30,44 +30,21 @@ std::ostream& ExpKinetic::print(std::ostream& stream) const {
 	return stream << prefactor << "·exp(" << time_step*coefficient << "·T)";
 }
 
-ExpKinetic::ExpKinetic(double e, double B_, Transformer const& tr, BoundaryType bt,
-				double c, double p) :
-		transformer(tr),
-		datalayout(transformer.datalayout),
-		boundary_type(bt),
-		B(B_),
-		coefficient(c),
-		prefactor(p),
-		time_step(e),
+ExpKineticTables::ExpKineticTables(double time_step, double B, Transformer const& tr, BoundaryType boundary_type,
+				double coefficient, double prefactor) :
 		multipliers(NULL),
 		xmultipliers(NULL),
 		xmultipliers2(NULL),
 		ymultipliers(NULL) {
+	DataLayout const& datalayout = tr.datalayout;
+	// The rows of the tables are independent, so they are computed in
+	// parallel
 	if (B == 0) {
 		multipliers = new double[datalayout.N];
-	}
-	else {
-		xmultipliers = new double[datalayout.N];
-		if (boundary_type == Dirichlet)
-			xmultipliers2 = new double[datalayout.N];
-		ymultipliers = new double[datalayout.sizey];
-	}
-	calculate_multipliers();
-}
-
-ExpKinetic::~ExpKinetic() {
-	delete[] multipliers;
-	delete[] xmultipliers;
-	delete[] xmultipliers2;
-	delete[] ymultipliers;
-}
-
-void ExpKinetic::calculate_multipliers() {
-	Transformer const& tr = transformer;
-	if (B == 0) {
 		const double normfac = tr.normalization_factor(boundary_type);
 		const double A = coefficient*time_step*0.5;
 		const double p = prefactor*normfac;
+		#pragma omp parallel for schedule(static)
 		for (size_t y=0; y<datalayout.sizey; y++) {
 			const double ky = tr.ky(y, boundary_type);
 			for (size_t x=0; x<datalayout.sizex; x++) {
@@ -77,6 +54,10 @@ void ExpKinetic::calculate_multipliers() {
 		}
 	}
 	else {
+		xmultipliers = new double[datalayout.N];
+		if (boundary_type == Dirichlet)
+			xmultipliers2 = new double[datalayout.N];
+		ymultipliers = new double[datalayout.sizey];
 		// Take into account that for periodic boundary conditions the
 		// multiplication for the x-part of kinetic energy is done twice, so we
 		// need to split the normalization into two
@@ -95,6 +76,7 @@ void ExpKinetic::calculate_multipliers() {
 		const double py = prefactor*normfacy;
 		switch (boundary_type) {
 			case Periodic:
+				#pragma omp parallel for schedule(static)
 				for (size_t y=0; y<datalayout.sizey; y++) {
 					const double ky = tr.ky(y, boundary_type);
 					const double dy = datalayout.get_posy(y);
@@ -117,6 +99,7 @@ void ExpKinetic::calculate_multipliers() {
 				// arithmetic, a series of sines and cosines. This means that
 				// the multiplication needs to be split into two, with separate
 				// multipliers for the sine and cosine parts of the series.
+				#pragma omp parallel for schedule(static)
 				for (size_t y=0; y<datalayout.sizey; y++) {
 					const double ky = tr.ky(y, boundary_type);
 					const double dy = datalayout.get_posy(y);
@@ -135,6 +118,97 @@ void ExpKinetic::calculate_multipliers() {
 	}
 }
 
+ExpKineticTables::~ExpKineticTables() {
+	delete[] multipliers;
+	delete[] xmultipliers;
+	delete[] xmultipliers2;
+	delete[] ymultipliers;
+}
+
+ExpKineticCache::ExpKineticCache(Transformer const& tr) :
+		transformer(tr) {
+}
+
+ExpKineticCache::~ExpKineticCache() {
+	for (table_map::iterator it = tables.begin(); it != tables.end(); ++it)
+		delete it->second.first;
+}
+
+// The constants are compared exactly, as in ExpPotentialCache. All users of
+// the cache are serialized by a critical section. A missing table is computed
+// inside it, but this happens only when the time step changes.
+ExpKineticTables const* ExpKineticCache::acquire(double time_step, double B, BoundaryType bt, double coeff, double prefactor) {
+	const key_type key(time_step, B, static_cast<int>(bt), coeff, prefactor);
+	ExpKineticTables* result;
+	#pragma omp critical(expkinetic_cache)
+	{
+		table_map::iterator it = tables.find(key);
+		if (it != tables.end()) {
+			it->second.second++;
+			result = it->second.first;
+		}
+		else {
+			result = new ExpKineticTables(time_step, B, transformer, bt, coeff, prefactor);
+			tables[key] = std::make_pair(result, static_cast<size_t>(1));
+		}
+	}
+	return result;
+}
+
+void ExpKineticCache::release(double time_step, double B, BoundaryType bt, double coeff, double prefactor) {
+	const key_type key(time_step, B, static_cast<int>(bt), coeff, prefactor);
+	bool found;
+	#pragma omp critical(expkinetic_cache)
+	{
+		table_map::iterator it = tables.find(key);
+		found = (it != tables.end());
+		if (found and --(it->second.second) == 0) {
+			delete it->second.first;
+			tables.erase(it);
+		}
+	}
+	if (not found)
+		throw GeneralError("ExpKineticCache::release() called for a table that does not exist. This should never happen.");
+}
+
+size_t ExpKineticCache::get_num_tables() const {
+	size_t num;
+	#pragma omp critical(expkinetic_cache)
+	num = tables.size();
+	return num;
+}
+
+ExpKinetic::ExpKinetic(double e, double B_, Transformer const& tr, BoundaryType bt,
+				double c, double p, ExpKineticCache* given_cache) :
+		transformer(tr),
+		datalayout(transformer.datalayout),
+		boundary_type(bt),
+		B(B_),
+		coefficient(c),
+		prefactor(p),
+		owned_cache((given_cache == NULL)? new ExpKineticCache(tr) : NULL),
+		cache((given_cache == NULL)? owned_cache : given_cache),
+		time_step(e) {
+	assert(cache->transformer.datalayout == datalayout);
+	tables = cache->acquire(time_step, B, boundary_type, coefficient, prefactor);
+}
+
+ExpKinetic::~ExpKinetic() {
+	cache->release(time_step, B, boundary_type, coefficient, prefactor);
+	delete owned_cache;
+}
+
+// Acquire the new tables before releasing the old ones, so that tables still
+// needed by others are not recomputed
+void ExpKinetic::set_time_step(double e) {
+	if (e == time_step)
+		return;
+	ExpKineticTables const* const new_tables = cache->acquire(e, B, boundary_type, coefficient, prefactor);
+	cache->release(time_step, B, boundary_type, coefficient, prefactor);
+	tables = new_tables;
+	time_step = e;
+}
+
 void ExpKinetic::operate(State& state, StateArray& workspace) const {
 	assert(datalayout == state.datalayout);
 	Transformer const& tr = transformer;
@@ -144,12 +218,12 @@ void ExpKinetic::operate(State& state, StateArray& workspace) const {
 		switch (boundary_type) {
 			case Periodic:
 				state.transform(FFT, tr);
-				state.pointwise_multiply(multipliers);
+				state.pointwise_multiply(tables->multipliers);
 				state.transform(iFFT, tr);
 				break;
 			case Dirichlet:
 				state.transform(DST, tr);
-				state.pointwise_multiply(multipliers);
+				state.pointwise_multiply(tables->multipliers);
 				state.transform(iDST, tr);
 				break;
 		}
@@ -163,11 +237,11 @@ void ExpKinetic::operate(State& state, StateArray& workspace) const {
 				// waves. This case is documented well in the article
 				// referenced in expkinetic.hpp
 				state.transform(FFTx, tr);
-				state.pointwise_multiply(xmultipliers);
+				state.pointwise_multiply(tables->xmultipliers);
 				state.transform(FFTy, tr);
-				state.pointwise_multiply_y(ymultipliers);
+				state.pointwise_multiply_y(tables->ymultipliers);
 				state.transform(iFFTy, tr);
-				state.pointwise_multiply(xmultipliers);
+				state.pointwise_multiply(tables->xmultipliers);
 				state.transform(iFFTx, tr);
 				break;
 			case Dirichlet:
@@ -177,17 +251,17 @@ void ExpKinetic::operate(State& state, StateArray& workspace) const {
 				State& temp = workspace[0];
 				state.transform(DSTx, tr);
 				temp = state;
-				state.pointwise_multiply(xmultipliers);
-				temp.pointwise_multiply_imaginary_shiftx(xmultipliers2);
+				state.pointwise_multiply(tables->xmultipliers);
+				temp.pointwise_multiply_imaginary_shiftx(tables->xmultipliers2);
 				state.transform(iDSTx, tr);
 				temp.transform(iDCTx, tr);
 				state += temp;
 				state.transform(DST, tr);
-				state.pointwise_multiply_y(ymultipliers);
+				state.pointwise_multiply_y(tables->ymultipliers);
 				state.transform(iDSTy, tr);
 				temp = state;
-				state.pointwise_multiply(xmultipliers);
-				temp.pointwise_multiply_imaginary_shiftx(xmultipliers2);
+				state.pointwise_multiply(tables->xmultipliers);
+				temp.pointwise_multiply_imaginary_shiftx(tables->xmultipliers2);
 				state.transform(iDSTx, tr);
 				temp.transform(iDCTx, tr);
 				state += temp;
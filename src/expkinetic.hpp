@@ -19,7 +19,10 @@
 #ifndef _EXPKINETIC_HPP_
 #define _EXPKINETIC_HPP_
 
+#include <map>
+#include <tr1/tuple>
 #include "operators.hpp"
+#include "exceptions.hpp"
 
 // Exponentiated kinetic energy operator for imaginary time propagation.
 //
@@ -29,6 +32,50 @@
 // algorithm in page 200, where this kinetic energy part is steps (3)--(5).
 // The only difference here is that we use linear gauge instead of symmetric gauge.
 
+// The multiplier tables of the operator p·exp(-e·c·T) with magnetic field B.
+// All these multiplier arrays are what the state will be multiplied with after
+// first transforming to a suitable space with FFTs.
+
+class ExpKineticTables {
+	public:
+		ExpKineticTables(double time_step, double B, Transformer const& tr, BoundaryType bt,
+				double coeff, double prefactor);
+		~ExpKineticTables();
+		double* multipliers;
+		double* xmultipliers;
+		double* xmultipliers2;
+		double* ymultipliers;
+	private:
+		// Disallow copying, since the tables are owned
+		ExpKineticTables(ExpKineticTables const&);
+		ExpKineticTables& operator=(ExpKineticTables const&);
+};
+
+// A cache of multiplier tables shared by all kinetic operators with the same
+// constants. The realizations of an ensemble use the same sequence of time
+// steps, so they can share one set of tables. Tables are reference counted
+// and freed when no operator uses them anymore. Unlike ExpPotentialCache,
+// this can be used by several threads at once.
+
+class ExpKineticCache {
+	public:
+		ExpKineticCache(Transformer const& tr);
+		~ExpKineticCache();
+		// Get the tables for the given constants, computing them if no one
+		// else uses them yet
+		ExpKineticTables const* acquire(double time_step, double B, BoundaryType bt, double coeff, double prefactor);
+		void release(double time_step, double B, BoundaryType bt, double coeff, double prefactor);
+		size_t get_num_tables() const;
+		Transformer const& transformer;
+	private:
+		// Disallow copying, since the tables are owned
+		ExpKineticCache(ExpKineticCache const&);
+		ExpKineticCache& operator=(ExpKineticCache const&);
+		typedef std::tr1::tuple<double, double, int, double, double> key_type;
+		typedef std::map<key_type, std::pair<ExpKineticTables*, size_t> > table_map;
+		table_map tables;
+};
+
 class ExpKinetic : public EvolutionOperator {
 	public:
 		// The constructor creates an operator for
@@ -39,14 +86,15 @@ class ExpKinetic : public EvolutionOperator {
 		// 	c is some numerical coefficient, and T is the kinetic energy
 		// 	operator. Argument B specifies the strength of magnetic field. You
 		// 	also need to supply a Transformer instance for doing FFT
-		// 	transformations and a boundary type.
+		// 	transformations and a boundary type. The multiplier tables are
+		// 	taken from the given cache, or from a private one if none is given.
 		ExpKinetic(double time_step, double B, Transformer const& tr, BoundaryType bt,
-				double coeff=-1.0, double prefactor=1.0);
+				double coeff=-1.0, double prefactor=1.0, ExpKineticCache* cache = NULL);
 		~ExpKinetic();
 		void operate(State& state, __attribute__((unused))StateArray& workspace) const;
 		inline size_t required_workspace() const;
 		std::ostream& print(std::ostream& out) const;
-		inline void set_time_step(double e) { time_step = e; calculate_multipliers(); }
+		void set_time_step(double e);
 		Transformer const& transformer;
 		DataLayout const& datalayout;
 		const BoundaryType boundary_type;
@@ -54,14 +102,10 @@ class ExpKinetic : public EvolutionOperator {
 		const double coefficient;
 		const double prefactor;
 	private:
+		ExpKineticCache* owned_cache;
+		ExpKineticCache* const cache;
 		double time_step;
-		// All these multiplier arrays are what the state will be multiplied
-		// with after first transforming to a suitable space with FFTs.
-		double* multipliers;
-		double* xmultipliers;
-		double* xmultipliers2;
-		double* ymultipliers;
-		void calculate_multipliers();
+		ExpKineticTables const* tables;
 };
 
 inline size_t ExpKinetic::required_workspace() const {
@@ -25,24 +25,65 @@ std::ostream& ExpPotential::print(std::ostream& stream) const {
 	return stream;
 }
 
-ExpPotential::ExpPotential(Potential const& pot, double e, double c, double p) :
+ExpPotentialCache::ExpPotentialCache(Potential const& pot) :
+		datalayout(pot.datalayout),
+		original_potential(pot) {
+}
+
+ExpPotentialCache::~ExpPotentialCache() {
+	for (table_map::iterator it = tables.begin(); it != tables.end(); ++it)
+		delete[] it->second.first;
+}
+
+double const* ExpPotentialCache::acquire(double k) {
+	// The exponents are compared exactly. Exponents differing only by
+	// rounding just get separate tables.
+	table_map::iterator it = tables.find(k);
+	if (it != tables.end()) {
+		it->second.second++;
+		return it->second.first;
+	}
+	double* const values = new double[datalayout.N];
+	double const* const potential = original_potential.get_valueptr();
+	// A plain loop over contiguous arrays, so that the compiler can vectorize
+	// it
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<datalayout.N; i++)
+		values[i] = exp(k*potential[i]);
+	tables[k] = std::make_pair(values, static_cast<size_t>(1));
+	return values;
+}
+
+void ExpPotentialCache::release(double k) {
+	table_map::iterator it = tables.find(k);
+	if (it == tables.end())
+		throw GeneralError("ExpPotentialCache::release() called for a table that does not exist. This should never happen.");
+	if (--(it->second.second) == 0) {
+		delete[] it->second.first;
+		tables.erase(it);
+	}
+}
+
+ExpPotential::ExpPotential(Potential const& pot, double e, double c, double p, ExpPotentialCache* given_cache) :
 		datalayout(pot.datalayout),
 		original_potential(pot),
+		owned_cache((given_cache == NULL)? new ExpPotentialCache(pot) : NULL),
+		cache((given_cache == NULL)? owned_cache : given_cache),
 		values(NULL),
+		exponent(0),
 		time_step(e),
 		coefficient(c),
 		prefactor(p),
 		original_name(pot.get_name()),
 		is_trivial(pot.is_null()) {
-	if (not is_trivial) {	// Don't bother calculating an array of ones if the potential is always zero.
-		values = new double[datalayout.N];
-		recalc_potential();
-	}
+	assert(cache->datalayout == datalayout);
+	recalc_potential();
 }
 
 ExpPotential::~ExpPotential() {
-	if (not is_trivial)
-		delete[] values;
+	if (values != NULL)
+		cache->release(exponent);
+	delete owned_cache;
 }
 
 void ExpPotential::set_constants(double e, double c, double p) {
@@ -52,12 +93,20 @@ void ExpPotential::set_constants(double e, double c, double p) {
 	recalc_potential();
 }
 
+// The prefactor is applied when operating, so that operators differing only
+// by it can share the table
 void ExpPotential::recalc_potential() {
+	// Don't bother calculating an array of ones if the potential is always zero.
 	if (is_trivial)
 		return;
-	for (size_t x=0; x<datalayout.sizex; x++) {
-		for (size_t y=0; y<datalayout.sizey; y++) {
-			datalayout.value(values, x, y) =  prefactor*exp(time_step*coefficient * original_potential.get_value(x,y));
-		}
-	}
+	const double new_exponent = time_step*coefficient;
+	if (values != NULL and new_exponent == exponent)
+		return;
+	// Acquire the new table before releasing the old one, so that a table
+	// still needed by others is not recomputed
+	double const* const new_values = cache->acquire(new_exponent);
+	if (values != NULL)
+		cache->release(exponent);
+	values = new_values;
+	exponent = new_exponent;
 }
@@ -19,9 +19,35 @@
 #ifndef _EXPPOTENTIAL_HPP_
 #define _EXPPOTENTIAL_HPP_
 
+#include <map>
 #include "operators.hpp"
 #include "potential.hpp"
 
+// Tables of exp(k·V) for a potential V, shared between the ExpPotential
+// operators that have the same exponent k. The operators of a higher order
+// split often need the same table, for example exp(-e·V) is both the square of
+// the potential part of one member and the half potential part of another.
+// Tables are reference counted and freed when no operator uses them anymore.
+
+class ExpPotentialCache {
+	public:
+		ExpPotentialCache(Potential const& pot);
+		~ExpPotentialCache();
+		// Get the table for exponent k, computing it if no one else uses it yet
+		double const* acquire(double k);
+		void release(double k);
+		inline size_t get_num_tables() const { return tables.size(); }
+		inline size_t get_memory_usage() const { return tables.size()*datalayout.N*sizeof(double); }
+		DataLayout const& datalayout;
+	private:
+		// Disallow copying, since the tables are owned
+		ExpPotentialCache(ExpPotentialCache const&);
+		ExpPotentialCache& operator=(ExpPotentialCache const&);
+		typedef std::map<double, std::pair<double*, size_t> > table_map;
+		Potential const& original_potential;
+		table_map tables;
+};
+
 // Exponentiated potential operator. This is simply a local potential operator with exponentiated values.
 
 class ExpPotential : public EvolutionOperator {
@@ -31,8 +57,10 @@ class ExpPotential : public EvolutionOperator {
 		//		p·exp(c·e·V),
 		//
 		//	where p is the prefactor, c is the coefficient, e is imaginary time
-		//	step and V is the original potential.
-		ExpPotential(Potential const& pot, double time_step, double coefficient=-0.5, double prefactor=1.0);
+		//	step and V is the original potential. The table of exp(c·e·V) is
+		//	taken from the given cache, or from a private one if none is given.
+		ExpPotential(Potential const& pot, double time_step, double coefficient=-0.5, double prefactor=1.0,
+				ExpPotentialCache* cache = NULL);
 		~ExpPotential();
 		std::ostream& print(std::ostream& out) const;
 		inline void operate(State& state, __attribute__((unused))StateArray& workspace) const;
@@ -45,7 +73,10 @@ class ExpPotential : public EvolutionOperator {
 	private:
 		void recalc_potential();
 		Potential const& original_potential;
-		double* values;
+		ExpPotentialCache* owned_cache;
+		ExpPotentialCache* const cache;
+		double const* values;
+		double exponent;
 		double time_step;
 		double coefficient;
 		double prefactor;
@@ -59,6 +90,9 @@ inline void ExpPotential::operate(State& state, __attribute__((unused))StateArra
 		if (prefactor != 1.0)
 			state *= prefactor;
 	}
+	else if (prefactor != 1.0) {
+		state.pointwise_multiply(values, prefactor);
+	}
 	else {
 		state.pointwise_multiply(values);
 	}
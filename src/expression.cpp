@@ -0,0 +1,375 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#include "expression.hpp"
+
+// Apply a function of one argument to a block of values. The function is a
+// template parameter, so the call is direct and the loop can be vectorized.
+template <double (*f)(double)>
+static inline void apply_in_place(double* values, size_t len) {
+	for (size_t i=0; i<len; i++)
+		values[i] = f(values[i]);
+}
+
+Expression::Expression(std::string const& s) :
+		str(s), pos(0), stack_depth(0) {
+	parse_sum();
+	skip_whitespace();
+	if (pos != str.size())
+		fail("unexpected character");
+	// Compute the depth of the stack needed to run the program
+	size_t depth = 0;
+	for (std::vector<Instruction>::const_iterator it = program.begin(); it != program.end(); ++it) {
+		const size_t args = num_arguments(it->op);
+		depth = depth - args + 1;
+		stack_depth = std::max(stack_depth, depth);
+	}
+}
+
+double Expression::operator()(double x, double y) const {
+	double value;
+	evaluate_row(&x, y, 1, &value);
+	return value;
+}
+
+void Expression::evaluate_row(double const* x, double y, size_t n, double* values) const {
+	std::vector<double> stack(stack_depth*block_size);
+	for (size_t first=0; first<n; first+=block_size) {
+		const size_t len = std::min(block_size, n-first);
+		double const* const bx = x+first;
+		// Pointer to the top of the stack, that is, to the block of the value
+		// pushed last
+		double* top = &stack[0]-block_size;
+		for (std::vector<Instruction>::const_iterator it = program.begin(); it != program.end(); ++it) {
+			double* const a = top-block_size;
+			switch (it->op) {
+				case PushX:
+					top += block_size;
+					std::copy(bx, bx+len, top);
+					break;
+				case PushY:
+					top += block_size;
+					std::fill(top, top+len, y);
+					break;
+				case PushR:
+					top += block_size;
+					for (size_t i=0; i<len; i++)
+						top[i] = sqrt(bx[i]*bx[i] + y*y);
+					break;
+				case PushConst:
+					top += block_size;
+					std::fill(top, top+len, it->value);
+					break;
+				case Add:
+					for (size_t i=0; i<len; i++)
+						a[i] += top[i];
+					top = a;
+					break;
+				case Sub:
+					for (size_t i=0; i<len; i++)
+						a[i] -= top[i];
+					top = a;
+					break;
+				case Mul:
+					for (size_t i=0; i<len; i++)
+						a[i] *= top[i];
+					top = a;
+					break;
+				case Div:
+					for (size_t i=0; i<len; i++)
+						a[i] /= top[i];
+					top = a;
+					break;
+				case Pow:
+					for (size_t i=0; i<len; i++)
+						a[i] = pow(a[i], top[i]);
+					top = a;
+					break;
+				case Min:
+					for (size_t i=0; i<len; i++)
+						a[i] = std::min(a[i], top[i]);
+					top = a;
+					break;
+				case Max:
+					for (size_t i=0; i<len; i++)
+						a[i] = std::max(a[i], top[i]);
+					top = a;
+					break;
+				case Atan2:
+					for (size_t i=0; i<len; i++)
+						a[i] = atan2(a[i], top[i]);
+					top = a;
+					break;
+				case Hypot:
+					for (size_t i=0; i<len; i++)
+						a[i] = sqrt(a[i]*a[i] + top[i]*top[i]);
+					top = a;
+					break;
+				case Neg:
+					for (size_t i=0; i<len; i++)
+						top[i] = -top[i];
+					break;
+				case Square:
+					for (size_t i=0; i<len; i++)
+						top[i] *= top[i];
+					break;
+				case Sin: apply_in_place<sin>(top, len); break;
+				case Cos: apply_in_place<cos>(top, len); break;
+				case Tan: apply_in_place<tan>(top, len); break;
+				case Asin: apply_in_place<asin>(top, len); break;
+				case Acos: apply_in_place<acos>(top, len); break;
+				case Atan: apply_in_place<atan>(top, len); break;
+				case Sinh: apply_in_place<sinh>(top, len); break;
+				case Cosh: apply_in_place<cosh>(top, len); break;
+				case Tanh: apply_in_place<tanh>(top, len); break;
+				case Exp: apply_in_place<exp>(top, len); break;
+				case Log: apply_in_place<log>(top, len); break;
+				case Sqrt: apply_in_place<sqrt>(top, len); break;
+				case Abs: apply_in_place<fabs>(top, len); break;
+			}
+		}
+		std::copy(&stack[0], &stack[0]+len, values+first);
+	}
+}
+
+// Apply an operation to constant arguments, for folding constants
+double Expression::apply(OpCode op, double a, double b) {
+	switch (op) {
+		case Add: return a+b;
+		case Sub: return a-b;
+		case Mul: return a*b;
+		case Div: return a/b;
+		case Pow: return pow(a, b);
+		case Min: return std::min(a, b);
+		case Max: return std::max(a, b);
+		case Atan2: return atan2(a, b);
+		case Hypot: return sqrt(a*a + b*b);
+		case Neg: return -a;
+		case Square: return a*a;
+		case Sin: return sin(a);
+		case Cos: return cos(a);
+		case Tan: return tan(a);
+		case Asin: return asin(a);
+		case Acos: return acos(a);
+		case Atan: return atan(a);
+		case Sinh: return sinh(a);
+		case Cosh: return cosh(a);
+		case Tanh: return tanh(a);
+		case Exp: return exp(a);
+		case Log: return log(a);
+		case Sqrt: return sqrt(a);
+		case Abs: return fabs(a);
+		default:
+			throw GeneralError("Expression::apply called for an instruction that is not a function. This should never happen.");
+	}
+}
+
+size_t Expression::num_arguments(OpCode op) {
+	switch (op) {
+		case PushX:
+		case PushY:
+		case PushR:
+		case PushConst:
+			return 0;
+		case Add:
+		case Sub:
+		case Mul:
+		case Div:
+		case Pow:
+		case Min:
+		case Max:
+		case Atan2:
+		case Hypot:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+void Expression::emit(OpCode op, double value) {
+	const size_t args = num_arguments(op);
+	const size_t len = program.size();
+	// A power of two is computed with a multiplication
+	if (op == Pow and program.back().op == PushConst and program.back().value == 2
+			and not (len >= 2 and program[len-2].op == PushConst)) {
+		program.pop_back();
+		op = Square;
+	}
+	if (args == 2 and len >= 2 and program[len-2].op == PushConst and program[len-1].op == PushConst) {
+		const double folded = apply(op, program[len-2].value, program[len-1].value);
+		program.resize(len-2);
+		emit(PushConst, folded);
+		return;
+	}
+	if (args == 1 and len >= 1 and program[len-1].op == PushConst) {
+		program.back().value = apply(op, program.back().value, 0);
+		return;
+	}
+	Instruction instruction = {op, value};
+	program.push_back(instruction);
+}
+
+// Parser functions
+
+void Expression::skip_whitespace() {
+	while (pos < str.size() and isspace(str[pos]))
+		pos++;
+}
+
+bool Expression::accept(char c) {
+	skip_whitespace();
+	if (pos < str.size() and str[pos] == c) {
+		pos++;
+		return true;
+	}
+	return false;
+}
+
+void Expression::expect(char c) {
+	if (not accept(c))
+		fail(std::string("expected '") + c + "'");
+}
+
+void Expression::fail(std::string const& reason) const {
+	throw InvalidExpression(str, pos, reason);
+}
+
+// sum := product (('+'|'-') product)*
+void Expression::parse_sum() {
+	parse_product();
+	while (true) {
+		if (accept('+')) {
+			parse_product();
+			emit(Add);
+		}
+		else if (accept('-')) {
+			parse_product();
+			emit(Sub);
+		}
+		else
+			return;
+	}
+}
+
+// product := unary (('*'|'/') unary)*
+void Expression::parse_product() {
+	parse_unary();
+	while (true) {
+		if (accept('*')) {
+			parse_unary();
+			emit(Mul);
+		}
+		else if (accept('/')) {
+			parse_unary();
+			emit(Div);
+		}
+		else
+			return;
+	}
+}
+
+// unary := ('-'|'+') unary | power
+void Expression::parse_unary() {
+	if (accept('-')) {
+		parse_unary();
+		emit(Neg);
+	}
+	else if (accept('+'))
+		parse_unary();
+	else
+		parse_power();
+}
+
+// power := primary ('^' unary)?
+void Expression::parse_power() {
+	parse_primary();
+	if (accept('^')) {
+		parse_unary();
+		emit(Pow);
+	}
+}
+
+// primary := number | variable | function '(' arguments ')' | '(' sum ')'
+void Expression::parse_primary() {
+	skip_whitespace();
+	if (pos == str.size())
+		fail("unexpected end of expression");
+	const char c = str[pos];
+	if (isdigit(c) or c == '.') {
+		char const* const begin = str.c_str()+pos;
+		char* end;
+		const double value = strtod(begin, &end);
+		if (end == begin)
+			fail("invalid number");
+		pos += static_cast<size_t>(end-begin);
+		emit(PushConst, value);
+	}
+	else if (isalpha(c)) {
+		const size_t begin = pos;
+		while (pos < str.size() and (isalnum(str[pos]) or str[pos] == '_'))
+			pos++;
+		const std::string name(str, begin, pos-begin);
+		if (name == "x")
+			emit(PushX);
+		else if (name == "y")
+			emit(PushY);
+		else if (name == "r")
+			emit(PushR);
+		else if (name == "pi")
+			emit(PushConst, M_PI);
+		else if (accept('('))
+			parse_call(name, begin);
+		else {
+			pos = begin;
+			fail("unknown variable '" + name + "'");
+		}
+	}
+	else if (accept('(')) {
+		parse_sum();
+		expect(')');
+	}
+	else
+		fail("expected a number, a variable, a function or a parenthesis");
+}
+
+void Expression::parse_call(std::string const& name, size_t name_pos) {
+	static const char* const names[] = {"atan2", "pow", "hypot", "min", "max",
+		"sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh", "exp", "log", "sqrt", "abs"};
+	static const OpCode ops[] = {Atan2, Pow, Hypot, Min, Max,
+		Sin, Cos, Tan, Asin, Acos, Atan, Sinh, Cosh, Tanh, Exp, Log, Sqrt, Abs};
+	const size_t num_functions = sizeof(ops)/sizeof(OpCode);
+	size_t f = 0;
+	while (f < num_functions and name != names[f])
+		f++;
+	if (f == num_functions) {
+		pos = name_pos;
+		fail("unknown function '" + name + "'");
+	}
+	parse_sum();
+	if (num_arguments(ops[f]) == 2) {
+		expect(',');
+		parse_sum();
+	}
+	expect(')');
+	emit(ops[f]);
+}
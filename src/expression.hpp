@@ -0,0 +1,89 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Arithmetic expressions of the coordinates x and y, such as
+ * "0.5*(x^2+y^2) + 0.1*sin(3*atan2(y,x))".
+ *
+ * The expression is parsed once into a program for a simple stack machine.
+ * Instead of interpreting the program separately for every point, it is run
+ * for a block of points at a time, so that every instruction is a simple loop
+ * over arrays that the compiler can vectorize, and the cost of interpreting
+ * is spread over the whole block.
+ *
+ * Supported syntax:
+ * 	* numbers like 2, 0.5 and 1e-3
+ * 	* the coordinates x and y, the radius r and the constant pi
+ * 	* operators +, -, *, / and ^ (power, right-associative) and parentheses
+ * 	* functions sin, cos, tan, asin, acos, atan, sinh, cosh, tanh, exp, log,
+ * 	  sqrt and abs of one argument, and atan2, pow, hypot, min and max of two
+ * 	  arguments
+ */
+
+#ifndef _EXPRESSION_HPP_
+#define _EXPRESSION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "exceptions.hpp"
+
+class Expression {
+	public:
+		// Parse the expression, throwing InvalidExpression if it is not valid
+		Expression(std::string const& str);
+		// Evaluate at a single point
+		double operator()(double x, double y) const;
+		// Evaluate at points (x[i], y) for i < n
+		void evaluate_row(double const* x, double y, size_t n, double* values) const;
+		inline std::string const& get_string() const { return str; }
+		inline size_t get_program_length() const { return program.size(); }
+		// Points evaluated together by evaluate_row
+		static const size_t block_size = 256;
+	private:
+		enum OpCode { PushX, PushY, PushR, PushConst,
+			Add, Sub, Mul, Div, Pow, Min, Max, Atan2, Hypot,
+			Neg, Square, Sin, Cos, Tan, Asin, Acos, Atan, Sinh, Cosh, Tanh, Exp, Log, Sqrt, Abs };
+		struct Instruction {
+			OpCode op;
+			double value;
+		};
+		// Recursive descent parser. Each function parses one level of the
+		// grammar and emits the instructions for it.
+		void parse_sum();
+		void parse_product();
+		void parse_unary();
+		void parse_power();
+		void parse_primary();
+		void parse_call(std::string const& name, size_t name_pos);
+		void skip_whitespace();
+		bool accept(char c);
+		void expect(char c);
+		void fail(std::string const& reason) const;
+		// Emit an instruction, folding it into a constant if its arguments
+		// are constants
+		void emit(OpCode op, double value = 0);
+		static size_t num_arguments(OpCode op);
+		static double apply(OpCode op, double a, double b);
+		std::string str;
+		size_t pos;
+		std::vector<Instruction> program;
+		size_t stack_depth;
+};
+
+#endif // _EXPRESSION_HPP_
@@ -34,6 +34,9 @@
 #include "parameters.hpp"
 #include "commandlineparser.hpp"
 #include "itpsystem.hpp"
+#include "ensemble.hpp"
+#include "service.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
@@ -41,12 +44,13 @@ using namespace std;
 volatile sig_atomic_t abort_flag = false;
 volatile sig_atomic_t save_flag = false;
 
-const char abort_flag_note[] = "\nCaught SIGINT. Saving data and quitting at next convenient spot.\nPress Ctrl-C again to signal immediate stop.\n";
+const char abort_flag_note[] = "\nCaught SIGINT or SIGTERM. Saving data and quitting at next convenient spot.\nPress Ctrl-C again to signal immediate stop.\n";
 const size_t abort_flag_note_size = sizeof(abort_flag_note);
 const char save_flag_note[] = "\nCaught SIGUSR1. Saving states at next convenient stop and continuing.\n";
 const size_t save_flag_note_size = sizeof(save_flag_note);
 
-// Signal handlers for SIGINT and SIGUSR1
+// Signal handlers for SIGINT (and SIGTERM, sent e.g. by batch queue systems
+// before stopping a job) and SIGUSR1
 void sigint_handler(__attribute__((unused)) int s) {
 	if (abort_flag)
 		exit(1);
@@ -59,9 +63,132 @@ void sigusr1_handler(__attribute__((unused)) int s) {
 	save_flag = true;
 }
 
+// Run an ensemble of realizations instead of a single system. Returns the
+// exit status of the program.
+int run_ensemble(Parameters const& params) {
+	Ensemble* ensemble = NULL;
+	try {
+		ensemble = new Ensemble(params, &abort_flag);
+	}
+	catch (exception& e) {
+		cerr << "Error while initializing ensemble:" << endl
+			<< e.what() << endl;
+		return 3;
+	}
+	catch(...) {
+		return 3;
+	}
+	try {
+		ensemble->run();
+	}
+	catch (exception& e) {
+		cerr << "Error while running ensemble:" << endl
+			<< e.what() << endl;
+		delete ensemble;
+		return 4;
+	}
+	catch(...) {
+		delete ensemble;
+		return 4;
+	}
+	const bool error_flag = ensemble->get_error_flag();
+	delete ensemble;
+	return error_flag? 1 : 0;
+}
+
+// Run as a service until it is stopped. Returns the exit status of the
+// program.
+int run_service(Parameters const& params) {
+	try {
+		Service service(params.get_service_directory(), &abort_flag, &save_flag);
+		service.run();
+	}
+	catch (exception& e) {
+		cerr << "Error while running service:" << endl
+			<< e.what() << endl;
+		return 3;
+	}
+	return 0;
+}
+
+// Run a single system, or the levels of a coarse-to-fine cascade. Returns the
+// exit status of the program.
+int run_system(Parameters const& params) {
+	// Run the levels of the coarse-to-fine cascade from the coarsest to the
+	// finest grid. Without a cascade there is only one level. A resumed
+	// simulation continues directly on the finest grid. The previous level is
+	// kept until the next one finishes, since its states are needed again if
+	// the next level has to recover by resetting its states.
+	const size_t levels = (params.get_resume() and Checkpoint::exists(params.get_checkpoint_file()))?
+		1 : params.get_cascade_levels();
+	ITPSystem* sys = NULL;
+	ITPSystem* coarser = NULL;
+	for (size_t level=levels; level-- > 0;) {
+		// Initialize ITPSystem
+		try {
+			sys = new ITPSystem(ITPSystem::cascade_parameters(params, level, coarser), &abort_flag, &save_flag);
+		}
+		catch (exception& e) {
+			cerr << "Error while initializing ITP system:" << endl
+				<< e.what() << endl;
+			delete coarser;
+			return 3;
+		}
+		catch(...) {
+			delete coarser;
+			return 3;
+		}
+		// Main loop. In a parameter sweep the same system continues with the
+		// next point after each point has finished.
+		try {
+			do {
+				while(not sys->is_finished())
+					sys->step();
+			} while (sys->next_sweep_point());
+		}
+		catch (exception& e) {
+			cerr << "Error while running ITP iteration:" << endl
+				<< e.what() << endl;
+			delete sys;
+			delete coarser;
+			return 4;
+		}
+		catch(...) {
+			delete sys;
+			delete coarser;
+			return 4;
+		}
+		delete coarser;
+		coarser = NULL;
+		if (level > 0) {
+			if (sys->get_error_flag() or abort_flag)
+				break;
+			coarser = sys;
+		}
+	}
+	const bool error_flag = sys->get_error_flag();
+	delete sys;
+	return error_flag? 1 : 0;
+}
+
+// Write the trace recorded during the run, if one was requested
+void write_trace(Parameters const& params) {
+	if (params.get_trace_file().empty())
+		return;
+	Trace::disable();
+	try {
+		Trace::write(params.get_trace_file());
+	}
+	catch (exception& e) {
+		cerr << "Error while writing trace:" << endl
+			<< e.what() << endl;
+	}
+}
+
 int main(int argc, char* argv[]) {
-	// Trap SIGINT and SIGUSR1
+	// Trap SIGINT, SIGTERM and SIGUSR1
 	signal(SIGINT, sigint_handler);
+	signal(SIGTERM, sigint_handler);
 	signal(SIGUSR1, sigusr1_handler);
 	// Parse parameters
 	vector<string> args(argv, argv+argc);
@@ -83,6 +210,8 @@ int main(int argc, char* argv[]) {
 		return e.getExitStatus();
 	}
 	Parameters params(parser.get_params());
+	if (not params.get_trace_file().empty())
+		Trace::enable();
 	// Import FFTW Wisdom if available
 	std::string const& fftw_wisdom_filename = params.get_wisdom_file_name();
 	FILE* wisdom_file = fopen(fftw_wisdom_filename.c_str(), "r");
@@ -90,46 +219,20 @@ int main(int argc, char* argv[]) {
 		fftw_import_wisdom_from_file(wisdom_file);
 		fclose(wisdom_file);
 	}
-	// Initialize ITPSystem
-	ITPSystem* sys = NULL;
-	try {
-		sys = new ITPSystem(params, &abort_flag, &save_flag);
-	}
-	catch (exception& e) {
-		cerr << "Error while initializing ITP system:" << endl
-			<< e.what() << endl;
-		delete sys;
-		return 3;
-	}
-	catch(...) {
-		delete sys;
-		return 3;
-	}
-	// Main loop
-	while(not sys->is_finished()) {
-		try {
-			sys->step();
-		}
-		catch (exception& e) {
-			cerr << "Error while running ITP iteration:" << endl
-				<< e.what() << endl;
-			delete sys;
-			return 4;
-		}
-		catch(...) {
-			delete sys;
-			return 4;
-		}
-	}
+	// A service or an ensemble replaces the usual single system
+	int retval;
+	if (not params.get_service_directory().empty())
+		retval = run_service(params);
+	else if (params.is_ensemble())
+		retval = run_ensemble(params);
+	else
+		retval = run_system(params);
 	// Save FFTW Wisdom
 	wisdom_file = fopen(fftw_wisdom_filename.c_str(), "w");
 	fftw_export_wisdom_to_file(wisdom_file);
-	// Cleanup and exit
-	const bool error_flag = sys->get_error_flag();
-	delete sys;
+	// Cleanup and exit. The trace is written also if the run failed, since
+	// it may tell where.
 	fftw_cleanup();
-	if (error_flag)
-		return 1;
-	else
-		return 0;
+	write_trace(params);
+	return retval;
 }
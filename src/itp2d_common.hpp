@@ -52,6 +52,18 @@ enum BoundaryType { Periodic, Dirichlet };
 // Available orthonormalization algorithms
 enum OrthoAlgorithm { Default, HighMem };
 
+// Available placement policies for state memory on NUMA machines
+enum MemoryPlacement { FirstTouchPlacement, InterleavedPlacement };
+
+// Available filters for compressing the datafile
+enum CompressionFilter { NoCompression, DeflateCompression, ShuffleDeflateCompression, LZ4Compression, ZstdCompression };
+
+// Available precisions for storing states in the datafile
+enum StatePrecision { DoublePrecision, SinglePrecision };
+
+// Available page sizes for backing state memory
+enum PageBacking { NormalPages, TransparentHugePages, HugePages2M, HugePages1G };
+
 // Default FFTW flags
 const unsigned int default_fftw_flags = FFTW_PATIENT;
 
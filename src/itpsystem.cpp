@@ -20,13 +20,23 @@
 
 // Constructors & destructors
 
+SharedOperators::SharedOperators(Parameters const& params) :
+		datalayout(params.get_sizex(), params.get_sizey(), params.get_grid_delta()),
+		transformer(datalayout, params.get_fftw_flags()),
+		kinetic(params.get_B(0), transformer, params.get_boundary_type()),
+		kinetic_tables(transformer) {}
+
 ITPSystem::ITPSystem(Parameters const& given_params,
 				volatile sig_atomic_t* arg_abort_flagptr,
 				volatile sig_atomic_t* arg_save_flagptr,
-				std::ostream& arg_out, std::ostream& arg_err) :
-		params(given_params),
-		datalayout(params.get_sizex(), params.get_sizey(), params.get_grid_delta()),
-		transformer(datalayout, params.get_fftw_flags()),
+				std::ostream& arg_out, std::ostream& arg_err,
+				SharedOperators const* shared_operators,
+				Workspace* arg_shared_workspace) :
+		params(resumed_parameters(given_params)),
+		own_operators((shared_operators == NULL)? new SharedOperators(params) : NULL),
+		operators((shared_operators == NULL)? *own_operators : *shared_operators),
+		datalayout(operators.datalayout),
+		transformer(operators.transformer),
 		boundary_type(params.get_boundary_type()),
 		abort_flagptr(arg_abort_flagptr),
 		save_flagptr(arg_save_flagptr),
@@ -34,28 +44,54 @@ ITPSystem::ITPSystem(Parameters const& given_params,
 		finished(false), error_flag(false),
 		all_needed_states_timestep_converged(false), all_needed_states_finally_converged(false),
 		exhausting_eps_values(params.get_exhaust_eps()),
+		resumed(false),
 		rng(params.get_random_seed()),
-		pot_type(parse_potential_description(params.get_potential_type())),
+		pot_type(parse_potential_description(params.get_potential_type(0))),
 		noise(NULL), impurity_type(NULL), impurity_distribution(NULL), impurity_constraint(NULL),
 		pot(NULL),
-		kin(params.get_B(), transformer, boundary_type),
-		states(params.get_N(), datalayout, params.get_ortho_algorithm()),
+		kin(NULL),
+		states(params, datalayout),
+		shared_workspace(arg_shared_workspace),
+		workspace(NULL),
 		Esn_tuples(params.get_N()),
 		total_step_counter(0),
 		step_counter(0),
-		eps(NaN), eps_values(params.get_eps_values()) {
+		initial_step_counter(0),
+		eps(NaN), eps_values(params.get_eps_values()),
+		sweep_point(0), sweep_first_step(0) {
 	if (verb(1)) {
 		out << "Initializing ITP system..." << std::endl;
 	}
 	update_timestring();
+	memset(&telemetry, 0, sizeof(telemetry));
+	telemetry_pending = false;
+	// A run that is resumed overwrites the datafile of the interrupted run
+	const bool resume = params.get_resume() and Checkpoint::exists(params.get_checkpoint_file());
+	if (params.get_resume() and not resume and verb(1))
+		out << "No checkpoint " << params.get_checkpoint_file() << " found, starting from the beginning." << std::endl;
+	if (params.is_sweep() and not params.get_checkpoint_file().empty())
+		throw GeneralError("Checkpoints cannot be used with a parameter sweep.");
+	if (datalayout != DataLayout(params.get_sizex(), params.get_sizey(), params.get_grid_delta())
+			or operators.kinetic.boundary_type != boundary_type)
+		throw GeneralError("Shared operators do not match the grid of the system.");
+	set_kinetic(params.get_B(0));
 	omp_set_num_threads(static_cast<int>(params.get_num_threads()));
+	if (params.get_pin_threads() and not pin_omp_threads())
+		err << "Warning: could not pin threads to CPUs. Continuing without pinning." << std::endl;
+	if (states.is_out_of_core() and (params.get_numa_interleave() or params.get_page_backing() != NormalPages))
+		err << "Warning: memory placement and page backing settings have no effect when storing states out-of-core." << std::endl;
+	else if (params.get_numa_interleave() and states.get_memory_placement() != InterleavedPlacement)
+		err << "Warning: could not interleave memory over NUMA nodes (itp2d compiled without libnuma support, or libnuma not available). Using first-touch placement." << std::endl;
+	else if (states.get_page_backing() != params.get_page_backing())
+		err << "Warning: requested page backing '" << page_backing_description(params.get_page_backing())
+			<< "' not used for the states. Using '" << page_backing_description(states.get_page_backing()) << "' instead." << std::endl;
 	// Initialize noise class
 	std::string const& noise_type = params.get_noise_type();
 	if (noise_type == "none" or noise_type == "no" or noise_type == "zero") {
 		noise = new NoNoise();
 	}
 	else if (noise_type == "impurities") {
-		impurity_type = parse_impurity_type_description(params.get_impurity_type(), datalayout, rng);
+		impurity_type = parse_impurity_type_description(params.get_impurity_type(), datalayout, rng, boundary_type);
 		impurity_constraint = parse_constraint_description(params.get_impurity_constraint());
 		impurity_distribution = parse_impurity_distribution_description(params.get_impurity_distribution(), datalayout, *impurity_constraint, rng);
 		noise = new SpatialImpurities(*impurity_type, *impurity_distribution);
@@ -67,17 +103,32 @@ ITPSystem::ITPSystem(Parameters const& given_params,
 		throw UnknownNoiseType(noise_type);
 	// Initialize potential
 	pot = new Potential(datalayout, *pot_type, *noise);
+	writer = NULL;
 	if (params.get_save_what() != Parameters::Nothing) {
 		// Create a datafile and write some attributes describing the simulation
-		datafile = new Datafile(params.get_datafile_name(), datalayout, params.get_clobber());
+		datafile = new Datafile(params.get_datafile_name(), datalayout, params.get_clobber() or resume,
+				params.get_states_chunk_size(), params.get_compression_filter(), params.get_compression_level(),
+				params.get_state_precision());
 		datafile->add_attribute("program_version", version_string);
 		datafile->add_attribute("random_seed", params.get_random_seed());
 		datafile->add_attribute("start_time", timestring);
 		datafile->add_attribute("num_threads", params.get_num_threads());
+		datafile->add_attribute("pin_threads", static_cast<int>(params.get_pin_threads()));
+		datafile->add_attribute("memory_placement", memory_placement_description(states.get_memory_placement()));
+		datafile->add_attribute("page_backing", page_backing_description(states.get_page_backing()));
+		if (states.is_out_of_core()) {
+			datafile->add_attribute("scratch_directory", params.get_scratch_directory());
+			datafile->add_attribute("memory_budget", static_cast<int>(params.get_memory_budget()));
+		}
+		datafile->add_attribute("compress_converged", static_cast<int>(params.get_compress_converged()));
+		datafile->add_attribute("async_io", static_cast<int>(params.get_async_io()));
+		datafile->add_attribute("compression", compression_filter_description(params.get_compression_filter()));
 		datafile->add_attribute("num_states", static_cast<int>(params.get_N()));
 		datafile->add_attribute("num_wanted_to_converge", static_cast<int>(params.get_needed_to_converge()));
 		datafile->add_attribute("ignore_lowest", static_cast<int>(params.get_ignore_lowest()));
 		datafile->add_attribute("grid_length", params.get_lenx());
+		datafile->add_attribute("cascade_levels", static_cast<int>(params.get_cascade_levels()));
+		datafile->add_attribute("sweep", params.get_sweep());
 		switch (boundary_type) {
 			case Periodic:
 				datafile->add_attribute("grid_boundary_type", "periodic");
@@ -92,9 +143,10 @@ ITPSystem::ITPSystem(Parameters const& given_params,
 		datafile->add_attribute("impurity_type", params.get_impurity_type());
 		datafile->add_attribute("impurity_distribution", params.get_impurity_distribution());
 		datafile->add_attribute("impurity_constraint", params.get_impurity_constraint());
+		datafile->add_attribute("noise_truncation_error_bound", noise->get_truncation_error_bound());
 		datafile->add_attribute("timestep_convergence_test", params.get_timestep_convergence_test().get_description());
 		datafile->add_attribute("final_convergence_test", params.get_final_convergence_test().get_description());
-		datafile->add_attribute("magnetic_field_strength", params.get_B());
+		datafile->add_attribute("magnetic_field_strength", kin->B);
 		datafile->write_potential(*pot);
 		datafile->write_noise_realization(*noise);
 	}
@@ -109,43 +161,99 @@ ITPSystem::ITPSystem(Parameters const& given_params,
 	}
 	else
 		eps = Parameters::default_initial_eps;
+	time_step_history.push_back(std::make_pair(total_step_counter+1, eps));
 	if (params.get_save_what() != Parameters::Nothing) {
 		datafile->add_attribute("initial_time_step", eps);
-		datafile->write_time_step_history(total_step_counter+1, eps);
+		if (not resume)
+			datafile->write_time_step_history(total_step_counter+1, eps);
 	}
 	// Form the Hamiltonian (sum kinetic and potential energy operators)
-	H += kin;
+	H += *kin;
 	if (not pot->is_null())
 		H += *pot;
 	// Create an approximation for the imaginary time evolution operator
-	T = new MultiProductSplit(params.get_halforder(), *pot, eps, transformer, boundary_type, params.get_B());
-	// Initialize states
-	states.init(params, rng);
+	T = new MultiProductSplit(params.get_halforder(), *pot, eps, transformer, boundary_type, kin->B,
+			&operators.kinetic_tables);
+	// Initialize states, or continue where the checkpoint left off
+	if (resume)
+		resume_from_checkpoint();
+	else
+		states.init(params, rng);
 	// Allocate some working space for multithreaded operation
 	// This is used for operating with the evolution operator
 	// and calculating the mean and standard deviation
-	const size_t workspace_per_thread = std::max((*T).required_workspace(), H.required_workspace() + 1);
-	workslices = new StateArray*[params.get_num_threads()];
-	for (size_t i=0; i<params.get_num_threads(); i++) {
-		workslices[i] = new StateArray(workspace_per_thread, datalayout);
-	}
-	if (params.get_save_what() == Parameters::Everything)
+	allocate_workspace(std::max((*T).required_workspace(), H.required_workspace() + 1));
+	if (params.get_save_what() == Parameters::Everything and not resumed)
 		save_states(false);
 	if (datafile != NULL)
 		datafile->flush();
+	time(&last_checkpoint_time);
+	// From now on the datafile is written in the background, if requested
+	if (datafile != NULL and params.get_async_io())
+		writer = new AsyncWriter(*datafile, params.get_io_queue_length());
 	if (verb(1)) {
 		print_initial_message();
 	}
 }
 
+// When resuming, the random seed is taken from the checkpoint so that the
+// potential is the same as in the interrupted run, even if its seed was
+// generated from the current time.
+Parameters ITPSystem::resumed_parameters(Parameters const& given_params) {
+	Parameters resumed_params(given_params);
+	if (given_params.get_resume() and Checkpoint::exists(given_params.get_checkpoint_file())) {
+		const Checkpoint checkpoint(given_params.get_checkpoint_file());
+		resumed_params.set_random_seed(checkpoint.read_ulong("random_seed"));
+	}
+	return resumed_params;
+}
+
+// Parameters for one level of a coarse-to-fine cascade, level 0 being the
+// finest grid, which is the one given in params. Each coarser level has half
+// as many grid points in both directions, convergence limits looser by the
+// cascade tolerance factor, and saves nothing. A level starts from the states
+// of the coarser level before it, if given, with the time step that level
+// finished with.
+Parameters ITPSystem::cascade_parameters(Parameters const& params, size_t level, ITPSystem const* coarser) {
+	Parameters level_params(params);
+	level_params.set_cascade_level(level);
+	if (coarser != NULL) {
+		level_params.define_initial_states(coarser->get_states());
+		const double coarser_eps = coarser->get_eps();
+		level_params.clear_eps_values();
+		level_params.add_eps_value(coarser_eps);
+		std::list<double> const& given_eps_values = params.get_eps_values();
+		for (std::list<double>::const_iterator it=given_eps_values.begin(); it!=given_eps_values.end(); ++it) {
+			if (*it < coarser_eps)
+				level_params.add_eps_value(*it);
+		}
+	}
+	if (level == 0)
+		return level_params;
+	const size_t divisor = static_cast<size_t>(1) << level;
+	// Coarser levels only do the first point of a sweep
+	level_params.define_external_field(params.get_potential_type(0), params.get_B(0));
+	level_params.clear_sweep();
+	level_params.define_grid(params.get_sizex()/divisor, params.get_sizey()/divisor, params.get_lenx(),
+			params.get_boundary_type());
+	level_params.define_data_storage(params.get_datafile_name(), Parameters::Nothing);
+	level_params.set_checkpoint("");
+	level_params.set_resume(false);
+	const double factor = pow(params.get_cascade_tolerance_factor(), static_cast<double>(level));
+	level_params.set_timestep_convergence_test(params.get_timestep_convergence_test().loosened(factor));
+	level_params.set_final_convergence_test(params.get_final_convergence_test().loosened(factor));
+	return level_params;
+}
+
 ITPSystem::~ITPSystem() {
 	delete T;
-	for (size_t i=0; i<params.get_num_threads(); i++) {
-		delete workslices[i];
-	}
-	delete[] workslices;
+	if (workspace != shared_workspace)
+		delete workspace;
+	delete writer;
 	delete datafile;
 	delete pot;
+	if (kin != &operators.kinetic)
+		delete kin;
 	delete pot_type;
 	if (params.get_noise_type() != "user") {
 		delete noise;
@@ -153,6 +261,94 @@ ITPSystem::~ITPSystem() {
 	delete impurity_type;
 	delete impurity_distribution;
 	delete impurity_constraint;
+	delete own_operators;
+}
+
+// Use the shared kinetic energy operator if it has the right magnetic field,
+// otherwise create a new one.
+void ITPSystem::set_kinetic(double B) {
+	if (kin != &operators.kinetic)
+		delete kin;
+	if (B == operators.kinetic.B)
+		kin = &operators.kinetic;
+	else
+		kin = new Kinetic(B, transformer, boundary_type);
+}
+
+// Use the shared workspace if it is large enough, otherwise allocate one.
+void ITPSystem::allocate_workspace(size_t per_thread) {
+	if (workspace != shared_workspace)
+		delete workspace;
+	if (shared_workspace != NULL and shared_workspace->fits(params.get_num_threads(), per_thread, datalayout,
+				states.get_page_backing()))
+		workspace = shared_workspace;
+	else
+		workspace = new Workspace(params.get_num_threads(), per_thread, datalayout, states.get_page_backing());
+}
+
+Workspace* ITPSystem::release_workspace() {
+	if (workspace == shared_workspace)
+		return NULL;
+	Workspace* const released = workspace;
+	workspace = shared_workspace;
+	return released;
+}
+
+// The potential and the magnetic field of the next point replace the old ones,
+// but the grid, the FFTW plans, the states and the workspaces stay. The states
+// of the previous point are close to the new eigenstates, so propagation
+// continues with the small time step the previous point finished with instead
+// of starting again from the initial time step.
+bool ITPSystem::next_sweep_point() {
+	if (not finished or error_flag or sweep_point+1 >= params.get_num_sweep_points())
+		return false;
+	sweep_point++;
+	sweep_first_step = total_step_counter;
+	delete T;
+	delete pot;
+	delete pot_type;
+	pot_type = parse_potential_description(params.get_potential_type(sweep_point));
+	pot = new Potential(datalayout, *pot_type, *noise);
+	set_kinetic(params.get_B(sweep_point));
+	H = OperatorSum();
+	H += *kin;
+	if (not pot->is_null())
+		H += *pot;
+	eps_values.clear();
+	std::list<double> const& given_eps_values = params.get_eps_values();
+	for (std::list<double>::const_iterator it=given_eps_values.begin(); it!=given_eps_values.end(); ++it) {
+		if (*it < eps)
+			eps_values.push_back(*it);
+	}
+	exhausting_eps_values = params.get_exhaust_eps() and not eps_values.empty();
+	T = new MultiProductSplit(params.get_halforder(), *pot, eps, transformer, boundary_type, kin->B,
+			&operators.kinetic_tables);
+	// A magnetic field needs more workspace
+	const size_t needed_workspace = std::max((*T).required_workspace(), H.required_workspace() + 1);
+	if (needed_workspace > workspace->per_thread)
+		allocate_workspace(needed_workspace);
+	// The states were unlocked when the previous point finished
+	locked_energies.clear();
+	for (size_t n=0; n<params.get_N(); n++) {
+		states.set_timestep_converged(n, false);
+		states.set_finally_converged(n, false);
+	}
+	all_needed_states_timestep_converged = false;
+	all_needed_states_finally_converged = false;
+	step_counter = 0;
+	finished = false;
+	time_step_history.push_back(std::make_pair(total_step_counter+1, eps));
+	if (params.get_save_what() != Parameters::Nothing) {
+		if (writer != NULL)
+			writer->submit(new TimeStepHistoryWriteJob(total_step_counter+1, eps));
+		else
+			datafile->write_time_step_history(total_step_counter+1, eps);
+	}
+	if (verb(1)) {
+		out << "Starting sweep point " << sweep_point+1 << " of " << params.get_num_sweep_points() << ": "
+			<< "potential " << pot_type->get_description() << ", magnetic field " << kin->B << std::endl;
+	}
+	return true;
 }
 
 void ITPSystem::print_initial_message() {
@@ -169,7 +365,11 @@ void ITPSystem::print_initial_message() {
 		out << "\t\timpurity distribution: " << noise->get_distribution_description() << std::endl
 			<< "\t\timpurity constraint: " << noise->get_constraint_description() << std::endl;
 	}
-	out << "\tmagnetic field strength: " << params.get_B() << std::endl
+	if (noise->get_truncation_error_bound() > 0) {
+		out << std::scientific << "\t\tnoise truncation error at most "
+			<< noise->get_truncation_error_bound() << std::fixed << std::endl;
+	}
+	out << "\tmagnetic field strength: " << kin->B << std::endl
 		<< "\tgrid: " << params.get_sizex() << "x" << params.get_sizey() << " of length " << params.get_lenx() << ", ";
 	switch (boundary_type) {
 		case Periodic:
@@ -179,6 +379,36 @@ void ITPSystem::print_initial_message() {
 			out << "Dirichlet boundary conditions" << std::endl;
 			break;
 	}
+	if (params.is_sweep()) {
+		out << "\tparameter sweep: " << params.get_sweep() << ", "
+			<< params.get_num_sweep_points() << " points" << std::endl;
+	}
+	if (params.get_cascade_levels() > 1) {
+		out << "\tcoarse-to-fine cascade: level " << params.get_cascade_levels()-params.get_cascade_level()
+			<< " of " << params.get_cascade_levels() << std::endl;
+	}
+	out << "\tstate memory: " << memory_placement_description(states.get_memory_placement()) << " placement, "
+		<< "page backing: " << page_backing_description(states.get_page_backing()) << std::endl;
+	if (states.is_out_of_core()) {
+		out << "\tstates stored out-of-core in " << params.get_scratch_directory() << ", "
+			<< "memory budget " << params.get_memory_budget() << " MB, "
+			<< states.get_block_size() << " states per block" << std::endl;
+	}
+	if (not params.get_checkpoint_file().empty()) {
+		out << "\tcheckpoints written to " << params.get_checkpoint_file() << " every "
+			<< params.get_checkpoint_interval() << " s" << std::endl;
+		if (resumed)
+			out << "\tresumed from checkpoint at step " << initial_step_counter << std::endl;
+	}
+	if (params.get_save_what() != Parameters::Nothing) {
+		out << "\tdatafile compression: " << compression_filter_description(params.get_compression_filter());
+		if (params.get_compression_filter() != NoCompression and params.get_compression_filter() != LZ4Compression)
+			out << " at level " << params.get_compression_level();
+		out << ", " << params.get_states_chunk_size() << " states per chunk";
+		if (params.get_state_precision() == SinglePrecision)
+			out << ", states in single precision";
+		out << std::endl;
+	}
 	if (pot->is_null()) {
 		out << "\tzero potential -> no operator splitting needed" << std::endl;
 		assert(T->halforder == 1);
@@ -190,7 +420,7 @@ void ITPSystem::print_initial_message() {
 			<< "\traw parameter list: " << std::endl << params << std::endl;
 	}
 	// Warnings about incompatible or dangerous parameters
-	if (boundary_type == Dirichlet and params.get_B() != 0) {
+	if (boundary_type == Dirichlet and kin->B != 0) {
 		err << "Warning: you are using Dirichlet boundary conditions with a magnetic field. This can cause slower convergence. Please see the README for more details." << std::endl;
 		if (typeid(params.get_timestep_convergence_test()) == typeid(RelativeEnergyDeviationTest) or
 			typeid(params.get_final_convergence_test()) == typeid(RelativeEnergyDeviationTest)) {
@@ -219,10 +449,14 @@ void ITPSystem::change_time_step() {
 		return;
 	}
 	T->set_time_step(eps);
+	time_step_history.push_back(std::make_pair(total_step_counter+1, eps));
 	if (params.get_save_what() != Parameters::Nothing) {
 		// record the first step to have the new time step value, i.e. the next value
 		// of total_step_counter
-		datafile->write_time_step_history(total_step_counter+1, eps);
+		if (writer != NULL)
+			writer->submit(new TimeStepHistoryWriteJob(total_step_counter+1, eps));
+		else
+			datafile->write_time_step_history(total_step_counter+1, eps);
 	}
 	step_counter = 0;
 	all_needed_states_timestep_converged = false;
@@ -232,25 +466,71 @@ void ITPSystem::change_time_step() {
 		out << "\tEpsilon changed to " << std::scientific << eps << std::fixed << "." << std::endl;
 }
 
+// Lock finally converged states, starting from the lowest energy and stopping
+// at the first state that is not converged. See StateSet::lock_state().
+void ITPSystem::lock_converged_states() {
+	const size_t N = params.get_N();
+	const size_t previously_locked = states.get_num_locked();
+	for (size_t n=0; n<N; n++) {
+		Esn_tuple& tuple = Esn_tuples[n];
+		const size_t index = std::tr1::get<2>(tuple);
+		if (states.is_locked(index))
+			continue;
+		if (not states.is_finally_converged(index))
+			break;
+		const size_t new_index = states.lock_state(index);
+		// Locking swaps the state with the one in slot new_index
+		for (size_t m=0; m<N; m++) {
+			if (std::tr1::get<2>(Esn_tuples[m]) == new_index) {
+				std::tr1::get<2>(Esn_tuples[m]) = index;
+				break;
+			}
+		}
+		std::tr1::get<2>(tuple) = new_index;
+		locked_energies.push_back(std::make_pair(std::tr1::get<0>(tuple), std::tr1::get<1>(tuple)));
+	}
+	if (verb(2) and states.get_num_locked() > previously_locked) {
+		out << "\t\tLocked " << states.get_num_locked() - previously_locked << " converged states ("
+			<< states.get_num_locked() << " locked in total, using "
+			<< static_cast<double>(states.get_locked_memory())/(1024*1024) << " MB)" << std::endl;
+	}
+}
+
 // Check if save_flag is raised by e.g. the signal handlers
 void ITPSystem::check_save_flag() {
 	if (save_flagptr != NULL and *save_flagptr) {
 		save_states();
+		if (params.get_save_what() != Parameters::Nothing)
+			flush_history();
 		*save_flagptr = false;
 	}
 }
 
 void ITPSystem::propagate() {
+	TraceScope trace("propagate");
 	if (verb(2))
 		out << "\tPropagating..." << std::endl;
 	prop_timer.start();
-	#pragma omp parallel for
-	for (size_t n=0; n<params.get_N(); n++) {
-		// Here we have a chance for optimization, since we could just
-		// propagate the non-converged states. However, propagation is a cheap
-		// step when the number of states is large, so we'll propagate all
-		// states just for added precision and robustness.
-		(*T)(states[n], *(workslices[omp_get_thread_num()]));
+	// States are propagated in blocks, so that out-of-core states can be read
+	// in and written back a block at a time. For states in memory there is
+	// only one block.
+	// Locked states, which are stored first, are not propagated.
+	const size_t N = params.get_N();
+	const size_t block_size = states.get_block_size();
+	for (size_t first=states.get_num_locked(); first<N; first+=block_size) {
+		const size_t last = std::min(first+block_size, N);
+		states.prefetch_states(first, last-first);
+		// The static schedule needs to match the one used by StateSet when
+		// placing state memory. See StateSet::first_touch_state_arrays()
+		#pragma omp parallel for schedule(static)
+		for (size_t n=first; n<last; n++) {
+			// Here we have a chance for optimization, since we could just
+			// propagate the non-converged states. However, propagation is a cheap
+			// step when the number of states is large, so we'll propagate all
+			// states just for added precision and robustness.
+			(*T)(states[n], (*workspace)[omp_get_thread_num()]);
+		}
+		states.release_states(first, last-first);
 	}
 	prop_timer.stop();
 }
@@ -270,7 +550,14 @@ void ITPSystem::orthonormalize() {
 		if (params.get_recover()) {
 			err	<< "Trying to recover: Changing time step and resetting states." << std::endl;
 			change_time_step();
+			if (finished)
+				return;
+			// The states may be copied from a datafile, and HDF5 must not be
+			// used from two threads at once
+			if (writer != NULL)
+				writer->flush();
 			states.init(params, rng);
+			locked_energies.clear();
 			out << "States reset. Resuming propagation." << std::endl;
 		}
 		else {
@@ -289,6 +576,7 @@ void ITPSystem::orthonormalize() {
 }
 
 void ITPSystem::check_timestep_convergence() {
+	TraceScope trace("check timestep convergence");
 	convtest_timer.start();
 	if (verb(2))
 		out << "\tChecking timestep convergence..." << std::endl;
@@ -332,6 +620,7 @@ void ITPSystem::check_timestep_convergence() {
 }
 
 void ITPSystem::check_final_convergence() {
+	TraceScope trace("check final convergence");
 	convtest_timer.start();
 	if (verb(2))
 		out << "\tChecking final convergence..." << std::endl;
@@ -372,54 +661,94 @@ void ITPSystem::check_final_convergence() {
 }
 
 void ITPSystem::save_states(bool sort) {
+	TraceScope trace("save states");
 	if (verb(2))
 		out << "\tSaving states..." << std::endl;
 	io_timer.start();
-	if (not sort)
-		datafile->write_stateset(states, total_step_counter, NULL);
-	else {
-		// Create a temporary list to store the order of states
-		std::list<size_t> sort_order;
+	// Create a temporary list to store the order of states
+	std::list<size_t> sort_order;
+	if (sort) {
 		for (size_t n=0; n<params.get_N(); n++)
 			sort_order.push_back(std::tr1::get<2>(Esn_tuples[n]));
-		datafile->write_stateset(states, total_step_counter, &sort_order);
 	}
+	std::list<size_t> const* order = sort? &sort_order : NULL;
+	if (writer != NULL) {
+		// Only the copying is done here, and the background writer does the rest
+		StateArray* const snapshot = writer->snapshot(states, order);
+		io_timer.stop();
+		writer->submit(new StateSetWriteJob(snapshot, total_step_counter));
+		return;
+	}
+	datafile->write_stateset(states, total_step_counter, order);
 	io_timer.stop();
 }
 
 void ITPSystem::save_energies() {
+	TraceScope trace("save energies");
+	const std::vector<double> no_values;
+	std::vector<double> const& E = energies.empty()? no_values : energies.back();
+	std::vector<double> const& sd = standard_deviations.empty()? no_values : standard_deviations.back();
+	if (writer != NULL) {
+		writer->submit(new FinalEnergiesWriteJob(E, sd));
+		return;
+	}
 	io_timer.start();
-	if (not energies.empty())
-		datafile->write_energies(energies.back());
-	if (not standard_deviations.empty())
-		datafile->write_energy_standard_deviations(standard_deviations.back());
+	if (not E.empty())
+		datafile->write_energies(E);
+	if (not sd.empty())
+		datafile->write_energy_standard_deviations(sd);
 	io_timer.stop();
 }
 
 void ITPSystem::save_energy_history() {
+	TraceScope trace("save energy history");
+	const size_t index = total_step_counter-1;
+	if (writer != NULL) {
+		writer->submit(new EnergyHistoryWriteJob(energies[index], standard_deviations[index], index));
+		return;
+	}
+	io_timer.start();
+	datafile->write_energy_history(energies[index], index);
+	datafile->write_deviation_history(standard_deviations[index], index);
+	io_timer.stop();
+}
+
+// Write the buffered rows of the history datasets to the file
+void ITPSystem::flush_history() {
+	TraceScope trace("flush history");
+	if (writer != NULL) {
+		writer->submit(new HistoryFlushJob());
+		return;
+	}
 	io_timer.start();
-	datafile->write_energy_history(energies[total_step_counter-1], total_step_counter-1);
-	datafile->write_deviation_history(standard_deviations[total_step_counter-1], total_step_counter-1);
+	datafile->flush_history();
 	io_timer.stop();
 }
 
 // A single iteration of imaginary time propagation
 void ITPSystem::step() {
+	TraceScope trace("step");
 	// First check for error conditions and increment some counters
 	if (abort_flagptr != NULL and *abort_flagptr) {
 		// The abort flag has been raised by a signal handler so we certainly
-		// have an error
+		// have an error. The states are as they were at the end of the last
+		// step, so this is a good spot for a checkpoint.
 		error_flag = true;
+		if (not params.get_checkpoint_file().empty())
+			write_checkpoint();
 		finish();
 		return;
 	}
-	if (total_step_counter == 0) { // This is the first step
+	if (total_step_counter == initial_step_counter) { // This is the first step
 		if (verb(1)) {
-			out << "Starting first propagation step." << std::endl;
+			if (resumed)
+				out << "Resuming propagation from step " << total_step_counter << "." << std::endl;
+			else
+				out << "Starting first propagation step." << std::endl;
 		}
 		total_timer.start();
 	}
-	if (total_step_counter >= params.get_max_steps()) {
+	if (total_step_counter - sweep_first_step >= params.get_max_steps()) {
 		err << "Error: Maximum number of total steps reached (" << params.get_max_steps() << ")." << std::endl
 			<< "Bailing out." << std::endl;
 		error_flag = true;
@@ -433,11 +762,14 @@ void ITPSystem::step() {
 		out << "Step " << total_step_counter << " (step " << step_counter << " with eps = " << std::scientific << eps << std::fixed << ") starting at "
 			<< timestring << std::endl;
 	}
+	start_telemetry();
 	// Propagate the states
 	propagate();
 	check_save_flag();
 	// Orthonormalize them
 	orthonormalize();
+	if (finished)
+		return;
 	check_save_flag();
 	// And check convergence
 	calculate_energies();
@@ -462,15 +794,189 @@ void ITPSystem::step() {
 			finish();
 			return;
 		}
+		if (params.get_compress_converged())
+			lock_converged_states();
 		change_time_step();
 	}
 	else if (exhausting_eps_values)
 		change_time_step();
+	// Reaching the minimum time step ends the simulation
+	if (finished)
+		return;
 	check_save_flag();
+	if (checkpoint_due())
+		write_checkpoint();
+	record_telemetry();
+}
+
+// Take the readings of the cumulative timers at the start of a step
+void ITPSystem::start_telemetry() {
+	telemetry.step = total_step_counter;
+	telemetry.propagation_time = get_prop_time();
+	telemetry.orthonormalization_time = get_ortho_time();
+	telemetry.convtest_time = get_convtest_time();
+	telemetry.io_time = get_io_time();
+	step_timer.reset();
+	step_timer.start();
+	telemetry_pending = true;
+}
+
+// Complete the telemetry of a step and save it along with the energy history.
+// A step that ends the simulation is recorded by finish(), since after it the
+// background writer is drained and the datafile is finalized.
+void ITPSystem::record_telemetry() {
+	if (finished or not telemetry_pending)
+		return;
+	telemetry_pending = false;
+	step_timer.stop();
+	telemetry.num_converged = static_cast<int>(how_many_finally_converged());
+	telemetry.num_timestep_converged = static_cast<int>(how_many_timestep_converged());
+	telemetry.wall_time = step_timer.get_time();
+	telemetry.propagation_time = get_prop_time() - telemetry.propagation_time;
+	telemetry.orthonormalization_time = get_ortho_time() - telemetry.orthonormalization_time;
+	telemetry.convtest_time = get_convtest_time() - telemetry.convtest_time;
+	telemetry.io_time = get_io_time() - telemetry.io_time;
+	const size_t propagated = params.get_N() - states.get_num_locked();
+	telemetry.states_per_second = (telemetry.wall_time > 0)? static_cast<double>(propagated)/telemetry.wall_time : 0.0;
+	telemetry.bytes_written = 0;
+	if (params.get_save_what() == Parameters::Nothing)
+		return;
+	if (writer != NULL) {
+		writer->submit(new TelemetryWriteJob(telemetry));
+		return;
+	}
+	io_timer.start();
+	datafile->write_telemetry(telemetry);
+	io_timer.stop();
+}
+
+// Write everything needed for continuing the simulation later to the
+// checkpoint file. The states are stored in the order they are in the
+// StateSet, together with the convergence flags, the list of time steps still
+// to be used and the complete histories. The checkpoint is first written to a
+// temporary file, which then replaces the previous checkpoint, so that an
+// interruption while writing leaves the previous checkpoint intact.
+void ITPSystem::write_checkpoint() {
+	TraceScope trace("write checkpoint");
+	if (verb(2))
+		out << "\tWriting checkpoint..." << std::endl;
+	// HDF5 must not be used from two threads at once
+	if (writer != NULL)
+		writer->flush();
+	io_timer.start();
+	const size_t N = params.get_N();
+	std::string const& filename = params.get_checkpoint_file();
+	const std::string tempname = filename + ".tmp";
+	{
+		Datafile checkpoint(tempname, datalayout, true, 1, NoCompression);
+		checkpoint.add_attribute("program_version", version_string);
+		checkpoint.add_attribute("random_seed", params.get_random_seed());
+		checkpoint.add_attribute("rng_state", rng.get_state());
+		checkpoint.add_attribute("num_states", static_cast<int>(N));
+		checkpoint.add_attribute("total_step_counter", total_step_counter);
+		checkpoint.add_attribute("step_counter", step_counter);
+		checkpoint.add_attribute("time_step", eps);
+		checkpoint.add_attribute("exhausting_eps_values", static_cast<int>(exhausting_eps_values));
+		checkpoint.add_attribute("all_needed_states_timestep_converged", static_cast<int>(all_needed_states_timestep_converged));
+		checkpoint.add_attribute("all_needed_states_finally_converged", static_cast<int>(all_needed_states_finally_converged));
+		checkpoint.add_attribute("num_locked", static_cast<int>(states.get_num_locked()));
+		checkpoint.write_stateset(states, total_step_counter);
+		std::vector<int> timestep_flags(N), final_flags(N), sorted_indices(N);
+		for (size_t n=0; n<N; n++) {
+			timestep_flags[n] = states.is_timestep_converged(n);
+			final_flags[n] = states.is_finally_converged(n);
+			sorted_indices[n] = static_cast<int>(std::tr1::get<2>(Esn_tuples[n]));
+		}
+		checkpoint.write_values("/timestep_converged", timestep_flags, "Timestep convergence flag of each state, in the order the states are stored.");
+		checkpoint.write_values("/finally_converged", final_flags, "Final convergence flag of each state, in the order the states are stored.");
+		checkpoint.write_values("/sorted_indices", sorted_indices, "Indices of the states in the order of their latest energies.");
+		std::vector<double> locked_E, locked_sd;
+		for (size_t l=0; l<locked_energies.size(); l++) {
+			locked_E.push_back(locked_energies[l].first);
+			locked_sd.push_back(locked_energies[l].second);
+		}
+		checkpoint.write_values("/locked_energies", locked_E, "Energies of the locked states at the time of locking.");
+		checkpoint.write_values("/locked_standard_deviations", locked_sd, "Standard deviations of energy of the locked states at the time of locking.");
+		checkpoint.write_values("/remaining_time_steps", std::vector<double>(eps_values.begin(), eps_values.end()),
+				"User-supplied time step values not used yet.");
+		checkpoint.write_energy_history(energies);
+		checkpoint.write_deviation_history(standard_deviations);
+		for (size_t i=0; i<time_step_history.size(); i++)
+			checkpoint.write_time_step_history(time_step_history[i].first, time_step_history[i].second);
+		checkpoint.flush();
+	}
+	if (rename(tempname.c_str(), filename.c_str()) != 0)
+		throw GeneralError("Cannot replace checkpoint file '" + filename + "'.");
+	io_timer.stop();
+	time(&last_checkpoint_time);
+}
+
+// Continue from the checkpoint written by write_checkpoint(). Everything that
+// affects the following steps is restored, so that the simulation continues
+// exactly as it would have without the interruption.
+void ITPSystem::resume_from_checkpoint() {
+	std::string const& filename = params.get_checkpoint_file();
+	if (verb(1))
+		out << "Resuming from checkpoint " << filename << "..." << std::endl;
+	const size_t N = params.get_N();
+	const Checkpoint checkpoint(filename);
+	// This also checks that the grid and the number of states match
+	states.init_from_datafile(filename);
+	const std::vector<int> timestep_flags = checkpoint.read_int_values("/timestep_converged");
+	const std::vector<int> final_flags = checkpoint.read_int_values("/finally_converged");
+	const std::vector<int> sorted_indices = checkpoint.read_int_values("/sorted_indices");
+	const std::vector<double> locked_E = checkpoint.read_double_values("/locked_energies");
+	const std::vector<double> locked_sd = checkpoint.read_double_values("/locked_standard_deviations");
+	const size_t num_locked = static_cast<size_t>(checkpoint.read_int("num_locked"));
+	if (timestep_flags.size() != N or final_flags.size() != N or sorted_indices.size() != N
+			or locked_E.size() != num_locked or locked_sd.size() != num_locked)
+		throw GeneralError("Checkpoint file '" + filename + "' is inconsistent.");
+	for (size_t n=0; n<N; n++) {
+		states.set_timestep_converged(n, timestep_flags[n] != 0);
+		states.set_finally_converged(n, final_flags[n] != 0);
+	}
+	// The locked states were stored in the first slots with their single
+	// precision values, so locking them again gives exactly the same states
+	for (size_t l=0; l<num_locked; l++) {
+		states.lock_state(l);
+		locked_energies.push_back(std::make_pair(locked_E[l], locked_sd[l]));
+	}
+	total_step_counter = checkpoint.read_int("total_step_counter");
+	step_counter = checkpoint.read_int("step_counter");
+	initial_step_counter = total_step_counter;
+	eps = checkpoint.read_double("time_step");
+	const std::vector<double> remaining_eps_values = checkpoint.read_double_values("/remaining_time_steps");
+	eps_values.assign(remaining_eps_values.begin(), remaining_eps_values.end());
+	exhausting_eps_values = checkpoint.read_int("exhausting_eps_values") != 0;
+	all_needed_states_timestep_converged = checkpoint.read_int("all_needed_states_timestep_converged") != 0;
+	all_needed_states_finally_converged = checkpoint.read_int("all_needed_states_finally_converged") != 0;
+	energies = checkpoint.read_history("/energy_history");
+	standard_deviations = checkpoint.read_history("/deviation_history");
+	time_step_history = checkpoint.read_time_step_history();
+	if (energies.size() != static_cast<size_t>(total_step_counter) or standard_deviations.size() != energies.size())
+		throw GeneralError("Checkpoint file '" + filename + "' is inconsistent.");
+	if (not energies.empty()) {
+		for (size_t n=0; n<N; n++)
+			Esn_tuples[n] = std::tr1::make_tuple(energies.back()[n], standard_deviations.back()[n],
+					static_cast<size_t>(sorted_indices[n]));
+	}
+	T->set_time_step(eps);
+	// The generator is still needed for resetting the states in recovery
+	rng.set_state(checkpoint.read_string("rng_state"));
+	resumed = true;
+	// The new datafile gets the complete histories
+	if (datafile != NULL) {
+		datafile->add_attribute("resumed_from_step", total_step_counter);
+		for (size_t i=0; i<time_step_history.size(); i++)
+			datafile->write_time_step_history(time_step_history[i].first, time_step_history[i].second);
+		datafile->write_energy_history(energies);
+		datafile->write_deviation_history(standard_deviations);
+	}
 }
 
 // Calculate energies and the standard deviations of energy for each state.
 void ITPSystem::calculate_energies() {
+	TraceScope trace("calculate energies");
 	// Don't bother calculating and saving the energies if no steps are done yet.
 	if (total_step_counter == 0)
 		return;
@@ -480,18 +986,27 @@ void ITPSystem::calculate_energies() {
 	// Clear the list of (energy,deviation,index)-tuples
 	Esn_tuples.clear();
 	const size_t N = params.get_N();
-	#pragma omp parallel for
-	for (size_t n=0; n<N; n++) {
-		const std::pair<comp,comp> e_and_sd = H.mean_and_standard_deviation(states[n],
-				*(workslices[omp_get_thread_num()]));
-		const double energy = std::real(e_and_sd.first);
-		const double deviation = std::real(e_and_sd.second);
-		const Esn_tuple new_tuple = std::tr1::make_tuple(energy, deviation, n);
-		#pragma omp critical
-		{
-			Esn_tuples.push_back(new_tuple);
+	const size_t block_size = states.get_block_size();
+	for (size_t first=states.get_num_locked(); first<N; first+=block_size) {
+		const size_t last = std::min(first+block_size, N);
+		states.prefetch_states(first, last-first);
+		#pragma omp parallel for schedule(static)
+		for (size_t n=first; n<last; n++) {
+			const std::pair<comp,comp> e_and_sd = H.mean_and_standard_deviation(states[n],
+					(*workspace)[omp_get_thread_num()]);
+			const double energy = std::real(e_and_sd.first);
+			const double deviation = std::real(e_and_sd.second);
+			const Esn_tuple new_tuple = std::tr1::make_tuple(energy, deviation, n);
+			#pragma omp critical
+			{
+				Esn_tuples.push_back(new_tuple);
+			}
 		}
+		states.release_states(first, last-first);
 	}
+	// Locked states keep the energies they had when they were locked
+	for (size_t l=0; l<states.get_num_locked(); l++)
+		Esn_tuples.push_back(std::tr1::make_tuple(locked_energies[l].first, locked_energies[l].second, l));
 	// Sort Esn_tuples according to energy
 	sort(Esn_tuples.begin(), Esn_tuples.end());
 	// Save energies and standard deviations
@@ -513,12 +1028,37 @@ void ITPSystem::calculate_energies() {
 void ITPSystem::finish() {
 	if (finished)
 		return;
+	// The step that ended the simulation, possibly with an error
+	record_telemetry();
+	// Return locked states to double precision so that they can be used as
+	// usual. Their values stay single precision approximations, which is
+	// recorded in the datafile.
+	const size_t single_precision_states = states.get_num_locked();
+	states.unlock_all();
 	if (params.get_save_what() == Parameters::FinalStates)
 		save_states();
-	if (params.get_save_what() != Parameters::Nothing) {
+	if (params.get_save_what() != Parameters::Nothing)
 		save_energies();
+	// Only the last point of a sweep finishes the whole simulation
+	if (params.is_sweep()) {
+		record_sweep_point();
+		print_sweep_point_message();
+		if (not error_flag and sweep_point+1 < params.get_num_sweep_points()) {
+			finished = true;
+			return;
+		}
+	}
+	if (params.get_save_what() != Parameters::Nothing) {
+		// Wait for the background writer before using the datafile directly
+		if (writer != NULL)
+			writer->flush();
 		io_timer.start();
+		datafile->flush_history();
+		if (params.is_sweep())
+			write_sweep_results();
+		datafile->write_statistics();
 		datafile->add_attribute("num_converged", static_cast<int>(how_many_finally_converged()));
+		datafile->add_attribute("num_single_precision_states", static_cast<int>(single_precision_states));
 		datafile->add_attribute("error_flag", error_flag);
 		datafile->add_attribute("total_steps_done", total_step_counter);
 		datafile->add_attribute("propagation_time", get_prop_time());
@@ -529,15 +1069,55 @@ void ITPSystem::finish() {
 		datafile->add_attribute("convtest_time", get_convtest_time());
 		io_timer.stop();
 		datafile->add_attribute("io_time", get_io_time());
+		if (writer != NULL) {
+			datafile->add_attribute("io_wait_time", get_io_wait_time());
+			datafile->add_attribute("background_io_time", writer->get_write_time());
+		}
 	}
 	total_timer.stop();
 	if (params.get_save_what() != Parameters::Nothing) {
 		datafile->add_attribute("total_time", get_total_time());
 	}
 	finished = true;
+	// A checkpoint of a successfully finished simulation is of no use
+	if (not error_flag and not params.get_checkpoint_file().empty())
+		remove(params.get_checkpoint_file().c_str());
 	print_final_message();
 }
 
+void ITPSystem::record_sweep_point() {
+	sweep_first_steps.push_back(sweep_first_step);
+	sweep_final_steps.push_back(total_step_counter);
+	sweep_num_converged.push_back(static_cast<int>(how_many_finally_converged()));
+	const bool has_energies = total_step_counter > sweep_first_step and not energies.empty();
+	sweep_energies.push_back(has_energies? energies.back() : std::vector<double>(params.get_N(), NaN));
+	sweep_deviations.push_back(has_energies? standard_deviations.back() : std::vector<double>(params.get_N(), NaN));
+}
+
+// The histories and the saved states of all points are in the usual datasets,
+// one point after another. These datasets tell which steps belong to which
+// point.
+void ITPSystem::write_sweep_results() {
+	const size_t done = sweep_final_steps.size();
+	const std::vector<double> values(params.get_sweep_values().begin(), params.get_sweep_values().begin()+done);
+	datafile->write_values("/sweep_values", values, "Value of the swept parameter at each finished sweep point.");
+	datafile->write_values("/sweep_first_steps", sweep_first_steps, "Value of the step counter before the first step of each sweep point. The steps of a sweep point are the rows of the history datasets from this index on.");
+	datafile->write_values("/sweep_final_steps", sweep_final_steps, "Value of the step counter at the end of each sweep point. The final states of a sweep point are saved with this step number.");
+	datafile->write_values("/sweep_num_converged", sweep_num_converged, "Number of states converged at each sweep point.");
+	datafile->write_values("/sweep_final_energies", sweep_energies, "Final energies of each sweep point, in increasing order.");
+	datafile->write_values("/sweep_final_energy_standard_deviations", sweep_deviations, "Standard deviations of the final energies of each sweep point.");
+}
+
+void ITPSystem::print_sweep_point_message() {
+	if (not verb(1))
+		return;
+	out << "Sweep point " << sweep_point+1 << " of " << params.get_num_sweep_points() << " finished after "
+		<< total_step_counter-sweep_first_step << " steps, " << how_many_finally_converged()
+		<< " states converged." << std::endl;
+	if (verb(2))
+		print_energies();
+}
+
 void ITPSystem::print_final_message() {
 	if (not verb(1))
 		return;
@@ -555,7 +1135,8 @@ void ITPSystem::print_final_message() {
 		const double lincomb_ratio = get_lincomb_time()/total_time;
 		const double convtest_ratio = get_convtest_time()/total_time;
 		const double io_ratio = get_io_time()/total_time;
-		const double other_ratio = 1.0 - prop_ratio - ortho_ratio - convtest_ratio - io_ratio;
+		const double io_wait_ratio = get_io_wait_time()/total_time;
+		const double other_ratio = 1.0 - prop_ratio - ortho_ratio - convtest_ratio - io_ratio - io_wait_ratio;
 		out << "Ratios:" << std::fixed << std::setprecision(3) << std::endl
 			<< "\tPropagation:         " << prop_ratio << std::endl
 			<< "\tOrthonormalization:  " << ortho_ratio << std::endl
@@ -563,8 +1144,14 @@ void ITPSystem::print_final_message() {
 			<< "\t      eigenvalues:   " << eigensolve_ratio << std::endl
 			<< "\t      combination:   " << lincomb_ratio << std::endl
 			<< "\tConvergence testing: " << convtest_ratio << std::endl
-			<< "\tI/O:                 " << io_ratio << std::endl
-			<< "\tOther:               " << other_ratio << std::endl << std::endl;
+			<< "\tI/O:                 " << io_ratio << std::endl;
+		if (writer != NULL)
+			out << "\tWaiting for I/O:     " << io_wait_ratio << std::endl;
+		out << "\tOther:               " << other_ratio << std::endl << std::endl;
+		if (datafile != NULL) {
+			datafile->print_statistics(out);
+			out << std::endl;
+		}
 		if (not error_flag)
 			print_energies();
 	}
@@ -580,7 +1167,7 @@ void ITPSystem::print_energies() {
 		const double error = std::tr1::get<1>(tuple);
 		const size_t index = std::tr1::get<2>(tuple);
 		out << "\t" << n << "\t" << std::fixed << sim_E;
-		if (not (params.get_B() != 0 and boundary_type == Dirichlet))
+		if (not (kin->B != 0 and boundary_type == Dirichlet))
 			out << " ± " << std::scientific << error;
 		if (not states.is_finally_converged(index))
 			out << " (not converged)";
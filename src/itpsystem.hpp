@@ -31,6 +31,8 @@
 #include <utility>
 #include <algorithm>
 #include <ctime>
+#include <cstdio>
+#include <cstring>
 #include <csignal>
 #include <tr1/tuple>
 
@@ -39,9 +41,12 @@
 #include "itp2d_common.hpp"
 #include "exceptions.hpp"
 #include "datafile.hpp"
+#include "checkpoint.hpp"
+#include "asyncwriter.hpp"
 #include "state.hpp"
 #include "stateset.hpp"
 #include "statearray.hpp"
+#include "workspace.hpp"
 #include "operators.hpp"
 #include "potential.hpp"
 #include "kinetic.hpp"
@@ -52,17 +57,49 @@
 #include "potentialtypes.hpp"
 #include "convergence.hpp"
 
+// The grid, the FFTW plans and the kinetic energy operator of a system. These
+// are only read during propagation, so an ensemble of systems with the same
+// grid and magnetic field can share one instance. The ensemble also shares
+// the tables of the exponentiated kinetic energy operator, which the systems
+// acquire and release as their time steps change.
+class SharedOperators {
+	public:
+		SharedOperators(Parameters const& params);
+		const DataLayout datalayout;
+		const Transformer transformer;
+		const Kinetic kinetic;
+		mutable ExpKineticCache kinetic_tables;
+};
+
 class ITPSystem {
 	public:
 		typedef std::tr1::tuple<double,double,size_t> Esn_tuple;
 		// Constructors & destructors
-		// All parameters for ITPSystem are provided by the Parameters class
+		// All parameters for ITPSystem are provided by the Parameters class. If
+		// shared operators are given, they must match the grid in params and
+		// outlive the system, otherwise the system creates its own. A given
+		// workspace is used if it is large enough.
 		ITPSystem(Parameters const& params,
 				volatile sig_atomic_t* abort_flagptr = NULL,
 				volatile sig_atomic_t* save_flagptr = NULL,
 				std::ostream& out = std::cout,
-				std::ostream& err = std::cerr);
+				std::ostream& err = std::cerr,
+				SharedOperators const* shared_operators = NULL,
+				Workspace* shared_workspace = NULL);
 		~ITPSystem();
+		// Parameters for level 'level' of a coarse-to-fine cascade, starting
+		// from the final states of the coarser level, if given
+		static Parameters cascade_parameters(Parameters const& params, size_t level, ITPSystem const* coarser = NULL);
+		// In a parameter sweep, continue with the next sweep point after the
+		// previous one has finished, starting from its states and final time
+		// step. Returns false if there are no more points to do.
+		bool next_sweep_point();
+		// Hand the workspace the system allocated for itself over to the
+		// caller, for reuse by a later system with the same grid. Returns NULL
+		// if the system used a given workspace. The system cannot be stepped
+		// afterwards. The workspace refers to the grid of the system, so it
+		// can only outlive the system if the operators were shared.
+		Workspace* release_workspace();
 		// Status checks
 		inline size_t how_many_timestep_converged() { return states.get_num_timestep_converged(); }
 		inline size_t how_many_finally_converged() { return states.get_num_finally_converged(); }
@@ -83,12 +120,20 @@ class ITPSystem {
 		inline double get_eigensolve_time() { return states.get_eigensolve_time(); }
 		inline double get_lincomb_time() { return states.get_lincomb_time(); }
 		inline double get_io_time() { return io_timer.get_time(); }
+		inline double get_io_wait_time() { return (writer != NULL)? writer->get_wait_time() : 0.0; }
 		inline double get_convtest_time() { return convtest_timer.get_time(); }
+		inline Datafile::telemetry_row const& get_telemetry() const { return telemetry; }	// Telemetry of the latest step
 		inline StateSet const& get_states() const { return states; }
 		inline State const& get_state(size_t n) const { return states[n]; }
 		inline Potential const& get_potential() const { return *pot; }
+		inline Noise const& get_noise() const { return *noise; }
 		inline OperatorSum const& get_hamiltonian() const { return H; }
 		inline double get_eps() const { return eps; }
+		inline bool is_resumed() const { return resumed; }
+		inline size_t get_sweep_point() const { return sweep_point; }
+		inline std::vector<int> const& get_sweep_final_steps() const { return sweep_final_steps; }
+		inline std::vector<std::vector<double> > const& get_sweep_energies() const { return sweep_energies; }
+		inline double get_B() const { return kin->B; }
 		// Main operation
 		void step();	// A single iteration of ITP
 		void check_timestep_convergence();
@@ -97,18 +142,35 @@ class ITPSystem {
 		void save_states(bool sort = true); // If sort is true, states are sorted according to energy
 		void save_energies();
 		void save_energy_history();
+		void flush_history();
+		void write_checkpoint();
 		void print_energies();
 		void finish();
 		const Parameters params;
-		const DataLayout datalayout;
-		const Transformer transformer;
+	private:
+		SharedOperators const* const own_operators;	// NULL if the operators are shared
+		SharedOperators const& operators;
+	public:
+		DataLayout const& datalayout;
+		Transformer const& transformer;
 		const BoundaryType boundary_type;
 	private:
+		static Parameters resumed_parameters(Parameters const& params);
+		void resume_from_checkpoint();
+		inline bool checkpoint_due() const;
 		void print_initial_message();
 		void print_final_message();
+		void print_sweep_point_message();
+		void start_telemetry();
+		void record_telemetry();
+		void record_sweep_point();
+		void write_sweep_results();
+		void allocate_workspace(size_t per_thread);
+		void set_kinetic(double B);
 		void propagate();
 		void orthonormalize();
 		void change_time_step();
+		void lock_converged_states();
 		inline void check_save_flag();
 		inline bool verb(int level) const { return (params.get_verbosity() >= level)? true : false; }
 		inline void update_timestring();
@@ -124,11 +186,18 @@ class ITPSystem {
 		bool all_needed_states_timestep_converged;
 		bool all_needed_states_finally_converged;
 		bool exhausting_eps_values;
+		bool resumed;	// True if the simulation was continued from a checkpoint
 		// Timers, RNG etc helpers
 		RNG rng;
 		Timer total_timer, prop_timer, io_timer, convtest_timer;
+		// The timers above are cumulative, so the telemetry of a step is the
+		// difference of their readings at the start and end of the step
+		Timer step_timer;
+		Datafile::telemetry_row telemetry;
+		bool telemetry_pending;	// True between start_telemetry() and record_telemetry()
 		time_t rawtime;
-		struct tm* timeinfo;
+		time_t last_checkpoint_time;
+		struct tm timeinfo;
 		char timestring[24];
 		// Main members
 		PotentialType const* pot_type;
@@ -137,28 +206,46 @@ class ITPSystem {
 		ImpurityDistribution const* impurity_distribution;
 		Constraint const* impurity_constraint;
 		Potential const* pot;
-		const Kinetic kin;
+		Kinetic const* kin;
 		OperatorSum H;
 		MultiProductSplit* T;
 		Datafile* datafile;
+		AsyncWriter* writer;	// Writes to datafile in the background, or NULL if writing synchronously
 		StateSet states;
-		StateArray** workslices;
+		Workspace* const shared_workspace;
+		Workspace* workspace;	// Either the shared workspace or one owned by the system
 		std::vector<std::vector<double> > energies;				// A vector of energy values for each iteration
 		std::vector<std::vector<double> > standard_deviations;	// ... and the same thing for the standard deviations of energy
 		std::vector<Esn_tuple> Esn_tuples;	// A vector of tuples (E,s,n), where E is the energy of a state,
 											// s is the standard deviation, and n is the index where the state is stored in the StateSet.
 											// This will be updated whenever new energy values are calculated.
+		std::vector<std::pair<double,double> > locked_energies;	// Energies and standard deviations of locked states at the time of locking
 		// Running counters etc.
 		int total_step_counter;
 		int step_counter;
+		int initial_step_counter;	// Value of total_step_counter before the first step, nonzero when resumed
 		double eps;
 		std::list<double> eps_values;
+		std::vector<std::pair<int,double> > time_step_history;	// Pairs of (first step, time step), as in the datafile
+		// Parameter sweep
+		size_t sweep_point;		// Index of the current sweep point, 0 if not sweeping
+		int sweep_first_step;	// Value of total_step_counter when the current sweep point started
+		std::vector<int> sweep_first_steps;
+		std::vector<int> sweep_final_steps;
+		std::vector<int> sweep_num_converged;
+		std::vector<std::vector<double> > sweep_energies;	// Final energies of each finished sweep point
+		std::vector<std::vector<double> > sweep_deviations;
 };
 
+inline bool ITPSystem::checkpoint_due() const {
+	return not finished and not params.get_checkpoint_file().empty()
+		and difftime(time(NULL), last_checkpoint_time) >= params.get_checkpoint_interval();
+}
+
 inline void ITPSystem::update_timestring() {
 	time (&rawtime);
-	timeinfo = gmtime(&rawtime);
-	__attribute__((unused)) const size_t retval = strftime(timestring, 24, "%Y-%m-%d %H:%M:%SZ", timeinfo);
+	gmtime_r(&rawtime, &timeinfo);
+	__attribute__((unused)) const size_t retval = strftime(timestring, 24, "%Y-%m-%d %H:%M:%SZ", &timeinfo);
 	assert(retval != 0);
 }
 
@@ -20,15 +20,19 @@
 
 // For more documentation please see the article referenced in multiproductsplit.hpp.
 
-MultiProductSplit::MultiProductSplit(int hord, Potential const& original_potential, double time_step, Transformer const& tr, BoundaryType bt, double B) :
-		halforder((original_potential.is_null())? 1 : hord) {
+MultiProductSplit::MultiProductSplit(int hord, Potential const& original_potential, double time_step, Transformer const& tr, BoundaryType bt, double B,
+		ExpKineticCache* kinetic_cache) :
+		halforder((original_potential.is_null())? 1 : hord),
+		potential_tables(original_potential),
+		owned_kinetic_tables((kinetic_cache == NULL)? new ExpKineticCache(tr) : NULL) {
 	assert(tr.datalayout == original_potential.datalayout);
 	assert(halforder >= 1);
 	coefficients = new double[halforder];
 	calculate_coefficients();
 	members.resize(halforder);
 	for (int t=0; t<halforder; t++) {
-		members[t] = new SecondOrderSplit(original_potential, time_step/(t+1), B, tr, bt, coefficients[t], t+1);
+		members[t] = new SecondOrderSplit(original_potential, time_step/(t+1), B, tr, bt, coefficients[t], t+1,
+				&potential_tables, (kinetic_cache == NULL)? owned_kinetic_tables : kinetic_cache);
 		(*this) += *(members[t]);
 	}
 }
@@ -37,6 +41,7 @@ MultiProductSplit::~MultiProductSplit() {
 	for (size_t t=0; t<members.size(); t++) {
 		delete members[t];
 	}
+	delete owned_kinetic_tables;
 	delete[] coefficients;
 }
 
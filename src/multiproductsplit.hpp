@@ -31,13 +31,21 @@
 class MultiProductSplit : public EvolutionOperator, public OperatorSum {
 	public:
 		typedef std::vector<SecondOrderSplit*> membervector;
-		MultiProductSplit(int halforder, Potential const& original_potential, double time_step, Transformer const& tr, BoundaryType bt, double B=0);
+		// The tables of the exponentiated kinetic energy are taken from the
+		// given cache, which may be shared with other operators, or from a
+		// private one if none is given
+		MultiProductSplit(int halforder, Potential const& original_potential, double time_step, Transformer const& tr, BoundaryType bt, double B=0,
+				ExpKineticCache* kinetic_cache = NULL);
 		~MultiProductSplit();
 		void set_time_step(double time_step);
+		inline ExpPotentialCache const& get_potential_tables() const { return potential_tables; }
 		const int halforder;
 	private:
 		void calculate_coefficients();
 		double* coefficients;
+		// Tables of the exponentiated potential, shared by all members
+		ExpPotentialCache potential_tables;
+		ExpKineticCache* owned_kinetic_tables;
 		// The members of the expansion. Each will be a SecondOrderSplit
 		// operator with a certain prefactor and time step size
 		membervector members;
@@ -22,15 +22,15 @@ using namespace std;
 
 // GaussianImpurities
 
-void GaussianImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, double* pot_values) const {
+void GaussianImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const {
 	if (params.size() != num_params)
 		throw GeneralError("GaussianImpurities constructor with incorrect length for parameter vector. This should never happen.");
 	const double A = params[0];
 	const double w = params[1];
 	const double w2 = w*w;
-	for (size_t x=0; x<dl.sizex; x++) {
+	for (size_t x=box.x_begin; x<box.x_end; x++) {
 		const double px = dl.get_posx(x);
-		for (size_t y=0; y<dl.sizey; y++) {
+		for (size_t y=box.y_begin; y<box.y_end; y++) {
 			const double py = dl.get_posy(y);
 			const double rx = sx-px;
 			const double ry = sy-py;
@@ -42,12 +42,12 @@ void GaussianImpurities::add_noise(double sx, double sy, vector<double> const& p
 
 // CoulombImpurities
 
-void CoulombImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, double* pot_values) const {
+void CoulombImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const {
 	if (params.size() != num_params)
 		throw GeneralError("CoulombImpurities constructor with incorrect length for parameter vector. This should never happen.");
-	for (size_t x=0; x<dl.sizex; x++) {
+	for (size_t x=box.x_begin; x<box.x_end; x++) {
 		const double px = dl.get_posx(x);
-		for (size_t y=0; y<dl.sizey; y++) {
+		for (size_t y=box.y_begin; y<box.y_end; y++) {
 			const double py = dl.get_posy(y);
 			const double rx = sx-px;
 			const double ry = sy-py;
@@ -57,14 +57,103 @@ void CoulombImpurities::add_noise(double sx, double sy, vector<double> const& pa
 	}
 }
 
+// Grid coordinate of position p, which may be outside the grid or fractional
+static double grid_coordinate(double p, size_t s, double d) {
+	return p/d + (static_cast<double>(s)-1)/2;
+}
+
+// Signed distance in grid points that index i of a periodic grid of size s
+// corresponds to
+static double signed_index(size_t i, size_t s) {
+	return (i < s/2)? static_cast<double>(i) : static_cast<double>(i)-static_cast<double>(s);
+}
+
+bool CoulombImpurities::add_all_noise(vector<double> const& positions, __attribute__((unused)) vector< vector<double> > const& params, DataLayout const& dl, double* pot_values) const {
+	if (not convolve)
+		return false;
+	// The convolution done with FFTs is periodic. Without periodic boundary
+	// conditions the grid is padded so that the potential of each impurity
+	// does not wrap around the grid. Impurities are deposited on grid points
+	// -1, ..., s of a grid of s points, so the distances from them to the
+	// grid range from -s to s, and the padded grid of 2s+2 points holds
+	// the kernel for all of them.
+	const bool periodic = (boundary == Periodic);
+	const DataLayout padded(periodic? dl.sizex : 2*dl.sizex+2, periodic? dl.sizey : 2*dl.sizey+2, dl.dx);
+	const Transformer transformer(padded, FFTW_ESTIMATE);
+	comp* const charges = malloc_comp(padded.N);
+	comp* const kernel = malloc_comp(padded.N);
+	// The potential of a single impurity, cut off at half a grid spacing
+	const double min_r2 = 0.25*dl.dx*dl.dx;
+	#pragma omp parallel for schedule(static)
+	for (size_t y=0; y<padded.sizey; y++) {
+		const double ry = signed_index(y, padded.sizey)*dl.dx;
+		for (size_t x=0; x<padded.sizex; x++) {
+			const double rx = signed_index(x, padded.sizex)*dl.dx;
+			const double r2 = std::max(rx*rx + ry*ry, min_r2);
+			padded.value(kernel, x, y) = alpha*pow(r2, -halfexponent);
+			padded.value(charges, x, y) = 0;
+		}
+	}
+	// Deposit the impurities on the grid points around them with bilinear
+	// weights. Without periodic boundary conditions the padding leaves room
+	// for one grid point on each side of the grid, so impurities within one
+	// grid spacing of the grid are deposited on grid points -1, ..., s.
+	// Impurities further away are added directly.
+	const GridBox grid = {0, dl.sizex, 0, dl.sizey};
+	const vector<double> no_params;
+	for (size_t i=0; i<positions.size(); i+=2) {
+		double gx = grid_coordinate(positions[i], dl.sizex, dl.dx);
+		double gy = grid_coordinate(positions[i+1], dl.sizey, dl.dx);
+		if (periodic) {
+			gx -= floor(gx/static_cast<double>(dl.sizex))*static_cast<double>(dl.sizex);
+			gy -= floor(gy/static_cast<double>(dl.sizey))*static_cast<double>(dl.sizey);
+		}
+		else if (gx < -1 or gx >= static_cast<double>(dl.sizex) or gy < -1 or gy >= static_cast<double>(dl.sizey)) {
+			add_noise(positions[i], positions[i+1], no_params, dl, grid, pot_values);
+			continue;
+		}
+		const double fx = floor(gx);
+		const double fy = floor(gy);
+		const double tx = gx-fx;
+		const double ty = gy-fy;
+		const int ix = static_cast<int>(fx);
+		const int iy = static_cast<int>(fy);
+		const int sx = static_cast<int>(padded.sizex);
+		const int sy = static_cast<int>(padded.sizey);
+		const size_t x0 = static_cast<size_t>((ix+sx) % sx);
+		const size_t x1 = static_cast<size_t>((ix+1+sx) % sx);
+		const size_t y0 = static_cast<size_t>((iy+sy) % sy);
+		const size_t y1 = static_cast<size_t>((iy+1+sy) % sy);
+		padded.value(charges, x0, y0) += (1-tx)*(1-ty);
+		padded.value(charges, x1, y0) += tx*(1-ty);
+		padded.value(charges, x0, y1) += (1-tx)*ty;
+		padded.value(charges, x1, y1) += tx*ty;
+	}
+	transformer.transform(charges, FFT);
+	transformer.transform(kernel, FFT);
+	const double norm = transformer.normalization_factor(Periodic);
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<padded.N; i++)
+		charges[i] *= norm*kernel[i];
+	transformer.transform(charges, iFFT);
+	#pragma omp parallel for schedule(static)
+	for (size_t y=0; y<dl.sizey; y++) {
+		for (size_t x=0; x<dl.sizex; x++)
+			dl.value(pot_values, x, y) += real(padded.value(charges, x, y));
+	}
+	fftw_free(charges);
+	fftw_free(kernel);
+	return true;
+}
+
 // HemisphereImpurities
 
-void HemisphereImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, double* pot_values) const {
+void HemisphereImpurities::add_noise(double sx, double sy, vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const {
 	if (params.size() != num_params)
 		throw GeneralError("HemisphereImpurities constructor with incorrect length for parameter vector. This should never happen.");
-	for (size_t x=0; x<dl.sizex; x++) {
+	for (size_t x=box.x_begin; x<box.x_end; x++) {
 		const double px = dl.get_posx(x);
-		for (size_t y=0; y<dl.sizey; y++) {
+		for (size_t y=box.y_begin; y<box.y_end; y++) {
 			const double py = dl.get_posy(y);
 			const double dx = sx-px;
 			const double dy = sy-py;
@@ -77,44 +166,120 @@ void HemisphereImpurities::add_noise(double sx, double sy, vector<double> const&
 
 // DeltaImpurities
 
-void DeltaImpurities::add_noise(double sx, double sy, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const {
+// Index of the grid point nearest to position p, which might be outside the
+// grid. Like DataLayout::nearest_index, but does not throw.
+static int nearest_grid_index(double p, size_t s, double d) {
+	return round_to_int(p/d + (static_cast<double>(s)-1)/2);
+}
+
+static bool index_in_range(int i, size_t begin, size_t end) {
+	return i >= static_cast<int>(begin) and i < static_cast<int>(end);
+}
+
+void DeltaImpurities::add_noise(double sx, double sy, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const {
 	if (params.size() != num_params)
 		throw GeneralError("DeltaImpurities::add_noise with incorrect length for parameter vector. This should never happen.");
 	const double A = params[0];
-	size_t x = dl.get_x_index(sx);
-	size_t y = dl.get_y_index(sy);
-	dl.value(pot_values, x, y) += A;
+	const int x = nearest_grid_index(sx, dl.sizex, dl.dx);
+	const int y = nearest_grid_index(sy, dl.sizey, dl.dx);
+	if (index_in_range(x, box.x_begin, box.x_end) and index_in_range(y, box.y_begin, box.y_end))
+		dl.value(pot_values, static_cast<size_t>(x), static_cast<size_t>(y)) += A;
 }
 
 // SpatialImpurities
 
 SpatialImpurities::SpatialImpurities(ImpurityType const& _type, ImpurityDistribution const& _distribution) :
-		type(_type), distribution(_distribution) {
+		type(_type), distribution(_distribution), truncation_error_bound(0.0) {
 	list<coordinate_pair> const& coords = distribution.get_coordinates();
+	vector<double> params;
 	for (list<coordinate_pair>::const_iterator it = coords.begin(); it != coords.end(); ++it) {
 		double const& x = it->first;
 		double const& y = it->second;
 		realization_data.push_back(x);
 		realization_data.push_back(y);
+		list<double>::iterator first_param = realization_data.end();
+		--first_param;
 		type.new_realization(realization_data);
+		// The truncation errors of all impurities can add up at a single grid
+		// point, so the bound is their sum
+		params.assign(++first_param, realization_data.end());
+		truncation_error_bound += type.get_truncation_error(params);
+	}
+}
+
+// Range of grid indices [begin, end) with positions within radius r of p. A
+// negative radius covers the whole grid.
+static void support_range(double p, double r, size_t s, double d, size_t& begin, size_t& end) {
+	if (r < 0) {
+		begin = 0;
+		end = s;
+		return;
 	}
+	const double offset = (static_cast<double>(s)-1)/2;
+	const double lo = std::max(0.0, ceil((p-r)/d + offset));
+	const double hi = std::min(static_cast<double>(s), floor((p+r)/d + offset) + 1);
+	begin = static_cast<size_t>(std::min(lo, static_cast<double>(s)));
+	end = static_cast<size_t>(std::max(hi, 0.0));
+	if (end < begin)
+		end = begin;
 }
 
 void SpatialImpurities::add_noise(DataLayout const& dl, double* pot_values) const {
-	if (realization_data.size() % (2+type.get_num_params()) != 0) {
+	const size_t stride = 2+type.get_num_params();
+	if (realization_data.size() % stride != 0) {
 		throw GeneralError("SpatialImpurities::add_noise() with incorrect length for realization_data vector. This should never happen.");
 	}
+	const size_t num_impurities = realization_data.size()/stride;
+	vector<double> positions(2*num_impurities);
+	vector< vector<double> > params(num_impurities);
 	list<double>::const_iterator it = realization_data.begin();
-	vector<double> params;
-	do {
-		const double x = *it; ++it;
-		const double y = *it; ++it;
-		for (size_t i=0; i<type.get_num_params(); i++) {
-			params.push_back(*it); it++;
+	for (size_t i=0; i<num_impurities; i++) {
+		positions[2*i] = *it; ++it;
+		positions[2*i+1] = *it; ++it;
+		for (size_t j=0; j<type.get_num_params(); j++) {
+			params[i].push_back(*it); ++it;
+		}
+	}
+	if (type.add_all_noise(positions, params, dl, pot_values))
+		return;
+	vector<GridBox> supports(num_impurities);
+	// Bin the impurities into the tiles that their supports overlap
+	const size_t tiles_x = (dl.sizex+tile_size-1)/tile_size;
+	const size_t tiles_y = (dl.sizey+tile_size-1)/tile_size;
+	vector< vector<size_t> > bins(tiles_x*tiles_y);
+	for (size_t i=0; i<num_impurities; i++) {
+		const double r = type.get_support_radius(params[i], dl);
+		GridBox& support = supports[i];
+		support_range(positions[2*i], r, dl.sizex, dl.dx, support.x_begin, support.x_end);
+		support_range(positions[2*i+1], r, dl.sizey, dl.dx, support.y_begin, support.y_end);
+		if (support.x_begin == support.x_end or support.y_begin == support.y_end)
+			continue;
+		for (size_t ty=support.y_begin/tile_size; ty<=(support.y_end-1)/tile_size; ty++) {
+			for (size_t tx=support.x_begin/tile_size; tx<=(support.x_end-1)/tile_size; tx++)
+				bins[ty*tiles_x+tx].push_back(i);
 		}
-		type.add_noise(x, y, params, dl, pot_values);
-		params.clear();
-	} while (it != realization_data.end());
+	}
+	// Tiles do not overlap, so each tile can be processed by a separate
+	// thread. Within a tile the impurities are added in their original order.
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t t=0; t<bins.size(); t++) {
+		const size_t tx = t % tiles_x;
+		const size_t ty = t / tiles_x;
+		GridBox tile;
+		tile.x_begin = tx*tile_size;
+		tile.x_end = std::min((tx+1)*tile_size, dl.sizex);
+		tile.y_begin = ty*tile_size;
+		tile.y_end = std::min((ty+1)*tile_size, dl.sizey);
+		for (vector<size_t>::const_iterator i = bins[t].begin(); i != bins[t].end(); ++i) {
+			GridBox const& support = supports[*i];
+			GridBox box;
+			box.x_begin = std::max(tile.x_begin, support.x_begin);
+			box.x_end = std::min(tile.x_end, support.x_end);
+			box.y_begin = std::max(tile.y_begin, support.y_begin);
+			box.y_end = std::min(tile.y_end, support.y_end);
+			type.add_noise(positions[2*(*i)], positions[2*(*i)+1], params[*i], dl, box, pot_values);
+		}
+	}
 }
 
 void SpatialImpurities::write_realization_data(vector<double>& vec) const {
@@ -125,25 +290,33 @@ void SpatialImpurities::write_realization_data(vector<double>& vec) const {
 
 // noise parser function
 
-ImpurityType const* parse_impurity_type_description(string const& type_str, DataLayout const& dl, RNG& rng) {
+ImpurityType const* parse_impurity_type_description(string const& type_str, DataLayout const& dl, RNG& rng, BoundaryType boundary) {
 	name_parameters_pair p;
 	p = parse_parameter_string(type_str);
 	string const& name = p.first;
 	vector<double> const& params = p.second;
 	// Simply delegate to the individual constructors based on name
 	if (name == "gaussian" or name == "gaussians") {
+		// An optional last parameter gives the cutoff in widths
+		if ((params.size() == 3 or params.size() == 5) and not (params.back() > 0))
+			throw InvalidImpurityType("The cutoff of GaussianImpurities needs to be positive");
 		if (params.size() == 2)
 			return new GaussianImpurities(params[0], 0.0, params[1], 0.0, rng);
+		else if (params.size() == 3)
+			return new GaussianImpurities(params[0], 0.0, params[1], 0.0, rng, params[2]);
 		else if (params.size() == 4)
 			return new GaussianImpurities(params[0], params[1], params[2], params[3], rng);
+		else if (params.size() == 5)
+			return new GaussianImpurities(params[0], params[1], params[2], params[3], rng, params[4]);
 		else
-			throw InvalidImpurityType("Impurity type GaussianImpurities takes either 2 or 4 parameters");
+			throw InvalidImpurityType("Impurity type GaussianImpurities takes either 2 or 4 parameters, plus an optional cutoff");
 	}
-	else if (name == "coulomb") {
+	else if (name == "coulomb" or name == "coulombfft" or name == "coulomb-fft") {
+		const bool convolve = (name != "coulomb");
 		if (params.size() == 2)
-			return new CoulombImpurities(params[0], params[1], rng);
+			return new CoulombImpurities(params[0], params[1], rng, convolve, boundary);
 		else if (params.empty())
-			return new CoulombImpurities(1.0, 1.0, rng);
+			return new CoulombImpurities(1.0, 1.0, rng, convolve, boundary);
 		else
 			throw InvalidImpurityType("Impurity type CoulombImpurities takes either 2 or 0 parameters");
 	}
@@ -19,12 +19,14 @@
 #ifndef _NOISE_HPP_
 #define _NOISE_HPP_
 
+#include <algorithm>
 #include <list>
 #include <vector>
 #include <tr1/tuple>
 
 #include "itp2d_common.hpp"
 #include "datalayout.hpp"
+#include "transformer.hpp"
 #include "rng.hpp"
 #include "parser.hpp"
 #include "constraint.hpp"
@@ -41,6 +43,18 @@ class Noise {
 		// Write internal data which can be used to re-create the noise realization. For example for
 		// Gaussian impurities, store the positions, amplitudes and widths of the Gaussians.
 		virtual void write_realization_data(std::vector<double>& vec) const = 0;
+		// Upper bound for the error any single grid point gets from evaluating
+		// the noise only near its source. Zero if the noise is evaluated
+		// exactly.
+		virtual double get_truncation_error_bound() const { return 0.0; }
+};
+
+// A rectangle of grid points, with indices x_begin <= x < x_end and
+// y_begin <= y < y_end
+
+struct GridBox {
+	size_t x_begin, x_end;
+	size_t y_begin, y_end;
 };
 
 // Interface class of impurity types
@@ -49,8 +63,20 @@ class ImpurityType {
 	public:
 		virtual ~ImpurityType() {};
 		virtual void new_realization(std::list<double>& params) const = 0;
-		virtual void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const = 0;
+		// Add the impurity located at (x,y) to the grid points inside box
+		virtual void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const = 0;
 		virtual size_t get_num_params() const = 0;
+		// Radius outside which the impurity is not evaluated, or a negative
+		// value if the impurity needs to be evaluated on the whole grid
+		virtual double get_support_radius(__attribute__((unused)) std::vector<double> const& params, __attribute__((unused)) DataLayout const& dl) const { return -1; }
+		// Upper bound for the part of the impurity left out by only evaluating
+		// it inside the support radius
+		virtual double get_truncation_error(__attribute__((unused)) std::vector<double> const& params) const { return 0.0; }
+		// Add all impurities at once, if the type has a faster way of doing
+		// that than adding them one by one. Returns false if it does not.
+		virtual bool add_all_noise(__attribute__((unused)) std::vector<double> const& positions,
+				__attribute__((unused)) std::vector< std::vector<double> > const& params,
+				__attribute__((unused)) DataLayout const& dl, __attribute__((unused)) double* pot_values) const { return false; }
 		std::string const& get_description() const { return description; }
 	protected:
 		std::string description;
@@ -81,10 +107,16 @@ class SpatialImpurities : public Noise {
 		std::string const& get_distribution_description() const { return distribution.get_description(); }
 		std::string const& get_constraint_description() const { return distribution.get_constraint().get_description(); }
 		void write_realization_data(std::vector<double>& vec) const;
+		double get_truncation_error_bound() const { return truncation_error_bound; }
 		ImpurityType const& type;
 		ImpurityDistribution const& distribution;
+		// The grid is processed in parallel in square tiles of this many grid
+		// points per side, each tile evaluating only the impurities that reach
+		// it
+		static const size_t tile_size = 64;
 	private:
 		std::list<double> realization_data;
+		double truncation_error_bound;
 };
 
 // The trivial case of no noise at all
@@ -108,13 +140,18 @@ class NoNoise : public Noise {
 class GaussianImpurities : public ImpurityType {
 	static const size_t num_params = 2;
 	public:
-		GaussianImpurities(double _amp_mean, double _amp_stdev, double _width_mean, double _width_stdev, RNG& _rng) :
-				amp_mean(_amp_mean), amp_stdev(_amp_stdev), width_mean(_width_mean), width_stdev(_width_stdev), rng(_rng) {
+		// If cutoff is positive, each Gaussian is only evaluated up to cutoff
+		// times its width from its center
+		GaussianImpurities(double _amp_mean, double _amp_stdev, double _width_mean, double _width_stdev, RNG& _rng, double _cutoff = 0) :
+				amp_mean(_amp_mean), amp_stdev(_amp_stdev), width_mean(_width_mean), width_stdev(_width_stdev), cutoff(_cutoff), rng(_rng) {
 			std::stringstream ss;
 			ss << "Gaussian spikes, normally distributed amplitude with mean " << amp_mean
 				<< " and standard deviation " << amp_stdev
 				<< ", normally distributed width with mean " << width_mean
 				<< " and standard deviation " << width_stdev;
+			if (cutoff > 0)
+				ss << ", cut off at " << cutoff << " widths with relative truncation error "
+					<< std::exp(-0.5*cutoff*cutoff);
 			description = ss.str();
 		}
 		void new_realization(std::list<double>& params) const {
@@ -123,32 +160,51 @@ class GaussianImpurities : public ImpurityType {
 			params.push_back(A);
 			params.push_back(w);
 		}
-		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const;
+		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const;
 		size_t get_num_params() const { return num_params; }
+		double get_support_radius(std::vector<double> const& params, __attribute__((unused)) DataLayout const& dl) const {
+			return (cutoff > 0)? cutoff*std::abs(params[1]) : -1;
+		}
+		double get_truncation_error(std::vector<double> const& params) const {
+			return (cutoff > 0)? std::abs(params[0])*std::exp(-0.5*cutoff*cutoff) : 0.0;
+		}
 	private:
 		double amp_mean;
 		double amp_stdev;
 		double width_mean;
 		double width_stdev;
+		double cutoff;
 		RNG& rng;
 };
 
 class CoulombImpurities : public ImpurityType {
 	static const size_t num_params = 0;
 	public:
-		CoulombImpurities(double e, double _alpha, RNG& _rng) :
-				halfexponent(e/2), alpha(_alpha), rng(_rng) {
+		// If convolve is true, the impurities are deposited on the grid and
+		// convolved with the potential of a single impurity using FFTs. With
+		// periodic boundary conditions only the nearest periodic image of each
+		// impurity is then taken into account.
+		CoulombImpurities(double e, double _alpha, RNG& _rng, bool _convolve = false, BoundaryType _boundary = Periodic) :
+				halfexponent(e/2), alpha(_alpha), convolve(_convolve), boundary(_boundary), rng(_rng) {
 			std::stringstream ss;
 			ss << "Coulomb-like impurities with exponent " << 2*halfexponent
 				<< " and prefactor " << alpha;
+			if (convolve) {
+				ss << ", convolved on the grid";
+				if (boundary == Periodic)
+					ss << " using the nearest periodic images";
+			}
 			description = ss.str();
 		}
 		void new_realization(__attribute__((unused)) std::list<double>& params) const {}
-		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const;
+		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const;
+		bool add_all_noise(std::vector<double> const& positions, std::vector< std::vector<double> > const& params, DataLayout const& dl, double* pot_values) const;
 		size_t get_num_params() const { return num_params; }
 	private:
 		double halfexponent;
 		double alpha;
+		bool convolve;
+		BoundaryType boundary;
 		RNG& rng;
 };
 
@@ -163,8 +219,10 @@ class HemisphereImpurities : public ImpurityType {
 			description = ss.str();
 		}
 		void new_realization(__attribute__((unused)) std::list<double>& params) const {}
-		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const;
+		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const;
 		size_t get_num_params() const { return num_params; }
+		// Hemispheres vanish outside their radius, so they are never truncated
+		double get_support_radius(__attribute__((unused)) std::vector<double> const& params, __attribute__((unused)) DataLayout const& dl) const { return std::sqrt(r2); }
 	private:
 		double A;
 		double r2;
@@ -185,8 +243,10 @@ class DeltaImpurities : public ImpurityType {
 			const double A = amp_mean + amp_stdev*rng.gaussian_rand();
 			params.push_back(A);
 		}
-		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, double* pot_values) const;
+		void add_noise(double x, double y, std::vector<double> const& params, DataLayout const& dl, GridBox const& box, double* pot_values) const;
 		size_t get_num_params() const { return num_params; }
+		// A delta spike only touches the grid point nearest to it
+		double get_support_radius(__attribute__((unused)) std::vector<double> const& params, DataLayout const& dl) const { return dl.dx; }
 	private:
 		double amp_mean;
 		double amp_stdev;
@@ -234,7 +294,7 @@ class FixedImpurities : public ImpurityDistribution {
 // Parser functions for returning instances from user-provided desciption
 // strings
 
-ImpurityType const* parse_impurity_type_description(std::string const& type_str, DataLayout const& dl, RNG& rng);
+ImpurityType const* parse_impurity_type_description(std::string const& type_str, DataLayout const& dl, RNG& rng, BoundaryType boundary = Periodic);
 
 ImpurityDistribution const* parse_impurity_distribution_description(std::string const& distribution_str, DataLayout const& dl, Constraint const& constraint, RNG& rng);
 
@@ -0,0 +1,57 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "numa.hpp"
+
+void first_touch(comp* ptr, size_t num_blocks, size_t blocksize) {
+	#pragma omp parallel for schedule(static)
+	for (size_t n=0; n<num_blocks; n++)
+		memset(reinterpret_cast<void*>(ptr+n*blocksize), 0x00, blocksize*sizeof(comp));
+}
+
+bool pin_omp_threads() {
+	#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return false;
+	std::vector<int> cpus;
+	for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed))
+			cpus.push_back(cpu);
+	}
+	if (cpus.empty())
+		return false;
+	bool success = true;
+	#pragma omp parallel
+	{
+		// With Linux, a zero PID in sched_setaffinity refers to the calling
+		// thread, not the whole process
+		cpu_set_t own;
+		CPU_ZERO(&own);
+		CPU_SET(cpus[static_cast<size_t>(omp_get_thread_num()) % cpus.size()], &own);
+		if (sched_setaffinity(0, sizeof(own), &own) != 0) {
+			#pragma omp critical
+			success = false;
+		}
+	}
+	return success;
+	#else
+	return false;
+	#endif
+}
@@ -0,0 +1,53 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helpers for placing the large state buffers and the OpenMP worker threads
+ * sensibly on NUMA machines.
+ *
+ * Linux places a memory page on the NUMA node of the thread that first writes
+ * to it. The state buffers are therefore zeroed in parallel with the same
+ * static schedule that is used for propagating the states, so that each thread
+ * mostly works with local memory. Alternatively the pages can be interleaved
+ * over all nodes, see statememory.hpp.
+ */
+
+#ifndef _NUMA_HPP_
+#define _NUMA_HPP_
+
+#include <cstring>
+#include <vector>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "itp2d_common.hpp"
+
+// Zero num_blocks consecutive blocks of blocksize elements, so that each block
+// is first touched by the thread that handles it in a "parallel for
+// schedule(static)" loop over the blocks.
+void first_touch(comp* ptr, size_t num_blocks, size_t blocksize);
+
+// Pin each thread of the OpenMP thread team to its own CPU, chosen in order
+// from the CPUs the process is allowed to run on. Returns false if pinning is
+// not supported or failed.
+bool pin_omp_threads();
+
+#endif // _NUMA_HPP_
@@ -30,6 +30,28 @@ const Parameters::SaveWhat Parameters::default_save_what = FinalStates;
 const bool Parameters::default_clobber = false;
 const int Parameters::default_verbosity = 1;
 const size_t Parameters::default_num_threads = 2;
+const bool Parameters::default_numa_interleave = false;
+const bool Parameters::default_pin_threads = false;
+const PageBacking Parameters::default_page_backing = NormalPages;
+const char Parameters::default_scratch_directory[] = "";
+const size_t Parameters::default_memory_budget = 1024;
+const bool Parameters::default_compress_converged = false;
+const bool Parameters::default_async_io = false;
+const size_t Parameters::default_io_queue_length = 2;
+const size_t Parameters::default_states_chunk_size = 1;
+const CompressionFilter Parameters::default_compression_filter = DeflateCompression;
+const int Parameters::default_compression_level = 9;
+const StatePrecision Parameters::default_state_precision = DoublePrecision;
+const char Parameters::default_checkpoint_file[] = "";
+const double Parameters::default_checkpoint_interval = 600;
+const bool Parameters::default_resume = false;
+const size_t Parameters::default_cascade_levels = 1;
+const double Parameters::default_cascade_tolerance_factor = 10;
+const char Parameters::default_sweep[] = "none";
+const size_t Parameters::default_ensemble_size = 0;
+const size_t Parameters::default_ensemble_threads = 1;
+const char Parameters::default_service_directory[] = "";
+const char Parameters::default_trace_file[] = "";
 const BoundaryType Parameters::default_boundary = Periodic;
 const size_t Parameters::default_sizex = 64;
 const size_t Parameters::default_sizey = 64;
@@ -66,6 +88,29 @@ std::ostream& operator<<(std::ostream& stream, const Parameters& params) {
 	stream << "clobber: " << params.get_clobber() << std::endl;
 	stream << "verbosity: " << params.get_verbosity() << std::endl;
 	stream << "num_threads: " << params.get_num_threads() << std::endl;
+	stream << "numa_interleave: " << params.get_numa_interleave() << std::endl;
+	stream << "pin_threads: " << params.get_pin_threads() << std::endl;
+	stream << "page_backing: " << params.get_page_backing() << std::endl;
+	stream << "scratch_directory: " << params.get_scratch_directory() << std::endl;
+	stream << "memory_budget: " << params.get_memory_budget() << std::endl;
+	stream << "compress_converged: " << params.get_compress_converged() << std::endl;
+	stream << "async_io: " << params.get_async_io() << std::endl;
+	stream << "io_queue_length: " << params.get_io_queue_length() << std::endl;
+	stream << "states_chunk_size: " << params.get_states_chunk_size() << std::endl;
+	stream << "compression_filter: " << params.get_compression_filter() << std::endl;
+	stream << "compression_level: " << params.get_compression_level() << std::endl;
+	stream << "state_precision: " << params.get_state_precision() << std::endl;
+	stream << "checkpoint_file: " << params.get_checkpoint_file() << std::endl;
+	stream << "checkpoint_interval: " << params.get_checkpoint_interval() << std::endl;
+	stream << "resume: " << params.get_resume() << std::endl;
+	stream << "cascade_levels: " << params.get_cascade_levels() << std::endl;
+	stream << "cascade_tolerance_factor: " << params.get_cascade_tolerance_factor() << std::endl;
+	stream << "cascade_level: " << params.get_cascade_level() << std::endl;
+	stream << "sweep: " << params.get_sweep() << std::endl;
+	stream << "ensemble_size: " << params.get_ensemble_size() << std::endl;
+	stream << "ensemble_threads: " << params.get_ensemble_threads() << std::endl;
+	stream << "service_directory: " << params.get_service_directory() << std::endl;
+	stream << "trace_file: " << params.get_trace_file() << std::endl;
 	stream << "ortho_alg: " << params.get_ortho_algorithm() << std::endl;
 	stream << "fftw_flags: " << params.get_fftw_flags() << std::endl;
 	stream << "sizex: " << params.get_sizex() << std::endl;
@@ -104,6 +149,29 @@ void Parameters::set_to_defaults() {
 	clobber = default_clobber;
 	verbosity = default_verbosity;
 	num_threads = default_num_threads;
+	numa_interleave = default_numa_interleave;
+	pin_threads = default_pin_threads;
+	page_backing = default_page_backing;
+	scratch_directory = default_scratch_directory;
+	memory_budget = default_memory_budget;
+	compress_converged = default_compress_converged;
+	async_io = default_async_io;
+	io_queue_length = default_io_queue_length;
+	states_chunk_size = default_states_chunk_size;
+	compression_filter = default_compression_filter;
+	compression_level = default_compression_level;
+	state_precision = default_state_precision;
+	checkpoint_file = default_checkpoint_file;
+	checkpoint_interval = default_checkpoint_interval;
+	resume = default_resume;
+	cascade_levels = default_cascade_levels;
+	cascade_tolerance_factor = default_cascade_tolerance_factor;
+	cascade_level = 0;
+	clear_sweep();
+	ensemble_size = default_ensemble_size;
+	ensemble_threads = default_ensemble_threads;
+	service_directory = default_service_directory;
+	trace_file = default_trace_file;
 	halforder = default_halforder;
 	eps_divisor = default_eps_divisor;
 	exhaust_eps = default_exhaust_eps;
@@ -112,6 +180,9 @@ void Parameters::set_to_defaults() {
 	ortho_alg = default_ortho_alg;
 	fftw_flags = default_fftw_flags;
 	noise_type = default_noise_type;
+	impurity_type = default_impurity_type;
+	impurity_distribution = default_impurity_distribution;
+	impurity_constraint = default_impurity_constraint;
 	user_noise = NULL;
 	//
 	define_grid(default_sizex, default_sizey, default_lenx, default_boundary);
@@ -123,6 +194,7 @@ void Parameters::set_to_defaults() {
 }
 
 Parameters::Parameters() :
+		initial_states(NULL),
 		user_noise(NULL),
 		timestep_convergence_test(NULL),
 		final_convergence_test(NULL) {
@@ -162,6 +234,7 @@ void Parameters::set_num_states(size_t _N, size_t _needed_to_converge, size_t _i
 void Parameters::define_initial_states(InitialStatePreset preset) {
 	initialstate_preset = preset;
 	initialstate_func = NULL;
+	initial_states = NULL;
 	// Actual implementations are in stateset.hpp because we can't throw around function pointers
 	// with references to internal RNG objects.
 	switch (preset) {
@@ -177,10 +250,88 @@ void Parameters::define_initial_states(InitialStatePreset preset) {
 void Parameters::define_initial_states(std::string description, initialstatefunc func) {
 	initialstate_preset = UserSuppliedInitialState;
 	initialstate_func = func;
+	initial_states = NULL;
 	initialstate_description = description;
 }
 
+// The states are not copied, so they must exist as long as these parameters
+// are used
+void Parameters::define_initial_states(StateSet const& states) {
+	initialstate_preset = CopyFromStateSet;
+	initialstate_func = NULL;
+	initial_states = &states;
+	initialstate_description = "copied from another simulation";
+}
+
 void Parameters::set_bailout_limits(int arg_max_steps, double arg_min_time_step) {
 	max_steps = arg_max_steps;
 	min_time_step = arg_min_time_step;
 }
+
+void Parameters::clear_sweep() {
+	sweep_description = default_sweep;
+	sweep_parameter = 0;
+	sweep_values.clear();
+}
+
+// The values are evenly spaced from start to end, both included
+void Parameters::set_sweep(std::string const& description) {
+	name_parameters_pair p;
+	try {
+		p = parse_parameter_string(description);
+	}
+	catch (ParseError& e) {
+		throw InvalidSweep(description, "should be of the form name(start,end,points)");
+	}
+	std::string const& name = p.first;
+	std::vector<double> const& values = p.second;
+	if (values.size() != 3)
+		throw InvalidSweep(description, "should be of the form name(start,end,points)");
+	if (not (values[2] >= 1) or values[2] != floor(values[2]))
+		throw InvalidSweep(description, "the number of points should be a positive integer");
+	size_t parameter = 0;
+	if (name != "B") {
+		std::istringstream in(name.substr(std::min(name.size(), static_cast<size_t>(1))));
+		int k = 0;
+		if (name.empty() or name[0] != 'p' or not (in >> k) or not in.eof() or k < 1)
+			throw InvalidSweep(description, "the swept parameter should be B or p1, p2, ... for the parameters of the potential");
+		parameter = static_cast<size_t>(k);
+	}
+	const size_t points = static_cast<size_t>(values[2]);
+	sweep_description = description;
+	sweep_parameter = parameter;
+	sweep_values.resize(points);
+	for (size_t i=0; i<points; i++) {
+		const double t = (points > 1)? static_cast<double>(i)/static_cast<double>(points-1) : 0.0;
+		sweep_values[i] = values[0] + t*(values[1]-values[0]);
+	}
+}
+
+// The swept parameter replaces the corresponding parameter in the potential
+// description, which must then list the parameters explicitly up to it
+std::string Parameters::get_potential_type(size_t sweep_point) const {
+	if (not is_sweep() or sweep_parameter == 0)
+		return potential_type;
+	name_parameters_pair p;
+	try {
+		p = parse_parameter_string(potential_type);
+	}
+	catch (ParseError& e) {
+		throw InvalidSweep(sweep_description, "the parameters of potential " + potential_type + " cannot be swept");
+	}
+	if (p.second.size() < sweep_parameter)
+		throw InvalidSweep(sweep_description, "potential " + potential_type + " does not list that many parameters");
+	p.second[sweep_parameter-1] = sweep_values.at(sweep_point);
+	std::ostringstream ss;
+	ss << std::setprecision(17) << p.first << "(";
+	for (size_t i=0; i<p.second.size(); i++)
+		ss << ((i > 0)? "," : "") << p.second[i];
+	ss << ")";
+	return ss.str();
+}
+
+double Parameters::get_B(size_t sweep_point) const {
+	if (not is_sweep() or sweep_parameter != 0)
+		return B;
+	return sweep_values.at(sweep_point);
+}
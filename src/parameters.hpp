@@ -24,22 +24,30 @@
 #define _PARAMETERS_HPP_
 
 #include <list>
+#include <vector>
 #include <string>
+#include <sstream>
+#include <iomanip>
 #include <iterator>
+#include <algorithm>
+#include <cmath>
 #include <cassert>
 
 #include "itp2d_common.hpp"
+#include "parser.hpp"
 #include "convergence.hpp"
 #include "noise.hpp"
 #include "constraint.hpp"
 #include "transformer.hpp"
 
+class StateSet;
+
 class Parameters {
 	friend class CommandLineParser;
 	public:
 		// Enums
 		enum SaveWhat { Nothing, OnlyEnergies, FinalStates, Everything };
-		enum InitialStatePreset { UserSuppliedInitialState, CopyFromFile, Random };
+		enum InitialStatePreset { UserSuppliedInitialState, CopyFromFile, CopyFromStateSet, Random };
 		// Typedefs
 		typedef double (*potfunc)(double, double);
 		typedef comp (*initialstatefunc)(size_t, double, double);
@@ -55,9 +63,11 @@ class Parameters {
 		void define_external_field(std::string const& ptype, double B=0);
 		void define_initial_states(InitialStatePreset preset = Random);
 		void define_initial_states(std::string description, initialstatefunc func);
+		void define_initial_states(StateSet const& states);	// Start from these states, resampled if needed
 		void set_num_states(size_t N, size_t wanted_to_converge, size_t ignore_lowest=default_ignore_lowest);
 		inline void set_operator_splitting_halforder(int h) { halforder = h; }
 		inline void add_eps_value(double e) { eps_values.push_back(e); }
+		inline void clear_eps_values() { eps_values.clear(); }
 		inline void set_time_step_divisor(double d) { eps_divisor = d; }
 		inline void set_exhaust_eps(bool val) { exhaust_eps = val; }
 		void set_bailout_limits(int max_steps, double min_time_step);
@@ -80,6 +90,40 @@ class Parameters {
 		inline void set_fftw_flags(unsigned int fl) { fftw_flags = fl; }
 		inline void set_verbosity(int val) { verbosity = val; }
 		inline void set_num_threads(int num) { num_threads = num; }
+		inline void set_numa_interleave(bool val) { numa_interleave = val; }
+		inline void set_pin_threads(bool val) { pin_threads = val; }
+		inline void set_page_backing(PageBacking backing) { page_backing = backing; }
+		inline void set_scratch_directory(std::string const& dir) { scratch_directory = dir; }
+		inline void set_memory_budget(size_t mb) { memory_budget = mb; }
+		inline void set_compress_converged(bool val) { compress_converged = val; }
+		inline void set_async_io(bool val) { async_io = val; }
+		inline void set_io_queue_length(size_t len) { io_queue_length = len; }
+		inline void set_states_chunk_size(size_t num) { states_chunk_size = num; }
+		inline void set_compression_filter(CompressionFilter filter) { compression_filter = filter; }
+		inline void set_compression_level(int level) { compression_level = level; }
+		inline void set_state_precision(StatePrecision precision) { state_precision = precision; }
+		inline void set_checkpoint(std::string const& filename, double interval = default_checkpoint_interval) {
+			checkpoint_file = filename;
+			checkpoint_interval = interval;
+		}
+		inline void set_resume(bool val) { resume = val; }
+		inline void set_cascade(size_t levels, double tolerance_factor = default_cascade_tolerance_factor) {
+			cascade_levels = levels;
+			cascade_tolerance_factor = tolerance_factor;
+		}
+		inline void set_cascade_level(size_t level) { cascade_level = level; }
+		// A sweep is described as name(start,end,points), where name is B for
+		// the magnetic field or pK for the Kth parameter of the potential
+		void set_sweep(std::string const& description);
+		void clear_sweep();
+		// An ensemble runs this many realizations of the system with
+		// consecutive random seeds, threads_per_member threads each
+		inline void set_ensemble(size_t size, size_t threads_per_member = default_ensemble_threads) {
+			ensemble_size = size;
+			ensemble_threads = threads_per_member;
+		}
+		inline void set_service_directory(std::string const& dir) { service_directory = dir; }
+		inline void set_trace_file(std::string const& filename) { trace_file = filename; }
 		// Simple getters
 		inline bool get_recover() const { return recover; }
 		inline unsigned long int get_random_seed() const { return rngseed; }
@@ -90,6 +134,36 @@ class Parameters {
 		inline bool get_clobber() const { return clobber; }
 		inline int get_verbosity() const { return verbosity; }
 		inline size_t get_num_threads() const { return num_threads; }
+		inline bool get_numa_interleave() const { return numa_interleave; }
+		inline bool get_pin_threads() const { return pin_threads; }
+		inline PageBacking get_page_backing() const { return page_backing; }
+		inline std::string const& get_scratch_directory() const { return scratch_directory; }
+		inline size_t get_memory_budget() const { return memory_budget; }
+		inline bool get_compress_converged() const { return compress_converged; }
+		inline bool get_async_io() const { return async_io; }
+		inline size_t get_io_queue_length() const { return io_queue_length; }
+		inline size_t get_states_chunk_size() const { return states_chunk_size; }
+		inline CompressionFilter get_compression_filter() const { return compression_filter; }
+		inline int get_compression_level() const { return compression_level; }
+		inline StatePrecision get_state_precision() const { return state_precision; }
+		inline std::string const& get_checkpoint_file() const { return checkpoint_file; }
+		inline double get_checkpoint_interval() const { return checkpoint_interval; }
+		inline bool get_resume() const { return resume; }
+		inline size_t get_cascade_levels() const { return cascade_levels; }
+		inline double get_cascade_tolerance_factor() const { return cascade_tolerance_factor; }
+		inline size_t get_cascade_level() const { return cascade_level; }
+		inline std::string const& get_sweep() const { return sweep_description; }
+		inline bool is_sweep() const { return not sweep_values.empty(); }
+		inline size_t get_num_sweep_points() const { return is_sweep()? sweep_values.size() : 1; }
+		inline std::vector<double> const& get_sweep_values() const { return sweep_values; }
+		// The potential and magnetic field at a point of the sweep
+		std::string get_potential_type(size_t sweep_point) const;
+		double get_B(size_t sweep_point) const;
+		inline size_t get_ensemble_size() const { return ensemble_size; }
+		inline size_t get_ensemble_threads() const { return ensemble_threads; }
+		inline bool is_ensemble() const { return ensemble_size > 0; }
+		inline std::string const& get_service_directory() const { return service_directory; }
+		inline std::string const& get_trace_file() const { return trace_file; }
 		inline size_t get_sizex() const { return sizex; }
 		inline size_t get_sizey() const { return sizey; }
 		inline double get_lenx() const { return lenx; }
@@ -101,6 +175,12 @@ class Parameters {
 		inline InitialStatePreset get_initialstate_preset () const { return initialstate_preset; }
 		inline initialstatefunc get_initialstate_func() const { return initialstate_func; }
 		inline std::string const& get_initialstate_description() const { return initialstate_description; }
+		inline StateSet const& get_initial_states() const {
+			if (initial_states != NULL) {
+				return *initial_states;
+			}
+			throw GeneralError("Parameters::get_initial_states() called but no initial states set");
+		}
 		inline std::string const& get_potential_type() const { return potential_type; }
 		inline ConvergenceTest const& get_timestep_convergence_test() const { return *timestep_convergence_test; }
 		inline ConvergenceTest const& get_final_convergence_test() const { return *final_convergence_test; }
@@ -134,6 +214,28 @@ class Parameters {
 		static const bool default_clobber;
 		static const int default_verbosity;
 		static const size_t default_num_threads;
+		static const bool default_numa_interleave;
+		static const bool default_pin_threads;
+		static const PageBacking default_page_backing;
+		static const char default_scratch_directory[];
+		static const size_t default_memory_budget;
+		static const bool default_compress_converged;
+		static const bool default_async_io;
+		static const size_t default_io_queue_length;
+		static const size_t default_states_chunk_size;
+		static const CompressionFilter default_compression_filter;
+		static const int default_compression_level;
+		static const StatePrecision default_state_precision;
+		static const char default_checkpoint_file[];
+		static const double default_checkpoint_interval;
+		static const bool default_resume;
+		static const size_t default_cascade_levels;
+		static const double default_cascade_tolerance_factor;
+		static const char default_sweep[];
+		static const size_t default_ensemble_size;
+		static const size_t default_ensemble_threads;
+		static const char default_service_directory[];
+		static const char default_trace_file[];
 		static const BoundaryType default_boundary;
 		static const size_t default_sizex;
 		static const size_t default_sizey;
@@ -175,6 +277,31 @@ class Parameters {
 		int verbosity;
 		// General performance parameters
 		size_t num_threads;
+		bool numa_interleave;	// If true, state memory is interleaved over NUMA nodes instead of placed by first touch
+		bool pin_threads;		// If true, each OpenMP thread is pinned to a single CPU
+		PageBacking page_backing;	// Page size used for state memory and workspaces
+		std::string scratch_directory;	// If not empty, states are stored out-of-core in a scratch file here
+		size_t memory_budget;	// Memory in megabytes to use for states when storing them out-of-core
+		bool compress_converged;	// If true, converged states are locked and stored in single precision
+		bool async_io;			// If true, the datafile is written by a background thread
+		size_t io_queue_length;	// How many writes can be waiting for the background thread
+		size_t states_chunk_size;	// How many states are stored in one HDF5 chunk in the datafile
+		CompressionFilter compression_filter;	// Filter used for compressing the datasets in the datafile
+		int compression_level;	// Compression level used with the filter
+		StatePrecision state_precision;	// Precision of the states stored in the datafile
+		std::string checkpoint_file;	// If not empty, the state of the simulation is saved here periodically
+		double checkpoint_interval;		// Seconds between checkpoints
+		bool resume;			// If true, continue from the checkpoint file if it exists
+		size_t cascade_levels;	// Number of grids in a coarse-to-fine cascade, 1 for no cascade
+		double cascade_tolerance_factor;	// Convergence limits are loosened by this factor for each coarser level
+		size_t cascade_level;	// Level of the cascade these parameters are for, 0 being the finest grid
+		std::string sweep_description;
+		size_t sweep_parameter;	// 0 for the magnetic field, K for the Kth parameter of the potential
+		std::vector<double> sweep_values;	// Values of the swept parameter, empty for no sweep
+		size_t ensemble_size;	// Number of realizations in an ensemble, 0 for a single system
+		size_t ensemble_threads;	// Threads used by each realization of an ensemble
+		std::string service_directory;	// If not empty, run as a service taking jobs from this directory
+		std::string trace_file;	// If not empty, record a trace of the run to this file
 		OrthoAlgorithm ortho_alg;
 		unsigned int fftw_flags;
 		// Grid parameters
@@ -187,6 +314,7 @@ class Parameters {
 		InitialStatePreset initialstate_preset;
 		std::string initialstate_description;
 		initialstatefunc initialstate_func;
+		StateSet const* initial_states;
 		// Potential & field parameters
 		std::string potential_type;
 		double B;
@@ -53,11 +53,8 @@ std::ostream& Potential::print(std::ostream& stream) const {
 
 void Potential::init_values() {
 	values = new double[datalayout.sizex*datalayout.sizey];
-	for (size_t y=0; y<datalayout.sizey; y++) {
-		double dy = datalayout.get_posy(y);
-		for (size_t x=0; x<datalayout.sizex; x++) {
-			double dx = datalayout.get_posx(x);
-			datalayout.value(values, x, y) = type(dx,dy);
-		}
-	}
+	double const* const posx = &datalayout.get_posx(0);
+	#pragma omp parallel for schedule(static) if(type.is_thread_safe())
+	for (size_t y=0; y<datalayout.sizey; y++)
+		type.evaluate_row(posx, datalayout.get_posy(y), datalayout.sizex, &datalayout.value(values, 0, y));
 }
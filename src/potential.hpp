@@ -21,6 +21,7 @@
 
 #include "operators.hpp"
 #include "potentialtypes.hpp"
+#include "tabulatedpotential.hpp"
 #include "noise.hpp"
 
 // A local potential operator, based on the potential definition given by the PotentialType class, and with
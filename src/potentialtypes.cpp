@@ -17,6 +17,7 @@
  */
 
 #include "potentialtypes.hpp"
+#include "tabulatedpotential.hpp"
 
 // Default values for parameters
 
@@ -53,7 +54,97 @@ const double PowerStadium::default_center_length = 2;
 const double PowerStadium::default_power = 4;
 // The parser delegator
 
+// Split a string of the form name(arguments) into the name and the
+// arguments, without parsing the arguments. Returns false if str is not of
+// this form.
+static bool split_name_and_arguments(std::string const& str, std::string& name, std::string& arguments) {
+	const size_t start = str.find_first_not_of(whitespace_characters);
+	const size_t open = str.find('(');
+	if (start == std::string::npos or open == std::string::npos or open <= start)
+		return false;
+	const size_t name_end = str.find_last_not_of(whitespace_characters, open-1);
+	if (name_end == std::string::npos or name_end < start)
+		return false;
+	const size_t close = str.find_last_not_of(whitespace_characters);
+	if (str[close] != ')' or close == open)
+		return false;
+	name.assign(str, start, name_end-start+1);
+	arguments.assign(str, open+1, close-open-1);
+	return true;
+}
+
+// Remove whitespace from both ends of a string
+static std::string trim(std::string const& str) {
+	const size_t start = str.find_first_not_of(whitespace_characters);
+	if (start == std::string::npos)
+		return std::string();
+	const size_t end = str.find_last_not_of(whitespace_characters);
+	return std::string(str, start, end-start+1);
+}
+
+static PotentialType const* parse_expression_potential(std::string const& str, std::string const& arguments) {
+	try {
+		return new ExpressionPotential(arguments);
+	}
+	catch (InvalidExpression& e) {
+		std::cerr << e.what() << std::endl;
+		throw InvalidPotentialType(str);
+	}
+}
+
+// The arguments of a tabulated potential are a filename and up to three
+// numbers:
+// 	tabulated(file.h5)			potential_values of an itp2d datafile
+// 	tabulated(file.h5:/dataset,dx)		an HDF5 dataset with grid spacing dx
+// 	tabulated(file.bin,sizex,sizey,dx)	a raw binary file of doubles
+static PotentialType const* parse_tabulated_potential(std::string const& str, std::string const& arguments) {
+	const size_t comma = arguments.find(',');
+	std::string filename = trim(arguments.substr(0, comma));
+	std::vector<double> params;
+	if (comma != std::string::npos) {
+		try {
+			params = parse_parameter_string("tabulated(" + arguments.substr(comma+1) + ")").second;
+		}
+		catch (ParseError& e) {
+			std::cerr << e.what() << std::endl;
+			throw InvalidPotentialType(str);
+		}
+	}
+	std::string dataset;
+	const size_t separator = filename.rfind(":/");
+	if (separator != std::string::npos) {
+		dataset = filename.substr(separator+1);
+		filename.erase(separator);
+	}
+	if (filename.empty())
+		throw InvalidPotentialType(str);
+	try {
+		if (not dataset.empty() and params.size() == 1)
+			return new TabulatedPotential(filename, dataset, params[0]);
+		if (dataset.empty() and params.empty())
+			return new TabulatedPotential(filename);
+		if (dataset.empty() and params.size() == 3 and params[0] >= 1 and params[1] >= 1
+				and params[0] == floor(params[0]) and params[1] == floor(params[1]))
+			return new TabulatedPotential(filename, static_cast<size_t>(params[0]),
+					static_cast<size_t>(params[1]), params[2]);
+	}
+	catch (TabulatedPotentialError& e) {
+		std::cerr << e.what() << std::endl;
+		throw InvalidPotentialType(str);
+	}
+	throw InvalidPotentialType(str);
+}
+
+// Expressions and tables are not described by lists of numbers, so they are
+// recognized before using the generic parser.
 PotentialType const* parse_potential_description(std::string const& str) {
+	std::string special_name, arguments;
+	if (split_name_and_arguments(str, special_name, arguments)) {
+		if (special_name == "expression" or special_name == "expr")
+			return parse_expression_potential(str, arguments);
+		if (special_name == "tabulated" or special_name == "table")
+			return parse_tabulated_potential(str, arguments);
+	}
 	name_parameters_pair p;
 	try {
 		p = parse_parameter_string(str);
@@ -33,10 +33,12 @@
 #include <string>
 #include <sstream>
 #include <cstdlib>
+#include <algorithm>
 
 #include "itp2d_common.hpp"
 #include "exceptions.hpp"
 #include "parser.hpp"
+#include "expression.hpp"
 
 // Main interface class.
 // A potential type is simply:
@@ -45,16 +47,43 @@
 // In addition, you need a constructor that constructs a potential from a
 // vector of doubles. This is used for creating potentials from user-provided
 // parameters.
+//
+// Potentials are evaluated on the grid one row at a time with evaluate_row,
+// which by default just calls operator() for each point. Potential types
+// with an inline operator() should derive from InlinePotentialType below,
+// which evaluates the rows with a loop that the compiler can vectorize. The
+// rows are evaluated in parallel, unless is_thread_safe() returns false.
 
 class PotentialType {
 	public:
 		virtual inline ~PotentialType() {}
 		virtual double operator()(double x, double y) const = 0;
+		// Evaluate the potential at points (x[i], y) for i < n
+		virtual void evaluate_row(double const* x, double y, size_t n, double* values) const {
+			for (size_t i=0; i<n; i++)
+				values[i] = (*this)(x[i], y);
+		}
+		// Whether evaluate_row can be called from several threads at once
+		virtual bool is_thread_safe() const { return true; }
 		inline std::string const& get_description() const { return description; }
 	protected:
 		std::string description;
 };
 
+// Base class for potential types with an inline operator(). The call in the
+// loop is not virtual, so it is inlined and the loop can be vectorized. For
+// this to work well, operator() should avoid branches.
+
+template <typename Derived>
+class InlinePotentialType : public PotentialType {
+	public:
+		void evaluate_row(double const* x, double y, size_t n, double* values) const {
+			Derived const& self = static_cast<Derived const&>(*this);
+			for (size_t i=0; i<n; i++)
+				values[i] = self.Derived::operator()(x[i], y);
+		}
+};
+
 // A parser function for constructing potentials from a user-provided string.
 // First, the generic parse_parameter_string is used to parse a string of the
 // form name(param1,param2,...) into a name and a vector of doubles. Then the
@@ -69,7 +98,7 @@ PotentialType const* parse_potential_description(std::string const& str);
 
 // Potential types
 
-class ZeroPotential : public PotentialType {
+class ZeroPotential : public InlinePotentialType<ZeroPotential> {
 	public:
 		ZeroPotential() { init(); }
 		ZeroPotential(std::vector<double> params);
@@ -80,7 +109,8 @@ class ZeroPotential : public PotentialType {
 
 // This potential type is not used at the moment, but it is implemented here in
 // case e.g. some method of reading the potential from a file is made available
-// later
+// later. The user function need not be thread-safe, since it is always called
+// from one thread at a time.
 class UserSetPotential : public PotentialType {
 	public:
 		typedef double (*potfunc)(double, double);
@@ -88,12 +118,13 @@ class UserSetPotential : public PotentialType {
 			description = desc;
 		}
 		inline double operator()(double x, double y) const { return f(x,y); }
+		bool is_thread_safe() const { return false; }
 	private:
 		potfunc f;
 };
 
 // The harmonic oscillator
-class HarmonicOscillator : public PotentialType {
+class HarmonicOscillator : public InlinePotentialType<HarmonicOscillator> {
 	public:
 		static const double default_prefactor;
 		static const double default_x0;
@@ -113,7 +144,7 @@ class HarmonicOscillator : public PotentialType {
 };
 
 // The non-degenerate (elliptic) harmonic oscillator
-class EllipticOscillator : public PotentialType {
+class EllipticOscillator : public InlinePotentialType<EllipticOscillator> {
 	public:
 		static const double default_prefactor_x;
 		static const double default_prefactor_y;
@@ -131,7 +162,7 @@ class EllipticOscillator : public PotentialType {
 };
 
 // A pretty hard square of length pi
-class PrettyHardSquare : public PotentialType {
+class PrettyHardSquare : public InlinePotentialType<PrettyHardSquare> {
 	public:
 		static const double default_exponent;
 		PrettyHardSquare(double e=default_exponent) : exponent(e) { init(); }
@@ -139,8 +170,7 @@ class PrettyHardSquare : public PotentialType {
 		inline double operator()(double x, double y) const {
 			const double ax = fabs(2*x/pi);
 			const double ay = fabs(2*y/pi);
-			const double r = (ax > ay)? ax : ay;
-			return pow(r,exponent);
+			return pow(std::max(ax, ay), exponent);
 		}
 	private:
 		double exponent;
@@ -148,7 +178,7 @@ class PrettyHardSquare : public PotentialType {
 };
 
 // A soft potential with a pentagon shape
-class SoftPentagon : public PotentialType {
+class SoftPentagon : public InlinePotentialType<SoftPentagon> {
 	public:
 		SoftPentagon() { init(); }
 		SoftPentagon(std::vector<double> params);
@@ -163,7 +193,7 @@ class SoftPentagon : public PotentialType {
 
 // A Hénon-Heiles type potential, modified so that all trajectories are bounded and generalized
 // as in http://mathworld.wolfram.com/Henon-HeilesEquation.html
-class HenonHeiles : public PotentialType {
+class HenonHeiles : public InlinePotentialType<HenonHeiles> {
 	public:
 		static const double default_a;
 		static const double default_b;
@@ -183,7 +213,7 @@ class HenonHeiles : public PotentialType {
 };
 
 // A GaussianPotential blob with a prescribed amplitude and width, centered at (x0,y0)
-class GaussianPotential : public PotentialType {
+class GaussianPotential : public InlinePotentialType<GaussianPotential> {
 	public:
 		static const double default_amplitude;
 		static const double default_width;
@@ -216,7 +246,7 @@ class GaussianPotential : public PotentialType {
 // For references please see e.g.
 // 	* Eckhardt et al, Phys Rev A 39 3776 (1989)
 //	* de Polavieja et al, Phys Rev Lett 73 1613 (1994)
-class QuarticPotential : public PotentialType {
+class QuarticPotential : public InlinePotentialType<QuarticPotential> {
 	public:
 		static const double default_b;
 		QuarticPotential(double _b = default_b) : b(_b) { init(); }
@@ -238,7 +268,7 @@ class QuarticPotential : public PotentialType {
 };
 
 //
-class SquareOscillator : public PotentialType {
+class SquareOscillator : public InlinePotentialType<SquareOscillator> {
 	public:
 		static const double default_alpha;
 		SquareOscillator(double alpha_=default_alpha) : alpha(alpha_) { init(); }
@@ -254,7 +284,7 @@ class SquareOscillator : public PotentialType {
 };
 
 // A generalization of the harmonic oscillator
-class PowerOscillator : public PotentialType {
+class PowerOscillator : public InlinePotentialType<PowerOscillator> {
 	public:
 		static const double default_exponent;
 		static const double default_prefactor;
@@ -272,7 +302,7 @@ class PowerOscillator : public PotentialType {
 
 // A flexible class for ring-like potentials, with optional asymmetry in the
 // form of a Gaussian spike
-class RingPotential : public PotentialType {
+class RingPotential : public InlinePotentialType<RingPotential> {
 	public:
 		static const double default_radius;
 		static const double default_width;
@@ -300,7 +330,7 @@ class RingPotential : public PotentialType {
 };
 
 // A radial cosh-potential
-class CoshPotential : public PotentialType {
+class CoshPotential : public InlinePotentialType<CoshPotential> {
 	public:
 		static const double default_amplitude;
 		static const double default_length_scale;
@@ -318,7 +348,7 @@ class CoshPotential : public PotentialType {
 
 // Soft stadium potential as described by
 // Tomsovic, S. and Heller, E. J., PRE 47, 282 (1993)
-class SoftStadium : public PotentialType {
+class SoftStadium : public InlinePotentialType<SoftStadium> {
 	public:
 		static const double default_radius;
 		static const double default_center_length;
@@ -329,17 +359,12 @@ class SoftStadium : public PotentialType {
 				double height=default_height, double a=default_a, double b=default_b);
 		SoftStadium(std::vector<double> params);
 		inline double operator()(double x, double y) const {
-			double q;
-			if (fabs(x) <= halfL) { // in the central rectangle
-				q = y/R;
-			}
-			else if (x < -halfL) { //  in the left end cap
-				q = hypot(x+halfL, y)/R;
-			}
-			else { // in the right end cap
-				q = hypot(x-halfL, y)/R;
-			}
-			return V/(1+a*exp(b*(1-q*q)));
+			// Distance from the central rectangle along x, which is zero
+			// inside it and the distance from the center of the end cap
+			// otherwise. Written without branches so that it vectorizes.
+			const double cx = std::max(fabs(x)-halfL, 0.0);
+			const double q2 = (cx*cx + y*y)/(R*R);
+			return V/(1+a*exp(b*(1-q2)));
 		}
 	private:
 		double R;
@@ -351,7 +376,7 @@ class SoftStadium : public PotentialType {
 };
 
 // Another soft stadium potential with power-function walls
-class PowerStadium : public PotentialType {
+class PowerStadium : public InlinePotentialType<PowerStadium> {
 	public:
 		static const double default_radius;
 		static const double default_center_length;
@@ -360,16 +385,9 @@ class PowerStadium : public PotentialType {
 				double power=default_power);
 		PowerStadium(std::vector<double> params);
 		inline double operator()(double x, double y) const {
-			double q;
-			if (fabs(x) <= halfL) { // in the central rectangle
-				q = fabs(y/R);
-			}
-			else if (x < -halfL) { //  in the left end cap
-				q = hypot(x+halfL, y)/R;
-			}
-			else { // in the right end cap
-				q = hypot(x-halfL, y)/R;
-			}
+			// See SoftStadium
+			const double cx = std::max(fabs(x)-halfL, 0.0);
+			const double q = sqrt(cx*cx + y*y)/R;
 			return 0.5*pow(q, a);
 		}
 	private:
@@ -379,4 +397,20 @@ class PowerStadium : public PotentialType {
 		void init();
 };
 
+// A potential given as an arithmetic expression of the coordinates, for
+// example "0.5*(x^2+y^2) + 0.1*sin(3*atan2(y,x))". See expression.hpp for the
+// syntax.
+class ExpressionPotential : public PotentialType {
+	public:
+		ExpressionPotential(std::string const& expression) : expr(expression) {
+			description = "expression(" + expression + ")";
+		}
+		inline double operator()(double x, double y) const { return expr(x, y); }
+		void evaluate_row(double const* x, double y, size_t n, double* values) const {
+			expr.evaluate_row(x, y, n, values);
+		}
+	private:
+		Expression expr;
+};
+
 #endif // _POTENTIALTYPES_HPP_
@@ -17,8 +17,45 @@
  */
 
 #include "rng.hpp"
+#include <sstream>
+#include "exceptions.hpp"
 
-RNG::RNG(unsigned long int s) : seed(s), uniform_rng(base_rng_type(seed), uniform_distribution_type()), normal_distribution() {}
+void CountingMT19937::reset(unsigned long int seed, uint64_t num_draws) {
+	engine.seed(seed);
+	draws = 0;
+	while (draws < num_draws)
+		(*this)();
+}
+
+RNG::RNG(unsigned long int s) : seed(s), base_rng(seed), uniform_rng(&base_rng, uniform_distribution_type()), normal_distribution() {}
+
+std::string RNG::get_state() const {
+	std::ostringstream state;
+	state << seed << ' ' << base_rng.get_draws() << ' ' << normal_distribution;
+	return state.str();
+}
+
+void RNG::set_state(std::string const& state) {
+	std::istringstream in(state);
+	unsigned long int new_seed;
+	uint64_t draws;
+	normal_distribution_type new_normal_distribution;
+	if (not (in >> new_seed >> draws >> new_normal_distribution))
+		throw GeneralError("Invalid random number generator state '" + state + "'.");
+	seed = new_seed;
+	base_rng.reset(seed, draws);
+	normal_distribution = new_normal_distribution;
+}
+
+CounterRNG::CounterRNG(uint64_t k) {
+	key[0] = static_cast<uint32_t>(k);
+	key[1] = static_cast<uint32_t>(k >> 32);
+}
+
+CounterRNG::CounterRNG(RNG& rng) {
+	key[0] = rng.integer_rand();
+	key[1] = rng.integer_rand();
+}
 
 unsigned long int RNG::produce_random_seed() {
 	timeval time_now;
@@ -17,15 +17,38 @@
  */
 
 /* 
- * A simple wrapper class for random number generation based on TR1/random.
+ * A simple wrapper class for random number generation based on TR1/random,
+ * and a counter-based generator for filling large arrays in parallel.
  */
 
 #ifndef _RNG_HPP_
 #define _RNG_HPP_
 
+#include <cmath>
+#include <string>
 #include <tr1/random>
+#include <stdint.h>
 #include <sys/time.h>
 
+// The mt19937 generator, counting how many numbers have been drawn from it.
+// The stream operators of GCC's TR1 mersenne_twister do not save the
+// position within the state vector, so the state of a generator is instead
+// saved as its seed and the number of draws.
+class CountingMT19937 {
+public:
+	typedef std::tr1::mt19937 engine_type;
+	typedef engine_type::result_type result_type;
+	CountingMT19937(unsigned long int seed) : engine(seed), draws(0) {}
+	inline result_type operator()() { draws++; return engine(); }
+	inline result_type min() const { return engine.min(); }
+	inline result_type max() const { return engine.max(); }
+	inline uint64_t get_draws() const { return draws; }
+	void reset(unsigned long int seed, uint64_t draws);
+private:
+	engine_type engine;
+	uint64_t draws;
+};
+
 class RNG {
 public:
 	RNG();	// If no seed is given, one is generated based on system time.
@@ -34,16 +57,28 @@ public:
 	inline double uniform_rand() { return uniform_rng(); }
 	inline bool bernoulli_trial(double p) { return bernoulli_distribution_type(p)(uniform_rng); }
 	inline unsigned int poisson_rand(double lambda) { return poisson_distribution_type(lambda)(uniform_rng); }
+	inline uint32_t integer_rand() { return static_cast<uint32_t>(base_rng()); }
 	inline unsigned long int get_seed() const { return seed; }
-	typedef std::tr1::mt19937 base_rng_type;
+	// The complete state of the generator as a string, and restoring it, so
+	// that a simulation continued from a checkpoint draws the same numbers
+	std::string get_state() const;
+	void set_state(std::string const& state);
+	typedef CountingMT19937 base_rng_type;
 	typedef std::tr1::normal_distribution<double> normal_distribution_type;
 	typedef std::tr1::uniform_real<double> uniform_distribution_type;
 	typedef std::tr1::bernoulli_distribution bernoulli_distribution_type;
 	typedef std::tr1::poisson_distribution<unsigned int> poisson_distribution_type;
-	typedef std::tr1::variate_generator<base_rng_type, uniform_distribution_type> uniform_rng_type;
+	typedef std::tr1::variate_generator<base_rng_type*, uniform_distribution_type> uniform_rng_type;
 	static unsigned long int produce_random_seed();
 private:
+	// Not copyable, since uniform_rng points to base_rng
+	RNG(RNG const&);
+	RNG& operator=(RNG const&);
 	unsigned long int seed;
+	// The underlying integer-valued generator. It is accessed directly only
+	// for integer_rand, since variate_generator::engine() returns an adaptor
+	// that converts the output to the distribution's input type.
+	base_rng_type base_rng;
 	// We must have a uniform double-valued generator not only to generate
 	// uniform random numbers, but also to generate normal distributed random
 	// numbers. This is because due to limitations in GCC's implementation of
@@ -55,4 +90,49 @@ private:
 	normal_distribution_type normal_distribution;
 };
 
+// The Philox4x32-10 generator of Salmon et al., "Parallel random numbers: as
+// easy as 1, 2, 3" (SC11). Each output is a pure function of a key and a
+// counter, so every element of an array can be drawn independently, in any
+// order and by any thread, and still the result depends only on the key.
+class CounterRNG {
+public:
+	CounterRNG(uint64_t key);
+	CounterRNG(RNG& rng);	// Draws the key from rng
+	// Four random words for the counter (a, b)
+	inline void generate(uint64_t a, uint64_t b, uint32_t out[4]) const {
+		uint32_t c[4] = { static_cast<uint32_t>(a), static_cast<uint32_t>(a >> 32),
+			static_cast<uint32_t>(b), static_cast<uint32_t>(b >> 32) };
+		uint32_t k0 = key[0], k1 = key[1];
+		for (int round=0; round<10; round++) {
+			if (round > 0) {
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u)*c[0];
+			const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u)*c[2];
+			const uint32_t next[4] = { static_cast<uint32_t>(p1 >> 32)^c[1]^k0, static_cast<uint32_t>(p1),
+				static_cast<uint32_t>(p0 >> 32)^c[3]^k1, static_cast<uint32_t>(p0) };
+			for (int i=0; i<4; i++)
+				c[i] = next[i];
+		}
+		for (int i=0; i<4; i++)
+			out[i] = c[i];
+	}
+	// Two independent normally distributed numbers for the counter (a, b),
+	// using the Box-Muller transform
+	inline void gaussian_pair(uint64_t a, uint64_t b, double& g1, double& g2) const {
+		uint32_t w[4];
+		generate(a, b, w);
+		// Uniform numbers with 53 random bits, u1 in (0,1] and u2 in [0,1)
+		const double u1 = static_cast<double>(((static_cast<uint64_t>(w[0]) << 32 | w[1]) >> 11) + 1)*(1.0/9007199254740992.0);
+		const double u2 = static_cast<double>((static_cast<uint64_t>(w[2]) << 32 | w[3]) >> 11)*(1.0/9007199254740992.0);
+		const double r = std::sqrt(-2*std::log(u1));
+		g1 = r*std::cos(2*M_PI*u2);
+		g2 = r*std::sin(2*M_PI*u2);
+	}
+	inline uint64_t get_key() const { return static_cast<uint64_t>(key[1]) << 32 | key[0]; }
+private:
+	uint32_t key[2];
+};
+
 #endif // _RNG_HPP_
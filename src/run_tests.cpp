@@ -22,18 +22,23 @@
 
 #include "test_rng.hpp"
 #include "test_timer.hpp"
+#include "test_trace.hpp"
 #include "test_eigensolver.hpp"
 #include "test_datalayout.hpp"
 #include "test_statearray.hpp"
 #include "test_state.hpp"
 #include "test_transformer.hpp"
 #include "test_stateset.hpp"
+#include "test_datafile.hpp"
 #include "test_operators.hpp"
 #include "test_parser.hpp"
 #include "test_commandlineparser.hpp"
 #include "test_potentialparser.hpp"
+#include "test_noise.hpp"
+#include "test_expression.hpp"
 #include "test_laplacian.hpp"
 #include "test_itp.hpp"
+#include "test_service.hpp"
 #include "test_hamiltonian.hpp"
 
 // Global variable that determines whether unit tests dump internal data for deeper analysis
@@ -18,17 +18,21 @@
 
 #include "secondordersplit.hpp"
 
-SecondOrderSplit::SecondOrderSplit(Potential const& original_potential, double time_step, double B, Transformer const& tr, BoundaryType bt, double prefactor, int exponent) {
+SecondOrderSplit::SecondOrderSplit(Potential const& original_potential, double time_step, double B, Transformer const& tr, BoundaryType bt, double prefactor, int exponent,
+		ExpPotentialCache* cache, ExpKineticCache* kinetic_cache) :
+		owned_cache(NULL) {
 	assert(tr.datalayout == original_potential.datalayout);
 	if (not original_potential.is_null()) {
-		kinetic_part = new ExpKinetic(time_step, B, tr, bt, -1.0);
-		potential_part = new ExpPotential(original_potential, time_step, -0.5, 1.0);
+		if (cache == NULL)
+			cache = owned_cache = new ExpPotentialCache(original_potential);
+		kinetic_part = new ExpKinetic(time_step, B, tr, bt, -1.0, 1.0, kinetic_cache);
+		potential_part = new ExpPotential(original_potential, time_step, -0.5, 1.0, cache);
 		if (prefactor != 1.0)
-			potential_with_prefactor = new ExpPotential(original_potential, time_step, -0.5, prefactor);
+			potential_with_prefactor = new ExpPotential(original_potential, time_step, -0.5, prefactor, cache);
 		else
 			potential_with_prefactor = potential_part;
 		if (exponent >= 2)
-			potential_part_square = new ExpPotential(original_potential, time_step, -1.0, 1.0);
+			potential_part_square = new ExpPotential(original_potential, time_step, -1.0, 1.0, cache);
 		else
 			potential_part_square = NULL;
 		(*this) *= (*potential_with_prefactor);
@@ -40,7 +44,7 @@ SecondOrderSplit::SecondOrderSplit(Potential const& original_potential, double t
 		(*this) *= (*potential_part);
 	}
 	else { // No splitting needed if potential is zero
-		kinetic_part = new ExpKinetic(time_step, B, tr, bt, -1.0*exponent, prefactor);
+		kinetic_part = new ExpKinetic(time_step, B, tr, bt, -1.0*exponent, prefactor, kinetic_cache);
 		(*this) *= (*kinetic_part);
 		potential_part = NULL;
 		potential_part_square = NULL;
@@ -56,6 +60,7 @@ SecondOrderSplit::~SecondOrderSplit() {
 		delete potential_with_prefactor;
 	}
 	delete potential_part;
+	delete owned_cache;
 }
 
 void SecondOrderSplit::set_time_step(double time_step) {
@@ -67,3 +72,9 @@ void SecondOrderSplit::set_time_step(double time_step) {
 	if (potential_with_prefactor != potential_part and potential_with_prefactor != NULL)
 		potential_with_prefactor->set_time_step(time_step);
 }
+
+// The product is applied as usual, but each split is traced separately
+void SecondOrderSplit::operate(State& state, StateArray& workspace) const {
+	TraceScope trace("SecondOrderSplit");
+	OperatorProduct::operate(state, workspace);
+}
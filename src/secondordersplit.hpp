@@ -25,6 +25,7 @@
 #include "expkinetic.hpp"
 #include "exppotential.hpp"
 #include "exceptions.hpp"
+#include "trace.hpp"
 
 // The second order split operator approximation (and powers of it) with or
 // without magnetic field. This is the famous Störmer/Verlet factorization
@@ -36,10 +37,15 @@
 
 class SecondOrderSplit : public EvolutionOperator, public OperatorProduct {
 	public:
-		SecondOrderSplit(Potential const& original_potential, double time_step, double B, Transformer const& tr, BoundaryType bt, double prefactor=1.0, int exponent=1);
+		// The tables of the exponentiated potential and kinetic energy are
+		// taken from the given caches, or from private ones if none are given
+		SecondOrderSplit(Potential const& original_potential, double time_step, double B, Transformer const& tr, BoundaryType bt, double prefactor=1.0, int exponent=1,
+				ExpPotentialCache* cache = NULL, ExpKineticCache* kinetic_cache = NULL);
 		~SecondOrderSplit();
 		void set_time_step(double time_step);
+		void operate(State& state, StateArray& workspace) const;
 	private:
+		ExpPotentialCache* owned_cache;
 		EvolutionOperator* kinetic_part;
 		EvolutionOperator* potential_part;
 		EvolutionOperator* potential_part_square;	// Save multiplications by precomputing exp(V)^2
@@ -0,0 +1,235 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "service.hpp"
+
+const size_t Service::max_cached_grids = 8;
+const unsigned int Service::poll_interval = 500;
+
+Service::Service(std::string const& arg_directory,
+		volatile sig_atomic_t* arg_abort_flagptr,
+		volatile sig_atomic_t* arg_save_flagptr,
+		std::ostream& arg_out, std::ostream& arg_err) :
+		directory(arg_directory),
+		abort_flagptr(arg_abort_flagptr),
+		save_flagptr(arg_save_flagptr),
+		out(arg_out), err(arg_err),
+		job_counter(0), jobs_done(0), jobs_failed(0) {
+	struct stat st;
+	if (stat(directory.c_str(), &st) != 0 or not S_ISDIR(st.st_mode))
+		throw GeneralError("Service directory " + directory + " does not exist.");
+}
+
+Service::~Service() {
+	for (std::map<std::string, CachedGrid>::iterator it = cache.begin(); it != cache.end(); ++it) {
+		delete it->second.workspace;
+		delete it->second.operators;
+	}
+}
+
+void Service::run() {
+	out << "Waiting for jobs in " << directory << "." << std::endl;
+	while (not aborted() and not stop_requested()) {
+		if (not run_next_job())
+			usleep(poll_interval*1000);
+	}
+	out << "Service stopped after " << jobs_done + jobs_failed << " jobs, " << jobs_failed << " of which failed." << std::endl;
+}
+
+bool Service::stop_requested() const {
+	struct stat st;
+	return stat((directory + "/stop").c_str(), &st) == 0;
+}
+
+std::vector<std::string> Service::waiting_jobs() const {
+	std::vector<std::string> names;
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL)
+		throw GeneralError("Cannot read service directory " + directory + ".");
+	const std::string suffix(".job");
+	for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+		const std::string filename(entry->d_name);
+		if (filename.size() > suffix.size() and filename.compare(filename.size()-suffix.size(), suffix.size(), suffix) == 0)
+			names.push_back(filename.substr(0, filename.size()-suffix.size()));
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+// Another service sharing the directory may claim a job between listing the
+// jobs and renaming it, in which case the rename fails and the next job is
+// tried.
+bool Service::run_next_job() {
+	const std::vector<std::string> names = waiting_jobs();
+	for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		std::string const& name = *it;
+		if (rename(path(name, ".job").c_str(), path(name, ".running").c_str()) != 0)
+			continue;
+		job_counter++;
+		std::ofstream log(path(name, ".log").c_str());
+		out << "Running job " << name << "..." << std::flush;
+		const bool success = run_job(name, log);
+		log.close();
+		rename(path(name, ".running").c_str(), path(name, success? ".done" : ".failed").c_str());
+		if (success)
+			jobs_done++;
+		else
+			jobs_failed++;
+		out << (success? " done." : " failed.") << std::endl;
+		trim_cache();
+		return true;
+	}
+	return false;
+}
+
+// Run the job the same way as itp2d would with the same arguments, except
+// that the grids come from the cache. Errors are reported in the log of the
+// job.
+bool Service::run_job(std::string const& name, std::ostream& log) {
+	std::ifstream file(path(name, ".running").c_str());
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::vector<std::string> args = split_arguments(contents.str());
+	args.insert(args.begin(), "itp2d");
+	CommandLineParser parser;
+	try {
+		parser.parse(args);
+	}
+	catch (TCLAP::ArgException& e) {
+		log << "Command line parsing error:" << std::endl
+			<< "\tError: " << e.error() << std::endl
+			<< "\t" << e.argId() << std::endl;
+		return false;
+	}
+	catch (TCLAP::ExitException&) {
+		return false;
+	}
+	Parameters params(parser.get_params());
+	if (params.is_ensemble() or not params.get_service_directory().empty()) {
+		log << "Ensembles and services cannot be run as service jobs." << std::endl;
+		return false;
+	}
+	if (params.get_datafile_name() == Parameters::default_datafile_name)
+		params.define_data_storage(path(name, ".h5"), params.get_save_what(), params.get_clobber());
+	const size_t levels = (params.get_resume() and Checkpoint::exists(params.get_checkpoint_file()))?
+		1 : params.get_cascade_levels();
+	ITPSystem* sys = NULL;
+	ITPSystem* coarser = NULL;
+	try {
+		for (size_t level=levels; level-- > 0;) {
+			const Parameters level_params(ITPSystem::cascade_parameters(params, level, coarser));
+			CachedGrid& grid = cached_grid(level_params);
+			sys = new ITPSystem(level_params, abort_flagptr, save_flagptr, log, log, grid.operators, grid.workspace);
+			do {
+				while (not sys->is_finished())
+					sys->step();
+			} while (sys->next_sweep_point());
+			// Keep a workspace the system had to allocate for the next job
+			Workspace* const workspace = sys->release_workspace();
+			if (workspace != NULL) {
+				delete grid.workspace;
+				grid.workspace = workspace;
+			}
+			delete coarser;
+			coarser = NULL;
+			if (level > 0) {
+				if (sys->get_error_flag() or aborted())
+					break;
+				coarser = sys;
+				sys = NULL;
+			}
+		}
+	}
+	catch (std::exception& e) {
+		log << "Error while running job:" << std::endl
+			<< e.what() << std::endl;
+		delete sys;
+		delete coarser;
+		return false;
+	}
+	const bool success = (sys != NULL) and not sys->get_error_flag() and not aborted();
+	delete sys;
+	delete coarser;
+	return success;
+}
+
+// Grids are identified by everything that goes into the shared operators
+std::string Service::grid_key(Parameters const& params) {
+	std::ostringstream key;
+	key << std::setprecision(17) << params.get_sizex() << "x" << params.get_sizey()
+		<< " dx=" << params.get_grid_delta() << " B=" << params.get_B(0)
+		<< " boundary=" << params.get_boundary_type() << " fftw=" << params.get_fftw_flags();
+	return key.str();
+}
+
+Service::CachedGrid& Service::cached_grid(Parameters const& params) {
+	CachedGrid& grid = cache[grid_key(params)];
+	if (grid.operators == NULL)
+		grid.operators = new SharedOperators(params);
+	grid.last_used = job_counter;
+	return grid;
+}
+
+// Forget the least recently used grids. This is only done between jobs, since
+// the systems of a job refer to the grids.
+void Service::trim_cache() {
+	while (cache.size() > max_cached_grids) {
+		std::map<std::string, CachedGrid>::iterator oldest = cache.begin();
+		for (std::map<std::string, CachedGrid>::iterator it = cache.begin(); it != cache.end(); ++it) {
+			if (it->second.last_used < oldest->second.last_used)
+				oldest = it;
+		}
+		delete oldest->second.workspace;
+		delete oldest->second.operators;
+		cache.erase(oldest);
+	}
+}
+
+std::vector<std::string> Service::split_arguments(std::string const& str) {
+	std::vector<std::string> args;
+	std::string current;
+	bool in_argument = false;
+	char quote = '\0';
+	for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+		const char c = *it;
+		if (quote != '\0') {
+			if (c == quote)
+				quote = '\0';
+			else
+				current += c;
+		}
+		else if (c == '\'' or c == '"') {
+			quote = c;
+			in_argument = true;
+		}
+		else if (c == ' ' or c == '\t' or c == '\n' or c == '\r') {
+			if (in_argument)
+				args.push_back(current);
+			current.clear();
+			in_argument = false;
+		}
+		else {
+			current += c;
+			in_argument = true;
+		}
+	}
+	if (in_argument)
+		args.push_back(current);
+	return args;
+}
@@ -0,0 +1,115 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A long-lived itp2d process that runs jobs from a spool directory. Setting up
+ * a system on a new grid means creating FFTW plans, which can take much longer
+ * than solving a small system, and allocating memory. The service keeps the
+ * grid, FFTW plans, kinetic energy operator and workspace of recently used
+ * grids between jobs, so a series of jobs on the same grid only pays for them
+ * once.
+ *
+ * A job is a file NAME.job in the spool directory, containing itp2d command
+ * line arguments separated by whitespace. Arguments containing whitespace can
+ * be quoted with single or double quotes. Waiting jobs are run one at a time
+ * in order of their names. A job is claimed by renaming it to NAME.running,
+ * and when finished it is renamed to NAME.done or NAME.failed. The output of
+ * the job is written to NAME.log. Unless the job names a datafile, its
+ * results are saved to NAME.h5. Claiming a job is atomic, so several service
+ * processes can share one spool directory to run jobs concurrently. The
+ * service stops when a file named "stop" appears in the directory.
+ */
+
+#ifndef _SERVICE_HPP_
+#define _SERVICE_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "itp2d_common.hpp"
+#include "exceptions.hpp"
+#include "parameters.hpp"
+#include "commandlineparser.hpp"
+#include "workspace.hpp"
+#include "itpsystem.hpp"
+
+class Service {
+	public:
+		Service(std::string const& directory,
+				volatile sig_atomic_t* abort_flagptr = NULL,
+				volatile sig_atomic_t* save_flagptr = NULL,
+				std::ostream& out = std::cout,
+				std::ostream& err = std::cerr);
+		~Service();
+		// Run jobs until the service is stopped or the abort flag is set
+		void run();
+		// Run the first waiting job. Returns false if there was none.
+		bool run_next_job();
+		// Names of the waiting jobs, without the suffix, in the order they will be run
+		std::vector<std::string> waiting_jobs() const;
+		// Split the contents of a job file into arguments
+		static std::vector<std::string> split_arguments(std::string const& str);
+		// Getters
+		inline std::string const& get_directory() const { return directory; }
+		inline size_t get_num_cached_grids() const { return cache.size(); }
+		inline size_t get_jobs_done() const { return jobs_done; }
+		inline size_t get_jobs_failed() const { return jobs_failed; }
+		// How many grids are kept in the cache, and how often the directory
+		// is checked for new jobs
+		static const size_t max_cached_grids;
+		static const unsigned int poll_interval;	// in milliseconds
+	private:
+		struct CachedGrid {
+			CachedGrid() : operators(NULL), workspace(NULL), last_used(0) {}
+			SharedOperators const* operators;
+			Workspace* workspace;
+			unsigned long int last_used;	// Number of the job that last used this grid
+		};
+		static std::string grid_key(Parameters const& params);
+		CachedGrid& cached_grid(Parameters const& params);
+		void trim_cache();
+		bool run_job(std::string const& name, std::ostream& log);
+		bool stop_requested() const;
+		inline bool aborted() const { return abort_flagptr != NULL and *abort_flagptr; }
+		inline std::string path(std::string const& name, const char* suffix) const {
+			return directory + "/" + name + suffix;
+		}
+		const std::string directory;
+		volatile sig_atomic_t* abort_flagptr;
+		volatile sig_atomic_t* save_flagptr;
+		std::ostream& out;
+		std::ostream& err;
+		std::map<std::string, CachedGrid> cache;
+		unsigned long int job_counter;
+		size_t jobs_done;
+		size_t jobs_failed;
+};
+
+#endif // _SERVICE_HPP_
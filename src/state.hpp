@@ -57,6 +57,7 @@ class State {
 		inline comp& operator()(size_t x, size_t y) { return datalayout.value(memptr, x, y); }
 		inline comp const& operator()(size_t x, size_t y) const { return datalayout.value(memptr, x, y); }
 		inline comp const* data_ptr() const { return memptr; }
+		inline comp* data_ptr() { return memptr; }
 		void set_by_func(comp (*initfunc)(double, double));
 		// Arithmetic
 		inline State& operator+=(const State& other);
@@ -66,6 +67,7 @@ class State {
 		inline State& operator*=(const comp& other);
 		inline State& operator/=(const comp& other);
 		template<typename Type> inline void pointwise_multiply(Type const* values);
+		template<typename Type> inline void pointwise_multiply(Type const* values, double prefactor);
 		template<typename Type> inline void pointwise_divide(Type const* values);
 		template<typename Type> inline void pointwise_multiply_imaginary_shiftx(Type const* values);
 		template<typename Type> inline void pointwise_multiply_y(Type const* values);
@@ -183,6 +185,13 @@ inline void State::pointwise_multiply(Type const* values) {
 		memptr[i] *= values[i];
 }
 
+// Multiply with values scaled by a constant prefactor, in a single pass
+template <typename Type>
+inline void State::pointwise_multiply(Type const* values, double prefactor) {
+	for (size_t i=0; i<datalayout.N; i++)
+		memptr[i] *= prefactor*values[i];
+}
+
 template <typename Type>
 inline void State::pointwise_divide(Type const* values) {
 	for (size_t i=0; i<datalayout.N; i++)
@@ -0,0 +1,240 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "statememory.hpp"
+
+#ifdef __linux__
+// Older C libraries do not define the flags for selecting the huge page size
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+namespace {
+	const size_t huge_page_size_2M = 2*1024*1024;
+	const size_t huge_page_size_1G = 1024*1024*1024;
+
+	inline size_t round_up(size_t num, size_t multiple) {
+		return ((num + multiple - 1)/multiple)*multiple;
+	}
+}
+
+StateMemory::StateMemory(size_t num, MemoryPlacement arg_placement, PageBacking backing) :
+		dataptr(NULL), placement(arg_placement), page_backing(backing),
+		mapping(NULL), mapping_length(0), scratch_fd(-1) {
+	#ifdef USE_LIBNUMA
+	if (numa_available() < 0)
+		placement = FirstTouchPlacement;
+	#else
+	placement = FirstTouchPlacement;
+	#endif
+	#ifndef __linux__
+	// Huge pages are only supported on Linux
+	page_backing = NormalPages;
+	#endif
+	if (placement == FirstTouchPlacement and page_backing == NormalPages) {
+		dataptr = malloc_comp(num);
+		if (dataptr == NULL)
+			throw std::bad_alloc();
+		return;
+	}
+	map_memory(num*sizeof(comp), page_backing);
+	dataptr = reinterpret_cast<comp*>(mapping);
+	#ifdef USE_LIBNUMA
+	// This only sets the policy for the pages. They are placed when touched.
+	if (placement == InterleavedPlacement)
+		numa_interleave_memory(mapping, mapping_length, numa_all_nodes_ptr);
+	#endif
+}
+
+#ifdef __linux__
+StateMemory::StateMemory(size_t num, std::string const& scratch_directory) :
+		dataptr(NULL), placement(FirstTouchPlacement), page_backing(NormalPages),
+		mapping(NULL), mapping_length(0), scratch_fd(-1) {
+	const std::string name = scratch_directory + "/itp2d-scratch-XXXXXX";
+	std::vector<char> namebuf(name.begin(), name.end());
+	namebuf.push_back('\0');
+	const int fd = mkstemp(&namebuf[0]);
+	if (fd < 0)
+		throw ScratchFileError(name, strerror(errno));
+	// The file is unlinked right away, so it is removed even if itp2d crashes
+	unlink(&namebuf[0]);
+	const size_t length = round_up(num*sizeof(comp), static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+	if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+		const int error = errno;
+		close(fd);
+		throw ScratchFileError(&namebuf[0], strerror(error));
+	}
+	void* const ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		const int error = errno;
+		close(fd);
+		throw ScratchFileError(&namebuf[0], strerror(error));
+	}
+	scratch_fd = fd;
+	mapping = ptr;
+	mapping_length = length;
+	dataptr = reinterpret_cast<comp*>(mapping);
+}
+#else
+StateMemory::StateMemory(size_t, std::string const&) :
+		dataptr(NULL), placement(FirstTouchPlacement), page_backing(NormalPages),
+		mapping(NULL), mapping_length(0), scratch_fd(-1) {
+	throw NotImplemented("File-backed state memory on this platform");
+}
+#endif
+
+StateMemory::~StateMemory() {
+	#ifdef __linux__
+	if (mapping != NULL) {
+		munmap(mapping, mapping_length);
+		if (scratch_fd >= 0)
+			close(scratch_fd);
+		return;
+	}
+	#endif
+	fftw_free(dataptr);
+}
+
+#ifdef __linux__
+void StateMemory::prefetch(size_t offset, size_t num) const {
+	if (scratch_fd < 0 or num == 0)
+		return;
+	// Extend the range to whole pages
+	const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t start = (offset*sizeof(comp)/pagesize)*pagesize;
+	const size_t end = std::min(round_up((offset+num)*sizeof(comp), pagesize), mapping_length);
+	madvise(reinterpret_cast<char*>(mapping) + start, end - start, MADV_WILLNEED);
+}
+
+void StateMemory::release(size_t offset, size_t num) const {
+	if (scratch_fd < 0 or num == 0)
+		return;
+	// Shrink the range to whole pages, since the pages at the edges might
+	// still be needed by someone else
+	const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t start = round_up(offset*sizeof(comp), pagesize);
+	const size_t end = ((offset+num)*sizeof(comp)/pagesize)*pagesize;
+	if (end <= start)
+		return;
+	// Start writing the pages back to the file, and drop them from our
+	// address space. With a shared file mapping no data is lost, and the
+	// kernel is free to evict the pages once they are written.
+	sync_file_range(scratch_fd, static_cast<off_t>(start), static_cast<off_t>(end - start), SYNC_FILE_RANGE_WRITE);
+	madvise(reinterpret_cast<char*>(mapping) + start, end - start, MADV_DONTNEED);
+}
+
+void StateMemory::discard(size_t offset, size_t num) const {
+	if (num == 0)
+		return;
+	// The memory might have come from malloc, so round the actual addresses
+	// instead of offsets from the start of a mapping
+	const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t start = round_up(reinterpret_cast<size_t>(dataptr + offset), pagesize);
+	const size_t end = (reinterpret_cast<size_t>(dataptr + offset + num)/pagesize)*pagesize;
+	if (end <= start)
+		return;
+	// This fails for explicit huge pages unless the range happens to be
+	// aligned to them, in which case the memory is simply kept
+	madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+}
+#else
+// Without Linux the memory is never file-backed and the pages are simply kept
+void StateMemory::prefetch(size_t, size_t) const {}
+void StateMemory::release(size_t, size_t) const {}
+void StateMemory::discard(size_t, size_t) const {}
+#endif
+
+// Map anonymous memory with the requested page backing, falling back to
+// explicit huge pages of a smaller size, then to transparent huge pages and
+// finally to normal pages. 1 GB pages are only used for allocations of at
+// least one page, since otherwise most of the page would be wasted.
+#ifdef __linux__
+void StateMemory::map_memory(size_t bytes, PageBacking backing) {
+	#ifdef MAP_HUGETLB
+	if (backing == HugePages1G and bytes < huge_page_size_1G)
+		backing = HugePages2M;
+	if (backing == HugePages1G or backing == HugePages2M) {
+		const size_t pagesize = (backing == HugePages1G)? huge_page_size_1G : huge_page_size_2M;
+		const int sizeflag = (backing == HugePages1G)? MAP_HUGE_1GB : MAP_HUGE_2MB;
+		const size_t length = round_up(bytes, pagesize);
+		void* const ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | sizeflag, -1, 0);
+		if (ptr != MAP_FAILED) {
+			mapping = ptr;
+			mapping_length = length;
+			page_backing = backing;
+			return;
+		}
+		// Usually this means that no huge pages of this size are reserved
+		map_memory(bytes, (backing == HugePages1G)? HugePages2M : TransparentHugePages);
+		return;
+	}
+	#endif
+	const size_t length = round_up(bytes, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+	void* const ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		throw std::bad_alloc();
+	mapping = ptr;
+	mapping_length = length;
+	#ifdef MADV_HUGEPAGE
+	if (backing != NormalPages and madvise(mapping, mapping_length, MADV_HUGEPAGE) == 0)
+		page_backing = TransparentHugePages;
+	else
+		page_backing = NormalPages;
+	#else
+	page_backing = NormalPages;
+	#endif
+}
+#else
+void StateMemory::map_memory(size_t, PageBacking) {
+	throw NotImplemented("Memory mapping on this platform");
+}
+#endif
+
+std::string page_backing_description(PageBacking backing) {
+	switch (backing) {
+		case NormalPages:
+			return "normal";
+		case TransparentHugePages:
+			return "transparent-huge-pages";
+		case HugePages2M:
+			return "hugetlb-2MB";
+		case HugePages1G:
+			return "hugetlb-1GB";
+		default:
+			throw GeneralError("Switch statement at page_backing_description ended up where it never should.");
+	}
+}
+
+std::string memory_placement_description(MemoryPlacement placement) {
+	switch (placement) {
+		case FirstTouchPlacement:
+			return "first-touch";
+		case InterleavedPlacement:
+			return "interleaved";
+		default:
+			throw GeneralError("Switch statement at memory_placement_description ended up where it never should.");
+	}
+}
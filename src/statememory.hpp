@@ -0,0 +1,93 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A class owning one large block of memory for state data. The memory can be
+ * interleaved over NUMA nodes (with libnuma, if itp2d was compiled with
+ * USE_LIBNUMA defined) and backed by huge pages, which reduces TLB misses when
+ * the states are accessed with large strides. If the requested placement or
+ * page backing is not available the allocation falls back to a less demanding
+ * one, and the backing that was actually used can be queried afterwards.
+ *
+ * The memory is not touched when allocated, so that the pages can be placed
+ * on NUMA nodes by first touch. See numa.hpp.
+ *
+ * For data sets that do not fit in RAM the memory can also be backed by a
+ * scratch file, which is memory-mapped and unlinked right after creation so
+ * that it disappears when itp2d exits. The operating system then pages the
+ * data in and out as needed. Users of file-backed memory should work on it in
+ * blocks and tell StateMemory which parts they are about to use (prefetch) and
+ * which parts they are done with (release).
+ */
+
+#ifndef _STATEMEMORY_HPP_
+#define _STATEMEMORY_HPP_
+
+#include <string>
+#include <new>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#endif
+
+#ifdef USE_LIBNUMA
+#include <numa.h>
+#endif
+
+#include "itp2d_common.hpp"
+#include "exceptions.hpp"
+
+class StateMemory {
+	public:
+		StateMemory(size_t num, MemoryPlacement placement = FirstTouchPlacement,
+				PageBacking backing = NormalPages);
+		StateMemory(size_t num, std::string const& scratch_directory);	// File-backed memory
+		~StateMemory();
+		inline comp* get_dataptr() const { return dataptr; }
+		inline bool is_file_backed() const { return scratch_fd >= 0; }
+		// Hints about the use of num elements starting from offset. These do
+		// nothing unless the memory is file-backed.
+		void prefetch(size_t offset, size_t num) const;
+		void release(size_t offset, size_t num) const;
+		// Give the whole pages within num elements starting from offset back
+		// to the operating system. The contents of the range are lost.
+		void discard(size_t offset, size_t num) const;
+		inline MemoryPlacement get_placement() const { return placement; }
+		inline PageBacking get_page_backing() const { return page_backing; }
+	private:
+		void map_memory(size_t bytes, PageBacking backing);
+		comp* dataptr;
+		MemoryPlacement placement;
+		PageBacking page_backing;
+		// Start and length of the mapping if the memory was allocated with
+		// mmap instead of fftw_malloc
+		void* mapping;
+		size_t mapping_length;
+		int scratch_fd;	// File descriptor of the scratch file, or -1 if not file-backed
+};
+
+std::string page_backing_description(PageBacking backing);
+std::string memory_placement_description(MemoryPlacement placement);
+
+#endif // _STATEMEMORY_HPP_
@@ -20,18 +20,55 @@
 
 // Constructors & Destructors
 
-StateSet::StateSet(size_t arg_N, DataLayout const& dl, OrthoAlgorithm algo) :
-		datalayout(dl), N(arg_N), ortho_algorithm(algo), ESolver(N),
+StateSet::StateSet(size_t arg_N, DataLayout const& dl, OrthoAlgorithm algo,
+		MemoryPlacement placement, PageBacking backing) :
+		datalayout(dl), N(arg_N), ortho_algorithm(algo), memory_budget(0), snapshot_memory(0), ESolver(new EigenSolver(arg_N)), ESolver_size(arg_N),
 		timestep_converged(N), finally_converged(N) {
-	dataptr1 = reinterpret_cast<comp*>(fftw_malloc(N*datalayout.N*sizeof(comp)));
-	dataptr2 = NULL;
-	statearrayptr1 = new StateArray(N, datalayout, dataptr1);
-	statearrayptr2 = NULL;
+	// The memory is not touched here. See first_touch_state_arrays()
+	memory1 = new StateMemory(N*datalayout.N, placement, backing);
+	memory2 = NULL;
 	// More memory is needed if using the HighMem algorithm
-	if (ortho_algorithm == HighMem) {
-		dataptr2 = reinterpret_cast<comp*>(fftw_malloc(N*datalayout.N*sizeof(comp)));
-		statearrayptr2 = new StateArray(N, datalayout, dataptr2);
+	if (ortho_algorithm == HighMem)
+		memory2 = new StateMemory(N*datalayout.N, placement, backing);
+	setup();
+}
+
+// When the states are saved with a background writer, up to io_queue_length
+// copies of them can be waiting to be written while one more is being made.
+static size_t async_io_snapshot_memory(Parameters const& params, DataLayout const& dl) {
+	const Parameters::SaveWhat save_what = params.get_save_what();
+	if (not params.get_async_io() or (save_what != Parameters::FinalStates and save_what != Parameters::Everything))
+		return 0;
+	return (params.get_io_queue_length()+1)*params.get_N()*dl.N*sizeof(comp);
+}
+
+StateSet::StateSet(Parameters const& params, DataLayout const& dl) :
+		datalayout(dl), N(params.get_N()), ortho_algorithm(params.get_ortho_algorithm()),
+		memory_budget(params.get_memory_budget()*1024*1024),
+		snapshot_memory(async_io_snapshot_memory(params, dl)),
+		ESolver(new EigenSolver(params.get_N())), ESolver_size(params.get_N()),
+		timestep_converged(N), finally_converged(N) {
+	memory2 = NULL;
+	if (params.get_scratch_directory().empty()) {
+		const MemoryPlacement placement = params.get_numa_interleave()? InterleavedPlacement : FirstTouchPlacement;
+		memory1 = new StateMemory(N*datalayout.N, placement, params.get_page_backing());
+		if (ortho_algorithm == HighMem)
+			memory2 = new StateMemory(N*datalayout.N, placement, params.get_page_backing());
+	}
+	else {
+		if (ortho_algorithm == HighMem)
+			throw GeneralError("The HighMem orthonormalization algorithm cannot be used with out-of-core storage.");
+		memory1 = new StateMemory(N*datalayout.N, params.get_scratch_directory());
 	}
+	setup();
+}
+
+// Common part of the constructors
+void StateSet::setup() {
+	dataptr1 = memory1->get_dataptr();
+	dataptr2 = (memory2 != NULL)? memory2->get_dataptr() : NULL;
+	statearrayptr1 = new StateArray(N, datalayout, dataptr1);
+	statearrayptr2 = (memory2 != NULL)? new StateArray(N, datalayout, dataptr2) : NULL;
 	state_array = statearrayptr1;
 	other_state_array = statearrayptr2;
 	overlapmatrix = new comp[N*N];
@@ -41,14 +78,38 @@ StateSet::StateSet(size_t arg_N, DataLayout const& dl, OrthoAlgorithm algo) :
 	}
 	how_many_timestep_converged = 0;
 	how_many_finally_converged = 0;
+	// With out-of-core storage, the overlap matrix, the workspace of the
+	// eigensolver and the copies of the states made by the background writer
+	// are always in memory. What is left of the memory budget needs to fit
+	// two blocks of states when forming the overlap matrix, and two sets of
+	// lincomb_chunk grid points for all states when forming the linear
+	// combinations.
+	if (is_out_of_core()) {
+		const size_t fixed = N*N*sizeof(comp) + ESolver->get_memory() + snapshot_memory;
+		const size_t state_size = datalayout.N*sizeof(comp);
+		if (memory_budget < fixed + 2*state_size) {
+			std::ostringstream msg;
+			msg << "Memory budget too small for out-of-core operation: at least "
+				<< (fixed + 2*state_size)/(1024*1024) + 1 << " MB is needed.";
+			throw GeneralError(msg.str());
+		}
+		const size_t available = memory_budget - fixed;
+		block_size = std::min(N, available/(2*state_size));
+		lincomb_chunk = std::max(static_cast<size_t>(1), std::min(datalayout.N, available/(2*N*sizeof(comp))));
+	}
+	else {
+		block_size = N;
+		lincomb_chunk = datalayout.N;
+	}
 }
 
 StateSet::~StateSet() {
-	fftw_free(dataptr1);
-	if (dataptr2 != NULL)
-		fftw_free(dataptr2);
+	discard_locked_states();
+	delete ESolver;
 	delete statearrayptr1;
 	delete statearrayptr2;
+	delete memory1;
+	delete memory2;
 	delete[] overlapmatrix;
 }
 
@@ -62,17 +123,13 @@ void StateSet::init(Parameters const& params, RNG& rng) {
 	// Initialize wave function data
 	switch(params.get_initialstate_preset()) {
 		case Parameters::UserSuppliedInitialState:
-			for (size_t n=0; n<N; n++)
-				for (size_t y=0; y<datalayout.sizey; y++) {
-					const double dy = datalayout.get_posy(y);
-					for (size_t x=0; x<datalayout.sizex; x++) {
-						const double dx = datalayout.get_posx(x);
-						data(n,x,y) = func(n, dx, dy);
-					}
-				}
+			init(func);
 			break;
 		case Parameters::CopyFromFile:
-			init_from_datafile(params.get_copy_from());
+			init_from_datafile(params.get_copy_from(), rng, params.get_boundary_type());
+			break;
+		case Parameters::CopyFromStateSet:
+			init_from_stateset(params.get_initial_states(), rng, params.get_boundary_type());
 			break;
 		case Parameters::Random:
 			init_to_gaussian_noise(rng);
@@ -83,32 +140,266 @@ void StateSet::init(Parameters const& params, RNG& rng) {
 	}
 }
 
+// Read the grid properties and the number of states from the root of a
+// datafile
+static void read_saved_grid(H5::H5File const& file, size_t& num_states, size_t& sizex, size_t& sizey, double& dx) {
+	H5::Group root = file.openGroup("/");
+	int n, sx, sy;
+	root.openAttribute("num_states").read(H5::PredType::NATIVE_INT, &n);
+	root.openAttribute("grid_sizex").read(H5::PredType::NATIVE_INT, &sx);
+	root.openAttribute("grid_sizey").read(H5::PredType::NATIVE_INT, &sy);
+	root.openAttribute("grid_delta").read(H5::PredType::NATIVE_DOUBLE, &dx);
+	num_states = static_cast<size_t>(n);
+	sizex = static_cast<size_t>(sx);
+	sizey = static_cast<size_t>(sy);
+}
+
 void StateSet::init_from_datafile(std::string filename) {
-	// open other file read-only
+	// open other file read-only, making sure that the states can be
+	// decompressed if they were written with one of our own filters
+	register_compression_filters();
 	H5::H5File otherfile;
 	otherfile.openFile(filename, H5F_ACC_RDONLY);
-	H5::Group otherroot = otherfile.openGroup("/");
 	// check that grid properties match
-	int othersx, othersy, otherN;
+	size_t otherN, othersx, othersy;
 	double otherdx;
-	otherroot.openAttribute("num_states").read(H5::PredType::NATIVE_INT, &otherN);
-	otherroot.openAttribute("grid_sizex").read(H5::PredType::NATIVE_INT, &othersx);
-	otherroot.openAttribute("grid_sizex").read(H5::PredType::NATIVE_INT, &othersy);
-	otherroot.openAttribute("grid_delta").read(H5::PredType::NATIVE_DOUBLE, &otherdx);
-	if (static_cast<int>(N) != otherN)
+	read_saved_grid(otherfile, otherN, othersx, othersy, otherdx);
+	if (N != otherN)
 		throw GeneralError("Cannot copy state data from datafile: value for num_states does not match.");
-	if (static_cast<int>(datalayout.sizex) != othersx)
+	if (datalayout.sizex != othersx)
 		throw GeneralError("Cannot copy state data from datafile: value for grid_sizex does not match.");
-	if (static_cast<int>(datalayout.sizey) != othersy)
+	if (datalayout.sizey != othersy)
 		throw GeneralError("Cannot copy state data from datafile: value for grid_sizey does not match.");
 	if (datalayout.dx != otherdx)
 		throw GeneralError("Cannot copy state data from datafile: value for grid_delta does not match.");
-	// copy data
-	H5::DataSet other_states_data = otherfile.openDataSet("/states");
-	other_states_data.read(state_array->get_dataptr(), other_states_data.getArrayType());
+	discard_locked_states();
+	first_touch_state_arrays();
+	read_saved_states(otherfile.openDataSet("/states"), 0, N, datalayout, state_array->get_dataptr());
+}
+
+// Whether two grids cover the same area, up to rounding errors
+static bool same_area(DataLayout const& a, DataLayout const& b) {
+	return std::abs(a.lenx - b.lenx) <= 1e-9*b.lenx and std::abs(a.leny - b.leny) <= 1e-9*b.leny;
+}
+
+// Copy as many states as possible from the datafile, and fill the rest with
+// noise. If the grid differs, the states are resampled by spectral
+// interpolation, which requires that both grids cover the same area.
+void StateSet::init_from_datafile(std::string filename, RNG& rng, BoundaryType boundary) {
+	register_compression_filters();
+	H5::H5File otherfile;
+	otherfile.openFile(filename, H5F_ACC_RDONLY);
+	size_t otherN, othersx, othersy;
+	double otherdx;
+	read_saved_grid(otherfile, otherN, othersx, othersy, otherdx);
+	const DataLayout otherlayout(othersx, othersy, otherdx);
+	const bool same_grid = (otherlayout == datalayout);
+	if (not same_grid and not same_area(otherlayout, datalayout))
+		throw GeneralError("Cannot copy state data from datafile: the grids do not cover the same area.");
+	const size_t num_copied = std::min(N, otherN);
+	const H5::DataSet other_states_data = otherfile.openDataSet("/states");
+	discard_locked_states();
+	first_touch_state_arrays();
+	if (same_grid)
+		read_saved_states(other_states_data, 0, num_copied, datalayout, state_array->get_dataptr());
+	else
+		resample_saved_states(other_states_data, num_copied, otherlayout, boundary);
+	if (num_copied < N) {
+		fill_with_gaussian_noise(num_copied, rng);
+		orthogonalize_against_first(num_copied);
+	}
+}
+
+// Read states first, ..., first+num-1 of the last saved set of states, stored
+// on the given grid, to ptr. The states are read as double precision,
+// whatever precision they were stored in. Datafiles of earlier versions of
+// itp2d store each state as a single element of an array type, and they can
+// be read as well.
+void StateSet::read_saved_states(H5::DataSet const& dataset, size_t first, size_t num, DataLayout const& layout,
+		comp* ptr) const {
+	H5::DataSpace filespace = dataset.getSpace();
+	const int rank = filespace.getSimpleExtentNdims();
+	if (rank != 2 and rank != 4)
+		throw GeneralError("Cannot copy state data from datafile: the states are not stored as expected.");
+	hsize_t dims[4];
+	filespace.getSimpleExtentDims(dims);
+	if (dims[0] == 0 or dims[1] < first+num)
+		throw GeneralError("Cannot copy state data from datafile: not enough states saved.");
+	const hsize_t start[4] = {dims[0]-1, first, 0, 0};
+	const hsize_t count[4] = {1, num, layout.sizey, layout.sizex};
+	filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+	H5::CompType complex_type(sizeof(comp));
+	complex_type.insertMember("r", 0, H5::PredType::NATIVE_DOUBLE);
+	complex_type.insertMember("i", sizeof(double), H5::PredType::NATIVE_DOUBLE);
+	if (rank == 4) {
+		const hsize_t len = num*layout.N;
+		const H5::DataSpace memspace(1, &len);
+		dataset.read(ptr, complex_type, memspace, filespace);
+	}
+	else {
+		const H5::DataSpace memspace(1, &count[1]);
+		const hsize_t state_dims[2] = {layout.sizey, layout.sizex};
+		const H5::ArrayType state_type(complex_type, 2, state_dims);
+		dataset.read(ptr, state_type, memspace, filespace);
+	}
+}
+
+// For resampling from a grid of n points to a grid of m points covering the
+// same length, find the frequency of the old grid matching each frequency of
+// the new grid, or -1 if there is none. The Nyquist frequency of the smaller
+// grid is dropped, since it cannot be split between the positive and
+// negative frequencies unambiguously.
+static std::vector<long> match_frequencies(size_t n, size_t m) {
+	std::vector<long> index(m, -1);
+	const long ln = static_cast<long>(n);
+	const long lm = static_cast<long>(m);
+	const long smaller = std::min(ln, lm);
+	for (long q=0; q<lm; q++) {
+		const long s = (q < lm/2)? q : q-lm;
+		if (2*std::abs(s) < smaller)
+			index[static_cast<size_t>(q)] = (s >= 0)? s : s+ln;
+	}
+	return index;
+}
+
+// The same for the sine modes of grids with Dirichlet boundaries. Both grids
+// have the walls at the same place, so the modes are the same on both grids
+// and each mode of the new grid is simply the same mode of the old grid, if
+// the old grid has it.
+static std::vector<long> match_sine_modes(size_t n, size_t m) {
+	std::vector<long> index(m, -1);
+	for (size_t k=0; k<std::min(n, m); k++)
+		index[k] = static_cast<long>(k);
+	return index;
+}
+
+// The factor for each copied sine mode. The inverse of FFTW's DST-II counts
+// the coefficient of the highest mode once and the others twice, so the
+// coefficient of the highest mode of either grid is scaled accordingly when
+// it is copied to an ordinary mode.
+static std::vector<comp> sine_mode_factors(size_t n, size_t m) {
+	std::vector<comp> factor(m, 1.0);
+	for (size_t k=0; k<std::min(n, m); k++) {
+		if (k+1 == n)
+			factor[k] *= 0.5;
+		if (k+1 == m)
+			factor[k] *= 2.0;
+	}
+	return factor;
+}
+
+// Resample the first num saved states from their grid to ours, reading them a
+// block at a time.
+void StateSet::resample_saved_states(H5::DataSet const& dataset, size_t num, DataLayout const& layout,
+		BoundaryType boundary) {
+	const Transformer from(layout, FFTW_ESTIMATE);
+	const Transformer to(datalayout, FFTW_ESTIMATE);
+	const size_t block = std::min(block_size, num);
+	std::vector<comp> saved(block*layout.N);
+	for (size_t first=0; first<num; first+=block) {
+		const size_t len = std::min(block, num-first);
+		read_saved_states(dataset, first, len, layout, &saved[0]);
+		prefetch_states(first, len);
+		resample_states(&saved[0], first, len, from, to, boundary);
+		release_states(first, len);
+	}
+}
+
+// Resample states first, ..., first+len-1 from the grid of the transformer
+// 'from' to ours by spectral interpolation. The states are read contiguously
+// from source. The Fourier coefficients of the old grid are copied to the
+// frequencies of the new grid, which amounts to zero-padding or truncation,
+// and shifted in phase to account for the grid points of the two grids being
+// offset from each other. With Dirichlet boundaries the sine transform is used
+// instead, and the sine modes need no phase shift.
+void StateSet::resample_states(comp const* source, size_t first, size_t len, Transformer const& from,
+		Transformer const& to, BoundaryType boundary) {
+	DataLayout const& layout = from.datalayout;
+	const bool periodic = (boundary == Periodic);
+	std::vector<long> mapx, mapy;
+	std::vector<comp> factorx, factory;
+	if (periodic) {
+		mapx = match_frequencies(layout.sizex, datalayout.sizex);
+		mapy = match_frequencies(layout.sizey, datalayout.sizey);
+		const double shiftx = datalayout.get_posx(0) - layout.get_posx(0);
+		const double shifty = datalayout.get_posy(0) - layout.get_posy(0);
+		factorx.resize(datalayout.sizex);
+		factory.resize(datalayout.sizey);
+		for (size_t x=0; x<datalayout.sizex; x++)
+			factorx[x] = std::exp(comp(0, to.fft_kx(x)*shiftx));
+		for (size_t y=0; y<datalayout.sizey; y++)
+			factory[y] = std::exp(comp(0, to.fft_ky(y)*shifty));
+	}
+	else {
+		mapx = match_sine_modes(layout.sizex, datalayout.sizex);
+		mapy = match_sine_modes(layout.sizey, datalayout.sizey);
+		factorx = sine_mode_factors(layout.sizex, datalayout.sizex);
+		factory = sine_mode_factors(layout.sizey, datalayout.sizey);
+	}
+	#pragma omp parallel
+	{
+		State buffer(layout);
+		#pragma omp for schedule(dynamic)
+		for (size_t n=first; n<first+len; n++) {
+			memcpy(buffer.data_ptr(), source + (n-first)*layout.N, layout.N*sizeof(comp));
+			buffer.transform(periodic? FFT : DST, from);
+			State& state = (*state_array)[n];
+			for (size_t y=0; y<datalayout.sizey; y++) {
+				for (size_t x=0; x<datalayout.sizex; x++) {
+					if (mapx[x] < 0 or mapy[y] < 0)
+						state(x,y) = 0;
+					else
+						state(x,y) = buffer(static_cast<size_t>(mapx[x]), static_cast<size_t>(mapy[y]))
+							*factorx[x]*factory[y];
+				}
+			}
+			state.transform(periodic? iFFT : iDST, to);
+			state.normalize();
+		}
+	}
+}
+
+// Start from the states of another StateSet, such as one converged on
+// a coarser grid. As with datafiles, the number of states and the grid may
+// differ, as long as both grids cover the same area.
+void StateSet::init_from_stateset(StateSet const& other, RNG& rng, BoundaryType boundary) {
+	if (other.get_num_locked() > 0)
+		throw GeneralError("Cannot copy states from a set of states with locked states.");
+	DataLayout const& layout = other.datalayout;
+	const bool same_grid = (layout == datalayout);
+	if (not same_grid and not same_area(layout, datalayout))
+		throw GeneralError("Cannot copy states: the grids do not cover the same area.");
+	const size_t num_copied = std::min(N, other.N);
+	discard_locked_states();
+	first_touch_state_arrays();
+	const Transformer from(layout, FFTW_ESTIMATE);
+	const Transformer to(datalayout, FFTW_ESTIMATE);
+	const size_t block = std::min(std::min(block_size, other.block_size), std::max(num_copied, static_cast<size_t>(1)));
+	for (size_t first=0; first<num_copied; first+=block) {
+		const size_t len = std::min(block, num_copied-first);
+		other.prefetch_states(first, len);
+		prefetch_states(first, len);
+		if (same_grid) {
+			#pragma omp parallel for schedule(static)
+			for (size_t n=first; n<first+len; n++)
+				(*state_array)[n] = other[n];
+		}
+		else {
+			// The states of a StateSet are stored contiguously
+			resample_states(other[first].data_ptr(), first, len, from, to, boundary);
+		}
+		release_states(first, len);
+		other.release_states(first, len);
+	}
+	if (num_copied < N) {
+		fill_with_gaussian_noise(num_copied, rng);
+		orthogonalize_against_first(num_copied);
+	}
 }
 
 void StateSet::init(comp (*initfunc)(size_t, double, double)) {
+	discard_locked_states();
+	first_touch_state_arrays();
 	double dx, dy;
 	for (size_t n=0; n<N; n++) {
 		for (size_t y=0; y<datalayout.sizey; y++) {
@@ -122,41 +413,135 @@ void StateSet::init(comp (*initfunc)(size_t, double, double)) {
 }
 
 void StateSet::init_to_gaussian_noise(RNG& rng) {
-	for (size_t n=0; n<N; n++) {
-		for (size_t y=0; y<datalayout.sizey; y++)
-			for (size_t x=0; x<datalayout.sizex; x++)
-				data(n,x,y) = comp(rng.gaussian_rand(), rng.gaussian_rand());
+	discard_locked_states();
+	first_touch_state_arrays();
+	fill_with_gaussian_noise(0, rng);
+}
+
+// Fill states first, ..., N-1 with normalized gaussian noise. The value at
+// each grid point is drawn from a counter-based generator keyed from rng, with
+// the state index and the grid point as the counter, so the rows can be filled
+// in parallel and the result is still independent of the number of threads.
+// The pages are already placed by now.
+void StateSet::fill_with_gaussian_noise(size_t first, RNG& rng) {
+	const CounterRNG counter_rng(rng);
+	const size_t sizex = datalayout.sizex;
+	const size_t sizey = datalayout.sizey;
+	#pragma omp parallel for schedule(static)
+	for (size_t row=first*sizey; row<N*sizey; row++) {
+		const size_t n = row/sizey;
+		const size_t y = row%sizey;
+		double re, im;
+		for (size_t x=0; x<sizex; x++) {
+			counter_rng.gaussian_pair(n, y*sizex+x, re, im);
+			data(n,x,y) = comp(re, im);
+		}
+	}
+	#pragma omp parallel for schedule(static)
+	for (size_t n=first; n<N; n++)
 		(*state_array)[n].normalize();
+}
+
+// Make states first, ..., N-1 orthogonal to the states before them. The
+// subspace orthonormalization mixes states that overlap, so this keeps it
+// from disturbing the states that were copied from a datafile.
+void StateSet::orthogonalize_against_first(size_t first) {
+	std::vector<double> norms(first);
+	for (size_t m=0; m<first; m++)
+		norms[m] = real((*state_array)[m].dot((*state_array)[m]));
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t n=first; n<N; n++) {
+		State& state = (*state_array)[n];
+		for (size_t m=0; m<first; m++) {
+			const comp mult = -(*state_array)[m].dot(state)/norms[m];
+			cblas_zaxpy(static_cast<int>(datalayout.N),
+					reinterpret_cast<const double*>(&mult),
+					reinterpret_cast<const double*>((*state_array)[m].data_ptr()), 1,
+					reinterpret_cast<double*>(state.data_ptr()), 1);
+		}
+		state.normalize();
 	}
 }
 
+// Zero the state data in parallel so that on NUMA machines each state is
+// stored on the node of the thread that propagates it. This needs to happen
+// after the number of OpenMP threads is set, which is why it is not done in
+// the constructor.
+void StateSet::first_touch_state_arrays() {
+	// A fresh scratch file reads as zeroes, and there is nothing to place
+	if (is_out_of_core())
+		return;
+	first_touch(dataptr1, N, datalayout.N);
+	if (dataptr2 != NULL)
+		first_touch(dataptr2, N, datalayout.N);
+}
+
 // Orthonormalization with the subspace orthonormalization method,
 // explained for example in M. Aichinger, E. Krotscheck, Comp. Mat. Sci. 34 (2005), pages 193--194.
 
 void StateSet::orthonormalize() throw(std::exception) {
-	// Handle the trivial case N=1 separately
-	if (N == 1) {
-		ortho_timer.start();
-		const double norm = (*state_array)[0].norm();
-		(*state_array)[0] *= 1.0/norm;
+	TraceScope trace("orthonormalize");
+	ortho_timer.start();
+	// Locked states occupy the first L slots and are left alone. The other K
+	// states are first made orthogonal to them, and then orthonormalized
+	// among themselves as usual.
+	const size_t L = get_num_locked();
+	const size_t K = N - L;
+	if (L > 0) {
+		dot_timer.start();
+		for (size_t first=L; first<N; first+=block_size) {
+			const size_t len = std::min(block_size, N-first);
+			prefetch_states(first, len);
+			#pragma omp parallel for
+			for (size_t n=first; n<first+len; n++) {
+				for (size_t l=0; l<L; l++)
+					cold_states[l]->project_out((*state_array)[n]);
+			}
+			release_states(first, len);
+		}
+		dot_timer.stop();
+	}
+	// Handle the trivial cases K=0 and K=1 separately
+	if (K <= 1) {
+		if (K == 1) {
+			const double norm = (*state_array)[L].norm();
+			(*state_array)[L] *= 1.0/norm;
+		}
 		ortho_timer.stop();
 		return;
 	}
-	ortho_timer.start();
 	dot_timer.start();
+	TraceScope overlap_trace("overlap matrix");
 	// NOTE: Because Eigensolver uses LAPACK, the overlap matrix is stored in column-major format
-	#pragma omp parallel for
-	for (size_t i=0; i<N; i++) {
-		for (size_t j=i; j<N; j++) {
-			overlapmatrix[N*j+i] = dot(i,j);
+	// The matrix is formed in blocks of states. Unless the states are stored
+	// out-of-core there is only one block.
+	for (size_t first_i=L; first_i<N; first_i+=block_size) {
+		const size_t len_i = std::min(block_size, N-first_i);
+		prefetch_states(first_i, len_i);
+		for (size_t first_j=first_i; first_j<N; first_j+=block_size) {
+			const size_t len_j = std::min(block_size, N-first_j);
+			if (first_j != first_i)
+				prefetch_states(first_j, len_j);
+			#pragma omp parallel for
+			for (size_t i=first_i; i<first_i+len_i; i++) {
+				for (size_t j=std::max(i, first_j); j<first_j+len_j; j++) {
+					overlapmatrix[K*(j-L)+(i-L)] = dot(i,j);
+				}
+			}
+			if (first_j != first_i)
+				release_states(first_j, len_j);
 		}
+		release_states(first_i, len_i);
 	}
+	overlap_trace.end();
 	dot_timer.stop();
 	// Solve eigenvalue problem for the overlap matrix
 	eigensolve_timer.start();
-	ESolver.solve(overlapmatrix);
-	for (size_t n=0; n<N; n++) {
-		const double eval = ESolver.eigenvalue(n);
+	TraceScope eigensolve_trace("eigensolve");
+	EigenSolver& solver = eigensolver(K);
+	solver.solve(overlapmatrix);
+	for (size_t n=0; n<K; n++) {
+		const double eval = solver.eigenvalue(n);
 		// Check that eigenvalues are OK. If states are propagated "too much",
 		// they can become linearly dependent (or close enough so), which
 		// causes the overlap matrix to have non-positive eigenvalues and as a
@@ -164,31 +549,37 @@ void StateSet::orthonormalize() throw(std::exception) {
 		if (eval <= 0) {
 			ortho_timer.stop();
 			eigensolve_timer.stop();
-			throw(NonPositiveEigenvalue(n, eval, overlapmatrix, N));
+			throw(NonPositiveEigenvalue(n, eval, overlapmatrix, K));
 		}
 		else if (std::fpclassify(eval) != FP_NORMAL) {
 			ortho_timer.stop();
 			eigensolve_timer.stop();
-			throw(NonNormalEigenvalue(n, eval, overlapmatrix, N));
+			throw(NonNormalEigenvalue(n, eval, overlapmatrix, K));
 		}
 		// Scale eigenvectors with the eigenvalues
-		ESolver.scale_eigenvector(overlapmatrix, n, 1/sqrt(eval));
+		solver.scale_eigenvector(overlapmatrix, n, 1/sqrt(eval));
 	}
+	eigensolve_trace.end();
 	eigensolve_timer.stop();
 	// Form orthonormal states from linear combinations
 	lincomb_timer.start();
+	TraceScope lincomb_trace("lincomb");
 	const comp one = 1;
 	const comp zero = 0;
-	const int iN = static_cast<int>(N);
+	const int iK = static_cast<int>(K);
 	const int iM = static_cast<int>(datalayout.N);
-	comp* const statedata = state_array->get_dataptr();
+	comp* const statedata = state_array->get_dataptr() + L*datalayout.N;
 	switch (ortho_algorithm) {
 		case Default:
+			if (is_out_of_core()) {
+				lincomb_in_chunks(L);
+				break;
+			}
 			// This is the in-place version, which uses less memory
 			#pragma omp parallel
 			{
-				const size_t required_size = N*omp_get_num_threads();
-				const size_t thread_offset = N*omp_get_thread_num();
+				const size_t required_size = K*omp_get_num_threads();
+				const size_t thread_offset = K*omp_get_thread_num();
 				#pragma omp single
 				{
 				// Check for enough space on tempstate
@@ -199,12 +590,12 @@ void StateSet::orthonormalize() throw(std::exception) {
 				#pragma omp for
 				for (size_t t=0; t<datalayout.N; t++) {
 					// Save old state values
-					cblas_zcopy(iN, reinterpret_cast<const double*>(statedata+t), iM,
+					cblas_zcopy(iK, reinterpret_cast<const double*>(statedata+t), iM,
 							reinterpret_cast<double*>(temp), 1);
 					// Note that now overlapmatrix holds the eigenvectors
-					cblas_zgemv(CblasRowMajor, CblasNoTrans, iN, iN,
+					cblas_zgemv(CblasRowMajor, CblasNoTrans, iK, iK,
 							reinterpret_cast<const double*>(&one),
-							reinterpret_cast<const double*>(overlapmatrix), iN,
+							reinterpret_cast<const double*>(overlapmatrix), iK,
 							reinterpret_cast<const double*>(temp), 1,
 							reinterpret_cast<const double*>(&zero),
 							reinterpret_cast<double*>(statedata+t), iM);
@@ -215,12 +606,12 @@ void StateSet::orthonormalize() throw(std::exception) {
 			// This is the out-of-place version, where the formation of linear
 			// combinations can be expressed simply as a product of two (very
 			// large) matrices.
-			comp* const other_statedata = other_state_array->get_dataptr();
+			comp* const other_statedata = other_state_array->get_dataptr() + L*datalayout.N;
 			assert(statedata != NULL);
 			assert(other_statedata != NULL);
-			cblas_zgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, iN, iM, iN,
+			cblas_zgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, iK, iM, iK,
 					reinterpret_cast<const double*>(&one),
-					reinterpret_cast<const double*>(overlapmatrix), iN,
+					reinterpret_cast<const double*>(overlapmatrix), iK,
 					reinterpret_cast<const double*>(statedata), iM,
 					reinterpret_cast<const double*>(&zero),
 					reinterpret_cast<double*>(other_statedata), iM);
@@ -231,11 +622,111 @@ void StateSet::orthonormalize() throw(std::exception) {
 	ortho_timer.stop();
 }
 
+// The in-place linear combination for out-of-core storage. Going through the
+// states one grid point at a time would read the whole scratch file for each
+// point, so instead the values at lincomb_chunk consecutive grid points are
+// copied from all states to a buffer and transformed with a single matrix
+// product. This is the same product as in the HighMem case, done piecewise.
+// The first L states are locked and left out.
+void StateSet::lincomb_in_chunks(size_t L) {
+	const comp one = 1;
+	const comp zero = 0;
+	const size_t K = N - L;
+	const int iK = static_cast<int>(K);
+	const size_t M = datalayout.N;
+	comp* const statedata = state_array->get_dataptr() + L*M;
+	if (lincomb_buffer.size() < 2*K*lincomb_chunk)
+		lincomb_buffer.resize(2*K*lincomb_chunk);
+	comp* const oldvalues = &lincomb_buffer[0];
+	comp* const newvalues = oldvalues + K*lincomb_chunk;
+	for (size_t start=0; start<M; start+=lincomb_chunk) {
+		const size_t len = std::min(lincomb_chunk, M-start);
+		const int ilen = static_cast<int>(len);
+		#pragma omp parallel for
+		for (size_t n=0; n<K; n++)
+			std::copy(statedata+n*M+start, statedata+n*M+start+len, oldvalues+n*len);
+		cblas_zgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, iK, ilen, iK,
+				reinterpret_cast<const double*>(&one),
+				reinterpret_cast<const double*>(overlapmatrix), iK,
+				reinterpret_cast<const double*>(oldvalues), ilen,
+				reinterpret_cast<const double*>(&zero),
+				reinterpret_cast<double*>(newvalues), ilen);
+		#pragma omp parallel for
+		for (size_t n=0; n<K; n++) {
+			std::copy(newvalues+n*len, newvalues+(n+1)*len, statedata+n*M+start);
+			current_memory().release((L+n)*M+start, len);
+		}
+	}
+}
+
+// The eigensolver is sized for the number of unlocked states, and replaced
+// when that changes
+EigenSolver& StateSet::eigensolver(size_t K) {
+	if (ESolver_size != K) {
+		delete ESolver;
+		ESolver = new EigenSolver(K);
+		ESolver_size = K;
+	}
+	return *ESolver;
+}
+
+// Locking
+
+size_t StateSet::lock_state(size_t n) {
+	const size_t L = get_num_locked();
+	assert(n >= L and n < N);
+	// Move the state to the first unlocked slot
+	if (n != L) {
+		comp* const a = (*state_array)[n].data_ptr();
+		comp* const b = (*state_array)[L].data_ptr();
+		std::swap_ranges(a, a+datalayout.N, b);
+		const bool ts = timestep_converged[n];
+		timestep_converged[n] = timestep_converged[L];
+		timestep_converged[L] = ts;
+		const bool fc = finally_converged[n];
+		finally_converged[n] = finally_converged[L];
+		finally_converged[L] = fc;
+	}
+	cold_states.push_back(new CompressedState((*state_array)[L]));
+	// The full-precision copy is not needed anymore
+	memory1->discard(L*datalayout.N, datalayout.N);
+	if (memory2 != NULL)
+		memory2->discard(L*datalayout.N, datalayout.N);
+	return L;
+}
+
+void StateSet::unlock_all() {
+	for (size_t l=0; l<cold_states.size(); l++) {
+		cold_states[l]->decompress((*state_array)[l]);
+		delete cold_states[l];
+	}
+	cold_states.clear();
+}
+
+void StateSet::get_locked_state(size_t n, State& state) const {
+	assert(is_locked(n));
+	cold_states[n]->decompress(state);
+}
+
+size_t StateSet::get_locked_memory() const {
+	size_t bytes = 0;
+	for (size_t l=0; l<cold_states.size(); l++)
+		bytes += cold_states[l]->size_in_bytes();
+	return bytes;
+}
+
+void StateSet::discard_locked_states() {
+	for (size_t l=0; l<cold_states.size(); l++)
+		delete cold_states[l];
+	cold_states.clear();
+}
+
 // Check whether the states are orthonormal to a given precision "epsilon".
+// Locked states are not included.
 bool StateSet::is_orthonormal(double epsilon) const {
 	comp z;
-	for (size_t n=0; n<N; n++) {
-		for (size_t k=0; k<n; k++) {
+	for (size_t n=get_num_locked(); n<N; n++) {
+		for (size_t k=get_num_locked(); k<n; k++) {
 			z = dot(n,k);
 			if (fabs(imag(z)) > epsilon)
 				return false;
@@ -250,8 +741,8 @@ bool StateSet::is_orthonormal(double epsilon) const {
 
 double StateSet::how_orthonormal() const {
 	double max = 0;
-	for (size_t n=0; n<N; n++) {
-		for (size_t k=0; k<=n; k++) {
+	for (size_t n=get_num_locked(); n<N; n++) {
+		for (size_t k=get_num_locked(); k<=n; k++) {
 			const comp z = dot(n,k);
 			const double i = imag(z);
 			const double r = real(z);
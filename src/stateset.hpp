@@ -27,8 +27,12 @@
 #include <vector>
 #include <utility>
 #include <map>
+#include <sstream>
 #include <exception>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <omp.h>
 #include "H5Cpp.h"
 
@@ -43,30 +47,73 @@ extern "C" {
 #include "itp2d_common.hpp"
 #include "exceptions.hpp"
 #include "state.hpp"
+#include "transformer.hpp"
 #include "statearray.hpp"
 #include "timer.hpp"
+#include "trace.hpp"
 #include "rng.hpp"
 #include "eigensolver.hpp"
 #include "parameters.hpp"
+#include "numa.hpp"
+#include "statememory.hpp"
+#include "compressedstate.hpp"
+#include "compression.hpp"
 
 class StateSet {
 	public:
-		StateSet(size_t N, DataLayout const& dl, OrthoAlgorithm algo = Default);
+		StateSet(size_t N, DataLayout const& dl, OrthoAlgorithm algo = Default,
+				MemoryPlacement placement = FirstTouchPlacement, PageBacking backing = NormalPages);
+		StateSet(Parameters const& params, DataLayout const& dl);	// Take all settings from params
 		~StateSet();
 		// Initializing
 		void init(Parameters const& params, RNG& rng);
 		void init(comp (*initfunc)(size_t n, double x, double y)); // Initialize from function
+		// Copy the last saved states from a datafile with exactly the same
+		// number of states and grid
 		void init_from_datafile(std::string filename);
+		// Warm start from a datafile which may have a different number of
+		// states, or a different grid covering the same area. Missing states
+		// are random noise orthogonal to the copied ones. The boundary type
+		// determines how the states are resampled to a different grid.
+		void init_from_datafile(std::string filename, RNG& rng, BoundaryType boundary = Periodic);
+		// The same from another set of states in memory
+		void init_from_stateset(StateSet const& other, RNG& rng, BoundaryType boundary = Periodic);
 		void init_to_gaussian_noise(RNG& rng);
 		// Simple getters & setters
 		inline State& operator[](size_t n) const { return (*state_array)[n]; }
 		inline size_t get_num_states() const { return N; }
+		// The placement and page backing actually used, which might differ from the requested ones
+		inline MemoryPlacement get_memory_placement() const { return memory1->get_placement(); }
+		inline PageBacking get_page_backing() const { return memory1->get_page_backing(); }
+		// Out-of-core operation. When the states are stored in a scratch
+		// file, they should be worked on in blocks of get_block_size()
+		// states, calling prefetch_states() before and release_states() after
+		// working on a block. For states in memory these do nothing and the
+		// block size is simply the number of states.
+		inline bool is_out_of_core() const { return memory1->is_file_backed(); }
+		inline size_t get_block_size() const { return block_size; }
+		inline void prefetch_states(size_t first, size_t len) const { current_memory().prefetch(first*datalayout.N, len*datalayout.N); }
+		inline void release_states(size_t first, size_t len) const { current_memory().release(first*datalayout.N, len*datalayout.N); }
 		inline void set_timestep_converged(size_t n, bool val=true);
 		inline bool is_timestep_converged(size_t n) const { return timestep_converged[n]; }
 		inline size_t get_num_timestep_converged() const { return how_many_timestep_converged; }
 		inline void set_finally_converged(size_t n, bool val=true);
 		inline bool is_finally_converged(size_t n) const { return finally_converged[n]; }
 		inline size_t get_num_finally_converged() const { return how_many_finally_converged; }
+		// Locking. A locked state is kept fixed: it is stored in single
+		// precision (see compressedstate.hpp), it should not be propagated, and
+		// orthonormalization only keeps the other states orthogonal to it.
+		// Locked states occupy the first get_num_locked() slots, so locking
+		// a state moves it to slot get_num_locked() and moves the state that
+		// was there to its old slot. The memory of the slots of locked states
+		// is given back to the operating system, so operator[] must not be
+		// used for them. Use get_locked_state() instead.
+		size_t lock_state(size_t n);	// Returns the new index of the state
+		void unlock_all();				// Copy locked states back to full precision and unlock them
+		inline size_t get_num_locked() const { return cold_states.size(); }
+		inline bool is_locked(size_t n) const { return n < cold_states.size(); }
+		void get_locked_state(size_t n, State& state) const;
+		size_t get_locked_memory() const;	// Memory used by locked states, in bytes
 		// Arithmetic
 		inline comp dot(size_t i, size_t j) const;
 		// Orthonormalizing
@@ -83,6 +130,10 @@ class StateSet {
 	private:
 		const size_t N;
 		const OrthoAlgorithm ortho_algorithm;
+		const size_t memory_budget;	// Memory to use for out-of-core operation, in bytes
+		const size_t snapshot_memory;	// Part of memory_budget taken by the copies of the states made for --async-io
+		size_t block_size;			// Number of states to work on at a time
+		size_t lincomb_chunk;		// Number of grid points to handle at a time in out-of-core orthonormalization
 		// Normally all operations are done as much in-place as possible to
 		// conserve memory. However, with the HighMem OrthoAlgorithm operations
 		// are done out-of-place, and for that we need to store the data
@@ -91,19 +142,36 @@ class StateSet {
 		// of roughly doubled memory requirement.
 		StateArray* state_array;
 		StateArray* other_state_array;
+		StateMemory* memory1;
+		StateMemory* memory2;
 		comp* dataptr1;
 		comp* dataptr2;
 		StateArray* statearrayptr1;
 		StateArray* statearrayptr2;
-		EigenSolver ESolver;
+		EigenSolver* ESolver;
+		size_t ESolver_size;
 		comp* overlapmatrix;
 		std::vector<comp> tempstate;
+		std::vector<comp> lincomb_buffer;
+		std::vector<CompressedState*> cold_states;
 		std::vector<bool> timestep_converged;
 		std::vector<bool> finally_converged;
 		size_t how_many_timestep_converged;
 		size_t how_many_finally_converged;
 		inline comp& data(size_t n, size_t x, size_t y) { return (*state_array)[n](x,y); }
 		inline void switch_state_arrays();
+		inline StateMemory const& current_memory() const { return (state_array == statearrayptr1)? *memory1 : *memory2; }
+		void setup();
+		void first_touch_state_arrays();
+		void lincomb_in_chunks(size_t L);
+		EigenSolver& eigensolver(size_t K);
+		void discard_locked_states();
+		void read_saved_states(H5::DataSet const& dataset, size_t first, size_t num, DataLayout const& layout, comp* ptr) const;
+		void resample_saved_states(H5::DataSet const& dataset, size_t num, DataLayout const& layout, BoundaryType boundary);
+		void resample_states(comp const* source, size_t first, size_t len, Transformer const& from, Transformer const& to,
+				BoundaryType boundary);
+		void fill_with_gaussian_noise(size_t first, RNG& rng);
+		void orthogonalize_against_first(size_t first);
 		// For timing
 		Timer ortho_timer, dot_timer, eigensolve_timer, lincomb_timer;
 };
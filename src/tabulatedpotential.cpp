@@ -0,0 +1,195 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tabulatedpotential.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#else
+#include <fstream>
+#endif
+
+#include "H5Cpp.h"
+#include "compression.hpp"
+
+TabulatedPotential::TabulatedPotential(std::string const& filename) :
+		sizex(0), sizey(0), dx(0), table(NULL), mapping(NULL), mapping_length(0) {
+	description = "tabulated(" + filename + ")";
+	try {
+		H5::H5File file(filename, H5F_ACC_RDONLY);
+		file.openGroup("/").openAttribute("grid_delta").read(H5::PredType::NATIVE_DOUBLE, &dx);
+	}
+	catch (H5::Exception& e) {
+		throw TabulatedPotentialError(filename, "not an itp2d datafile with a grid_delta attribute");
+	}
+	read_dataset(filename, "/potential_values");
+	check_grid(filename);
+}
+
+TabulatedPotential::TabulatedPotential(std::string const& filename, std::string const& dataset, double arg_dx) :
+		sizex(0), sizey(0), dx(arg_dx), table(NULL), mapping(NULL), mapping_length(0) {
+	std::stringstream ss;
+	ss << "tabulated(" << filename << ":" << dataset << "," << dx << ")";
+	description = ss.str();
+	read_dataset(filename, dataset);
+	check_grid(filename);
+}
+
+TabulatedPotential::TabulatedPotential(std::string const& filename, size_t sx, size_t sy, double arg_dx) :
+		sizex(sx), sizey(sy), dx(arg_dx), table(NULL), mapping(NULL), mapping_length(0) {
+	std::stringstream ss;
+	ss << "tabulated(" << filename << "," << sizex << "," << sizey << "," << dx << ")";
+	description = ss.str();
+	check_grid(filename);
+	map_file(filename);
+}
+
+TabulatedPotential::~TabulatedPotential() {
+	#ifdef __linux__
+	if (mapping != NULL)
+		munmap(mapping, mapping_length);
+	#endif
+}
+
+void TabulatedPotential::check_grid(std::string const& filename) const {
+	if (sizex == 0 or sizey == 0)
+		throw TabulatedPotentialError(filename, "the table is empty");
+	if (not (dx > 0))
+		throw TabulatedPotentialError(filename, "the grid spacing should be positive");
+}
+
+// Read a two-dimensional dataset, or a scalar dataset of a two-dimensional
+// array type like the potential_values of an itp2d datafile. HDF5 converts
+// the values to doubles.
+void TabulatedPotential::read_dataset(std::string const& filename, std::string const& dataset) {
+	try {
+		register_compression_filters();
+		H5::H5File file(filename, H5F_ACC_RDONLY);
+		H5::DataSet data = file.openDataSet(dataset);
+		H5::DataSpace space = data.getSpace();
+		hsize_t dims[2];
+		if (space.getSimpleExtentNdims() == 2) {
+			space.getSimpleExtentDims(dims);
+			sizey = static_cast<size_t>(dims[0]);
+			sizex = static_cast<size_t>(dims[1]);
+			loaded.resize(sizex*sizey);
+			if (not loaded.empty())
+				data.read(&loaded[0], H5::PredType::NATIVE_DOUBLE);
+		}
+		else if (space.getSimpleExtentNpoints() == 1 and data.getTypeClass() == H5T_ARRAY
+				and data.getArrayType().getArrayNDims() == 2) {
+			data.getArrayType().getArrayDims(dims);
+			sizey = static_cast<size_t>(dims[0]);
+			sizex = static_cast<size_t>(dims[1]);
+			loaded.resize(sizex*sizey);
+			const H5::ArrayType table_type(H5::PredType::NATIVE_DOUBLE, 2, dims);
+			if (not loaded.empty())
+				data.read(&loaded[0], table_type);
+		}
+		else
+			throw TabulatedPotentialError(filename, "dataset " + dataset + " is not two-dimensional");
+	}
+	catch (H5::Exception& e) {
+		throw TabulatedPotentialError(filename, "cannot read dataset " + dataset);
+	}
+	table = (loaded.empty())? NULL : &loaded[0];
+}
+
+// Map the file read-only. Pages are read in by the operating system as the
+// potential is evaluated, and shared with other processes using the same
+// table.
+void TabulatedPotential::map_file(std::string const& filename) {
+	const size_t length = sizex*sizey*sizeof(double);
+	#ifdef __linux__
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw TabulatedPotentialError(filename, strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		const int error = errno;
+		close(fd);
+		throw TabulatedPotentialError(filename, strerror(error));
+	}
+	if (static_cast<size_t>(st.st_size) != length) {
+		close(fd);
+		std::stringstream ss;
+		ss << "the file has " << st.st_size << " bytes instead of the " << length
+			<< " bytes of a " << sizex << "x" << sizey << " table of doubles";
+		throw TabulatedPotentialError(filename, ss.str());
+	}
+	void* const ptr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	const int error = errno;
+	// The mapping stays valid after the file is closed
+	close(fd);
+	if (ptr == MAP_FAILED)
+		throw TabulatedPotentialError(filename, strerror(error));
+	madvise(ptr, length, MADV_WILLNEED);
+	mapping = ptr;
+	mapping_length = length;
+	table = static_cast<double const*>(mapping);
+	#else
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	loaded.resize(sizex*sizey);
+	in.read(reinterpret_cast<char*>(&loaded[0]), static_cast<std::streamsize>(length));
+	if (not in or in.peek() != std::ifstream::traits_type::eof()) {
+		std::stringstream ss;
+		ss << "the file is not a " << sizex << "x" << sizey << " table of doubles";
+		throw TabulatedPotentialError(filename, ss.str());
+	}
+	table = &loaded[0];
+	#endif
+}
+
+double TabulatedPotential::operator()(double x, double y) const {
+	size_t ix[4], iy[4];
+	double wx[4], wy[4];
+	weights(x, sizex, ix, wx);
+	weights(y, sizey, iy, wy);
+	double result = 0;
+	for (size_t j=0; j<4; j++) {
+		double const* const row = table + iy[j]*sizex;
+		result += wy[j]*(wx[0]*row[ix[0]] + wx[1]*row[ix[1]] + wx[2]*row[ix[2]] + wx[3]*row[ix[3]]);
+	}
+	return result;
+}
+
+// Interpolate the four table rows around y into one row first, so that only
+// one row needs to be interpolated for each point
+void TabulatedPotential::evaluate_row(double const* x, double y, size_t n, double* values) const {
+	size_t iy[4];
+	double wy[4];
+	weights(y, sizey, iy, wy);
+	double const* const r0 = table + iy[0]*sizex;
+	double const* const r1 = table + iy[1]*sizex;
+	double const* const r2 = table + iy[2]*sizex;
+	double const* const r3 = table + iy[3]*sizex;
+	std::vector<double> row(sizex);
+	for (size_t i=0; i<sizex; i++)
+		row[i] = wy[0]*r0[i] + wy[1]*r1[i] + wy[2]*r2[i] + wy[3]*r3[i];
+	for (size_t i=0; i<n; i++) {
+		size_t ix[4];
+		double wx[4];
+		weights(x[i], sizex, ix, wx);
+		values[i] = wx[0]*row[ix[0]] + wx[1]*row[ix[1]] + wx[2]*row[ix[2]] + wx[3]*row[ix[3]];
+	}
+}
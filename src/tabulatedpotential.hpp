@@ -0,0 +1,95 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A potential given as values on a grid, for example computed by an external
+ * electrostatics solver. The values are read from
+ * 	* an HDF5 dataset, either the potential_values of an itp2d datafile or any
+ * 	  two-dimensional dataset of numbers, or
+ * 	* a raw binary file of doubles in native byte order, which is
+ * 	  memory-mapped so that the table is not copied.
+ * In both cases the values are stored row by row with x varying fastest, like
+ * the values of a Potential, and the table grid is centered on the origin like
+ * a DataLayout with the given spacing.
+ *
+ * Between the grid points the potential is interpolated with bicubic
+ * (Catmull-Rom) convolution, which reproduces the tabulated values exactly on
+ * the grid points and has a continuous gradient. Outside the table the value
+ * at the nearest edge is used.
+ */
+
+#ifndef _TABULATEDPOTENTIAL_HPP_
+#define _TABULATEDPOTENTIAL_HPP_
+
+#include <string>
+#include <vector>
+
+#include "potentialtypes.hpp"
+
+class TabulatedPotential : public PotentialType {
+	public:
+		// Read the potential_values of an itp2d datafile, with the grid
+		// spacing of the datafile
+		TabulatedPotential(std::string const& filename);
+		// Read a two-dimensional HDF5 dataset with grid spacing dx
+		TabulatedPotential(std::string const& filename, std::string const& dataset, double dx);
+		// Map a raw binary file of sizex*sizey doubles with grid spacing dx
+		TabulatedPotential(std::string const& filename, size_t sizex, size_t sizey, double dx);
+		~TabulatedPotential();
+		double operator()(double x, double y) const;
+		void evaluate_row(double const* x, double y, size_t n, double* values) const;
+		inline size_t get_sizex() const { return sizex; }
+		inline size_t get_sizey() const { return sizey; }
+		inline double get_dx() const { return dx; }
+		inline bool is_mapped() const { return mapping != NULL; }
+	private:
+		TabulatedPotential(TabulatedPotential const&);
+		TabulatedPotential& operator=(TabulatedPotential const&);
+		void read_dataset(std::string const& filename, std::string const& dataset);
+		void map_file(std::string const& filename);
+		void check_grid(std::string const& filename) const;
+		// The four table indices and weights for interpolating at coordinate
+		// pos along an axis of s points
+		inline void weights(double pos, size_t s, size_t* index, double* w) const;
+		size_t sizex;
+		size_t sizey;
+		double dx;
+		double const* table;
+		std::vector<double> loaded;
+		void* mapping;
+		size_t mapping_length;
+};
+
+// Catmull-Rom weights for the points i-1, i, i+1 and i+2, where i is the
+// point just below pos. Indices beyond the edges are clamped.
+inline void TabulatedPotential::weights(double pos, size_t s, size_t* index, double* w) const {
+	double u = pos/dx + 0.5*static_cast<double>(s-1);
+	u = std::min(std::max(u, 0.0), static_cast<double>(s-1));
+	const size_t i = std::min(static_cast<size_t>(u), s-1);
+	const double t = u - static_cast<double>(i);
+	w[0] = ((-0.5*t + 1.0)*t - 0.5)*t;
+	w[1] = (1.5*t - 2.5)*t*t + 1.0;
+	w[2] = ((-1.5*t + 2.0)*t + 0.5)*t;
+	w[3] = (0.5*t - 0.5)*t*t;
+	index[0] = (i == 0)? 0 : i-1;
+	index[1] = i;
+	index[2] = std::min(i+1, s-1);
+	index[3] = std::min(i+2, s-1);
+}
+
+#endif // _TABULATEDPOTENTIAL_HPP_
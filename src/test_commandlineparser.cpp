@@ -36,4 +36,43 @@ TEST_F(commandlineparser, highmem) {
 	ASSERT_EQ(parser.get_params().get_ortho_algorithm(), HighMem);
 }
 
+// The swept parameter replaces the corresponding parameter of the potential
+TEST_F(commandlineparser, sweep) {
+	std::vector<std::string> fakeargv(5);
+	fakeargv[0] = "test";
+	fakeargv[1] = "--potential";
+	fakeargv[2] = "ring(3,1,2)";
+	fakeargv[3] = "--sweep";
+	fakeargv[4] = "p1(2,4,5)";
+	parser.parse(fakeargv);
+	Parameters const& params = parser.get_params();
+	ASSERT_EQ(static_cast<size_t>(5), params.get_num_sweep_points());
+	EXPECT_EQ("ring(2,1,2)", params.get_potential_type(0));
+	EXPECT_EQ("ring(2.5,1,2)", params.get_potential_type(1));
+	EXPECT_EQ("ring(4,1,2)", params.get_potential_type(4));
+	EXPECT_EQ(0.0, params.get_B(4));
+	CommandLineParser other_parser;
+	fakeargv[2] = "ring";
+	EXPECT_THROW(other_parser.parse(fakeargv), TCLAP::ArgException);
+}
+
+// An ensemble cannot be combined with a sweep
+TEST_F(commandlineparser, ensemble) {
+	std::vector<std::string> fakeargv(5);
+	fakeargv[0] = "test";
+	fakeargv[1] = "--ensemble";
+	fakeargv[2] = "100";
+	fakeargv[3] = "--ensemble-threads";
+	fakeargv[4] = "4";
+	parser.parse(fakeargv);
+	Parameters const& params = parser.get_params();
+	EXPECT_TRUE(params.is_ensemble());
+	EXPECT_EQ(static_cast<size_t>(100), params.get_ensemble_size());
+	EXPECT_EQ(static_cast<size_t>(4), params.get_ensemble_threads());
+	CommandLineParser other_parser;
+	fakeargv[3] = "--sweep";
+	fakeargv[4] = "B(0,1,3)";
+	EXPECT_THROW(other_parser.parse(fakeargv), TCLAP::ArgException);
+}
+
 // TODO: Add unit tests to other features of the command line parser
@@ -0,0 +1,313 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "test_datafile.hpp"
+
+// Read back one slot of states from the datafile, converting them to double
+// precision if needed
+static void read_slot(std::string const& filename, size_t slot, size_t N, DataLayout const& dl, std::vector<comp>& result) {
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	H5::DataSet states_data = file.openDataSet("/states");
+	const hsize_t count[4] = {1, N, dl.sizey, dl.sizex};
+	const hsize_t start[4] = {slot, 0, 0, 0};
+	const hsize_t len = N*dl.N;
+	H5::DataSpace filespace = states_data.getSpace();
+	filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+	H5::DataSpace memspace(1, &len);
+	H5::CompType complex_type(sizeof(comp));
+	complex_type.insertMember("r", 0, H5::PredType::NATIVE_DOUBLE);
+	complex_type.insertMember("i", sizeof(double), H5::PredType::NATIVE_DOUBLE);
+	result.resize(N*dl.N);
+	states_data.read(&result[0], complex_type, memspace, filespace);
+}
+
+// Round a value to single precision. The rounding goes through volatile
+// variables so that it is not optimized away with -ffast-math.
+static comp round_to_float(comp z) {
+	volatile float re = static_cast<float>(z.real());
+	volatile float im = static_cast<float>(z.imag());
+	return comp(re, im);
+}
+
+// Write a StateSet in a permuted order several times with chunks that do not
+// divide the number of states evenly, and check that all slots read back
+// intact, or rounded to single precision if they were stored so.
+static void check_write_stateset(CompressionFilter filter, int level, StatePrecision precision = DoublePrecision) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 8, 1.0);
+	const size_t N = 7;
+	const size_t slots = 3;
+	const std::string filename = "data/test_datafile_write_stateset.h5";
+	StateSet states(N, dl, Default);
+	states.init_to_gaussian_noise(rng);
+	// Make one state trivially compressible, so that both compressed and
+	// uncompressed chunks are written
+	states[1].zero();
+	std::list<size_t> order;
+	for (size_t n=0; n<N; n++)
+		order.push_back((3*n) % N);
+	{
+		Datafile datafile(filename, dl, true, 3, filter, level, precision);
+		for (size_t slot=0; slot<slots; slot++)
+			datafile.write_stateset(states, static_cast<int>(slot), &order);
+	}
+	std::vector<comp> result;
+	for (size_t slot=0; slot<slots; slot++) {
+		read_slot(filename, slot, N, dl, result);
+		size_t m = 0;
+		for (std::list<size_t>::const_iterator it=order.begin(); it!=order.end(); ++it, ++m) {
+			State const& state = states[*it];
+			for (size_t i=0; i<dl.N; i++) {
+				const comp expected = (precision == SinglePrecision)?
+					round_to_float(state.data_ptr()[i]) : state.data_ptr()[i];
+				ASSERT_EQ(expected, result[m*dl.N+i]);
+			}
+		}
+	}
+}
+
+TEST(datafile, write_stateset_uncompressed) {
+	check_write_stateset(NoCompression, 0);
+}
+
+TEST(datafile, write_stateset_deflate) {
+	check_write_stateset(DeflateCompression, 1);
+}
+
+TEST(datafile, write_stateset_shuffle_deflate) {
+	check_write_stateset(ShuffleDeflateCompression, 1);
+}
+
+// LZ4 and Zstandard are only tested if itp2d is compiled with them
+TEST(datafile, write_stateset_lz4) {
+	if (compression_filter_available(LZ4Compression))
+		check_write_stateset(LZ4Compression, 0);
+}
+
+TEST(datafile, write_stateset_zstd) {
+	if (compression_filter_available(ZstdCompression))
+		check_write_stateset(ZstdCompression, 3);
+}
+
+TEST(datafile, write_stateset_single_precision) {
+	check_write_stateset(NoCompression, 0, SinglePrecision);
+	check_write_stateset(DeflateCompression, 1, SinglePrecision);
+}
+
+// A smooth real-valued state, as the states are without a magnetic field
+static comp smooth_state(double x, double y) {
+	return exp(-0.05*(x*x + y*y))*cos(0.3*x)*cos(0.2*y);
+}
+
+// Size of the /states dataset in the file when storing smooth states with
+// one state per chunk
+static hsize_t smooth_states_storage_size(CompressionFilter filter) {
+	const DataLayout dl(64, 64, 0.25);
+	const size_t N = 4;
+	const std::string filename = "data/test_datafile_shuffle.h5";
+	StateSet states(N, dl, Default);
+	for (size_t n=0; n<N; n++) {
+		states[n].set_by_func(smooth_state);
+		states[n] *= 1.0 + 0.3*static_cast<double>(n);
+	}
+	{
+		Datafile datafile(filename, dl, true, 1, filter, 6);
+		datafile.write_stateset(states, 0);
+	}
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	return file.openDataSet("/states").getStorageSize();
+}
+
+// The shuffle filter works on the bytes of each number, not of each state, so
+// it makes smooth states compress better
+TEST(datafile, shuffle_improves_compression) {
+	EXPECT_LT(smooth_states_storage_size(ShuffleDeflateCompression), smooth_states_storage_size(DeflateCompression));
+}
+
+// Datafiles of earlier versions store each state as a single element of an
+// array type, and they can still be used as initial states
+TEST(datafile, copy_from_array_type_states) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 8, 1.0);
+	const size_t N = 3;
+	const std::string filename = "data/test_datafile_array_type.h5";
+	StateSet states(N, dl, Default);
+	states.init_to_gaussian_noise(rng);
+	{
+		H5::H5File file(filename, H5F_ACC_TRUNC);
+		const int num_states = static_cast<int>(N);
+		const int sizex = static_cast<int>(dl.sizex);
+		const int sizey = static_cast<int>(dl.sizey);
+		H5::Group root = file.openGroup("/");
+		const H5::DataSpace scalar(H5S_SCALAR);
+		root.createAttribute("num_states", H5::PredType::NATIVE_INT, scalar).write(H5::PredType::NATIVE_INT, &num_states);
+		root.createAttribute("grid_sizex", H5::PredType::NATIVE_INT, scalar).write(H5::PredType::NATIVE_INT, &sizex);
+		root.createAttribute("grid_sizey", H5::PredType::NATIVE_INT, scalar).write(H5::PredType::NATIVE_INT, &sizey);
+		root.createAttribute("grid_delta", H5::PredType::NATIVE_DOUBLE, scalar).write(H5::PredType::NATIVE_DOUBLE, &dl.dx);
+		H5::CompType complex_type(sizeof(comp));
+		complex_type.insertMember("r", 0, H5::PredType::NATIVE_DOUBLE);
+		complex_type.insertMember("i", sizeof(double), H5::PredType::NATIVE_DOUBLE);
+		const hsize_t state_dims[2] = {dl.sizey, dl.sizex};
+		const H5::ArrayType state_type(complex_type, 2, state_dims);
+		const hsize_t dims[2] = {1, N};
+		H5::DataSet data = file.createDataSet("/states", state_type, H5::DataSpace(2, dims));
+		std::vector<comp> buffer(N*dl.N);
+		for (size_t n=0; n<N; n++)
+			std::copy(states[n].data_ptr(), states[n].data_ptr()+dl.N, &buffer[n*dl.N]);
+		data.write(&buffer[0], state_type);
+	}
+	StateSet copy(N, dl, Default);
+	copy.init_from_datafile(filename);
+	for (size_t n=0; n<N; n++) {
+		for (size_t i=0; i<dl.N; i++) {
+			ASSERT_EQ(states[n].data_ptr()[i], copy[n].data_ptr()[i]);
+		}
+	}
+}
+
+// States stored in single precision can be used as initial states
+TEST(datafile, copy_from_single_precision) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 8, 1.0);
+	const size_t N = 5;
+	const std::string filename = "data/test_datafile_single_precision.h5";
+	StateSet states(N, dl, Default);
+	states.init_to_gaussian_noise(rng);
+	{
+		Datafile datafile(filename, dl, true, 1, DeflateCompression, 1, SinglePrecision);
+		datafile.add_attribute("num_states", static_cast<int>(N));
+		datafile.write_stateset(states, 0);
+	}
+	StateSet copy(N, dl, Default);
+	copy.init_from_datafile(filename);
+	for (size_t n=0; n<N; n++) {
+		for (size_t i=0; i<dl.N; i++) {
+			ASSERT_EQ(round_to_float(states[n].data_ptr()[i]), copy[n].data_ptr()[i]);
+		}
+	}
+}
+
+// Write N orthonormalized random states to a datafile
+static void write_random_states(std::string const& filename, DataLayout const& dl, size_t N, RNG& rng, StateSet& states) {
+	states.init_to_gaussian_noise(rng);
+	states.orthonormalize();
+	Datafile datafile(filename, dl, true, 1, NoCompression);
+	datafile.add_attribute("num_states", static_cast<int>(N));
+	datafile.write_stateset(states, 0);
+}
+
+// A warm start from fewer states copies them and fills the rest with noise
+// orthogonal to them, and a warm start from more states copies the first ones
+TEST(datafile, copy_from_different_num_states) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 8, 1.0);
+	const std::string filename = "data/test_datafile_warm_start.h5";
+	StateSet states(4, dl, Default);
+	write_random_states(filename, dl, 4, rng, states);
+	StateSet bigger(7, dl, Default);
+	bigger.init_from_datafile(filename, rng);
+	for (size_t n=0; n<4; n++)
+		EXPECT_EQ(states[n], bigger[n]);
+	for (size_t n=4; n<7; n++) {
+		EXPECT_NEAR(1.0, bigger[n].norm(), 1e-12);
+		for (size_t m=0; m<4; m++)
+			EXPECT_LT(abs(bigger[m].dot(bigger[n])), 1e-12);
+	}
+	StateSet smaller(2, dl, Default);
+	smaller.init_from_datafile(filename, rng);
+	for (size_t n=0; n<2; n++)
+		EXPECT_EQ(states[n], smaller[n]);
+	EXPECT_THROW(smaller.init_from_datafile(filename), GeneralError);
+}
+
+// A gaussian off the grid center, different for each state
+static comp offset_gaussian(size_t n, double x, double y) {
+	const double x0 = 0.3 + 0.1*static_cast<double>(n);
+	const double y0 = -0.2;
+	return exp(-((x-x0)*(x-x0) + (y-y0)*(y-y0))/2);
+}
+
+// Smooth states are resampled to a finer grid covering the same area as
+// accurately as the original grid allows. On the coarser grid the error is
+// dominated by the part of the spectrum of the gaussian that does not fit on
+// the grid.
+TEST(datafile, copy_from_different_grid) {
+	const DataLayout dl(32, 24, 0.5);
+	const DataLayout finer(64, 48, 0.25);
+	const DataLayout coarser(24, 18, 2.0/3.0);
+	const std::string filename = "data/test_datafile_resample.h5";
+	const size_t N = 3;
+	{
+		StateSet states(N, dl, Default);
+		states.init(offset_gaussian);
+		Datafile datafile(filename, dl, true, 1, NoCompression);
+		datafile.add_attribute("num_states", static_cast<int>(N));
+		datafile.write_stateset(states, 0);
+	}
+	RNG rng(RNG::produce_random_seed());
+	DataLayout const* const layouts[] = {&finer, &coarser};
+	const double tolerances[] = {1e-7, 1e-4};
+	for (size_t l=0; l<2; l++) {
+		StateSet copy(N, *layouts[l], Default);
+		copy.init_from_datafile(filename, rng);
+		StateSet expected(N, *layouts[l], Default);
+		expected.init(offset_gaussian);
+		for (size_t n=0; n<N; n++) {
+			expected[n].normalize();
+			EXPECT_LT(max_distance(copy[n], expected[n]), tolerances[l]);
+		}
+	}
+	const DataLayout larger(64, 48, 0.5);
+	StateSet copy(N, larger, Default);
+	EXPECT_THROW(copy.init_from_datafile(filename, rng), GeneralError);
+}
+
+// History rows are written in batches, so write more rows than fit in one
+// batch and check that all of them end up in the file
+TEST(datafile, history_batches) {
+	const DataLayout dl(8, 8, 1.0);
+	const size_t N = 5;
+	const size_t steps = 150;
+	const std::string filename = "data/test_datafile_history.h5";
+	{
+		Datafile datafile(filename, dl, true);
+		std::vector<double> row(N);
+		for (size_t step=0; step<steps; step++) {
+			for (size_t n=0; n<N; n++)
+				row[n] = static_cast<double>(step*N+n);
+			datafile.write_energy_history(row, step);
+			if (step % 50 == 0)
+				datafile.write_time_step_history(step, 1.0/static_cast<double>(step+1));
+		}
+	}
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	H5::DataSet energy_history = file.openDataSet("/energy_history");
+	hsize_t dims[2];
+	energy_history.getSpace().getSimpleExtentDims(dims);
+	ASSERT_EQ(steps, dims[0]);
+	ASSERT_EQ(N, dims[1]);
+	std::vector<double> values(steps*N);
+	energy_history.read(&values[0], H5::PredType::NATIVE_DOUBLE);
+	for (size_t i=0; i<steps*N; i++) {
+		ASSERT_EQ(static_cast<double>(i), values[i]);
+	}
+	hsize_t num_time_steps;
+	file.openDataSet("/time_step_history").getSpace().getSimpleExtentDims(&num_time_steps);
+	EXPECT_EQ(static_cast<hsize_t>(3), num_time_steps);
+}
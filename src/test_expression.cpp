@@ -0,0 +1,82 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unit tests for parsing and evaluating expressions.
+ */
+
+#include "test_expression.hpp"
+
+TEST(expression, precedence) {
+	EXPECT_EQ(10.0, Expression("2*3+4")(0, 0));
+	EXPECT_EQ(9.0, Expression("(1+2)*3")(0, 0));
+	EXPECT_EQ(0.5, Expression("10/4/5")(0, 0));
+	EXPECT_EQ(-4.0, Expression("-2^2")(0, 0));
+	EXPECT_EQ(512.0, Expression("2^3^2")(0, 0));
+	EXPECT_EQ(0.5, Expression("2^-1")(0, 0));
+	EXPECT_EQ(1.0, Expression(" 3 - 1 - 1 ")(0, 0));
+	EXPECT_DOUBLE_EQ(M_PI, Expression("pi")(0, 0));
+}
+
+TEST(expression, variables_and_functions) {
+	const double x = 0.7;
+	const double y = -1.3;
+	EXPECT_DOUBLE_EQ(0.5*(x*x+y*y) + 0.1*sin(3*atan2(y,x)), Expression("0.5*(x^2+y^2)+0.1*sin(3*atan2(y,x))")(x, y));
+	EXPECT_DOUBLE_EQ(hypot(x, y), Expression("r")(x, y));
+	EXPECT_DOUBLE_EQ(hypot(x, y), Expression("hypot(x, y)")(x, y));
+	EXPECT_EQ(y, Expression("min(x,y)")(x, y));
+	EXPECT_EQ(x, Expression("max(x,y)")(x, y));
+	EXPECT_DOUBLE_EQ(exp(-x)*cosh(y) + log(fabs(y)) + sqrt(x) + pow(x, 1.5),
+			Expression("exp(-x)*cosh(y) + log(abs(y)) + sqrt(x) + pow(x, 1.5)")(x, y));
+}
+
+// Constant subexpressions are computed when parsing, and squares are
+// computed with a multiplication
+TEST(expression, constant_folding) {
+	EXPECT_EQ(static_cast<size_t>(1), Expression("2*pi*(3+1)^2").get_program_length());
+	EXPECT_EQ(static_cast<size_t>(2), Expression("x^2").get_program_length());
+	EXPECT_EQ(static_cast<size_t>(3), Expression("sin(pi/2)*x").get_program_length());
+}
+
+TEST(expression, invalid) {
+	const char* invalid[] = {"", "x+", "foo(x)", "z", "sin(x", "1 2", "atan2(x)", "(x))", "3*"};
+	for (size_t i=0; i<sizeof(invalid)/sizeof(char*); i++)
+		EXPECT_THROW(Expression e(invalid[i]), InvalidExpression) << invalid[i];
+}
+
+// Rows longer than a block are evaluated correctly
+TEST(expression, evaluate_row) {
+	const Expression e("0.5*r^2 + x*y - cos(x)/(1+y^2)");
+	const size_t n = 2*Expression::block_size+17;
+	std::vector<double> x(n);
+	std::vector<double> values(n);
+	for (size_t i=0; i<n; i++)
+		x[i] = -3.0 + 0.01*static_cast<double>(i);
+	const double y = 0.4;
+	e.evaluate_row(&x[0], y, n, &values[0]);
+	for (size_t i=0; i<n; i++)
+		EXPECT_NEAR(0.5*(x[i]*x[i]+y*y) + x[i]*y - cos(x[i])/(1+y*y), values[i], 1e-13);
+}
+
+TEST(expression, potential) {
+	PotentialType const* p = parse_potential_description(" expression( x^2 + 2*y ) ");
+	EXPECT_EQ("expression( x^2 + 2*y )", p->get_description());
+	EXPECT_EQ(5.0, (*p)(1, 2));
+	delete p;
+	EXPECT_THROW(parse_potential_description("expression(x^)"), InvalidPotentialType);
+}
@@ -90,6 +90,343 @@ TEST_F(itp, harmonic_oscillator) {
 	delete sys;
 }
 
+// Same as above, but with converged states locked and compressed. The locked
+// states are stored in single precision, which is still plenty for the
+// energies.
+TEST_F(itp, harmonic_oscillator_compressed) {
+	const double error_tolerance = 1e-4;
+	if (dump_data)
+		params.define_data_storage("data/test_itp_harmonic_compressed.h5", Parameters::FinalStates, true);
+	else
+		params.define_data_storage("", Parameters::Nothing);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(14, 8);
+	params.add_eps_value(1.0);
+	params.define_external_field("harmonic(1)");
+	params.set_compress_converged(true);
+	params.set_final_convergence_test(new RelativeEnergyDeviationTest(error_tolerance));
+	params.set_timestep_convergence_test(new RelativeEnergyDeviationTest(error_tolerance, 0.1*error_tolerance));
+	ITPSystem* sys = new ITPSystem(params);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	sys->finish();
+	ASSERT_FALSE(sys->get_error_flag());
+	EXPECT_EQ(sys->get_states().get_num_locked(), 0u);
+	const double reference_energies[] = { 1, 2, 2, 3, 3, 3, 4, 4 };
+	for (size_t n=0; n<params.get_needed_to_converge(); n++) {
+		EXPECT_NEAR(sys->get_sorted_energy(n), reference_energies[n], error_tolerance);
+	}
+	delete sys;
+}
+
+// Check that a dataset has the same shape and contents in both files
+static void expect_same_dataset(H5::H5File const& file, H5::H5File const& reference, const char* name) {
+	const H5::DataSet data = file.openDataSet(name);
+	const H5::DataSet reference_data = reference.openDataSet(name);
+	const H5::DataSpace space = data.getSpace();
+	const H5::DataSpace reference_space = reference_data.getSpace();
+	const int rank = space.getSimpleExtentNdims();
+	ASSERT_EQ(reference_space.getSimpleExtentNdims(), rank) << name;
+	std::vector<hsize_t> dims(static_cast<size_t>(rank));
+	std::vector<hsize_t> reference_dims(static_cast<size_t>(rank));
+	space.getSimpleExtentDims(&dims[0]);
+	reference_space.getSimpleExtentDims(&reference_dims[0]);
+	ASSERT_TRUE(dims == reference_dims) << name;
+	const H5::DataType type = data.getDataType();
+	const size_t size = static_cast<size_t>(space.getSimpleExtentNpoints())*type.getSize();
+	ASSERT_GT(size, 0u) << name;
+	std::vector<char> values(size);
+	std::vector<char> reference_values(size);
+	data.read(&values[0], type);
+	reference_data.read(&reference_values[0], type);
+	EXPECT_TRUE(values == reference_values) << name;
+}
+
+// Same as above, but saving everything with the background writer. Since the
+// writer is only used when something is saved, the datafile is always written.
+TEST_F(itp, harmonic_oscillator_async_io) {
+	const double error_tolerance = 1e-4;
+	params.define_data_storage("data/test_itp_harmonic_async_io.h5", Parameters::Everything, true);
+	params.set_async_io(true);
+	params.set_io_queue_length(1);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(14, 8);
+	params.add_eps_value(1.0);
+	params.define_external_field("harmonic(1)");
+	params.set_final_convergence_test(new RelativeEnergyDeviationTest(error_tolerance));
+	params.set_timestep_convergence_test(new RelativeEnergyDeviationTest(error_tolerance, 0.1*error_tolerance));
+	ITPSystem* sys = new ITPSystem(params);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	sys->finish();
+	ASSERT_FALSE(sys->get_error_flag());
+	const double reference_energies[] = { 1, 2, 2, 3, 3, 3, 4, 4 };
+	for (size_t n=0; n<params.get_needed_to_converge(); n++) {
+		EXPECT_NEAR(sys->get_sorted_energy(n), reference_energies[n], error_tolerance);
+	}
+	const int steps = sys->get_total_step_counter();
+	EXPECT_EQ(steps, sys->get_telemetry().step);
+	EXPECT_EQ(static_cast<int>(sys->how_many_finally_converged()), sys->get_telemetry().num_converged);
+	delete sys;
+	// The telemetry has a row for each step, written through the background
+	// thread, and the file grows as states are saved on each step
+	H5::H5File file("data/test_itp_harmonic_async_io.h5", H5F_ACC_RDONLY);
+	H5::DataSet telemetry = file.openDataSet("/telemetry");
+	hsize_t rows;
+	telemetry.getSpace().getSimpleExtentDims(&rows);
+	ASSERT_EQ(static_cast<hsize_t>(steps), rows);
+	std::vector<Datafile::telemetry_row> table(rows);
+	telemetry.read(&table.front(), telemetry.getDataType());
+	for (size_t i=0; i<rows; i++) {
+		EXPECT_EQ(static_cast<int>(i+1), table[i].step);
+		EXPECT_GE(table[i].wall_time, table[i].propagation_time + table[i].orthonormalization_time);
+		if (i > 0) {
+			EXPECT_GT(table[i].bytes_written, table[i-1].bytes_written);
+		}
+	}
+	// The background writer must write the same data, in the same places, as
+	// a run with the same random seed and synchronous I/O
+	params.define_data_storage("data/test_itp_harmonic_sync_io.h5", Parameters::Everything, true);
+	params.set_async_io(false);
+	sys = new ITPSystem(params);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	EXPECT_EQ(steps, sys->get_total_step_counter());
+	delete sys;
+	H5::H5File reference("data/test_itp_harmonic_sync_io.h5", H5F_ACC_RDONLY);
+	const char* datasets[] = { "/final_energies", "/final_energy_standard_deviations", "/energy_history",
+		"/deviation_history", "/state_history", "/states" };
+	for (size_t d=0; d<sizeof(datasets)/sizeof(datasets[0]); d++)
+		expect_same_dataset(file, reference, datasets[d]);
+}
+
+// A simulation that ends by reaching the minimum time step still records the
+// telemetry of its last step, before the background writer is drained.
+TEST_F(itp, telemetry_of_failed_run) {
+	const char filename[] = "data/test_itp_telemetry_of_failed_run.h5";
+	params.define_data_storage(filename, Parameters::FinalStates, true);
+	params.set_async_io(true);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(14, 8);
+	// The second time step value is used right after the first step
+	params.add_eps_value(1.0);
+	params.add_eps_value(0.5);
+	params.set_exhaust_eps(true);
+	params.set_bailout_limits(Parameters::default_max_steps, 0.9);
+	params.define_external_field("harmonic(1)");
+	ITPSystem* sys = new ITPSystem(params);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	ASSERT_TRUE(sys->get_error_flag());
+	const int steps = sys->get_total_step_counter();
+	EXPECT_EQ(steps, sys->get_telemetry().step);
+	delete sys;
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	hsize_t rows;
+	file.openDataSet("/telemetry").getSpace().getSimpleExtentDims(&rows);
+	EXPECT_EQ(static_cast<hsize_t>(steps), rows);
+	file.close();
+	remove(filename);
+}
+
+// Interrupt a harmonic oscillator just before it finishes and resume it from a
+// checkpoint. The looser timestep convergence test makes the run lock some
+// states and change the time step before the interruption. The resumed run
+// should end up exactly where an uninterrupted one does, with the same number
+// of steps.
+TEST_F(itp, harmonic_oscillator_resume) {
+	const double error_tolerance = 1e-4;
+	const char checkpoint_file[] = "data/test_itp_checkpoint.h5";
+	// A seed with which the run locks some states before its last step
+	params.set_random_seed(1);
+	params.define_data_storage("", Parameters::Nothing);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(20, 8);
+	params.add_eps_value(1.0);
+	params.define_external_field("harmonic(1)");
+	params.set_compress_converged(true);
+	params.set_final_convergence_test(new RelativeEnergyDeviationTest(error_tolerance));
+	params.set_timestep_convergence_test(new RelativeEnergyDeviationTest(10*error_tolerance, error_tolerance));
+	ITPSystem* sys = new ITPSystem(params);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	ASSERT_FALSE(sys->get_error_flag());
+	const int total_steps = sys->get_total_step_counter();
+	std::vector<double> reference_energies;
+	for (size_t n=0; n<params.get_N(); n++)
+		reference_energies.push_back(sys->get_sorted_energy(n));
+	delete sys;
+	// Stop before the last step, with a checkpoint written after each step
+	remove(checkpoint_file);
+	params.set_checkpoint(checkpoint_file, 0);
+	params.set_resume(true);
+	sys = new ITPSystem(params);
+	EXPECT_FALSE(sys->is_resumed());
+	while (sys->get_total_step_counter() < total_steps-1) {
+		sys->step();
+	}
+	ASSERT_FALSE(sys->is_finished());
+	ASSERT_GT(sys->get_states().get_num_locked(), 0u);
+	delete sys;
+	// Continue from the checkpoint with a different random seed, which
+	// should be replaced with the one from the checkpoint
+	params.set_random_seed(params.get_random_seed()+1);
+	sys = new ITPSystem(params);
+	ASSERT_TRUE(sys->is_resumed());
+	EXPECT_EQ(sys->get_total_step_counter(), total_steps-1);
+	EXPECT_EQ(sys->params.get_random_seed(), params.get_random_seed()-1);
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	ASSERT_FALSE(sys->get_error_flag());
+	EXPECT_EQ(sys->get_total_step_counter(), total_steps);
+	for (size_t n=0; n<params.get_N(); n++) {
+		EXPECT_EQ(sys->get_sorted_energy(n), reference_energies[n]);
+	}
+	delete sys;
+	// The checkpoint of a finished simulation is removed
+	EXPECT_FALSE(Checkpoint::exists(checkpoint_file));
+}
+
+// Converge a harmonic oscillator first on a grid with half as many points
+// and looser convergence limits, and then on the actual grid starting from
+// the interpolated states and the final time step of the coarse grid.
+TEST_F(itp, harmonic_oscillator_cascade) {
+	const double error_tolerance = 1e-4;
+	params.define_data_storage("", Parameters::Nothing);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(14, 8);
+	params.add_eps_value(1.0);
+	params.define_external_field("harmonic(1)");
+	params.set_final_convergence_test(new RelativeEnergyDeviationTest(error_tolerance));
+	params.set_timestep_convergence_test(new RelativeEnergyDeviationTest(error_tolerance, 0.1*error_tolerance));
+	params.set_cascade(2);
+	ITPSystem* coarse = new ITPSystem(ITPSystem::cascade_parameters(params, 1));
+	EXPECT_EQ(coarse->datalayout.sizex, sx/2);
+	EXPECT_EQ(coarse->datalayout.sizey, sy/2);
+	while (not coarse->is_finished()) {
+		coarse->step();
+	}
+	ASSERT_FALSE(coarse->get_error_flag());
+	ITPSystem* sys = new ITPSystem(ITPSystem::cascade_parameters(params, 0, coarse));
+	EXPECT_EQ(sys->datalayout, DataLayout(sx, sy, 12.0/static_cast<double>(sx)));
+	EXPECT_EQ(sys->get_eps(), coarse->get_eps());
+	while (not sys->is_finished()) {
+		sys->step();
+	}
+	ASSERT_FALSE(sys->get_error_flag());
+	std::vector<double> reference_energies;
+	int E = 1;
+	int deg_counter = 1;
+	for (size_t n=0; n<params.get_needed_to_converge(); n++) {
+		reference_energies.push_back(E);
+		if (deg_counter++ >= E) {
+			E++;
+			deg_counter = 1;
+		}
+	}
+	for (size_t n=0; n<params.get_needed_to_converge(); n++) {
+		EXPECT_NEAR(sys->get_sorted_energy(n), reference_energies[n], error_tolerance);
+	}
+	delete sys;
+	delete coarse;
+}
+
+// Sweep the magnetic field in one run, comparing each point to the
+// Fock-Darwin spectrum. The later points start from the states of the
+// previous point and need fewer steps than the first one.
+TEST_F(itp, harmonic_oscillator_sweep) {
+	const double error_tolerance = 1e-4;
+	const std::string filename = "data/test_itp_sweep.h5";
+	const size_t points = 3;
+	params.define_data_storage(filename, Parameters::FinalStates, true);
+	params.define_grid(sx, sy, 12.0);
+	params.set_num_states(14, 8);
+	params.add_eps_value(1.0);
+	params.define_external_field("harmonic(1)");
+	params.set_final_convergence_test(new RelativeEnergyDeviationTest(error_tolerance));
+	params.set_timestep_convergence_test(new RelativeEnergyDeviationTest(error_tolerance, 0.1*error_tolerance));
+	params.set_sweep("B(0,0.2,3)");
+	ITPSystem* sys = new ITPSystem(params);
+	do {
+		while (not sys->is_finished())
+			sys->step();
+	} while (sys->next_sweep_point());
+	ASSERT_FALSE(sys->get_error_flag());
+	ASSERT_EQ(points-1, sys->get_sweep_point());
+	EXPECT_DOUBLE_EQ(0.2, sys->get_B());
+	std::vector<std::vector<double> > const& energies = sys->get_sweep_energies();
+	std::vector<int> const& final_steps = sys->get_sweep_final_steps();
+	ASSERT_EQ(points, energies.size());
+	ASSERT_EQ(points, final_steps.size());
+	for (size_t i=0; i<points; i++) {
+		const double B = 0.1*static_cast<double>(i);
+		std::vector<double> reference_energies;
+		for (int n=0; n<8; n++)
+			for (int m=-16; m<=16; m++)
+				reference_energies.push_back(test_itp_reference::fock_darwin_energy(n, m, B));
+		std::sort(reference_energies.begin(), reference_energies.end());
+		for (size_t n=0; n<params.get_needed_to_converge(); n++) {
+			EXPECT_NEAR(reference_energies[n], energies[i][n], error_tolerance) << "B = " << B;
+		}
+		if (i > 0) {
+			EXPECT_LT(final_steps[i]-final_steps[i-1], final_steps[0]);
+		}
+	}
+	delete sys;
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	hsize_t dims[2];
+	file.openDataSet("/sweep_values").getSpace().getSimpleExtentDims(dims);
+	EXPECT_EQ(static_cast<hsize_t>(points), dims[0]);
+	file.openDataSet("/sweep_final_energies").getSpace().getSimpleExtentDims(dims);
+	EXPECT_EQ(static_cast<hsize_t>(points), dims[0]);
+	EXPECT_EQ(static_cast<hsize_t>(params.get_N()), dims[1]);
+}
+
+TEST_F(itp, harmonic_oscillator_ensemble) {
+	const std::string filename = "data/test_itp_ensemble.h5";
+	const size_t size = 2;
+	params.define_data_storage(filename, Parameters::FinalStates, true);
+	params.define_grid(32, 32, 12.0);
+	params.set_num_states(6, 4);
+	params.define_external_field("harmonic(1)");
+	params.set_noise_type("impurities");
+	params.set_impurity_type("gaussian(1,0.1)");
+	params.set_impurity_distribution("uniform(1)");
+	params.set_num_threads(2);
+	params.set_ensemble(size, 1);
+	Ensemble ensemble(params);
+	EXPECT_EQ(2u, ensemble.get_num_concurrent());
+	ensemble.run();
+	ASSERT_FALSE(ensemble.get_error_flag());
+	// Each realization must give the same result as a system run on its own
+	for (size_t i=0; i<size; i++) {
+		Parameters const member_params = ensemble.member_parameters(i);
+		EXPECT_EQ(params.get_random_seed()+i, member_params.get_random_seed());
+		ITPSystem sys(member_params);
+		while (not sys.is_finished())
+			sys.step();
+		EXPECT_EQ(sys.get_total_step_counter(), ensemble.get_steps()[i]);
+		for (size_t n=0; n<params.get_N(); n++) {
+			EXPECT_DOUBLE_EQ(sys.get_energies().back()[n], ensemble.get_final_energies()[i][n]);
+		}
+	}
+	EXPECT_NE(ensemble.get_final_energies()[0][0], ensemble.get_final_energies()[1][0]);
+	H5::H5File file(filename, H5F_ACC_RDONLY);
+	hsize_t dims[1];
+	for (size_t i=0; i<size; i++) {
+		std::ostringstream name;
+		name << "/realizations/" << i << "/final_energies";
+		file.openDataSet(name.str()).getSpace().getSimpleExtentDims(dims);
+		EXPECT_EQ(static_cast<hsize_t>(params.get_N()), dims[0]);
+	}
+}
+
 TEST_F(itp, harmonic_oscillator_dirichlet) {
 	const double error_tolerance = 1e-4;
 	if (dump_data)
@@ -21,5 +21,6 @@
 
 #include "tests_common.hpp"
 #include "itpsystem.hpp"
+#include "ensemble.hpp"
 
 #endif // _TEST_ITP_HPP_
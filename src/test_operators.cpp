@@ -84,3 +84,69 @@ TEST_F(operators, matrixelement) {
 	EXPECT_EQ(Two.matrixelement(A, A, work)/A.dot(A), comp(2));
 	EXPECT_EQ(I.matrixelement(A, A, work)/A.dot(A), comp(0,1));
 }
+
+static comp gaussian_blob(double x, double y) {
+	return exp(-(x*x+y*y));
+}
+
+// The members of a multi-product expansion share the tables of the
+// exponentiated potential. Member t needs exp(-e·V/2t) and, if t > 1,
+// exp(-e·V/t), which for even t is the same as the first table of member t/2.
+TEST(multiproductsplit, shared_potential_tables) {
+	const DataLayout dl(16, 16, 0.5);
+	const Transformer tr(dl, FFTW_ESTIMATE);
+	PotentialType const* type = parse_potential_description("harmonic");
+	const Potential pot(dl, *type, NoNoise());
+	State A(dl);
+	State B(dl);
+	for (int halforder=1; halforder<=6; halforder++) {
+		MultiProductSplit T(halforder, pot, 0.01, tr, Periodic);
+		const size_t expected = static_cast<size_t>(halforder + (halforder-1)/2);
+		EXPECT_EQ(expected, T.get_potential_tables().get_num_tables());
+		T.set_time_step(0.02);
+		EXPECT_EQ(expected, T.get_potential_tables().get_num_tables());
+		// Changing the time step gives the same operator as constructing it
+		// with the new time step
+		MultiProductSplit T2(halforder, pot, 0.02, tr, Periodic);
+		StateArray work(T.required_workspace(), dl);
+		A.set_by_func(gaussian_blob);
+		B.set_by_func(gaussian_blob);
+		T(A, work);
+		T2(B, work);
+		EXPECT_EQ(A, B);
+	}
+	delete type;
+}
+
+// Operators with the same time step share the tables of the exponentiated
+// kinetic energy if given the same cache, as the realizations of an ensemble
+// do. Each member of the expansion has its own time step.
+TEST(multiproductsplit, shared_kinetic_tables) {
+	const DataLayout dl(16, 16, 0.5);
+	const Transformer tr(dl, FFTW_ESTIMATE);
+	PotentialType const* type = parse_potential_description("harmonic");
+	const Potential pot(dl, *type, NoNoise());
+	ExpKineticCache cache(tr);
+	State A(dl);
+	State B(dl);
+	const int halforder = 3;
+	{
+		MultiProductSplit T(halforder, pot, 0.01, tr, Periodic, 0, &cache);
+		MultiProductSplit T2(halforder, pot, 0.01, tr, Periodic, 0, &cache);
+		EXPECT_EQ(static_cast<size_t>(halforder), cache.get_num_tables());
+		T.set_time_step(0.007);
+		EXPECT_EQ(static_cast<size_t>(2*halforder), cache.get_num_tables());
+		T2.set_time_step(0.007);
+		EXPECT_EQ(static_cast<size_t>(halforder), cache.get_num_tables());
+		// Sharing the tables gives the same operator as using private ones
+		MultiProductSplit T3(halforder, pot, 0.007, tr, Periodic);
+		StateArray work(T.required_workspace(), dl);
+		A.set_by_func(gaussian_blob);
+		B.set_by_func(gaussian_blob);
+		T(A, work);
+		T3(B, work);
+		EXPECT_EQ(A, B);
+	}
+	EXPECT_EQ(0u, cache.get_num_tables());
+	delete type;
+}
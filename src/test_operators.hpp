@@ -24,5 +24,6 @@
 #include "simpleoperators.hpp"
 #include "operatorsum.hpp"
 #include "operatorproduct.hpp"
+#include "multiproductsplit.hpp"
 
 #endif // _TEST_OPERATORS_HPP_
@@ -55,3 +55,128 @@ TEST(potentialparser, potentialparser_prettyhardsquare_628) {
 	EXPECT_EQ(p->get_description(), "prettyhardsquare(6.28)");
 	delete p;
 }
+
+// Evaluating a whole row gives the same values as evaluating point by point,
+// up to the accuracy of vectorized math functions
+TEST(potentialparser, evaluate_row) {
+	const char* descriptions[] = {"zero", "harmonic(0.5)", "elliptic", "prettyhardsquare", "softpentagon",
+		"henonheiles", "gaussian", "quartic", "squareoscillator", "power", "ring(3,1,2,1,0.5)", "cosh",
+		"softstadium", "powerstadium"};
+	const size_t n = 101;
+	std::vector<double> x(n);
+	std::vector<double> values(n);
+	for (size_t i=0; i<n; i++)
+		x[i] = -5.0 + 0.1*static_cast<double>(i);
+	for (size_t d=0; d<sizeof(descriptions)/sizeof(char*); d++) {
+		PotentialType const* p = parse_potential_description(descriptions[d]);
+		for (double y=-2.05; y<2.1; y+=0.5) {
+			p->evaluate_row(&x[0], y, n, &values[0]);
+			for (size_t i=0; i<n; i++) {
+				const double expected = (*p)(x[i], y);
+				EXPECT_NEAR(expected, values[i], 1e-13*(1+std::abs(expected))) << descriptions[d];
+			}
+		}
+		delete p;
+	}
+}
+
+// The function of a UserSetPotential need not be thread-safe, so it is never
+// called in parallel
+static bool called_in_parallel = false;
+
+static double recording_potential(double x, double y) {
+	if (omp_in_parallel())
+		called_in_parallel = true;
+	return x*x + y*y;
+}
+
+TEST(potentialparser, user_set_serial) {
+	const DataLayout dl(16, 16, 1.0);
+	const UserSetPotential type("user", &recording_potential);
+	const int old_num_threads = omp_get_max_threads();
+	omp_set_num_threads(4);
+	const Potential pot(dl, type, NoNoise());
+	omp_set_num_threads(old_num_threads);
+	EXPECT_FALSE(called_in_parallel);
+	EXPECT_DOUBLE_EQ(recording_potential(dl.get_posx(3), dl.get_posy(5)), pot.get_value(3, 5));
+}
+
+// The stadiums are the same in the central rectangle and in the end caps
+TEST(potentialparser, stadium_regions) {
+	PotentialType const* p = parse_potential_description("powerstadium(1,2,2)");
+	EXPECT_DOUBLE_EQ(0.5*0.25, (*p)(0.3, 0.5));
+	EXPECT_DOUBLE_EQ(0.5*0.25, (*p)(-1.3, -0.4));
+	EXPECT_DOUBLE_EQ(0.5*0.25, (*p)(1.5, 0));
+	delete p;
+}
+
+// Catmull-Rom interpolation reproduces quadratic functions exactly, so a
+// tabulated harmonic oscillator agrees with the real one between grid points,
+// except near the edges where the table is extended with its edge values
+TEST(potentialparser, tabulated_raw) {
+	const DataLayout table_grid(33, 25, 0.25);
+	const HarmonicOscillator harmonic(0.5);
+	std::vector<double> table(table_grid.N);
+	for (size_t y=0; y<table_grid.sizey; y++)
+		for (size_t x=0; x<table_grid.sizex; x++)
+			table_grid.value(&table[0], x, y) = harmonic(table_grid.get_posx(x), table_grid.get_posy(y));
+	const std::string filename = "data/test_potentialparser_table.bin";
+	std::ofstream(filename.c_str(), std::ios::binary).write(reinterpret_cast<char const*>(&table[0]),
+			static_cast<std::streamsize>(table.size()*sizeof(double)));
+	PotentialType const* p = parse_potential_description("tabulated(" + filename + ", 33, 25, 0.25)");
+	TabulatedPotential const& tabulated = dynamic_cast<TabulatedPotential const&>(*p);
+	EXPECT_EQ(static_cast<size_t>(33), tabulated.get_sizex());
+	EXPECT_EQ(static_cast<size_t>(25), tabulated.get_sizey());
+	#ifdef __linux__
+	EXPECT_TRUE(tabulated.is_mapped());
+	#endif
+	for (size_t y=0; y<table_grid.sizey; y++)
+		for (size_t x=0; x<table_grid.sizex; x++)
+			EXPECT_DOUBLE_EQ(table_grid.value(&table[0], x, y), (*p)(table_grid.get_posx(x), table_grid.get_posy(y)));
+	const size_t n = 51;
+	std::vector<double> posx(n);
+	std::vector<double> values(n);
+	for (size_t i=0; i<n; i++)
+		posx[i] = -3.0 + 0.12*static_cast<double>(i);
+	for (double y=-2.5; y<2.6; y+=0.37) {
+		p->evaluate_row(&posx[0], y, n, &values[0]);
+		for (size_t i=0; i<n; i++) {
+			EXPECT_NEAR((*p)(posx[i], y), values[i], 1e-13);
+			if (std::abs(posx[i]) < 3.5 and std::abs(y) < 2.5) {
+				EXPECT_NEAR(harmonic(posx[i], y), values[i], 1e-12);
+			}
+		}
+	}
+	// Outside the table the values at the edges are used
+	EXPECT_DOUBLE_EQ((*p)(4.0, 0.0), (*p)(10.0, 0.0));
+	delete p;
+	EXPECT_THROW(parse_potential_description("tabulated(" + filename + ", 33, 24, 0.25)"), InvalidPotentialType);
+	EXPECT_THROW(parse_potential_description("tabulated(" + filename + ", 33, 25)"), InvalidPotentialType);
+	EXPECT_THROW(parse_potential_description("tabulated(data/no_such_table.bin, 33, 25, 0.25)"), InvalidPotentialType);
+}
+
+// The potential saved in a datafile can be used as a tabulated potential, and
+// it is interpolated accurately to a finer grid
+TEST(potentialparser, tabulated_datafile) {
+	const DataLayout dl(48, 40, 0.25);
+	const GaussianPotential gaussian(1.0, 1.0, 0.3, -0.2);
+	const std::string filename = "data/test_potentialparser_table.h5";
+	{
+		const Potential pot(dl, gaussian, NoNoise());
+		Datafile datafile(filename, dl, true);
+		datafile.write_potential(pot);
+	}
+	const std::string descriptions[] = {"tabulated(" + filename + ")", "table(" + filename + ":/potential_values, 0.25)"};
+	const DataLayout finer(96, 80, 0.125);
+	for (size_t d=0; d<2; d++) {
+		PotentialType const* p = parse_potential_description(descriptions[d]);
+		const Potential pot(finer, *p, NoNoise());
+		double max_error = 0;
+		for (size_t y=0; y<finer.sizey; y++)
+			for (size_t x=0; x<finer.sizex; x++)
+				max_error = std::max(max_error, std::abs(pot.get_value(x, y) - gaussian(finer.get_posx(x), finer.get_posy(y))));
+		EXPECT_LT(max_error, 2e-3) << descriptions[d];
+		delete p;
+	}
+	EXPECT_THROW(parse_potential_description("tabulated(" + filename + ":/states, 0.25)"), InvalidPotentialType);
+}
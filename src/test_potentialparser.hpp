@@ -21,5 +21,10 @@
 
 #include "tests_common.hpp"
 #include "potentialtypes.hpp"
+#include "tabulatedpotential.hpp"
+#include "potential.hpp"
+#include "datafile.hpp"
+#include <fstream>
+#include <omp.h>
 
 #endif // _TEST_POTENTIALPARSER_HPP_
@@ -129,3 +129,69 @@ TEST_P(BernoulliTest, is_bernoulli) {
 }
 
 INSTANTIATE_TEST_CASE_P(rng, BernoulliTest, testing::Range(0.1, 0.9, 0.1));
+
+// Check the counter-based generator against the known-answer values published
+// with the reference implementation of Philox4x32-10.
+TEST(rng, counter_rng_known_answers) {
+	uint32_t out[4];
+	CounterRNG(0).generate(0, 0, out);
+	EXPECT_EQ(out[0], 0x6627e8d5u);
+	EXPECT_EQ(out[1], 0xe169c58du);
+	EXPECT_EQ(out[2], 0xbc57ac4cu);
+	EXPECT_EQ(out[3], 0x9b00dbd8u);
+	CounterRNG(0xffffffffffffffffull).generate(0xffffffffffffffffull, 0xffffffffffffffffull, out);
+	EXPECT_EQ(out[0], 0x408f276du);
+	EXPECT_EQ(out[1], 0x41c83b0eu);
+	EXPECT_EQ(out[2], 0xa20bc7c6u);
+	EXPECT_EQ(out[3], 0x6d5451fdu);
+}
+
+// The same check of the mean and variance as above for the normally
+// distributed numbers from the counter-based generator.
+TEST(rng, gaussianity_of_counter_rng) {
+	const size_t N = 100000;
+	const double tolerance = 0.01;
+	RNG rng(RNG::produce_random_seed());
+	const CounterRNG counter_rng(rng);
+	std::vector<double> sample(N);
+	for (size_t i=0; i<N; i+=2)
+		counter_rng.gaussian_pair(i/256, i%256, sample[i], sample[i+1]);
+	std::pair<double,double> p = mean_and_variance(sample);
+	EXPECT_NEAR(p.first, 0.0, tolerance);
+	EXPECT_NEAR(p.second, 1.0, 2*tolerance);
+	if (dump_data) {
+		write_sample(sample, "data/test_rng_counter_gaussian.h5");
+	}
+}
+
+// The key drawn for the counter-based generator must come from the full
+// integer output of the seeded generator.
+TEST(rng, counter_rng_key_depends_on_seed) {
+	RNG rng1(1), rng2(1), rng3(2);
+	const uint64_t key1 = CounterRNG(rng1).get_key();
+	EXPECT_NE(key1, 0u);
+	EXPECT_EQ(key1, CounterRNG(rng2).get_key());
+	EXPECT_NE(key1, CounterRNG(rng3).get_key());
+	EXPECT_NE(key1, CounterRNG(rng1).get_key());
+}
+
+// A generator restored from a saved state continues with exactly the same
+// numbers, including the value cached by the normal distribution.
+TEST(rng, saved_state) {
+	RNG rng(RNG::produce_random_seed());
+	for (int i=0; i<1001; i++) {
+		rng.uniform_rand();
+		rng.gaussian_rand();
+	}
+	rng.gaussian_rand();
+	const std::string state = rng.get_state();
+	RNG restored(0);
+	restored.set_state(state);
+	EXPECT_EQ(rng.get_seed(), restored.get_seed());
+	for (int i=0; i<100; i++) {
+		EXPECT_EQ(rng.gaussian_rand(), restored.gaussian_rand());
+		EXPECT_EQ(rng.uniform_rand(), restored.uniform_rand());
+		EXPECT_EQ(rng.integer_rand(), restored.integer_rand());
+	}
+	EXPECT_THROW(restored.set_state("garbage"), GeneralError);
+}
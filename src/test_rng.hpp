@@ -23,6 +23,7 @@
 #include <H5Cpp.h>
 #include "tests_common.hpp"
 #include "rng.hpp"
+#include "exceptions.hpp"
 
 std::pair<double,double> mean_and_variance(std::vector<double> const& vec);
 
@@ -0,0 +1,79 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unit tests for running jobs with the Service class.
+ */
+
+#include "test_service.hpp"
+
+namespace test_service_helpers {
+	bool file_exists(std::string const& filename) {
+		struct stat st;
+		return stat(filename.c_str(), &st) == 0;
+	}
+	void write_job(std::string const& filename, std::string const& contents) {
+		std::ofstream file(filename.c_str());
+		file << contents << std::endl;
+	}
+}
+
+using namespace test_service_helpers;
+
+TEST(service, split_arguments) {
+	std::vector<std::string> args = Service::split_arguments("  -s 32\t-p \"harmonic(1, 2)\"\n--rngseed='5' '' ");
+	ASSERT_EQ(6u, args.size());
+	EXPECT_EQ("-s", args[0]);
+	EXPECT_EQ("32", args[1]);
+	EXPECT_EQ("-p", args[2]);
+	EXPECT_EQ("harmonic(1, 2)", args[3]);
+	EXPECT_EQ("--rngseed=5", args[4]);
+	EXPECT_EQ("", args[5]);
+}
+
+// Jobs on the same grid share one cache entry, and a job with invalid
+// arguments fails without stopping the service
+TEST(service, jobs) {
+	const std::string directory = "data/test_service";
+	mkdir(directory.c_str(), 0755);
+	const char* names[] = {"a", "b", "c"};
+	for (size_t i=0; i<3; i++) {
+		const std::string name = directory + "/" + names[i];
+		remove((name + ".done").c_str());
+		remove((name + ".failed").c_str());
+	}
+	write_job(directory + "/a.job", "-s 32 -N 4 -n 2 -t 2 -q -f -p 'harmonic(1)'");
+	write_job(directory + "/b.job", "-s 32 -N 4 -n 2 -t 2 -q -f -p \"harmonic(2)\"");
+	write_job(directory + "/c.job", "-s 32 --no-such-argument");
+	std::ostringstream out;
+	Service service(directory, NULL, NULL, out, out);
+	ASSERT_EQ(3u, service.waiting_jobs().size());
+	EXPECT_EQ("a", service.waiting_jobs().front());
+	EXPECT_TRUE(service.run_next_job());
+	EXPECT_TRUE(file_exists(directory + "/a.done"));
+	EXPECT_TRUE(file_exists(directory + "/a.h5"));
+	EXPECT_TRUE(service.run_next_job());
+	EXPECT_TRUE(file_exists(directory + "/b.done"));
+	EXPECT_EQ(1u, service.get_num_cached_grids());
+	EXPECT_TRUE(service.run_next_job());
+	EXPECT_TRUE(file_exists(directory + "/c.failed"));
+	EXPECT_FALSE(service.run_next_job());
+	EXPECT_EQ(2u, service.get_jobs_done());
+	EXPECT_EQ(1u, service.get_jobs_failed());
+	EXPECT_THROW(Service("data/no_such_directory"), GeneralError);
+}
@@ -40,3 +40,169 @@ TEST(stateset, orthonormalization_highmem) {
 	states.orthonormalize();
 	EXPECT_LT(states.how_orthonormal(), 16*machine_epsilon);
 }
+
+// Interleaved placement falls back to first-touch placement if libnuma is not
+// available, so this should work everywhere. With libnuma the kernel is asked
+// for the memory policy of the state memory.
+TEST(stateset, orthonormalization_interleaved) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 16, 1.0);
+	StateSet states(8, dl, HighMem, InterleavedPlacement);
+	#ifdef USE_LIBNUMA
+	if (numa_available() >= 0) {
+		ASSERT_EQ(states.get_memory_placement(), InterleavedPlacement);
+		int policy = -1;
+		ASSERT_EQ(get_mempolicy(&policy, NULL, 0, states[0].data_ptr(), MPOL_F_ADDR), 0);
+		EXPECT_EQ(policy, MPOL_INTERLEAVE);
+	}
+	else {
+		EXPECT_EQ(states.get_memory_placement(), FirstTouchPlacement);
+	}
+	#else
+	EXPECT_EQ(states.get_memory_placement(), FirstTouchPlacement);
+	#endif
+	states.init_to_gaussian_noise(rng);
+	states.orthonormalize();
+	EXPECT_LT(states.how_orthonormal(), 16*machine_epsilon);
+}
+
+// Huge pages fall back to normal pages if they are not available, so this
+// should work everywhere. The states take far less than a 1 GB page, so they
+// get 2 MB pages at most.
+TEST(stateset, orthonormalization_huge_pages) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 16, 1.0);
+	const PageBacking requested[] = {HugePages2M, HugePages1G};
+	for (size_t i=0; i<2; i++) {
+		StateSet states(8, dl, Default, FirstTouchPlacement, requested[i]);
+		const PageBacking backing = states.get_page_backing();
+		EXPECT_TRUE(backing == HugePages2M or backing == TransparentHugePages or backing == NormalPages)
+			<< page_backing_description(backing);
+		states.init_to_gaussian_noise(rng);
+		states.orthonormalize();
+		EXPECT_LT(states.how_orthonormal(), 16*machine_epsilon);
+	}
+	StateSet states(8, dl, Default, FirstTouchPlacement, NormalPages);
+	EXPECT_EQ(states.get_page_backing(), NormalPages);
+}
+
+// With a 1 MB memory budget, less the overlap matrix and the eigensolver
+// workspace, these states are handled in blocks of seven, and the linear
+// combinations are formed in several chunks. There are more states and grid
+// points than above, so more rounding error is allowed.
+TEST(stateset, orthonormalization_out_of_core) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(64, 64, 1.0);
+	Parameters params;
+	params.set_num_states(40, 40);
+	params.set_scratch_directory(P_tmpdir);
+	params.set_memory_budget(1);
+	StateSet states(params, dl);
+	EXPECT_TRUE(states.is_out_of_core());
+	EXPECT_EQ(states.get_block_size(), 7u);
+	states.init_to_gaussian_noise(rng);
+	states.orthonormalize();
+	EXPECT_LT(states.how_orthonormal(), 64*machine_epsilon);
+	// The overlap matrix of 400 states alone takes 2.4 MB
+	params.set_num_states(400, 400);
+	EXPECT_THROW(StateSet(params, dl), GeneralError);
+	// Writing the states in the background keeps three copies of them,
+	// 7.5 MB in total, in memory
+	params.set_num_states(40, 40);
+	params.define_data_storage("unused.h5", Parameters::Everything);
+	params.set_async_io(true);
+	EXPECT_THROW(StateSet(params, dl), GeneralError);
+	params.set_memory_budget(9);
+	EXPECT_EQ(StateSet(params, dl).get_block_size(), 11u);
+}
+
+// Locked states are left alone by orthonormalization, and the other states
+// are made orthogonal to them.
+TEST(stateset, locking) {
+	RNG rng(RNG::produce_random_seed());
+	const DataLayout dl(16, 16, 1.0);
+	StateSet states(8, dl, Default);
+	states.init_to_gaussian_noise(rng);
+	states.orthonormalize();
+	EXPECT_EQ(states.lock_state(5), 0u);
+	EXPECT_EQ(states.lock_state(3), 1u);
+	EXPECT_EQ(states.get_num_locked(), 2u);
+	EXPECT_TRUE(states.is_locked(1));
+	EXPECT_FALSE(states.is_locked(2));
+	// Spoil the orthonormality of the unlocked states
+	State locked(dl);
+	states.get_locked_state(0, locked);
+	for (size_t n=2; n<8; n++)
+		states[n] += locked;
+	states.orthonormalize();
+	EXPECT_LT(states.how_orthonormal(), 16*machine_epsilon);
+	// After unlocking the whole set is orthonormal to single precision
+	states.unlock_all();
+	EXPECT_EQ(states.get_num_locked(), 0u);
+	EXPECT_LT(states.how_orthonormal(), 1e-6);
+}
+
+// The gaussian noise is filled in parallel, but it should depend only on the
+// seed and not on the number of threads.
+TEST(stateset, gaussian_noise_independent_of_threads) {
+	const unsigned long int seed = RNG::produce_random_seed();
+	const DataLayout dl(24, 20, 1.0);
+	const int saved_threads = omp_get_max_threads();
+	RNG rng1(seed);
+	StateSet states1(5, dl);
+	omp_set_num_threads(1);
+	states1.init_to_gaussian_noise(rng1);
+	RNG rng2(seed);
+	StateSet states2(5, dl);
+	omp_set_num_threads(3);
+	states2.init_to_gaussian_noise(rng2);
+	omp_set_num_threads(saved_threads);
+	for (size_t n=0; n<5; n++) {
+		EXPECT_NEAR(real(states1[n].dot(states1[n])), 1.0, 1e-12);
+		for (size_t y=0; y<dl.sizey; y++)
+			for (size_t x=0; x<dl.sizex; x++)
+				ASSERT_EQ(states1[n](x,y), states2[n](x,y));
+	}
+	// The next draws from the RNG are not affected either
+	EXPECT_EQ(rng1.uniform_rand(), rng2.uniform_rand());
+}
+
+// Eigenstates of a box with walls at x = +-5 and y = +-4, for the grids below
+static comp box_eigenstate(size_t n, double x, double y) {
+	const double kx = static_cast<double>(n+1)*pi/10;
+	const double ky = static_cast<double>(2-n)*pi/8;
+	return sin(kx*(x+5))*sin(ky*(y+4));
+}
+
+// Resampling states of a box with Dirichlet boundaries keeps them as sine
+// series, so eigenstates are resampled exactly to both finer and coarser
+// grids, and they vanish at the walls.
+TEST(stateset, resample_dirichlet_eigenstates) {
+	const DataLayout coarse(20, 16, 0.5);
+	const DataLayout fine(40, 32, 0.25);
+	const size_t N = 2;
+	RNG rng(RNG::produce_random_seed());
+	DataLayout const* const from[] = {&coarse, &fine};
+	DataLayout const* const to[] = {&fine, &coarse};
+	for (size_t l=0; l<2; l++) {
+		StateSet original(N, *from[l]);
+		original.init(box_eigenstate);
+		StateSet copy(N, *to[l]);
+		copy.init_from_stateset(original, rng, Dirichlet);
+		StateSet expected(N, *to[l]);
+		expected.init(box_eigenstate);
+		DataLayout const& dl = *to[l];
+		for (size_t n=0; n<N; n++) {
+			expected[n].normalize();
+			EXPECT_NEAR(abs(copy[n].dot(expected[n])), 1.0, 1e-12);
+			for (size_t y=0; y<dl.sizey; y++) {
+				EXPECT_NEAR(real(copy[n](0,y)), real(expected[n](0,y)), 1e-12);
+				EXPECT_NEAR(real(copy[n](dl.sizex-1,y)), real(expected[n](dl.sizex-1,y)), 1e-12);
+			}
+			for (size_t x=0; x<dl.sizex; x++) {
+				EXPECT_NEAR(real(copy[n](x,0)), real(expected[n](x,0)), 1e-12);
+				EXPECT_NEAR(real(copy[n](x,dl.sizey-1)), real(expected[n](x,dl.sizey-1)), 1e-12);
+			}
+		}
+	}
+}
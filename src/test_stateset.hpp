@@ -19,6 +19,11 @@
 #ifndef _TEST_STATESET_HPP_
 #define _TEST_STATESET_HPP_
 
+#include <cstdio>
+#include <omp.h>
+#ifdef USE_LIBNUMA
+#include <numaif.h>
+#endif
 #include "tests_common.hpp"
 #include "stateset.hpp"
 
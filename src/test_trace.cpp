@@ -0,0 +1,69 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unit tests for tracing with Trace and TraceScope.
+ */
+
+#include "test_trace.hpp"
+
+// Nothing is recorded while tracing is disabled
+TEST(trace, disabled) {
+	Trace::clear();
+	ASSERT_FALSE(Trace::is_enabled());
+	for (int i=0; i<10; i++) {
+		TraceScope scope("disabled");
+	}
+	EXPECT_EQ(0u, Trace::get_num_events());
+}
+
+// Nested scopes in a parallel loop are recorded by all threads and written
+// as complete events
+TEST(trace, parallel_scopes) {
+	const int num = 16;
+	const std::string filename = "data/test_trace.json";
+	Trace::clear();
+	Trace::enable();
+	#pragma omp parallel for num_threads(2)
+	for (int i=0; i<num; i++) {
+		TraceScope outer("outer");
+		TraceScope inner("inner");
+		inner.end();
+	}
+	Trace::disable();
+	{
+		TraceScope after("after");
+	}
+	EXPECT_EQ(static_cast<size_t>(2*num), Trace::get_num_events());
+	Trace::write(filename);
+	Trace::clear();
+	std::ifstream file(filename.c_str());
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string json = contents.str();
+	EXPECT_EQ(0u, json.find("{\"displayTimeUnit\""));
+	size_t complete = 0, inner = 0;
+	for (size_t pos = json.find("\"ph\":\"X\""); pos != std::string::npos; pos = json.find("\"ph\":\"X\"", pos+1))
+		complete++;
+	for (size_t pos = json.find("\"name\":\"inner\""); pos != std::string::npos; pos = json.find("\"name\":\"inner\"", pos+1))
+		inner++;
+	EXPECT_EQ(static_cast<size_t>(2*num), complete);
+	EXPECT_EQ(static_cast<size_t>(num), inner);
+	EXPECT_EQ(std::string::npos, json.find("after"));
+	EXPECT_EQ(json.size()-3, json.rfind("]}"));
+}
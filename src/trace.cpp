@@ -0,0 +1,135 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <pthread.h>
+#include <unistd.h>
+#include "exceptions.hpp"
+#include "trace.hpp"
+
+bool Trace::enabled = false;
+uint64_t Trace::origin = 0;
+
+namespace {
+	// The events of a single thread. The buffers are never freed, since the
+	// threads keep pointers to them for the lifetime of the program.
+	struct ThreadBuffer {
+		ThreadBuffer(size_t arg_tid) : tid(arg_tid) {}
+		const size_t tid;	// Index of the thread in the trace
+		std::vector<Trace::Event> events;
+	};
+
+	std::vector<ThreadBuffer*> buffers;
+	pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_key_t buffer_key;
+	pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+	void create_buffer_key() {
+		pthread_key_create(&buffer_key, NULL);
+	}
+
+	// The buffer of the calling thread, created on the first event
+	ThreadBuffer& thread_buffer() {
+		pthread_once(&buffer_key_once, create_buffer_key);
+		ThreadBuffer* buffer = static_cast<ThreadBuffer*>(pthread_getspecific(buffer_key));
+		if (buffer == NULL) {
+			pthread_mutex_lock(&buffers_mutex);
+			buffer = new ThreadBuffer(buffers.size());
+			buffers.push_back(buffer);
+			pthread_mutex_unlock(&buffers_mutex);
+			pthread_setspecific(buffer_key, buffer);
+		}
+		return *buffer;
+	}
+
+	// Nanoseconds as microseconds, the time unit of the trace format
+	struct Microseconds {
+		Microseconds(uint64_t arg_ns) : ns(arg_ns) {}
+		const uint64_t ns;
+	};
+
+	std::ostream& operator<<(std::ostream& stream, Microseconds const& t) {
+		return stream << t.ns/1000 << "." << std::setw(3) << std::setfill('0') << t.ns%1000;
+	}
+}
+
+// The thread that enables tracing, usually the main thread, is the first one
+// in the trace
+void Trace::enable() {
+	thread_buffer();
+	if (not enabled)
+		origin = now();
+	enabled = true;
+}
+
+void Trace::disable() {
+	enabled = false;
+}
+
+void Trace::record(const char* name, uint64_t start, uint64_t end) {
+	const Event event = { name, start, end };
+	thread_buffer().events.push_back(event);
+}
+
+size_t Trace::get_num_events() {
+	size_t num = 0;
+	pthread_mutex_lock(&buffers_mutex);
+	for (size_t i=0; i<buffers.size(); i++)
+		num += buffers[i]->events.size();
+	pthread_mutex_unlock(&buffers_mutex);
+	return num;
+}
+
+void Trace::clear() {
+	pthread_mutex_lock(&buffers_mutex);
+	for (size_t i=0; i<buffers.size(); i++)
+		buffers[i]->events.clear();
+	pthread_mutex_unlock(&buffers_mutex);
+}
+
+// Write all events as complete ("X") events, with a name for each thread. Event
+// names are written as they are, so they must not contain characters that
+// would need escaping in JSON.
+void Trace::write(std::string const& filename) {
+	std::ofstream file(filename.c_str());
+	if (not file)
+		throw GeneralError("Cannot open trace file '" + filename + "' for writing.");
+	const long int pid = static_cast<long int>(getpid());
+	pthread_mutex_lock(&buffers_mutex);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (size_t i=0; i<buffers.size(); i++) {
+		ThreadBuffer const& buffer = *buffers[i];
+		file << (first? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+			<< ",\"tid\":" << buffer.tid << ",\"args\":{\"name\":\"thread " << buffer.tid << "\"}}";
+		first = false;
+		for (size_t e=0; e<buffer.events.size(); e++) {
+			Event const& event = buffer.events[e];
+			// Events that started before enabling are clipped
+			const uint64_t start = std::max(event.start, origin);
+			file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+				<< ",\"ts\":" << Microseconds(start-origin) << ",\"dur\":" << Microseconds(event.end-start) << "}";
+		}
+	}
+	file << "\n]}" << std::endl;
+	pthread_mutex_unlock(&buffers_mutex);
+	if (not file)
+		throw GeneralError("Error writing trace file '" + filename + "'.");
+}
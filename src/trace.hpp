@@ -0,0 +1,103 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lightweight tracing of where the time goes in all threads. A TraceScope
+ * placed at the start of a block records the time spent in the block as an
+ * event of the calling thread. Scopes can be nested, and the events of each
+ * thread then form a hierarchy. The events are collected in a separate buffer
+ * for each thread, so recording them needs no locking, and they are written
+ * in the Chrome trace event format, which can be viewed with chrome://tracing
+ * or Perfetto (https://ui.perfetto.dev).
+ *
+ * Unlike a Timer, a TraceScope can be used inside parallel regions and in
+ * functions that are called recursively. Tracing is disabled by default, and
+ * then a TraceScope costs only a check of a flag.
+ */
+
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#ifdef __MACH__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+class Trace {
+	public:
+		struct Event {
+			const char* name;
+			uint64_t start;	// nanoseconds
+			uint64_t end;
+		};
+		// Events are only recorded between enable() and disable()
+		static void enable();
+		static void disable();
+		static inline bool is_enabled() { return enabled; }
+		static inline uint64_t now();
+		// Add an event to the buffer of the calling thread. The name must
+		// remain valid until the trace is written, so it is usually a string
+		// literal.
+		static void record(const char* name, uint64_t start, uint64_t end);
+		// These must not be called while other threads are recording events
+		static size_t get_num_events();
+		static void clear();
+		static void write(std::string const& filename);
+	private:
+		static bool enabled;
+		static uint64_t origin;	// Time of enabling, the zero time of the trace
+};
+
+// Records the lifetime of the object as an event named name. The event can
+// also be ended before the end of the scope with end().
+class TraceScope {
+	public:
+		inline explicit TraceScope(const char* arg_name) :
+			name(arg_name), start(Trace::is_enabled()? Trace::now() : 0) {}
+		inline ~TraceScope() { end(); }
+		inline void end() {
+			if (start != 0)
+				Trace::record(name, start, Trace::now());
+			start = 0;
+		}
+	private:
+		TraceScope(TraceScope const&);
+		TraceScope& operator=(TraceScope const&);
+		const char* const name;
+		uint64_t start;
+};
+
+inline uint64_t Trace::now() {
+	#ifdef __MACH__
+	static mach_timebase_info_data_t timebase_info;
+	if (timebase_info.denom == 0)
+		mach_timebase_info(&timebase_info);
+	return mach_absolute_time() * timebase_info.numer / timebase_info.denom;
+	#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return static_cast<uint64_t>(t.tv_sec)*1000000000u + static_cast<uint64_t>(t.tv_nsec);
+	#endif
+}
+
+#endif // _TRACE_HPP_
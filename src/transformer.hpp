@@ -28,6 +28,7 @@
 #include "itp2d_common.hpp"
 #include "exceptions.hpp"
 #include "datalayout.hpp"
+#include "trace.hpp"
 
 enum Transform { FFT, iFFT, FFTx, iFFTx, FFTy, iFFTy, DST, iDST, DSTx, iDSTx,
 	DSTy, iDSTy, DCT, iDCT, DCTx, iDCTx, DCTy, iDCTy };
@@ -130,6 +131,7 @@ inline double const& Transformer::normalization_factor(Transform trans) const {
 // DCT and DST we must first reinterpret the data pointer as a pointer to the
 // real part of the first data value.
 inline void Transformer::transform(comp* data, Transform trans) const {
+	TraceScope trace("transform");
 	switch (trans) {
 		case FFT:
 		case iFFT:
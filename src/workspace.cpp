@@ -0,0 +1,45 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workspace.hpp"
+
+Workspace::Workspace(size_t arg_num_threads, size_t arg_per_thread, DataLayout const& dl,
+		PageBacking backing) :
+		num_threads(arg_num_threads),
+		per_thread(arg_per_thread),
+		datalayout(dl),
+		page_backing(backing),
+		memory(new StateMemory*[num_threads]),
+		slices(new StateArray*[num_threads]) {
+	#pragma omp parallel for schedule(static,1) num_threads(static_cast<int>(num_threads))
+	for (size_t i=0; i<num_threads; i++) {
+		memory[i] = new StateMemory(per_thread*datalayout.N, FirstTouchPlacement, page_backing);
+		slices[i] = new StateArray(per_thread, datalayout, memory[i]->get_dataptr());
+		for (size_t j=0; j<per_thread; j++)
+			(*slices[i])[j].zero();
+	}
+}
+
+Workspace::~Workspace() {
+	for (size_t i=0; i<num_threads; i++) {
+		delete slices[i];
+		delete memory[i];
+	}
+	delete[] slices;
+	delete[] memory;
+}
@@ -0,0 +1,58 @@
+/* Copyright 2012 Perttu Luukko
+
+ * This file is part of itp2d.
+
+ * itp2d is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+
+ * itp2d is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+
+ * You should have received a copy of the GNU General Public License along with
+ * itp2d.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Working space for operating on states in parallel, a few states for each
+ * thread. Each thread allocates and zeroes its own part, so that on NUMA
+ * machines the memory ends up local to the thread using it. A workspace can
+ * be reused by a later system with the same grid, which saves allocating and
+ * touching the memory again.
+ */
+
+#ifndef _WORKSPACE_HPP_
+#define _WORKSPACE_HPP_
+
+#include <omp.h>
+
+#include "itp2d_common.hpp"
+#include "datalayout.hpp"
+#include "statememory.hpp"
+#include "statearray.hpp"
+
+class Workspace {
+	public:
+		Workspace(size_t num_threads, size_t per_thread, DataLayout const& datalayout,
+				PageBacking page_backing = NormalPages);
+		~Workspace();
+		// The states of thread number i
+		inline StateArray& operator[](size_t i) const { assert(i < num_threads); return *slices[i]; }
+		// True if this workspace can be used by a system with these requirements
+		inline bool fits(size_t threads, size_t states_per_thread, DataLayout const& dl, PageBacking backing) const {
+			return threads <= num_threads and states_per_thread <= per_thread and dl == datalayout
+				and backing == page_backing;
+		}
+		const size_t num_threads;
+		const size_t per_thread;
+		DataLayout const& datalayout;
+		const PageBacking page_backing;	// The page backing that was requested
+	private:
+		StateMemory** memory;
+		StateArray** slices;
+};
+
+#endif // _WORKSPACE_HPP_